@@ -1,16 +1,32 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <Eigen/StdVector>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace mr {
 
+/*
+ * The small primitives below are called in the inner loops of user code and
+ * are defined here, inline, so that those calls need not cross into the library.
+ */
+
 /*
  * Function: Find if the value is negligible enough to consider 0
  * Inputs: value to be checked as a float
  * Returns: Boolean of true-ignore or false-can't ignore
  */
-bool NearZero(const float);
+inline bool NearZero(const float val) {
+	return (std::abs(val) < .000001);
+}
 
 /*
  * Function: Calculate the 6x6 matrix [adV] of the given 6-vector
@@ -37,7 +53,13 @@ Eigen::MatrixXf Normalize(Eigen::MatrixXf);
  * Input: Eigen::Vector3f 3x1 angular velocity vector
  * Returns: Eigen::MatrixXf 3x3 skew symmetric matrix
  */
-Eigen::Matrix3f VecToso3(const Eigen::Vector3f&);
+inline Eigen::Matrix3f VecToso3(const Eigen::Vector3f& omg) {
+	Eigen::Matrix3f m_ret;
+	m_ret << 0, -omg(2), omg(1),
+		omg(2), 0, -omg(0),
+		-omg(1), omg(0), 0;
+	return m_ret;
+}
 
 
 /*
@@ -45,7 +67,9 @@ Eigen::Matrix3f VecToso3(const Eigen::Vector3f&);
  * Inputs: Eigen::MatrixXf 3x3 skew symmetric matrix
  * Returns: Eigen::Vector3f 3x1 angular velocity
  */
-Eigen::Vector3f so3ToVec(const Eigen::MatrixXf&);
+inline Eigen::Vector3f so3ToVec(const Eigen::MatrixXf& so3mat) {
+	return Eigen::Vector3f(so3mat(2, 1), so3mat(0, 2), so3mat(1, 0));
+}
 
 
 /*
@@ -65,6 +89,17 @@ Eigen::Vector4f AxisAng3(const Eigen::Vector3f&);
 Eigen::Matrix3f MatrixExp3(const Eigen::Matrix3f&);
 
 
+/*
+ * Function: MatrixExp3 over a contiguous array of exponential coordinates
+ * Inputs:
+ * expc3: count 3-vectors omg*theta stored back to back
+ * count: The number of vectors
+ * R:     Output array of count rotation matrices (9 floats each), column-major
+ *        as in Eigen
+ */
+void MatrixExp3Batch(const float*, std::size_t, float*);
+
+
 /* Function: Computes the matrix logarithm of a rotation matrix
  * Inputs: Rotation matrix
  * Returns: matrix logarithm of a rotation
@@ -103,7 +138,11 @@ Eigen::MatrixXf VecTose3(const Eigen::VectorXf&);
  * Inputs: Transformation matrix
  * Returns: Spatial velocity vector [angular velocity, linear velocity]
  */
-Eigen::VectorXf se3ToVec(const Eigen::MatrixXf&);
+inline Eigen::VectorXf se3ToVec(const Eigen::MatrixXf& T) {
+	Eigen::VectorXf m_ret(6);
+	m_ret << T(2, 1), T(0, 2), T(1, 0), T(0, 3), T(1, 3), T(2, 3);
+	return m_ret;
+}
 
 
 /*
@@ -131,6 +170,49 @@ Eigen::MatrixXf MatrixExp6(const Eigen::MatrixXf&);
 Eigen::MatrixXf MatrixLog6(const Eigen::MatrixXf&);
 
 
+/*
+ * Joint classes recognised by ClassifyJoint
+ *  Revolute: a unit omg with zero pitch (omg.v = 0)
+ *  Prismatic: omg = 0
+ *  Helical: a unit omg with nonzero pitch h = omg.v
+ *  General: any other screw axis, handled by the full MatrixExp6
+ */
+enum class JointType { Revolute, Prismatic, Helical, General };
+
+/*
+ * A screw axis together with its joint class
+ *  axis: 0, 1 or 2 when omg (or v for a prismatic joint) is plus or minus
+ *        that coordinate axis, -1 otherwise
+ *  pitch: omg.v, nonzero only for helical joints
+ */
+struct JointModel {
+	JointType type;
+	int axis;
+	float pitch;
+	Eigen::Matrix<float, 6, 1> S;
+};
+
+/*
+ * Function: Classifies a screw axis so that the kinematics and dynamics can
+ *           dispatch to the exponential and adjoint of its joint class
+ * Inputs: A screw axis S
+ * Returns: The JointModel of S
+ */
+JointModel ClassifyJoint(const Eigen::VectorXf&);
+
+/*
+ * Function: ClassifyJoint for every column of a screw axis list
+ */
+std::vector<JointModel> ClassifyJoints(const Eigen::MatrixXf&);
+
+/*
+ * Function: MatrixExp6(VecTose3(S*theta)) through the kernel of the joint class
+ * Inputs: A classified joint, the joint variable theta
+ * Returns: The 4x4 transform e^[S]theta
+ */
+Eigen::MatrixXf MatrixExp6(const JointModel&, float);
+
+
 /*
  * Function: Compute end effector frame (used for current spatial position calculation)
  * Inputs: Home configuration (position and orientation) of end-effector
@@ -156,6 +238,110 @@ Eigen::MatrixXf FKinSpace(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const
 Eigen::MatrixXf FKinBody(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::VectorXf&);
 
 
+/*
+ * Class: Forward kinematics in the space frame for a sequence of nearby queries
+ * Construction:
+ *  M: The home configuration of the end-effector
+ *  Slist: The joint screw axes in the space frame when the manipulator
+ *         is at the home position
+ *  thetalist: The initial joint coordinates
+ * Notes: The joints are classified once at construction.
+ *        The cache keeps every joint exponential and the prefix products
+ *        e^[S1]theta1 ... e^[Si]thetai, so moving to a configuration that only
+ *        differs from joint i onward recomputes joints i..n only.
+ */
+class FKinSpaceCache {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	FKinSpaceCache(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::VectorXf&);
+
+	/*
+	 * Moves the cache to thetalist
+	 * Returns: The index of the first joint that had to be recomputed (n if none)
+	 */
+	int Update(const Eigen::VectorXf&);
+
+	/* The end-effector frame at the cached configuration, as FKinSpace */
+	Eigen::MatrixXf Transform() const;
+
+	/*
+	 * The end-effector frame if only joint i were moved to theta. The cache is
+	 * left untouched; only the joints after i are multiplied through again.
+	 */
+	Eigen::MatrixXf WhatIf(int, float) const;
+
+	const Eigen::VectorXf& Thetalist() const { return thetalist_; }
+
+private:
+	typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > TransformList;
+
+	Eigen::Matrix4f M_;
+	std::vector<JointModel> joints_;
+	Eigen::VectorXf thetalist_;
+	TransformList exps_;    // exps_[i] = e^[S(i+1)]theta(i+1)
+	TransformList prefix_;  // prefix_[i] = exps_[0] * ... * exps_[i-1], prefix_[0] = I
+};
+
+
+/*
+ * Class: A rigid-body motion as a unit dual quaternion qr + eps qd
+ * Construction:
+ *  DualQuaternion(): The identity
+ *  DualQuaternion(qr, qd): From the real (rotation) and dual parts
+ *  DualQuaternion(T): From a 4x4 matrix in SE(3)
+ *  Exp(S, theta): e^[S]theta for a screw axis S
+ * Notes: qd = 1/2 p qr for the translation p as a pure quaternion. Composing
+ *        two motions takes three quaternion products (48 multiplies against
+ *        64 for 4x4 matrices) and eight floats of storage against twelve.
+ *        Round-off is removed by Normalize, which is much cheaper than
+ *        re-orthogonalizing a rotation matrix.
+ */
+class DualQuaternion {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	DualQuaternion();
+	DualQuaternion(const Eigen::Quaternionf&, const Eigen::Quaternionf&);
+	explicit DualQuaternion(const Eigen::Matrix4f&);
+	static DualQuaternion Exp(const Eigen::VectorXf&, float);
+
+	const Eigen::Quaternionf& Real() const { return real_; }
+	const Eigen::Quaternionf& Dual() const { return dual_; }
+	Eigen::Vector3f Translation() const;
+	/* The same motion as a 4x4 matrix in SE(3) */
+	Eigen::Matrix4f Matrix() const;
+	/* The exponential coordinates S*theta with Exp(S, theta) = *this, theta in [0, pi] */
+	Eigen::VectorXf Log() const;
+
+	DualQuaternion operator*(const DualQuaternion&) const;
+	/* The inverse motion */
+	DualQuaternion Inverse() const;
+	void Normalize();
+
+private:
+	Eigen::Quaternionf real_;
+	Eigen::Quaternionf dual_;
+};
+
+/*
+ * Function: Screw linear interpolation between two motions
+ * Inputs: The start and end motions, and s in [0, 1]
+ * Returns: Xstart * (Xstart^-1 * Xend)^s, the motion a fraction s along the
+ *          constant screw motion from Xstart to Xend
+ */
+DualQuaternion ScLERP(const DualQuaternion&, const DualQuaternion&, float);
+
+/*
+ * Function: FKinSpace and FKinBody on dual quaternions
+ * Inputs: As FKinSpace and FKinBody, with the home configuration M as a
+ *         dual quaternion
+ * Returns: The end-effector frame as a dual quaternion
+ */
+DualQuaternion FKinSpace(const DualQuaternion&, const Eigen::MatrixXf&, const Eigen::VectorXf&);
+DualQuaternion FKinBody(const DualQuaternion&, const Eigen::MatrixXf&, const Eigen::VectorXf&);
+
+
 /*
  * Function: Gives the space Jacobian
  * Inputs: Screw axis in home position, joint configuration
@@ -172,19 +358,79 @@ Eigen::MatrixXf JacobianSpace(const Eigen::MatrixXf&, const Eigen::MatrixXf&);
 Eigen::MatrixXf JacobianBody(const Eigen::MatrixXf&, const Eigen::MatrixXf&);
 
 
+/*
+ * Class: A fixed set of worker threads for data-parallel loops
+ * Construction:
+ *  threads: Number of threads taking part in a loop, the calling thread
+ *           included; 0 uses one per hardware thread
+ * Notes: ParallelFor(begin, end, body) calls body(i) once for every i in
+ *        [begin, end) and returns when all calls have finished. The first
+ *        exception thrown by body is rethrown to the caller. Loops started
+ *        from inside a body run serially on the calling thread, and loops
+ *        started by several threads at once take turns.
+ */
+class ThreadPool {
+public:
+	explicit ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	int Size() const;
+	void ParallelFor(int, int, const std::function<void(int)>&);
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	struct Impl;
+	std::unique_ptr<Impl> impl_;
+};
+
+/*
+ * Function: Computes every intermediate frame of the product of exponentials
+ *           as a parallel prefix product
+ * Inputs: The joint screw axes in the space frame when the manipulator
+ *             is at the home position
+ *         A list of joint coordinates
+ *         The thread pool to run on
+ * Returns: The n+1 transforms e^[S1]theta1 ... e^[Si]thetai for i = 0..n,
+ *          starting from the identity
+ * Notes: Composition is associative, so the chain is split into one block per
+ *        thread: each block multiplies out its own joints, a short serial pass
+ *        chains the block products, and each block then moves its frames onto
+ *        the product of the blocks before it. For chains of a few dozen joints
+ *        and more; shorter ones are faster serially.
+ */
+std::vector<Eigen::MatrixXf> FKinSpaceFrames(const Eigen::MatrixXf&, const Eigen::VectorXf&, ThreadPool&);
+
+/*
+ * Function: FKinSpace and JacobianSpace for long chains, computed with the
+ *           parallel prefix product of FKinSpaceFrames
+ * Inputs: As FKinSpace and JacobianSpace, followed by the thread pool to run on
+ */
+Eigen::MatrixXf FKinSpace(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::VectorXf&, ThreadPool&);
+Eigen::MatrixXf JacobianSpace(const Eigen::MatrixXf&, const Eigen::VectorXf&, ThreadPool&);
+
+
 /*
  * Inverts a homogeneous transformation matrix
  * Inputs: A homogeneous transformation Matrix T
  * Returns: The inverse of T
  */
-Eigen::MatrixXf TransInv(const Eigen::MatrixXf&);
+inline Eigen::MatrixXf TransInv(const Eigen::MatrixXf& transform) {
+	Eigen::MatrixXf inv = Eigen::MatrixXf::Identity(4, 4);
+	inv.topLeftCorner<3, 3>() = transform.topLeftCorner<3, 3>().transpose();
+	inv.topRightCorner<3, 1>() = -inv.topLeftCorner<3, 3>() * transform.topRightCorner<3, 1>();
+	return inv;
+}
 
 /*
  * Inverts a rotation matrix
  * Inputs: A rotation matrix  R
  * Returns: The inverse of R
  */
-Eigen::MatrixXf RotInv(const Eigen::MatrixXf&);
+inline Eigen::MatrixXf RotInv(const Eigen::MatrixXf& rotMatrix) {
+	return rotMatrix.transpose();
+}
 
 /*
  * Takes a parametric description of a screw axis and converts it to a
@@ -235,6 +481,22 @@ Eigen::MatrixXf ProjectToSO3(const Eigen::MatrixXf&);
 Eigen::MatrixXf ProjectToSE3(const Eigen::MatrixXf&);
 
 
+/*
+ * Function: ProjectToSO3 and ProjectToSE3 over contiguous arrays of matrices
+ * Inputs:
+ * matrices: count 3x3 (9 floats) or 4x4 (16 floats) matrices stored back to
+ *           back, each column-major as in Eigen
+ * count:    The number of matrices
+ * projected: Output array of the same layout; may be the same as matrices
+ * Notes: A matrix with a positive determinant is projected with a fixed-size
+ *        polar iteration and agrees with the singular-value decomposition to
+ *        float precision; any other matrix takes the decomposition itself.
+ *        The last row of each projected SE(3) matrix is set to [0 0 0 1].
+ */
+void ProjectToSO3Batch(const float*, std::size_t, float*);
+void ProjectToSE3Batch(const float*, std::size_t, float*);
+
+
 /*
  * Function: Returns the Frobenius norm to describe the distance of M from the SO(3) manifold
  * Inputs:
@@ -284,6 +546,56 @@ bool TestIfSO3(const Eigen::Matrix3f&);
 bool TestIfSE3(const Eigen::Matrix4f&);
 
 
+/*
+ * Function: DistanceToSO3/DistanceToSE3 and TestIfSO3/TestIfSE3 in one pass
+ *           over contiguous arrays of matrices
+ * Inputs:
+ * matrices: count 3x3 (9 floats) or 4x4 (16 floats) matrices stored back to
+ *           back, each column-major as in Eigen
+ * count:    The number of matrices
+ * Outputs:
+ * distances: count distances as DistanceToSO3/DistanceToSE3, including the
+ *            1.0e9 returned for det <= 0; may be null
+ * valid:     Bitmask of (count + 63) / 64 words, bit i % 64 of word i / 64 set
+ *            when matrix i passes TestIfSO3/TestIfSE3; may be null
+ * Returns: The number of matrices that pass
+ * Notes: The Repair versions also project every matrix that fails onto the
+ *        manifold in place, as ProjectToSO3Batch/ProjectToSE3Batch. The
+ *        distances and mask describe the matrices as they were passed in.
+ */
+std::size_t DistanceToSO3Batch(const float*, std::size_t, float*, std::uint64_t*);
+std::size_t DistanceToSE3Batch(const float*, std::size_t, float*, std::uint64_t*);
+std::size_t RepairSO3Batch(float*, std::size_t, float*, std::uint64_t*);
+std::size_t RepairSE3Batch(float*, std::size_t, float*, std::uint64_t*);
+
+
+/*
+ * Function: The instruction-set variant of the array kernels in use
+ * Returns: "avx512", "avx2", "sse4" or "baseline"
+ * Notes: The library is compiled for a baseline instruction set, and its array
+ *        kernels once more for every wider x86 instruction set the compiler
+ *        supports. The widest variant the processor runs is chosen when the
+ *        library is loaded. The kernels serve MatrixExp3Batch, the
+ *        DistanceTo/Repair batch functions, JointTrajectory and
+ *        CartesianTrajectory into CartesianSamples; everything else runs on
+ *        the instruction set of the build.
+ */
+std::string SimdVariant();
+
+/*
+ * Function: The kernel variants compiled into the library that this processor
+ *           runs, widest first; "baseline" is always last
+ */
+std::vector<std::string> SupportedSimdVariants();
+
+/*
+ * Function: Switches the array kernels to another variant, e.g. to compare them
+ * Inputs: name: One of SupportedSimdVariants()
+ * Returns: false, leaving the variant unchanged, when name is not supported
+ */
+bool SetSimdVariant(const std::string&);
+
+
 /*
  * Function: Computes inverse kinematics in the body frame for an open chain robot
  * Inputs:
@@ -335,6 +647,320 @@ bool IKinBody(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::Matri
  */
 bool IKinSpace(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&, Eigen::VectorXf&, float, float);
 
+/*
+ * Function: IKinBody with every joint kept inside [thetalower, thetaupper]
+ * Inputs: As IKinBody, followed by
+ *  thetalower, thetaupper: The joint limits (+-infinity for unlimited joints)
+ * Outputs: As IKinBody; thetalist is within the limits also on failure
+ * Notes: Each iteration takes a damped least-squares step on the joints
+ *        that are free. A joint whose step would cross its limit is stopped
+ *        there, and the step is re-solved for the remaining joints. Spare
+ *        degrees of freedom pull each limited joint toward the middle of
+ *        its range, in the null space of the task. Up to 50 iterations.
+ */
+bool IKinBodyBounded(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&, Eigen::VectorXf&,
+	const Eigen::VectorXf&, const Eigen::VectorXf&, float, float);
+
+/*
+ * Function: IKinSpace with every joint kept inside [thetalower, thetaupper]
+ * Inputs: As IKinSpace, followed by the joint limits as IKinBodyBounded
+ * Outputs: As IKinSpace; thetalist is within the limits also on failure
+ */
+bool IKinSpaceBounded(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&, Eigen::VectorXf&,
+	const Eigen::VectorXf&, const Eigen::VectorXf&, float, float);
+
+
+/*
+ * Class: Closed-form inverse kinematics in the space frame for 6R arms with
+ *        a spherical wrist
+ * Construction:
+ *  Slist: The joint screw axes in the space frame when the manipulator
+ *         is at the home position
+ *  M: The home configuration of the end-effector
+ * Notes: The geometry qualifies when all six joints are revolute, axes 4, 5
+ *        and 6 meet in one point (the wrist center) and either
+ *        - axes 1 and 2 intersect, or
+ *        - axes 2 and 3 are parallel and axis 1 is not parallel to them.
+ *        The wrist center then depends on joints 1-3 only, and the solution
+ *        splits into Paden-Kahan subproblems: up to two choices each for the
+ *        shoulder, the elbow and the wrist, so up to 8 solutions.
+ *        Arms without a spherical wrist (e.g. UR-style offset wrists) do not
+ *        qualify; Analytic() is false and Solve falls back to IKinSpace.
+ */
+class AnalyticIK {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	AnalyticIK(const Eigen::MatrixXf&, const Eigen::MatrixXf&);
+
+	/* Whether the geometry qualifies for the closed-form solution */
+	bool Analytic() const { return structure_ != None; }
+
+	/*
+	 * Function: All closed-form solutions for one end-effector configuration
+	 * Inputs: The desired end-effector configuration Tsd
+	 * Returns: The distinct solutions, each angle in (-pi, pi]; empty when
+	 *          T is out of reach or the geometry does not qualify
+	 */
+	std::vector<Eigen::VectorXf> Solutions(const Eigen::MatrixXf&) const;
+
+	/*
+	 * Function: Inverse kinematics with the interface of IKinSpace
+	 * Inputs: T, thetalist[in][out], eomg and ev as IKinSpace
+	 * Outputs: Whether a solution was found. With a qualifying geometry
+	 *          thetalist becomes the closed-form solution nearest to its
+	 *          value on input; otherwise IKinSpace is run from it.
+	 */
+	bool Solve(const Eigen::MatrixXf&, Eigen::VectorXf&, float, float) const;
+
+private:
+	enum Structure { None, IntersectingShoulder, ParallelElbow };
+
+	void WristSolutions(const Eigen::Matrix4f&, const Eigen::Vector3f&, std::vector<Eigen::VectorXf>&) const;
+
+	Eigen::MatrixXf Slist_;
+	std::vector<JointModel> joints_;
+	Eigen::Matrix4f M_;
+	Structure structure_;
+	Eigen::Matrix<float, 3, 6> omg_;    // joint axis directions
+	Eigen::Matrix<float, 3, 6> point_;  // a point on each joint axis
+	Eigen::Vector3f shoulder_;          // the intersection of axes 1 and 2
+	Eigen::Vector3f wrist_;             // the wrist center at home
+};
+
+
+/*
+ * Class: Warm starts for IKinSpace from earlier solutions to nearby targets
+ * Construction:
+ *  Slist: The joint screw axes in the space frame when the manipulator
+ *         is at the home position
+ *  M: The home configuration of the end-effector
+ *  capacity: The largest number of solutions kept
+ *  rotationWeight: Length per unit of rotation in the pose metric
+ * Notes: Poses are compared in the embedding [p; rotationWeight * vec(R)],
+ *        where distances grow with both the position offset and the
+ *        rotation angle, and are indexed by a KdTree. Once the cache is
+ *        full the least recently used solution is dropped. All methods may
+ *        be called from several threads at once.
+ */
+class IKSeedCache {
+public:
+	IKSeedCache(const Eigen::MatrixXf&, const Eigen::MatrixXf&, std::size_t, float rotationWeight = 1);
+	~IKSeedCache();
+
+	std::size_t Size() const;
+
+	/* Stores thetalist as the solution for the end-effector configuration T */
+	void Insert(const Eigen::MatrixXf&, const Eigen::VectorXf&);
+
+	/*
+	 * Sets thetalist to the stored solution whose pose is nearest to T
+	 * Returns: false, leaving thetalist untouched, if the cache is empty
+	 */
+	bool Seed(const Eigen::MatrixXf&, Eigen::VectorXf&);
+
+	/*
+	 * Function: IKinSpace from the nearest stored solution
+	 * Inputs: T, thetalist[in][out], eomg and ev as IKinSpace
+	 * Outputs: As IKinSpace. If the seeded solve fails it is retried from
+	 *          thetalist as passed in; a successful solution is stored.
+	 */
+	bool Solve(const Eigen::MatrixXf&, Eigen::VectorXf&, float, float);
+
+private:
+	IKSeedCache(const IKSeedCache&);
+	IKSeedCache& operator=(const IKSeedCache&);
+
+	struct Impl;
+	std::unique_ptr<Impl> impl_;
+};
+
+
+/*
+ * Class: Resolved-rate motion control: one damped least-squares velocity step
+ *        toward a target pose per servo tick
+ * Construction:
+ *  M: The home configuration of the end-effector
+ *  Slist: The joint screw axes in the space frame when the manipulator
+ *         is at the home position
+ *  dt: The servo period
+ *  gain: The feedback gain on the pose error, in 1/s
+ *  damping: The damping lambda of the least-squares step
+ * Notes: Step takes the pose error as the space twist Vs = [Ad_Tsb] log(Tsb^-1 Tsd),
+ *        as IKinSpace does, and commands
+ *            dthetalist = Js^T (Js Js^T + lambda^2 I)^-1 (Vd + gain Vs),
+ *        scaled down as a whole where it would exceed a velocity limit and
+ *        its change scaled down where it would exceed an acceleration
+ *        limit, so the end-effector keeps its direction. The joints are
+ *        classified and all storage sized at construction; Step does not
+ *        allocate and always does the same work.
+ */
+class ResolvedRateController {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	ResolvedRateController(const Eigen::MatrixXf&, const Eigen::MatrixXf&, float, float, float);
+
+	/* Per-joint velocity and acceleration limits; infinite until set */
+	void SetLimits(const Eigen::VectorXf&, const Eigen::VectorXf&);
+
+	/* Forgets the previous command, as from rest */
+	void Reset() { dthetalist_.setZero(); }
+
+	/*
+	 * Function: One servo tick
+	 * Inputs:
+	 *  thetalist: The measured joint variables
+	 *  Tsd: The desired end-effector configuration
+	 *  Vd: A feedforward space twist (zero if omitted)
+	 * Returns: The joint velocities to command for the next dt
+	 */
+	const Eigen::VectorXf& Step(const Eigen::VectorXf&, const Eigen::Matrix4f&);
+	const Eigen::VectorXf& Step(const Eigen::VectorXf&, const Eigen::Matrix4f&, const Eigen::Matrix<float, 6, 1>&);
+
+	/* The pose error Vs of the last Step */
+	const Eigen::Matrix<float, 6, 1>& Error() const { return error_; }
+
+private:
+	Eigen::Matrix4f M_;
+	std::vector<JointModel> joints_;
+	float dt_, gain_, damping_;
+	Eigen::VectorXf maxVelocity_, maxAcceleration_;
+	Eigen::VectorXf dthetalist_;
+	Eigen::Matrix<float, 6, Eigen::Dynamic> Js_;
+	Eigen::Matrix<float, 6, 1> error_;
+};
+
+/*
+ * Class: Bump (arena) allocator for the transient matrices of the dynamics functions
+ * Construction:
+ *  dof: The number of joints the workspace is sized for. The slab is allocated
+ *       once and reused by every call that is given this workspace.
+ * Notes: Matrix/Vector hand out uninitialized views into the slab. A Frame
+ *        rewinds the allocator to where it was when the Frame was created, so
+ *        every function releases its temporaries on return. The views are
+ *        invalidated by Reserve, which must only be called while nothing is
+ *        allocated. Running out of space throws std::bad_alloc.
+ *        A workspace must not be shared between threads.
+ */
+class Workspace {
+public:
+	explicit Workspace(int dof = 0);
+
+	/* Grows the slab so that it can serve any of the functions below for dof joints */
+	void Reserve(int dof);
+	/* Releases every allocation */
+	void Reset();
+
+	Eigen::Map<Eigen::MatrixXf> Matrix(int rows, int cols);
+	Eigen::Map<Eigen::VectorXf> Vector(int size);
+
+	int Dof() const { return dof_; }
+	std::size_t Capacity() const { return slab_.size(); }
+	std::size_t Used() const { return top_; }
+
+	/* Number of floats needed by the heaviest workspace function for dof joints */
+	static std::size_t RequiredSize(int dof);
+
+	class Frame {
+	public:
+		explicit Frame(Workspace& ws) : ws_(ws), mark_(ws.top_) {}
+		~Frame() { ws_.top_ = mark_; }
+	private:
+		Frame(const Frame&);
+		Frame& operator=(const Frame&);
+		Workspace& ws_;
+		std::size_t mark_;
+	};
+
+private:
+	float* Allocate(std::size_t count);
+
+	std::vector<float> slab_;
+	std::size_t top_;
+	int dof_;
+};
+
+/*
+ * Class: Everything about an open chain that depends on the joint variables alone,
+ *        computed once per configuration and shared by the kinematics and dynamics
+ *        functions below
+ * Construction:
+ *  Mlist: List of link frames {i} relative to {i-1} at the home position
+ *  Slist: Screw axes Si of the joints in a space frame, in the format
+ *         of a matrix with the screw axes as the columns.
+ *  thetalist: n-vector of joint variables
+ * Notes: Each revolute or helical joint costs one sine and one cosine, a
+ *        prismatic joint none; no function taking a KinematicState evaluates
+ *        any further transcendental. The end-effector home configuration M
+ *        is the product of all n+1 frames in Mlist.
+ */
+class KinematicState {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > TransformList;
+
+	KinematicState(const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&, const Eigen::VectorXf&);
+	/* As above with the joints already classified by ClassifyJoints */
+	KinematicState(const std::vector<Eigen::MatrixXf>&, const std::vector<JointModel>&, const Eigen::VectorXf&);
+
+	int Dof() const { return thetalist_.size(); }
+	const Eigen::VectorXf& Thetalist() const { return thetalist_; }
+	/* sin and cos of |omgi|*thetai for each joint (0 and 1 for prismatic joints) */
+	const Eigen::VectorXf& Sin() const { return sin_; }
+	const Eigen::VectorXf& Cos() const { return cos_; }
+	/* e^[Si]thetai for joint i */
+	const Eigen::Matrix4f& JointExp(int i) const { return exps_[i]; }
+	/* e^[S1]theta1 ... e^[Si]thetai, the identity for i = 0 */
+	const Eigen::Matrix4f& Prefix(int i) const { return prefix_[i]; }
+	/* The end-effector home configuration */
+	const Eigen::Matrix4f& HomeConfiguration() const { return M_; }
+	/* The end-effector frame, as FKinSpace */
+	const Eigen::Matrix4f& EndEffector() const { return T_; }
+	/* The space Jacobian, as JacobianSpace */
+	const Eigen::MatrixXf& Jacobian() const { return Js_; }
+	/* Screw axes of the joints in their link frames (6 x n) and the adjoints of
+	 * T_{i,i-1} as n+1 6x6 blocks side by side, as used by InverseDynamics */
+	const Eigen::MatrixXf& Ai() const { return Ai_; }
+	const Eigen::MatrixXf& AdTi() const { return AdTi_; }
+
+private:
+	Eigen::VectorXf thetalist_;
+	Eigen::VectorXf sin_;
+	Eigen::VectorXf cos_;
+	TransformList exps_;
+	TransformList prefix_;
+	Eigen::Matrix4f M_;
+	Eigen::Matrix4f T_;
+	Eigen::MatrixXf Js_;
+	Eigen::MatrixXf Ai_;
+	Eigen::MatrixXf AdTi_;
+};
+
+/*
+ * Function: FKinSpace, FKinBody, JacobianSpace and JacobianBody of the chain
+ *           described by a KinematicState. The body-frame versions are for the
+ *           same chain, i.e. Blist = Adjoint(TransInv(M)) * Slist.
+ */
+Eigen::MatrixXf FKinSpace(const KinematicState&);
+Eigen::MatrixXf FKinBody(const KinematicState&);
+Eigen::MatrixXf JacobianSpace(const KinematicState&);
+Eigen::MatrixXf JacobianBody(const KinematicState&);
+
+/*
+ * Function: InverseDynamics, MassMatrix and ForwardDynamics at the configuration
+ *           of a KinematicState
+ * Inputs: As the functions of the same name, with thetalist, Mlist and Slist
+ *         replaced by the state, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ */
+Eigen::VectorXf InverseDynamics(const KinematicState&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+	const Eigen::VectorXf&, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, Workspace&);
+Eigen::MatrixXf MassMatrix(const KinematicState&, const std::vector<Eigen::MatrixXf>&, Workspace&);
+Eigen::VectorXf ForwardDynamics(const KinematicState&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+	const Eigen::VectorXf&, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, Workspace&);
+
 /* 
  * Function: This function uses forward-backward Newton-Euler iterations to solve the 
  * equation:
@@ -359,6 +985,17 @@ Eigen::VectorXf InverseDynamics(const Eigen::VectorXf&, const Eigen::VectorXf&,
                                    const Eigen::VectorXf&, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, 
                                    const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&);
 
+/*
+ * Function: InverseDynamics drawing all of its temporaries from a Workspace
+ * Inputs: As InverseDynamics, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As InverseDynamics
+ */
+Eigen::VectorXf InverseDynamics(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, 
+                                   const Eigen::VectorXf&, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, 
+                                   const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&,
+	Workspace&);
+
 /* 
  * Function: This function calls InverseDynamics with Ftip = 0, dthetalist = 0, and 
  *   ddthetalist = 0. The purpose is to calculate one important term in the dynamics equation       
@@ -377,6 +1014,16 @@ Eigen::VectorXf InverseDynamics(const Eigen::VectorXf&, const Eigen::VectorXf&,
 Eigen::VectorXf GravityForces(const Eigen::VectorXf&, const Eigen::VectorXf&,
                                 const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&);
 
+/*
+ * Function: GravityForces drawing all of its temporaries from a Workspace
+ * Inputs: As GravityForces, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As GravityForces
+ */
+Eigen::VectorXf GravityForces(const Eigen::VectorXf&, const Eigen::VectorXf&,
+                                const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&,
+	Workspace&);
+
 /* 
  * Function: This function calls InverseDynamics n times, each time passing a 
  * ddthetalist vector with a single element equal to one and all other 
@@ -397,6 +1044,16 @@ Eigen::VectorXf GravityForces(const Eigen::VectorXf&, const Eigen::VectorXf&,
 Eigen::MatrixXf MassMatrix(const Eigen::VectorXf&,
                                 const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&);
 
+/*
+ * Function: MassMatrix drawing all of its temporaries from a Workspace
+ * Inputs: As MassMatrix, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As MassMatrix
+ */
+Eigen::MatrixXf MassMatrix(const Eigen::VectorXf&,
+                                const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&,
+	Workspace&);
+
 /* 
  * Function: This function calls InverseDynamics with g = 0, Ftip = 0, and 
  * ddthetalist = 0.      
@@ -416,6 +1073,16 @@ Eigen::MatrixXf MassMatrix(const Eigen::VectorXf&,
 Eigen::VectorXf VelQuadraticForces(const Eigen::VectorXf&, const Eigen::VectorXf&,
                             const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&);
 
+/*
+ * Function: VelQuadraticForces drawing all of its temporaries from a Workspace
+ * Inputs: As VelQuadraticForces, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As VelQuadraticForces
+ */
+Eigen::VectorXf VelQuadraticForces(const Eigen::VectorXf&, const Eigen::VectorXf&,
+                            const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&,
+	Workspace&);
+
 /* 
  * Function: This function calls InverseDynamics with g = 0, dthetalist = 0, and 
  * ddthetalist = 0.  
@@ -435,6 +1102,16 @@ Eigen::VectorXf VelQuadraticForces(const Eigen::VectorXf&, const Eigen::VectorXf
 Eigen::VectorXf EndEffectorForces(const Eigen::VectorXf&, const Eigen::VectorXf&, 
                             const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&);
 
+/*
+ * Function: EndEffectorForces drawing all of its temporaries from a Workspace
+ * Inputs: As EndEffectorForces, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As EndEffectorForces
+ */
+Eigen::VectorXf EndEffectorForces(const Eigen::VectorXf&, const Eigen::VectorXf&, 
+                            const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&,
+	Workspace&);
+
 /* 
  * Function: This function computes ddthetalist by solving:
  * Mlist(thetalist) * ddthetalist = taulist - c(thetalist,dthetalist) 
@@ -458,6 +1135,17 @@ Eigen::VectorXf ForwardDynamics(const Eigen::VectorXf&, const Eigen::VectorXf&,
                                    const Eigen::VectorXf&, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, 
                                    const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&);
 
+/*
+ * Function: ForwardDynamics drawing all of its temporaries from a Workspace
+ * Inputs: As ForwardDynamics, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As ForwardDynamics
+ */
+Eigen::VectorXf ForwardDynamics(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, 
+                                   const Eigen::VectorXf&, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, 
+                                   const std::vector<Eigen::MatrixXf>&, const Eigen::MatrixXf&,
+	Workspace&);
+
 
 /*
  * Function: Compute the joint angles and velocities at the next timestep using
@@ -475,6 +1163,17 @@ Eigen::VectorXf ForwardDynamics(const Eigen::VectorXf&, const Eigen::VectorXf&,
 void EulerStep(Eigen::VectorXf&, Eigen::VectorXf&, const Eigen::VectorXf&, float);
 
 
+/*
+ * The precision of the state ForwardDynamicsTrajectory and SimulateControl integrate
+ *  Float: joint variables, rates and the error integral in float, as EulerStep
+ *  Mixed: the same kept in double and updated with Kahan's compensated
+ *         summation, rounded to float for the dynamics, which stay in float.
+ *         Long runs with small steps no longer lose the increments to
+ *         round-off, at a few percent of the run time.
+ */
+enum class StatePrecision { Float, Mixed };
+
+
 /*
  * Function: Compute the joint forces/torques required to move the serial chain along the given
  *	trajectory using inverse dynamics
@@ -498,6 +1197,17 @@ Eigen::MatrixXf InverseDynamicsTrajectory(const Eigen::MatrixXf&, const Eigen::M
 	const Eigen::VectorXf&, const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
 	const Eigen::MatrixXf&);
 
+/*
+ * Function: InverseDynamicsTrajectory drawing all of its temporaries from a Workspace
+ * Inputs: As InverseDynamicsTrajectory, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As InverseDynamicsTrajectory
+ */
+Eigen::MatrixXf InverseDynamicsTrajectory(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&,
+	const Eigen::VectorXf&, const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+	const Eigen::MatrixXf&,
+	Workspace&);
+
 
 /*
  * Function: Compute the motion of a serial chain given an open-loop history of joint forces/torques
@@ -515,6 +1225,7 @@ Eigen::MatrixXf InverseDynamicsTrajectory(const Eigen::MatrixXf&, const Eigen::M
  *	dt: The timestep between consecutive joint forces/torques
  *	intRes: Integration resolution is the number of times integration (Euler) takes places between each time step.
  *			Must be an integer value greater than or equal to 1
+ *  precision: StatePrecision::Mixed to integrate in double, see StatePrecision
  *
  * Outputs: std::vector of [thetamat, dthetamat]
  *  thetamat: The N x n matrix of joint angles resulting from the specified joint forces/torques
@@ -522,7 +1233,49 @@ Eigen::MatrixXf InverseDynamicsTrajectory(const Eigen::MatrixXf&, const Eigen::M
  */
 std::vector<Eigen::MatrixXf> ForwardDynamicsTrajectory(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::MatrixXf&,
 	const Eigen::VectorXf&, const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
-	const Eigen::MatrixXf&, float, int);
+	const Eigen::MatrixXf&, float, int, StatePrecision = StatePrecision::Float);
+
+/*
+ * Function: ForwardDynamicsTrajectory drawing all of its temporaries from a Workspace
+ * Inputs: As ForwardDynamicsTrajectory, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As ForwardDynamicsTrajectory
+ */
+std::vector<Eigen::MatrixXf> ForwardDynamicsTrajectory(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::MatrixXf&,
+	const Eigen::VectorXf&, const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+	const Eigen::MatrixXf&, float, int,
+	Workspace&, StatePrecision = StatePrecision::Float);
+
+/*
+ * Function: ForwardDynamicsTrajectory integrated in parallel in time (Parareal)
+ * Inputs: As ForwardDynamicsTrajectory up to intRes, followed by
+ *  pool: The threads the time slices are spread over
+ *  tolerance: Iteration stops once no slice start state (joint variables and
+ *             rates) moves by more than this, in max norm, in an iteration;
+ *             0 iterates until the result is that of ForwardDynamicsTrajectory.
+ *             Round-off in float keeps the changes from falling much below
+ *             1e-6 times the size of the state.
+ *  slices: The number of time slices, 0 for one per thread of the pool
+ *  coarseStep: Time steps per Euler step of the coarse integrator
+ *  iterations: Receives the number of parallel fine sweeps taken; may be null
+ * Outputs: As ForwardDynamicsTrajectory
+ * Notes: The horizon is split into slices. A coarse integrator, one Euler step
+ *        of ForwardDynamics per coarseStep time steps, gives a first guess of
+ *        the state at the start of every slice. Each iteration then runs the
+ *        integration of ForwardDynamicsTrajectory on all slices at once from
+ *        those guesses, and a serial sweep corrects them,
+ *            U(s+1) = coarse(U(s)) + fine(U_old(s)) - coarse(U_old(s)).
+ *        After k iterations the first k slices equal the serial result bit
+ *        for bit, so it converges in at most slices iterations, usually in
+ *        a few. Each iteration costs one slice of fine integration plus a
+ *        coarse sweep, so the speedup over the serial function is bounded by
+ *        both slices / iterations and intRes * coarseStep / iterations. The
+ *        state is kept in float as with StatePrecision::Float.
+ */
+std::vector<Eigen::MatrixXf> ForwardDynamicsTrajectory(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::MatrixXf&,
+	const Eigen::VectorXf&, const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+	const Eigen::MatrixXf&, float, int,
+	ThreadPool&, float, int slices = 0, int coarseStep = 1, int* iterations = 0);
 
 
 /*
@@ -551,6 +1304,17 @@ Eigen::VectorXf ComputedTorque(const Eigen::VectorXf&, const Eigen::VectorXf&, c
 	const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
 	const Eigen::MatrixXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, float, float, float);
 
+/*
+ * Function: ComputedTorque drawing all of its temporaries from a Workspace
+ * Inputs: As ComputedTorque, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As ComputedTorque
+ */
+Eigen::VectorXf ComputedTorque(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+	const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+	const Eigen::MatrixXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, float, float, float,
+	Workspace&);
+
 
 /*
  * Function: Compute s(t) for a cubic time scaling
@@ -645,6 +1409,310 @@ std::vector<Eigen::MatrixXf> ScrewTrajectory(const Eigen::MatrixXf&, const Eigen
  */
 std::vector<Eigen::MatrixXf> CartesianTrajectory(const Eigen::MatrixXf&, const Eigen::MatrixXf&, float, int, int);
 
+/*
+ * The samples of a Cartesian trajectory as arrays, one row per sample and one
+ * contiguous column per coordinate
+ *  positions: N x 3 origins of the end-effector frame
+ *  quaternions: N x 4 orientations as unit quaternions (w, x, y, z)
+ *  linearVelocities: N x 3 time derivatives of positions
+ *  angularVelocities: N x 3 angular velocities in the space frame
+ */
+struct CartesianSamples {
+	Eigen::MatrixXf positions;
+	Eigen::MatrixXf quaternions;
+	Eigen::MatrixXf linearVelocities;
+	Eigen::MatrixXf angularVelocities;
+};
+
+/*
+ * Function: CartesianTrajectory sampled in bulk into arrays
+ * Inputs: As CartesianTrajectory, followed by
+ *  samples: Filled with the N samples, its matrices resized only when N changes
+ *  velocities: Whether to fill the linear and angular velocities as well,
+ *              which are otherwise left empty
+ * Notes: The rotation log of Rstart^T Rend is taken once. Every sample is then
+ *        qstart (cos(theta s/2), sin(theta s/2) omg), a pair of array sines and
+ *        cosines weighting two fixed quaternions, so each column is computed
+ *        for all samples at once. The velocities are analytic: sdot times
+ *        pend - pstart, and sdot theta Rstart omg.
+ */
+void CartesianTrajectory(const Eigen::MatrixXf&, const Eigen::MatrixXf&, float, int, int, CartesianSamples&,
+	bool velocities = false);
+
+/*
+ * Class: A uniform cumulative cubic B-spline on SE(3)
+ *            T(t) = T_i e^[Omega_i+1]B1(u) e^[Omega_i+2]B2(u) e^[Omega_i+3]B3(u),
+ *        Omega_j = log(T_j-1^-1 T_j), on the segment i the time t falls in,
+ *        with u = (t - t0)/dt - i and the cumulative basis
+ *            B1 = (5 + 3u - 3u^2 + u^3)/6, B2 = (1 + 3u + 3u^2 - 2u^3)/6, B3 = u^3/6
+ * Construction:
+ *  controls: The m >= 4 control poses T_0 ... T_m-1 in SE(3)
+ *  dt: The time between knots
+ *  t0: The start time
+ * Notes: The curve is C2 and passes near, not through, its control poses.
+ *        It is defined on [t0, t0 + (m-3) dt]; times outside are clamped.
+ *        The increments Omega are logged once at construction, so an
+ *        evaluation costs three exponentials, whatever m is. The twist and
+ *        its derivative follow the recursion over the three factors
+ *            V <- Ad(e^-[Omega]B) V + B' Omega
+ *            dV <- Ad(e^-[Omega]B) dV + B'' Omega + [ad V] B' Omega
+ */
+class SE3Spline {
+public:
+	SE3Spline(const std::vector<Eigen::MatrixXf>&, float, float t0 = 0);
+
+	/*
+	 * Function: Least-squares fit of the control poses to a pose log
+	 * Inputs:
+	 *  poses: The logged poses in SE(3)
+	 *  times: Their increasing times
+	 *  dt: The time between knots, which sets the smoothing
+	 *  iterations: The number of Gauss-Newton iterations at most
+	 * Returns: The spline from times(0) to at least the last time minimizing
+	 *          the sum of |log(Tlogged^-1 T(t))|^2 over the log
+	 */
+	static SE3Spline Fit(const std::vector<Eigen::MatrixXf>&, const Eigen::VectorXf&, float, int iterations = 10);
+
+	float StartTime() const { return t0_; }
+	float EndTime() const { return t0_ + (controls_.size() - 3) * dt_; }
+	const std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> >& Controls() const { return controls_; }
+
+	/* The pose at t */
+	Eigen::Matrix4f Evaluate(float) const;
+	/*
+	 * Function: The pose at t with its body twist Vb (T^-1 dT/dt = [Vb]) and
+	 *           the time derivative of Vb
+	 */
+	Eigen::Matrix4f Evaluate(float, Eigen::Matrix<float, 6, 1>&, Eigen::Matrix<float, 6, 1>&) const;
+	/*
+	 * Function: Evaluate at every time of an array, into the arrays of a
+	 *           CartesianSamples (the velocities in its space-frame convention)
+	 */
+	void Evaluate(const Eigen::VectorXf&, CartesianSamples&, bool velocities = false) const;
+
+private:
+	std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > controls_;
+	Eigen::Matrix<float, 6, Eigen::Dynamic> omegas_;  // column j is Omega_j, column 0 unused
+	float dt_, t0_;
+};
+
+
+/*
+ * Function: Time-scale a piecewise-linear joint path, as JointTrajectory
+ *           does for a single segment
+ * Inputs:
+ *  path: The waypoints as a K x n matrix, one row per waypoint (K >= 1)
+ *  Tf: Total time of the motion in seconds from rest to rest
+ *	N: The number of points N > 1 (Start and stop) in the discrete
+ *     representation of the trajectory
+ *  method: The time-scaling method, 3 for cubic and 5 for quintic
+ * Outputs:
+ *  traj: An N x n matrix following the path, where s(t) from the time
+ *        scaling is the fraction of its total length covered at time t
+ */
+Eigen::MatrixXf JointPathTrajectory(const Eigen::MatrixXf&, float, int, int);
+
+/* Receives sample k of a streamed trajectory: thetalist, dthetalist, ddthetalist, taulist */
+typedef std::function<void(int, const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+	const Eigen::VectorXf&)> TrajectorySink;
+
+/*
+ * Function: Joint torques along a CartesianTrajectory, streamed through three
+ *           pipelined stages instead of stored
+ * Inputs:
+ *  Xstart, Xend, Tf, N, method: As CartesianTrajectory
+ *  thetalist0: An initial guess of the joint variables at Xstart
+ *  M, Slist, eomg, ev: As IKinSpace
+ *  g, Mlist, Glist: As InverseDynamics, without tip forces
+ *  sink: Called for k = 0 ... N-1 in order, on the calling thread
+ *  capacity: The number of blocks of samples each queue holds at most
+ * Returns: true if IKinSpace converged at every sample
+ * Notes: One thread computes the poses, one runs IKinSpace seeded with the
+ *        previous sample's solution, and the calling thread differences the
+ *        joint variables and runs InverseDynamics:
+ *            dthetak = (thetak+1 - thetak-1) / 2dt
+ *            ddthetak = (thetak+1 - 2 thetak + thetak-1) / dt^2
+ *        where the motion, being at rest at both ends, continues past them as
+ *        its mirror image. The stages pass blocks of samples through bounded
+ *        queues, so memory does not grow with N. An exception thrown by sink
+ *        stops the other stages and is rethrown.
+ */
+bool CartesianTorquePipeline(const Eigen::MatrixXf&, const Eigen::MatrixXf&, float, int, int, const Eigen::VectorXf&,
+	const Eigen::MatrixXf&, const Eigen::MatrixXf&, float, float, const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&,
+	const std::vector<Eigen::MatrixXf>&, const TrajectorySink&, int capacity = 8);
+
+
+/*
+ * Class: A kd-tree over points of a fixed dimension for nearest-neighbor queries
+ * Construction:
+ *  dim: The dimension of the points
+ * Notes: Points are stored contiguously in insertion order and are never
+ *        rebalanced, which suits the random samples of sampling-based
+ *        planners. Insert returns the index of the point; queries return
+ *        indices. Removed points keep their index and are skipped by queries.
+ */
+class KdTree {
+public:
+	explicit KdTree(int dim);
+
+	int Dimension() const { return dim_; }
+	int Size() const { return static_cast<int>(left_.size()); }
+	Eigen::Map<const Eigen::VectorXf> Point(int i) const {
+		return Eigen::Map<const Eigen::VectorXf>(&points_[std::size_t(dim_) * i], dim_);
+	}
+
+	int Insert(const Eigen::VectorXf&);
+	void Remove(int i) { removed_[i] = 1; }
+	void Clear();
+
+	/* The index of the point nearest to q, or -1 if there is none */
+	int Nearest(const Eigen::VectorXf&) const;
+
+	/* The indices of the k points nearest to q, nearest first */
+	std::vector<int> KNearest(const Eigen::VectorXf&, int) const;
+
+private:
+	void Search(int, int, const float*, std::size_t, std::vector<std::pair<float, int> >&) const;
+
+	int dim_;
+	std::vector<float> points_;
+	std::vector<int> left_, right_;
+	std::vector<char> removed_;
+};
+
+
+/*
+ * Class: Sampling-based motion planning in joint space
+ * Construction:
+ *  lower, upper: The joint limits bounding the sampled configurations
+ *  valid: Whether a configuration is free, e.g. by FKinSpace and a collision check
+ *  resolution: The largest joint-space step between the configurations
+ *              checked along an edge
+ *  pool: Validates edges in parallel when given; valid must then be
+ *        safe to call from several threads at once
+ * Notes: Paths are returned as K x n matrices of waypoints from start to
+ *        goal, ready for JointPathTrajectory, or as 0 x n matrices when no
+ *        path was found. Edges are checked coarse-to-fine (midpoint first),
+ *        so most blocked edges are rejected after a few calls to valid.
+ *        The lazy PRM roadmap is kept across queries; start and goal are
+ *        joined to it only for the query that names them.
+ */
+class JointPlanner {
+public:
+	typedef std::function<bool(const Eigen::VectorXf&)> StateValidity;
+
+	JointPlanner(const Eigen::VectorXf&, const Eigen::VectorXf&, const StateValidity&, float, ThreadPool* pool = 0);
+
+	void Seed(unsigned seed) { rng_.seed(seed); }
+
+	/* Whether the straight segment between two configurations is free */
+	bool EdgeValid(const Eigen::VectorXf&, const Eigen::VectorXf&) const;
+
+	/*
+	 * Function: Bidirectional RRT (RRT-Connect)
+	 * Inputs:
+	 *  start, goal: Free configurations
+	 *  step: The longest edge added by one extension
+	 *  maxIterations: The number of samples drawn before giving up
+	 */
+	Eigen::MatrixXf RRTConnect(const Eigen::VectorXf&, const Eigen::VectorXf&, float, int);
+
+	/*
+	 * Function: Lazy PRM: edges are only checked once they lie on a shortest path
+	 * Inputs:
+	 *  start, goal: The configurations to join; no path is found unless both are free
+	 *  samples: The number of free configurations the roadmap is grown to
+	 *  neighbors: The number of nearest roadmap nodes each new node is joined to
+	 */
+	Eigen::MatrixXf LazyPRM(const Eigen::VectorXf&, const Eigen::VectorXf&, int, int);
+
+	/*
+	 * Function: Shorten a path by replacing random stretches with straight edges
+	 * Inputs:
+	 *  path: A K x n path from one of the planners
+	 *  attempts: The number of random shortcuts tried
+	 */
+	Eigen::MatrixXf Shortcut(const Eigen::MatrixXf&, int);
+
+private:
+	struct Edge { int a, b; float length; signed char state; };
+
+	Eigen::VectorXf Sample();
+	int AddRoadmapNode(const Eigen::VectorXf&, int);
+
+	Eigen::VectorXf lower_, upper_;
+	StateValidity valid_;
+	float resolution_;
+	ThreadPool* pool_;
+	std::mt19937 rng_;
+
+	KdTree roadmap_;
+	std::vector<Edge> edges_;
+	std::vector<std::vector<int> > incident_;
+};
+
+
+/*
+ * Class: End-effector reachability and manipulability over a voxel grid
+ * Construction:
+ *  lower: The corner of the grid with the smallest coordinates
+ *  size: The number of voxels along x, y and z
+ *  voxel: The edge length of a voxel
+ * Notes: Sample draws configurations uniformly within joint limits and bins
+ *        the end-effector position. The statistics use the body Jacobian,
+ *        so they do not change with the placement of the robot base; with
+ *        fewer than six joints det(Jb^T Jb) stands in for det(Jb Jb^T).
+ *        Save writes a flat little-endian file that can be memory-mapped:
+ *          bytes  0-7   "MRREACH1"
+ *          bytes  8-19  uint32 size along x, y, z
+ *          bytes 20-31  float lower corner x, y, z
+ *          bytes 32-35  float voxel edge length
+ *          bytes 36-39  zero
+ *          then one Voxel (12 bytes) per voxel, x fastest, then y, then z.
+ */
+class ReachabilityMap {
+public:
+	struct Voxel {
+		std::uint32_t count;       // samples with the end-effector in the voxel
+		float manipulability;      // the largest sqrt(det(Jb Jb^T)) among them
+		float minSingularValue;    // the largest smallest singular value of Jb among them
+	};
+
+	ReachabilityMap(const Eigen::Vector3f&, const Eigen::Vector3i&, float);
+
+	const Eigen::Vector3f& Lower() const { return lower_; }
+	const Eigen::Vector3i& Size() const { return size_; }
+	float VoxelSize() const { return voxel_; }
+	const std::vector<Voxel>& Voxels() const { return voxels_; }
+
+	/* The index into Voxels() of the voxel holding p, or -1 outside the grid */
+	int Index(const Eigen::Vector3f&) const;
+
+	/*
+	 * Function: Adds random samples of the joint space to the map
+	 * Inputs:
+	 *  M: The home configuration of the end-effector
+	 *  Slist: The joint screw axes in the space frame at the home position
+	 *  thetalower, thetaupper: The joint limits
+	 *  samples: The number of configurations drawn
+	 *  pool: The threads sharing the work
+	 *  seed: Seeds the random configurations; the map does not depend on
+	 *        the number of threads
+	 */
+	void Sample(const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+		std::size_t, ThreadPool&, unsigned seed = 0);
+
+	/* Writes and reads the file described above; false on I/O errors or a bad file */
+	bool Save(const std::string&) const;
+	bool Load(const std::string&);
+
+private:
+	Eigen::Vector3f lower_;
+	Eigen::Vector3i size_;
+	float voxel_;
+	std::vector<Voxel> voxels_;
+};
+
 
 /*
  * Function: Compute the motion of a serial chain given an open-loop history of joint forces/torques
@@ -670,6 +1738,7 @@ std::vector<Eigen::MatrixXf> CartesianTrajectory(const Eigen::MatrixXf&, const E
  *	dt: The timestep between points on the reference trajectory
  *	intRes: Integration resolution is the number of times integration (Euler) takes places between each time step.
  *			Must be an integer value greater than or equal to 1
+ *  precision: StatePrecision::Mixed to integrate in double, see StatePrecision
  *
  * Outputs: std::vector of [taumat, thetamat]
  *  taumat: An Nxn matrix of the controllers commanded joint forces/ torques, where each row of n forces/torques
@@ -680,6 +1749,222 @@ std::vector<Eigen::MatrixXf> SimulateControl(const Eigen::VectorXf&, const Eigen
 	const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
 	const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&,
 	const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
-	float, float, float, float, int);
+	float, float, float, float, int, StatePrecision = StatePrecision::Float);
+
+/*
+ * Function: SimulateControl drawing all of its temporaries from a Workspace
+ * Inputs: As SimulateControl, followed by
+ *  ws: The workspace, grown to the number of joints if it is too small
+ * Outputs: As SimulateControl
+ */
+std::vector<Eigen::MatrixXf> SimulateControl(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+	const Eigen::MatrixXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+	const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&, const Eigen::MatrixXf&,
+	const Eigen::VectorXf&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+	float, float, float, float, int,
+	Workspace&, StatePrecision = StatePrecision::Float);
+
+
+/*
+ * Class: Model-predictive path-integral (MPPI) control of joint torques
+ * Construction:
+ *  g: Gravity vector g
+ *  Mlist: List of link frames {i} relative to {i-1} at the home position
+ *  Glist: Spatial inertia matrices Gi of the links
+ *  Slist: Screw axes Si of the joints in a space frame, in the format
+ *         of a matrix with the screw axes as the columns.
+ *  dt: The control period, also the integration step of the rollouts
+ *  horizon: The number of steps per rollout
+ *  rollouts: The number of sampled torque sequences per Step
+ *  pool: The threads the rollouts are spread over
+ * Notes: The torques are InverseDynamics along the reference plus a
+ *        nominal correction sequence. Every Step perturbs the correction
+ *        with Gaussian noise, rolls each sample out with ForwardDynamics
+ *        and EulerStep, and moves the correction by the noise averaged with
+ *        weights exp(-cost / temperature). Rollout 0 replays the correction
+ *        unperturbed, so a good sequence is kept rather than averaged away.
+ *        The first torque is applied and the correction shifted by one step
+ *        as the warm start of the next Step. The cost of a rollout sums,
+ *        over its steps,
+ *            positionWeight |theta - thetad|^2 + velocityWeight |dtheta - dthetad|^2
+ *            + controlWeight |tau - tau_feedforward|^2.
+ *        Rollouts are split into fixed runs, each with its own workspace
+ *        and seeded generator: Step does not allocate, and its result does
+ *        not depend on the number of threads.
+ */
+class MPPIController {
+public:
+	MPPIController(const Eigen::Vector3f&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+		const Eigen::MatrixXf&, float, int, int, ThreadPool&);
+	~MPPIController();
+
+	/* Standard deviation of the torque noise per joint (1 by default) */
+	void SetNoise(const Eigen::VectorXf&);
+	/* Cost weights (100, 10, 0 by default) and temperature (1 by default) */
+	void SetCost(float, float, float);
+	void SetTemperature(float);
+	/* Symmetric per-joint torque limits (infinite by default) */
+	void SetTorqueLimits(const Eigen::VectorXf&);
+	void Seed(unsigned);
+
+	/* Zeroes the nominal correction sequence */
+	void Reset();
+
+	/*
+	 * Function: One control cycle
+	 * Inputs:
+	 *  thetalist, dthetalist: The measured joint state
+	 *  thetamatd: The reference as an N x n matrix, e.g. from JointTrajectory;
+	 *             row k is the desired position k steps ahead (the last row
+	 *             is held beyond the end)
+	 * Returns: The torques to apply for the next dt
+	 */
+	const Eigen::VectorXf& Step(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::MatrixXf&);
+
+	/* The nominal correction to the feedforward after the last Step, one column per step */
+	const Eigen::MatrixXf& Nominal() const { return nominal_; }
+
+private:
+	MPPIController(const MPPIController&);
+	MPPIController& operator=(const MPPIController&);
+
+	struct Run;
+
+	Eigen::Vector3f g_;
+	std::vector<Eigen::MatrixXf> Mlist_, Glist_;
+	Eigen::MatrixXf Slist_;
+	std::vector<JointModel> joints_;
+	float dt_;
+	int horizon_, rollouts_;
+	ThreadPool& pool_;
+	Eigen::VectorXf sigma_, tauMax_;
+	float positionWeight_, velocityWeight_, controlWeight_, temperature_;
+
+	Eigen::MatrixXf nominal_;      // n x horizon, added to feedforward_
+	Eigen::MatrixXf feedforward_;  // n x horizon, InverseDynamics along the reference
+	Eigen::MatrixXf noise_;        // n*horizon x rollouts
+	Eigen::VectorXf costs_;
+	Eigen::VectorXf taulist_;
+	std::vector<std::unique_ptr<Run> > runs_;
+};
+
+
+/*
+ * Class: Trajectory optimization of joint torques by iterative LQR
+ * Construction:
+ *  g: Gravity vector g
+ *  Mlist: List of link frames {i} relative to {i-1} at the home position
+ *  Glist: Spatial inertia matrices Gi of the links
+ *  Slist: Screw axes Si of the joints in a space frame, in the format
+ *         of a matrix with the screw axes as the columns.
+ *  dt: The time between knots, also the integration step of the dynamics
+ *  pool: The threads the derivatives and the line search are spread over
+ * Notes: The state is x = [thetalist; dthetalist] and each step is
+ *        ForwardDynamics followed by EulerStep, as in SimulateControl.
+ *        An iteration linearizes the dynamics at every knot, by central
+ *        differences in the state and the inverse mass matrix in the
+ *        torques; runs the Riccati recursion with Levenberg-Marquardt
+ *        regularization of Quu; and rolls out a fixed set of step sizes
+ *        together, keeping the largest that decreases the cost enough.
+ *        The second-order dynamics terms of full DDP are not included.
+ *        Knots are split into fixed runs, each with its own workspace,
+ *        reused by every iteration and every call to Optimize.
+ */
+class ILQROptimizer {
+public:
+	/* Derivatives of a stage cost with respect to the state x and torques u */
+	struct CostExpansion {
+		Eigen::VectorXf lx, lu;
+		Eigen::MatrixXf lxx, luu, lux;
+	};
+	/*
+	 * A stage cost l(k, x, u): returns its value at knot k and, when the last
+	 * argument is not null, adds its derivatives to the zeroed expansion.
+	 * Knot N-1 is the final cost, whose u is to be ignored. It is called
+	 * from several threads at once.
+	 */
+	typedef std::function<float(int, const Eigen::VectorXf&, const Eigen::VectorXf&, CostExpansion*)> CostFunction;
+
+	ILQROptimizer(const Eigen::Vector3f&, const std::vector<Eigen::MatrixXf>&, const std::vector<Eigen::MatrixXf>&,
+		const Eigen::MatrixXf&, float, ThreadPool&);
+	~ILQROptimizer();
+
+	/*
+	 * Quadratic tracking of the reference passed to Optimize, the default:
+	 *  positionWeight |theta - thetad|^2 + velocityWeight |dtheta - dthetad|^2
+	 *  + controlWeight |tau|^2 at every knot but the last, and
+	 *  finalWeight (|theta - thetad|^2 + |dtheta - dthetad|^2) at the last
+	 * (100, 1, 1e-4, 1000 by default)
+	 */
+	void SetCost(float, float, float, float);
+	/* Replaces the tracking cost */
+	void SetCost(const CostFunction&);
+
+	/*
+	 * Function: Optimizes the torques from a start state toward a reference
+	 * Inputs:
+	 *  thetalist, dthetalist: The start state
+	 *  thetamatd: The reference as an N x n matrix, e.g. from JointTrajectory,
+	 *             one row per knot; the initial torques are InverseDynamics
+	 *             along it
+	 *  maxIterations: The maximum number of iterations
+	 *  tolerance: Relative decrease of the cost below which it has converged
+	 * Returns: true if it converged within maxIterations
+	 */
+	bool Optimize(const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::MatrixXf&, int maxIterations = 100,
+		float tolerance = 1e-5f);
+
+	/* The cost of the last trajectory and the iterations it took */
+	float Cost() const { return cost_; }
+	int Iterations() const { return iterations_; }
+
+	/*
+	 * The optimized trajectory, N x n each, in the form SimulateControl takes
+	 * as thetamatd, dthetamatd and ddthetamatd. Row N-1 of the torques holds
+	 * the final state against gravity.
+	 */
+	const Eigen::MatrixXf& Torques() const { return taumat_; }
+	const Eigen::MatrixXf& Positions() const { return thetamat_; }
+	const Eigen::MatrixXf& Velocities() const { return dthetamat_; }
+	const Eigen::MatrixXf& Accelerations() const { return ddthetamat_; }
+	/* Feedback gains of the last iteration, n x 2n per knot */
+	const std::vector<Eigen::MatrixXf>& Gains() const { return K_; }
+
+private:
+	ILQROptimizer(const ILQROptimizer&);
+	ILQROptimizer& operator=(const ILQROptimizer&);
+
+	struct Run;
+
+	float TrackingCost(int, const Eigen::VectorXf&, const Eigen::VectorXf&, CostExpansion*) const;
+	float StageCost(int, const Eigen::VectorXf&, const Eigen::VectorXf&, CostExpansion*) const;
+	void Accelerations(Run&, const Eigen::Ref<const Eigen::VectorXf>&, const Eigen::Ref<const Eigen::VectorXf>&,
+		Eigen::Ref<Eigen::VectorXf>);
+	void Linearize(Run&, int);
+	float Rollout(Run&, float);
+	bool BackwardPass(float, float&, float&);
+
+	Eigen::Vector3f g_;
+	std::vector<Eigen::MatrixXf> Mlist_, Glist_;
+	Eigen::MatrixXf Slist_;
+	std::vector<JointModel> joints_;
+	float dt_;
+	ThreadPool& pool_;
+	float positionWeight_, velocityWeight_, controlWeight_, finalWeight_;
+	CostFunction custom_;
+
+	Eigen::MatrixXf xd_;           // 2n x N reference
+	Eigen::MatrixXf X_, U_;        // 2n x N states, n x N torques
+	std::vector<Eigen::MatrixXf> A_, B_, K_;
+	Eigen::MatrixXf kff_;          // n x N-1 feedforward steps
+	std::vector<CostExpansion> expansions_;
+	Eigen::MatrixXf Vxx_, Qxx_, Quu_, Qux_;
+	Eigen::VectorXf Vx_, Qx_, Qu_;
+	Eigen::LLT<Eigen::MatrixXf> llt_;
+	float cost_;
+	int iterations_;
+	Eigen::MatrixXf taumat_, thetamat_, dthetamat_, ddthetamat_;
+	std::vector<std::unique_ptr<Run> > runs_;
+};
 
 }
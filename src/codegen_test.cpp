@@ -0,0 +1,55 @@
+#include <Eigen/Dense>
+#include "../include/modern_robotics.h"
+#include "gtest/gtest.h"
+
+// Headers emitted at build time by tools/mr_codegen from tools/robots/*.txt
+#include "three_link.h"
+#include "mixed_chain.h"
+
+/* Evaluates a generated robot and the generic functions on the same random states */
+template <int N>
+static void CheckGenerated(Eigen::Matrix4f (*FKinSpace)(const Eigen::Matrix<float, N, 1>&),
+	Eigen::Matrix<float, 6, N> (*JacobianSpace)(const Eigen::Matrix<float, N, 1>&),
+	Eigen::Matrix<float, N, 1> (*InverseDynamics)(const Eigen::Matrix<float, N, 1>&, const Eigen::Matrix<float, N, 1>&,
+		const Eigen::Matrix<float, N, 1>&, const Eigen::Vector3f&, const Eigen::Matrix<float, 6, 1>&),
+	Eigen::Matrix<float, N, N> (*MassMatrix)(const Eigen::Matrix<float, N, 1>&),
+	Eigen::Matrix<float, N, 1> (*ForwardDynamics)(const Eigen::Matrix<float, N, 1>&, const Eigen::Matrix<float, N, 1>&,
+		const Eigen::Matrix<float, N, 1>&, const Eigen::Vector3f&, const Eigen::Matrix<float, 6, 1>&),
+	const Eigen::MatrixXf& Slist, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist) {
+	Eigen::Matrix4f M = Eigen::Matrix4f::Identity();
+	for (std::size_t i = 0; i < Mlist.size(); i++)
+		M = M * Eigen::Matrix4f(Mlist[i]);
+	Eigen::Vector3f g(0, 0, -9.8);
+	std::srand(55);
+	for (int trial = 0; trial < 20; trial++) {
+		Eigen::VectorXf thetalist = 2 * Eigen::VectorXf::Random(N);
+		Eigen::VectorXf dthetalist = Eigen::VectorXf::Random(N);
+		Eigen::VectorXf ddthetalist = Eigen::VectorXf::Random(N);
+		Eigen::VectorXf taulist = 5 * Eigen::VectorXf::Random(N);
+		Eigen::VectorXf Ftip = Eigen::VectorXf::Random(6);
+
+		Eigen::MatrixXf T = FKinSpace(thetalist);
+		ASSERT_TRUE(T.isApprox(mr::FKinSpace(M, Slist, thetalist), 1e-4));
+		Eigen::MatrixXf Js = JacobianSpace(thetalist);
+		ASSERT_TRUE(Js.isApprox(mr::JacobianSpace(Slist, thetalist), 1e-4));
+
+		Eigen::VectorXf tau = InverseDynamics(thetalist, dthetalist, ddthetalist, g, Ftip);
+		Eigen::VectorXf tauExpected = mr::InverseDynamics(thetalist, dthetalist, ddthetalist, g, Ftip, Mlist, Glist, Slist);
+		ASSERT_TRUE(tau.isApprox(tauExpected, 1e-4));
+		Eigen::MatrixXf Mass = MassMatrix(thetalist);
+		ASSERT_TRUE(Mass.isApprox(mr::MassMatrix(thetalist, Mlist, Glist, Slist), 1e-4));
+		Eigen::VectorXf ddtheta = ForwardDynamics(thetalist, dthetalist, taulist, g, Ftip);
+		Eigen::VectorXf ddthetaExpected = mr::ForwardDynamics(thetalist, dthetalist, taulist, g, Ftip, Mlist, Glist, Slist);
+		ASSERT_TRUE(ddtheta.isApprox(ddthetaExpected, 1e-3));
+	}
+}
+
+TEST(MRTest, CodegenThreeLinkTest) {
+	CheckGenerated<three_link::DOF>(three_link::FKinSpace, three_link::JacobianSpace, three_link::InverseDynamics,
+		three_link::MassMatrix, three_link::ForwardDynamics, three_link::Slist(), three_link::Mlist(), three_link::Glist());
+}
+
+TEST(MRTest, CodegenMixedChainTest) {
+	CheckGenerated<mixed_chain::DOF>(mixed_chain::FKinSpace, mixed_chain::JacobianSpace, mixed_chain::InverseDynamics,
+		mixed_chain::MassMatrix, mixed_chain::ForwardDynamics, mixed_chain::Slist(), mixed_chain::Mlist(), mixed_chain::Glist());
+}
@@ -0,0 +1,798 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Dense>
+#include "../include/modern_robotics.h"
+#include "reference.h"
+
+// Headers emitted at build time by tools/mr_codegen from tools/robots/*.txt
+#include "three_link.h"
+
+namespace {
+
+	/* Keeps the optimizer from discarding the benchmarked results */
+	volatile float sink;
+
+	/* Mean wall time of one call to f, in nanoseconds */
+	template <class F>
+	double TimeCall(F f, int reps) {
+		for (int i = 0; i < reps / 10; i++) f();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < reps; i++) f();
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / reps;
+	}
+
+	void Report(const char* name, double generic, double generated) {
+		std::printf("%-28s %12.1f %12.1f %9.1fx\n", name, generic, generated, generic / generated);
+	}
+
+	void BenchCodegen() {
+		Eigen::MatrixXf Slist = three_link::Slist();
+		std::vector<Eigen::MatrixXf> Mlist = three_link::Mlist();
+		std::vector<Eigen::MatrixXf> Glist = three_link::Glist();
+		Eigen::MatrixXf M = Mlist[0] * Mlist[1] * Mlist[2] * Mlist[3];
+		three_link::JointVector q(0.1f, 0.1f, 0.1f), dq(0.1f, 0.2f, 0.3f), ddq(2, 1.5f, 1), tau(0.5f, 0.6f, 0.7f);
+		Eigen::VectorXf thetalist = q, dthetalist = dq, ddthetalist = ddq, taulist = tau;
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::Matrix<float, 6, 1> Ftip;
+		Ftip << 1, 1, 1, 1, 1, 1;
+		Eigen::VectorXf FtipX = Ftip;
+		mr::Workspace ws(3);
+		// Every call nudges the first joint so that no result can be hoisted out of the loop
+		const int reps = 200000;
+
+		std::printf("three_link, ns per call      %12s %12s %10s\n", "mr::", "generated", "speedup");
+		Report("FKinSpace",
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::FKinSpace(M, Slist, thetalist).sum(); }, reps),
+			TimeCall([&]() { q(0) += 1e-6f; sink = three_link::FKinSpace(q).sum(); }, reps));
+		Report("JacobianSpace",
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::JacobianSpace(Slist, thetalist).sum(); }, reps),
+			TimeCall([&]() { q(0) += 1e-6f; sink = three_link::JacobianSpace(q).sum(); }, reps));
+		Report("InverseDynamics",
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::InverseDynamics(thetalist, dthetalist, ddthetalist, g, FtipX, Mlist, Glist, Slist, ws).sum(); }, reps),
+			TimeCall([&]() { q(0) += 1e-6f; sink = three_link::InverseDynamics(q, dq, ddq, g, Ftip).sum(); }, reps));
+		Report("MassMatrix",
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::MassMatrix(thetalist, Mlist, Glist, Slist, ws).sum(); }, reps),
+			TimeCall([&]() { q(0) += 1e-6f; sink = three_link::MassMatrix(q).sum(); }, reps));
+		Report("ForwardDynamics",
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::ForwardDynamics(thetalist, dthetalist, taulist, g, FtipX, Mlist, Glist, Slist, ws).sum(); }, reps),
+			TimeCall([&]() { q(0) += 1e-6f; sink = three_link::ForwardDynamics(q, dq, tau, g, Ftip).sum(); }, reps));
+	}
+
+	/* Serial against parallel-prefix FKinSpace plus JacobianSpace on random chains */
+	void BenchParallelFKin() {
+		mr::ThreadPool pool;
+		std::printf("\nFKinSpace + JacobianSpace, us per call, %d threads\n", pool.Size());
+		std::printf("%-28s %12s %12s %10s\n", "dof", "serial", "parallel", "speedup");
+		const int dofs[] = { 7, 16, 32, 64, 128, 256 };
+		for (int k = 0; k < 6; k++) {
+			int n = dofs[k];
+			Eigen::MatrixXf Slist(6, n);
+			for (int i = 0; i < n; i++)
+				Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f::Random(), Eigen::Vector3f::Random().normalized(), 0);
+			Eigen::VectorXf thetalist = Eigen::VectorXf::Random(n);
+			Eigen::MatrixXf M = Eigen::MatrixXf::Identity(4, 4);
+			int reps = 200000 / n;
+			double serial = TimeCall([&]() {
+				thetalist(0) += 1e-6f;
+				sink = mr::FKinSpace(M, Slist, thetalist).sum() + mr::JacobianSpace(Slist, thetalist).sum();
+			}, reps);
+			double parallel = TimeCall([&]() {
+				thetalist(0) += 1e-6f;
+				sink = mr::FKinSpace(M, Slist, thetalist, pool).sum() + mr::JacobianSpace(Slist, thetalist, pool).sum();
+			}, reps);
+			char name[16];
+			std::snprintf(name, sizeof(name), "%d", n);
+			std::printf("%-28s %12.2f %12.2f %9.2fx\n", name, serial / 1000, parallel / 1000, serial / parallel);
+		}
+	}
+
+	/* ProjectToSO3 by dynamic-size SVD, as it used to be, against the polar iteration */
+	void BenchProjectToSO3() {
+		const int count = 10000;
+		std::vector<float> drifted(9 * count), projected(9 * count);
+		for (int i = 0; i < count; i++) {
+			Eigen::Map<Eigen::Matrix3f> M(&drifted[9 * i]);
+			M = mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f::Random())) + 1e-3f * Eigen::Matrix3f::Random();
+		}
+		double svd = TimeCall([&]() {
+			for (int i = 0; i < count; i++) {
+				Eigen::MatrixXf M = Eigen::Map<Eigen::Matrix3f>(&drifted[9 * i]);
+				Eigen::JacobiSVD<Eigen::MatrixXf> decomposition(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
+				Eigen::Map<Eigen::Matrix3f> R(&projected[9 * i]);
+				R = decomposition.matrixU() * decomposition.matrixV().transpose();
+			}
+			sink = projected[0];
+		}, 20);
+		double single = TimeCall([&]() {
+			for (int i = 0; i < count; i++) {
+				Eigen::Map<Eigen::Matrix3f> R(&projected[9 * i]);
+				R = mr::ProjectToSO3(Eigen::Map<Eigen::Matrix3f>(&drifted[9 * i]));
+			}
+			sink = projected[0];
+		}, 20);
+		double batch = TimeCall([&]() {
+			mr::ProjectToSO3Batch(drifted.data(), count, projected.data());
+			sink = projected[0];
+		}, 20);
+		std::printf("\nProjectToSO3, ns per matrix\n");
+		std::printf("%-28s %12.1f\n", "JacobiSVD<MatrixXf>", svd / count);
+		std::printf("%-28s %12.1f %9.1fx\n", "ProjectToSO3", single / count, svd / single);
+		std::printf("%-28s %12.1f %9.1fx\n", "ProjectToSO3Batch", batch / count, svd / batch);
+	}
+
+	/* TestIfSE3 pose by pose against one DistanceToSE3Batch pass over the array */
+	void BenchDistanceToSE3() {
+		const int count = 1 << 20;
+		std::vector<float> poses(16 * count);
+		for (int i = 0; i < count; i++) {
+			Eigen::Map<Eigen::Matrix4f> T(&poses[16 * i]);
+			T = Eigen::Matrix4f::Identity();
+			T.topLeftCorner<3, 3>() += 1e-4f * Eigen::Matrix3f::Random();
+		}
+		std::vector<float> distances(count);
+		std::vector<std::uint64_t> valid((count + 63) / 64);
+		double single = TimeCall([&]() {
+			int passed = 0;
+			for (int i = 0; i < count; i++)
+				passed += mr::TestIfSE3(Eigen::Map<Eigen::Matrix4f>(&poses[16 * i]));
+			sink = passed;
+		}, 5);
+		double batch = TimeCall([&]() {
+			sink = mr::DistanceToSE3Batch(poses.data(), count, distances.data(), valid.data());
+		}, 5);
+		double bytes = count * (16 + 1) * sizeof(float);
+		std::printf("\nSE(3) validity of %d poses\n", count);
+		std::printf("%-28s %12.2f ns/pose %8.2f GB/s\n", "TestIfSE3", single / count, bytes / single);
+		std::printf("%-28s %12.2f ns/pose %8.2f GB/s\n", "DistanceToSE3Batch", batch / count, bytes / batch);
+	}
+
+	/* The 4x4 matrix path against dual quaternions */
+	void BenchDualQuaternion() {
+		Eigen::MatrixXf Slist(6, 7);
+		for (int i = 0; i < 7; i++)
+			Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f::Random(), Eigen::Vector3f::Random().normalized(), 0);
+		Eigen::VectorXf thetalist = Eigen::VectorXf::Random(7);
+		Eigen::Matrix4f M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 1));
+		mr::DualQuaternion Mdq(M);
+		const int reps = 200000;
+		std::printf("\n7-joint chain, ns per call      %9s %12s %10s\n", "matrix", "dual quat", "speedup");
+		Report("FKinSpace",
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::FKinSpace(M, Slist, thetalist).sum(); }, reps),
+			TimeCall([&]() { thetalist(0) += 1e-6f; sink = mr::FKinSpace(Mdq, Slist, thetalist).Real().w(); }, reps));
+
+		mr::DualQuaternion A(mr::FKinSpace(M, Slist, thetalist)), B = A;
+		Eigen::Matrix4f Am = A.Matrix(), Bm = Am;
+		Report("compose 1000 motions",
+			TimeCall([&]() { for (int i = 0; i < 1000; i++) Bm = Bm * Am; sink = Bm(0, 0); }, reps / 100),
+			TimeCall([&]() { for (int i = 0; i < 1000; i++) B = B * A; sink = B.Real().w(); }, reps / 100));
+		Eigen::Matrix4f Xend = mr::FKinSpace(M, Slist, -thetalist);
+		Report("ScrewTrajectory, 100 points",
+			TimeCall([&]() {
+				Eigen::MatrixXf expc6 = mr::MatrixLog6(mr::TransInv(Am) * Xend);
+				for (int i = 0; i < 100; i++) sink = (Am * mr::MatrixExp6(expc6 * (i / 99.0f))).sum();
+			}, reps / 100),
+			TimeCall([&]() { sink = mr::ScrewTrajectory(Am, Xend, 1, 100, 5)[50].sum(); }, reps / 100));
+	}
+
+	/* A PUMA-style 6R arm: shoulder offset, parallel shoulder and elbow axes, spherical wrist */
+	void PumaArm(Eigen::MatrixXf& Slist, Eigen::MatrixXf& M) {
+		Eigen::Vector3f c(0.5f, 0.1f, 1.3f);
+		Slist.resize(6, 6);
+		Slist.col(0) = mr::ScrewToAxis(Eigen::Vector3f::Zero(), Eigen::Vector3f(0, 0, 1), 0);
+		Slist.col(1) = mr::ScrewToAxis(Eigen::Vector3f(0.1f, 0, 0.5f), Eigen::Vector3f(0, 1, 0), 0);
+		Slist.col(2) = mr::ScrewToAxis(Eigen::Vector3f(0.1f, 0, 1.0f), Eigen::Vector3f(0, 1, 0), 0);
+		Slist.col(3) = mr::ScrewToAxis(c, Eigen::Vector3f(1, 0, 0), 0);
+		Slist.col(4) = mr::ScrewToAxis(c, Eigen::Vector3f(0, 1, 0), 0);
+		Slist.col(5) = mr::ScrewToAxis(c, Eigen::Vector3f(1, 0, 0), 0);
+		M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.6f, 0.1f, 1.3f));
+	}
+
+	/* Damped Newton from a nearby guess against the closed-form solutions */
+	void BenchAnalyticIK() {
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		mr::AnalyticIK ik(Slist, M);
+		Eigen::VectorXf thetalist(6);
+		thetalist << 0.3f, -0.5f, 0.8f, 0.2f, 0.4f, -0.1f;
+		Eigen::MatrixXf T = mr::FKinSpace(M, Slist, thetalist);
+		const int reps = 20000;
+		std::printf("\nPUMA-style arm, ns per call      %8s %12s %10s\n", "IKinSpace", "analytic", "speedup");
+		Report("IK from a guess / all",
+			TimeCall([&]() {
+				Eigen::VectorXf guess = thetalist + 0.2f * Eigen::VectorXf::Ones(6);
+				mr::IKinSpace(Slist, M, T, guess, 1e-3f, 1e-4f);
+				sink = guess(0);
+			}, reps),
+			TimeCall([&]() { sink = ik.Solutions(T).size(); }, reps));
+	}
+
+	/* Planning for a 7-joint arm around a spherical obstacle, serial against pooled edge checks */
+	void BenchJointPlanner() {
+		std::srand(61);
+		Eigen::MatrixXf Slist(6, 7);
+		for (int i = 0; i < 7; i++)
+			Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0.3f * i), i % 2 ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(0, 0, 1), 0);
+		Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 2.1f));
+		Eigen::Vector3f obstacle(0, 1.2f, 1.2f);
+		// The end-effector has to stay clear of the obstacle
+		mr::JointPlanner::StateValidity valid = [&](const Eigen::VectorXf& q) {
+			return (mr::FKinSpace(M, Slist, q).topRightCorner<3, 1>() - obstacle).norm() > 0.6f;
+		};
+		Eigen::VectorXf lower = -3 * Eigen::VectorXf::Ones(7), upper = 3 * Eigen::VectorXf::Ones(7);
+		Eigen::VectorXf start = Eigen::VectorXf::Zero(7), goal = Eigen::VectorXf::Zero(7);
+		start(0) = -1.2f;
+		start(1) = 0.8f;
+		goal(0) = 1.2f;
+		goal(1) = 0.8f;
+		mr::ThreadPool pool;
+		std::printf("\n7-joint planning, ms per query   %9s %12s %10s\n", "serial", "pooled", "speedup");
+		mr::JointPlanner serial(lower, upper, valid, 0.05f), pooled(lower, upper, valid, 0.05f, &pool);
+		Report("RRTConnect + Shortcut",
+			TimeCall([&]() { sink = serial.Shortcut(serial.RRTConnect(start, goal, 0.5f, 20000), 50).rows(); }, 10) / 1e6,
+			TimeCall([&]() { sink = pooled.Shortcut(pooled.RRTConnect(start, goal, 0.5f, 20000), 50).rows(); }, 10) / 1e6);
+		Report("LazyPRM, 1000 nodes",
+			TimeCall([&]() { serial = mr::JointPlanner(lower, upper, valid, 0.05f); sink = serial.LazyPRM(start, goal, 1000, 10).rows(); }, 3) / 1e6,
+			TimeCall([&]() { pooled = mr::JointPlanner(lower, upper, valid, 0.05f, &pool); sink = pooled.LazyPRM(start, goal, 1000, 10).rows(); }, 3) / 1e6);
+	}
+
+	/* Pick-and-place style targets clustered around a few poses, cold against cached seeds */
+	void BenchIKSeedCache() {
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		std::srand(62);
+		std::vector<Eigen::VectorXf> centers;
+		for (int i = 0; i < 4; i++)
+			centers.push_back(Eigen::VectorXf::Random(6));
+		std::vector<Eigen::MatrixXf> targets;
+		for (int i = 0; i < 2000; i++)
+			targets.push_back(mr::FKinSpace(M, Slist, centers[i % 4] + 0.05f * Eigen::VectorXf::Random(6)));
+		Eigen::VectorXf home = Eigen::VectorXf::Zero(6);
+		int coldSolved = 0, cachedSolved = 0;
+		double cold = TimeCall([&]() {
+			coldSolved = 0;
+			for (std::size_t i = 0; i < targets.size(); i++) {
+				Eigen::VectorXf thetalist = home;
+				coldSolved += mr::IKinSpace(Slist, M, targets[i], thetalist, 1e-3f, 1e-4f);
+			}
+		}, 3);
+		double cached = TimeCall([&]() {
+			mr::IKSeedCache cache(Slist, M, 256);
+			cachedSolved = 0;
+			for (std::size_t i = 0; i < targets.size(); i++) {
+				Eigen::VectorXf thetalist = home;
+				cachedSolved += cache.Solve(targets[i], thetalist, 1e-3f, 1e-4f);
+			}
+		}, 3);
+		std::printf("\nClustered IK targets, us per solve  %6s %12s %10s\n", "cold", "cached", "speedup");
+		Report("IKinSpace", cold / targets.size() / 1000, cached / targets.size() / 1000);
+		std::printf("%-28s %12d %12d\n", "solved of 2000", coldSolved, cachedSolved);
+	}
+
+	/* The scalar functions sample by sample against ReachabilityMap::Sample */
+	void BenchReachabilityMap() {
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		Eigen::VectorXf lower = -float(M_PI) * Eigen::VectorXf::Ones(6), upper = -lower;
+		const std::size_t samples = 200000;
+		mr::ReachabilityMap naive(Eigen::Vector3f(-2, -2, -1), Eigen::Vector3i(80, 80, 80), 0.05f), map = naive;
+		double scalar = TimeCall([&]() {
+			for (std::size_t k = 0; k < samples; k++) {
+				Eigen::VectorXf thetalist = lower + (upper - lower).cwiseProduct(0.5f * (Eigen::VectorXf::Random(6) + Eigen::VectorXf::Ones(6)));
+				Eigen::MatrixXf T = mr::FKinSpace(M, Slist, thetalist);
+				Eigen::MatrixXf Jb = mr::Adjoint(mr::TransInv(T)) * mr::JacobianSpace(Slist, thetalist);
+				Eigen::JacobiSVD<Eigen::MatrixXf> svd(Jb);
+				sink = svd.singularValues().prod() + T(0, 3);
+			}
+		}, 1);
+		mr::ThreadPool pool;
+		double sampled = TimeCall([&]() { map.Sample(M, Slist, lower, upper, samples, pool); }, 1);
+		std::printf("\nReachability of a 6R arm, ns per sample, %d threads\n", pool.Size());
+		Report("FK + Jacobian + SVD / Sample", scalar / samples, sampled / samples);
+	}
+
+	/* IKinSpace with reject-and-retry against IKinSpaceBounded for a 7R arm with joint limits */
+	void BenchIKinBounded() {
+		Eigen::MatrixXf Slist(6, 7);
+		for (int i = 0; i < 7; i++)
+			Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0.3f * i), i % 2 ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(0, 0, 1), 0);
+		Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 2.1f));
+		Eigen::VectorXf lower = -1.5f * Eigen::VectorXf::Ones(7), upper = -lower;
+		std::srand(64);
+		std::vector<Eigen::MatrixXf> targets;
+		std::vector<Eigen::VectorXf> guesses;
+		for (int i = 0; i < 500; i++) {
+			Eigen::VectorXf goal = 1.3f * Eigen::VectorXf::Random(7);
+			targets.push_back(mr::FKinSpace(M, Slist, goal));
+			guesses.push_back(goal + 0.6f * Eigen::VectorXf::Random(7));
+		}
+		// Up to 10 attempts, reseeding at random within the limits
+		int retrySolved = 0, boundedSolved = 0;
+		auto solve = [&](bool bounded) {
+			int solved = 0;
+			for (std::size_t i = 0; i < targets.size(); i++) {
+				Eigen::VectorXf guess = guesses[i];
+				for (int attempt = 0; attempt < 10; attempt++) {
+					Eigen::VectorXf thetalist = guess;
+					bool ok = bounded ? mr::IKinSpaceBounded(Slist, M, targets[i], thetalist, lower, upper, 1e-3f, 1e-4f)
+						: mr::IKinSpace(Slist, M, targets[i], thetalist, 1e-3f, 1e-4f)
+							&& (thetalist.array() >= lower.array()).all() && (thetalist.array() <= upper.array()).all();
+					if (ok) {
+						solved++;
+						break;
+					}
+					guess = 1.5f * Eigen::VectorXf::Random(7);
+				}
+			}
+			return solved;
+		};
+		double retry = TimeCall([&]() { retrySolved = solve(false); }, 2);
+		double bounded = TimeCall([&]() { boundedSolved = solve(true); }, 2);
+		std::printf("\nLimited 7R arm, us per target    %9s %12s %10s\n", "retry", "bounded", "speedup");
+		Report("IK within limits", retry / targets.size() / 1000, bounded / targets.size() / 1000);
+		std::printf("%-28s %12d %12d\n", "solved of 500", retrySolved, boundedSolved);
+	}
+
+	/* One servo tick for a 7R arm: IKinSpace every tick against ResolvedRateController::Step */
+	void BenchResolvedRate() {
+		Eigen::MatrixXf Slist(6, 7);
+		for (int i = 0; i < 7; i++)
+			Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0.3f * i), i % 2 ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(0, 0, 1), 0);
+		Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 2.1f));
+		mr::ResolvedRateController controller(M, Slist, 0.001f, 10, 0.01f);
+		controller.SetLimits(Eigen::VectorXf::Ones(7), 10 * Eigen::VectorXf::Ones(7));
+		Eigen::VectorXf thetalist = 0.3f * Eigen::VectorXf::Ones(7);
+		// A target circling slowly, as from a teleoperation device
+		const int ticks = 20000;
+		double worst[2] = { 0, 0 }, total[2] = { 0, 0 };
+		for (int k = 0; k < 2; k++) {
+			Eigen::VectorXf q = thetalist;
+			for (int tick = 0; tick < ticks; tick++) {
+				Eigen::VectorXf target = thetalist;
+				target(0) += 0.3f * std::sin(tick * 1e-3f);
+				target(3) += 0.2f * std::cos(tick * 1e-3f);
+				Eigen::Matrix4f Tsd = mr::FKinSpace(M, Slist, target);
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				if (k == 0)
+					mr::IKinSpace(Slist, M, Tsd, q, 1e-3f, 1e-4f);
+				else
+					q += 0.001f * controller.Step(q, Tsd);
+				std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+				worst[k] = std::max(worst[k], elapsed.count());
+				total[k] += elapsed.count();
+			}
+			sink = q(0);
+		}
+		std::printf("\n7R servo tick, ns                %9s %12s %10s\n", "IKinSpace", "Step", "speedup");
+		Report("mean", total[0] / ticks, total[1] / ticks);
+		Report("worst", worst[0], worst[1]);
+	}
+
+	/* One MPPI control cycle of a 6R arm against the same rollouts through the allocating calls */
+	void BenchMPPI() {
+		std::vector<Eigen::MatrixXf> Mlist, Glist;
+		Eigen::MatrixXf Slist;
+		Eigen::MatrixXf M;
+		PumaArm(Slist, M);
+		int n = Slist.cols();
+		Eigen::VectorXf G(6);
+		G << 0.05f, 0.05f, 0.05f, 2, 2, 2;
+		for (int i = 0; i < n; i++) {
+			Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+			Glist.push_back(G.asDiagonal());
+		}
+		Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+		Eigen::Vector3f g(0, 0, -9.8f);
+		const int rollouts = 1000, horizon = 50;
+		const float dt = 0.01f;
+		Eigen::MatrixXf reference = mr::JointTrajectory(Eigen::VectorXf::Zero(n), 0.5f * Eigen::VectorXf::Ones(n), 0.5f, horizon + 1, 5);
+		Eigen::VectorXf thetalist = Eigen::VectorXf::Zero(n), dthetalist = Eigen::VectorXf::Zero(n);
+
+		// The same cycle through the allocating ForwardDynamics, one rollout after another
+		std::mt19937 rng(1);
+		std::normal_distribution<float> normal;
+		double naive = TimeCall([&]() {
+			float total = 0;
+			for (int k = 0; k < rollouts; k++) {
+				Eigen::VectorXf q = thetalist, dq = dthetalist;
+				for (int t = 0; t < horizon; t++) {
+					Eigen::VectorXf taulist(n);
+					for (int i = 0; i < n; i++)
+						taulist(i) = normal(rng);
+					Eigen::VectorXf ddq = mr::ForwardDynamics(q, dq, taulist, g, Eigen::VectorXf::Zero(6), Mlist, Glist, Slist);
+					mr::EulerStep(q, dq, ddq, dt);
+					total += (q - reference.row(t + 1).transpose()).squaredNorm();
+				}
+			}
+			sink = total;
+		}, 2);
+
+		mr::ThreadPool serial(1), pool;
+		std::printf("\nMPPI cycle, %d rollouts x %d steps, ms   %9s %12s %10s\n", rollouts, horizon, "naive", "Step", "speedup");
+		mr::ThreadPool* pools[] = { &serial, &pool };
+		for (int k = 0; k < 2; k++) {
+			mr::MPPIController controller(g, Mlist, Glist, Slist, dt, horizon, rollouts, *pools[k]);
+			double step = TimeCall([&]() { sink = controller.Step(thetalist, dthetalist, reference)(0); }, 2);
+			char name[32];
+			std::snprintf(name, sizeof(name), "%d thread(s)", pools[k]->Size());
+			Report(name, naive * 1e-6, step * 1e-6);
+		}
+	}
+
+	/* iLQR on a 6R arm, the knots linearized and the step sizes rolled out on one thread or the pool */
+	void BenchILQR() {
+		std::vector<Eigen::MatrixXf> Mlist, Glist;
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		int n = Slist.cols();
+		Eigen::VectorXf G(6);
+		G << 0.05f, 0.05f, 0.05f, 2, 2, 2;
+		for (int i = 0; i <= n; i++)
+			Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+		for (int i = 0; i < n; i++)
+			Glist.push_back(G.asDiagonal());
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::MatrixXf reference = mr::JointTrajectory(Eigen::VectorXf::Zero(n), 0.5f * Eigen::VectorXf::Ones(n), 1.0f, 101, 5);
+		Eigen::VectorXf thetalist = 0.1f * Eigen::VectorXf::Ones(n), dthetalist = Eigen::VectorXf::Zero(n);
+
+		mr::ThreadPool serial(1), pool;
+		mr::ThreadPool* pools[] = { &serial, &pool };
+		double elapsed[2];
+		int iterations = 0;
+		for (int k = 0; k < 2; k++) {
+			mr::ILQROptimizer optimizer(g, Mlist, Glist, Slist, 0.01f, *pools[k]);
+			elapsed[k] = TimeCall([&]() {
+				optimizer.Optimize(thetalist, dthetalist, reference, 20);
+				sink = optimizer.Cost();
+			}, 3);
+			iterations = optimizer.Iterations();
+		}
+		std::printf("\niLQR, 6R, 101 knots, %d iterations, ms  %9s %12s %10s\n", iterations, "serial", "parallel", "speedup");
+		char name[32];
+		std::snprintf(name, sizeof(name), "%d thread(s)", pool.Size());
+		Report(name, elapsed[0] * 1e-6, elapsed[1] * 1e-6);
+	}
+
+	/* Torques along a Cartesian line: the stored, cold-seeded chain against the pipeline */
+	void BenchCartesianPipeline() {
+		std::vector<Eigen::MatrixXf> Mlist, Glist;
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		int n = Slist.cols();
+		Eigen::VectorXf G(6);
+		G << 0.05f, 0.05f, 0.05f, 2, 2, 2;
+		for (int i = 0; i <= n; i++)
+			Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+		for (int i = 0; i < n; i++)
+			Glist.push_back(G.asDiagonal());
+		Eigen::VectorXf g(3);
+		g << 0, 0, -9.8f;
+		Eigen::VectorXf thetastart(n), thetaend(n);
+		thetastart << 0.1f, 0.3f, -0.4f, 0.2f, 0.5f, 0.1f;
+		thetaend << 0.5f, 0.1f, -0.2f, 0.4f, 0.3f, -0.2f;
+		Eigen::MatrixXf Xstart = mr::FKinSpace(M, Slist, thetastart), Xend = mr::FKinSpace(M, Slist, thetaend);
+		const int N = 20000;
+		const float Tf = 20;
+
+		double stored = TimeCall([&]() {
+			std::vector<Eigen::MatrixXf> poses = mr::CartesianTrajectory(Xstart, Xend, Tf, N, 5);
+			Eigen::MatrixXf thetamat(N, n);
+			for (int k = 0; k < N; k++) {
+				Eigen::VectorXf thetalist = thetastart;
+				mr::IKinSpace(Slist, M, poses[k], thetalist, 1e-4f, 1e-5f);
+				thetamat.row(k) = thetalist.transpose();
+			}
+			float dt = Tf / (N - 1);
+			Eigen::MatrixXf dthetamat = Eigen::MatrixXf::Zero(N, n), ddthetamat = Eigen::MatrixXf::Zero(N, n);
+			for (int k = 1; k + 1 < N; k++) {
+				dthetamat.row(k) = (thetamat.row(k + 1) - thetamat.row(k - 1)) / (2 * dt);
+				ddthetamat.row(k) = (thetamat.row(k + 1) - 2 * thetamat.row(k) + thetamat.row(k - 1)) / (dt * dt);
+			}
+			sink = mr::InverseDynamicsTrajectory(thetamat, dthetamat, ddthetamat, g, Eigen::MatrixXf::Zero(N, 6),
+				Mlist, Glist, Slist).sum();
+		}, 1);
+		double pipelined = TimeCall([&]() {
+			float total = 0;
+			mr::CartesianTorquePipeline(Xstart, Xend, Tf, N, 5, thetastart, M, Slist, 1e-4f, 1e-5f, g, Mlist, Glist,
+				[&](int, const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf& taulist) {
+					total += taulist.sum();
+				});
+			sink = total;
+		}, 1);
+		std::printf("\nCartesian line to torques, %d samples, ms  %9s %12s %10s\n", N, "stored", "pipeline", "speedup");
+		Report("6R", stored * 1e-6, pipelined * 1e-6);
+	}
+
+	/* CartesianTrajectory as a list of matrices, by per-sample slerp as it used to be, against the arrays */
+	void BenchCartesianSamples() {
+		Eigen::MatrixXf Xstart = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(0.3f, -0.2f, 0.5f))),
+			Eigen::Vector3f(1, 0, 1));
+		Eigen::MatrixXf Xend = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(-1.2f, 0.8f, 1.9f))),
+			Eigen::Vector3f(0.1f, 0.4f, 2));
+		const int N = 100000;
+		const float Tf = 10;
+		double list = TimeCall([&]() {
+			float timegap = Tf / (N - 1);
+			std::vector<Eigen::MatrixXf> traj(N);
+			Eigen::Matrix3f Rstart = Xstart.topLeftCorner(3, 3), Rend = Xend.topLeftCorner(3, 3);
+			Eigen::Vector3f pstart = Xstart.topRightCorner(3, 1), pend = Xend.topRightCorner(3, 1);
+			Eigen::Quaternionf qstart(Rstart), qend(Rend);
+			for (int i = 0; i < N; ++i) {
+				float st = mr::QuinticTimeScaling(Tf, timegap * i);
+				Eigen::MatrixXf traji(4, 4);
+				traji << qstart.slerp(st, qend).toRotationMatrix(), st * pend + (1 - st) * pstart,
+					0, 0, 0, 1;
+				traj[i] = traji;
+			}
+			sink = traj[N / 2](0, 3);
+		}, 5);
+		mr::CartesianSamples samples;
+		double arrays = TimeCall([&]() {
+			mr::CartesianTrajectory(Xstart, Xend, Tf, N, 5, samples);
+			sink = samples.positions(N / 2, 0);
+		}, 20);
+		double velocities = TimeCall([&]() {
+			mr::CartesianTrajectory(Xstart, Xend, Tf, N, 5, samples, true);
+			sink = samples.angularVelocities(N / 2, 0);
+		}, 20);
+		std::printf("\nCartesianTrajectory, ns per sample %12s %12s %10s\n", "list", "arrays", "speedup");
+		Report("poses", list / N, arrays / N);
+		Report("poses and velocities", list / N, velocities / N);
+	}
+
+	/* The cumulative B-spline through MatrixLog6 and MatrixExp6 per sample against SE3Spline */
+	void BenchSE3Spline() {
+		std::srand(21);
+		std::vector<Eigen::MatrixXf> controls;
+		for (int j = 0; j < 20; j++)
+			controls.push_back(mr::MatrixExp6(mr::VecTose3(Eigen::VectorXf::Random(6))));
+		const float dt = 0.1f;
+		mr::SE3Spline spline(controls, dt);
+		const int N = 20000;
+		Eigen::VectorXf times = Eigen::VectorXf::LinSpaced(N, spline.StartTime(), spline.EndTime());
+		double generic = TimeCall([&]() {
+			for (int k = 0; k < N; k++) {
+				float s = times(k) / dt;
+				int i = std::min(static_cast<int>(s), static_cast<int>(controls.size()) - 4);
+				float u = s - i;
+				float B[3] = { (5 + 3 * u - 3 * u * u + u * u * u) / 6, (1 + 3 * u + 3 * u * u - 2 * u * u * u) / 6, u * u * u / 6 };
+				Eigen::MatrixXf T = controls[i];
+				for (int j = 1; j <= 3; j++)
+					T = T * mr::MatrixExp6(B[j - 1] * mr::MatrixLog6(mr::TransInv(controls[i + j - 1]) * controls[i + j]));
+				sink = T(0, 3);
+			}
+		}, 3);
+		double single = TimeCall([&]() {
+			for (int k = 0; k < N; k++)
+				sink = spline.Evaluate(times(k))(0, 3);
+		}, 3);
+		mr::CartesianSamples samples;
+		double batch = TimeCall([&]() {
+			spline.Evaluate(times, samples, true);
+			sink = samples.positions(N / 2, 0);
+		}, 3);
+		std::printf("\nSE3Spline, ns per sample %24s %12s %10s\n", "generic", "spline", "speedup");
+		Report("Evaluate", generic / N, single / N);
+		Report("arrays with velocities", generic / N, batch / N);
+	}
+
+	/* Call-heavy user code: the primitives through function pointers, the way calls into the library are bound, against inline */
+	void BenchInlinePrimitives() {
+		const int N = 100000;
+		std::srand(3);
+		std::vector<Eigen::Vector3f> omgs(N);
+		for (int k = 0; k < N; k++)
+			omgs[k] = Eigen::Vector3f::Random();
+		Eigen::MatrixXf T = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(0.1f, 0.2f, 0.3f))), Eigen::Vector3f(1, 2, 3));
+		bool (*volatile nearZero)(const float) = mr::NearZero;
+		Eigen::Matrix3f (*volatile vecToso3)(const Eigen::Vector3f&) = mr::VecToso3;
+		Eigen::Vector3f (*volatile so3ToVec)(const Eigen::MatrixXf&) = mr::so3ToVec;
+		Eigen::MatrixXf (*volatile transInv)(const Eigen::MatrixXf&) = mr::TransInv;
+		Eigen::VectorXf (*volatile se3ToVec)(const Eigen::MatrixXf&) = mr::se3ToVec;
+		double called = TimeCall([&]() {
+			float acc = 0;
+			for (int k = 0; k < N; k++)
+				if (!nearZero(omgs[k](0)))
+					acc += so3ToVec(vecToso3(omgs[k]))(1);
+			sink = acc;
+		}, 20);
+		double inlined = TimeCall([&]() {
+			float acc = 0;
+			for (int k = 0; k < N; k++)
+				if (!mr::NearZero(omgs[k](0)))
+					acc += mr::so3ToVec(mr::VecToso3(omgs[k]))(1);
+			sink = acc;
+		}, 20);
+		double calledInv = TimeCall([&]() {
+			float acc = 0;
+			for (int k = 0; k < N; k++)
+				acc += se3ToVec(transInv(T))(k % 6);
+			sink = acc;
+		}, 5);
+		double inlinedInv = TimeCall([&]() {
+			float acc = 0;
+			for (int k = 0; k < N; k++)
+				acc += mr::se3ToVec(mr::TransInv(T))(k % 6);
+			sink = acc;
+		}, 5);
+		std::printf("\nPrimitives, ns per iteration %20s %12s %10s\n", "called", "inline", "speedup");
+		Report("NearZero, VecToso3, so3ToVec", called / N, inlined / N);
+		Report("TransInv, se3ToVec", calledInv / N, inlinedInv / N);
+	}
+
+	/* The array kernels in every variant this processor runs against the baseline build */
+	void BenchSimdVariants() {
+		const int N = 100000;
+		std::srand(12);
+		Eigen::MatrixXf expc3 = 2 * Eigen::MatrixXf::Random(3, N);
+		Eigen::MatrixXf R(3, 3 * N);
+		std::vector<float> poses(16 * N);
+		for (int i = 0; i < N; i++) {
+			Eigen::Map<Eigen::Matrix4f> T(&poses[16 * i]);
+			T = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(expc3.col(i))), Eigen::Vector3f::Random());
+		}
+		std::vector<float> distances(N);
+		Eigen::MatrixXf Xstart = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(0.3f, -0.2f, 0.5f))),
+			Eigen::Vector3f(1, 0, 1));
+		Eigen::MatrixXf Xend = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(-1.2f, 0.8f, 1.9f))),
+			Eigen::Vector3f(0.1f, 0.4f, 2));
+		mr::CartesianSamples samples;
+
+		std::vector<std::string> variants = mr::SupportedSimdVariants();
+		std::vector<double> exp3, distance, cartesian;
+		for (std::size_t v = 0; v < variants.size(); v++) {
+			mr::SetSimdVariant(variants[v]);
+			exp3.push_back(TimeCall([&]() {
+				mr::MatrixExp3Batch(expc3.data(), N, R.data());
+				sink = R(0, N);
+			}, 20));
+			distance.push_back(TimeCall([&]() {
+				mr::DistanceToSE3Batch(poses.data(), N, distances.data(), 0);
+				sink = distances[N / 2];
+			}, 20));
+			cartesian.push_back(TimeCall([&]() {
+				mr::CartesianTrajectory(Xstart, Xend, 10, N, 5, samples, true);
+				sink = samples.quaternions(N / 2, 0);
+			}, 20));
+		}
+		mr::SetSimdVariant(variants.front());
+		std::printf("\nArray kernels, ns per element %18s %12s %10s\n", "baseline", "variant", "speedup");
+		for (std::size_t v = 0; v < variants.size(); v++) {
+			Report(("MatrixExp3Batch, " + variants[v]).c_str(), exp3.back() / N, exp3[v] / N);
+			Report(("DistanceToSE3Batch, " + variants[v]).c_str(), distance.back() / N, distance[v] / N);
+			Report(("CartesianTrajectory, " + variants[v]).c_str(), cartesian.back() / N, cartesian[v] / N);
+		}
+	}
+
+	/* ForwardDynamicsTrajectory in float, in mixed precision and in the double reference, 1 s of motion */
+	void BenchMixedPrecision() {
+		std::vector<Eigen::MatrixXf> Mlist, Glist;
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		int n = Slist.cols();
+		Eigen::VectorXf G(6);
+		G << 0.05f, 0.05f, 0.05f, 2, 2, 2;
+		for (int i = 0; i < n; i++) {
+			Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+			Glist.push_back(G.asDiagonal());
+		}
+		Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+		std::vector<Eigen::MatrixXd> Mlistd, Glistd;
+		for (std::size_t i = 0; i < Mlist.size(); i++)
+			Mlistd.push_back(Mlist[i].cast<double>());
+		for (std::size_t i = 0; i < Glist.size(); i++)
+			Glistd.push_back(Glist[i].cast<double>());
+		Eigen::MatrixXd Slistd = Slist.cast<double>();
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::VectorXf thetalist = Eigen::VectorXf::LinSpaced(n, 0.1f, 0.6f), dthetalist = Eigen::VectorXf::Zero(n);
+		Eigen::VectorXf gravity = mr::GravityForces(thetalist, g, Mlist, Glist, Slist);
+
+		std::printf("\nForwardDynamicsTrajectory, 1 s %9s %12s %12s %12s %12s\n", "float ms", "mixed ms", "double ms",
+			"float err", "mixed err");
+		for (int N = 1000; N <= 100000; N *= 10) {
+			float dt = 1.0f / N;
+			Eigen::MatrixXf taumat(N, n);
+			for (int k = 0; k < N; k++)
+				taumat.row(k) = (1 + 0.1f * std::sin(3.0f * k * dt)) * gravity.transpose();
+			Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+			mr::Workspace ws(n);
+			std::vector<Eigen::MatrixXf> single, mixed;
+			std::vector<Eigen::MatrixXd> reference;
+			double singleTime = TimeCall([&]() {
+				single = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat, Mlist, Glist, Slist, dt, 1, ws);
+			}, 1);
+			double mixedTime = TimeCall([&]() {
+				mixed = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat, Mlist, Glist, Slist, dt, 1, ws,
+					mr::StatePrecision::Mixed);
+			}, 1);
+			double referenceTime = TimeCall([&]() {
+				reference = mr_reference::ForwardDynamicsTrajectory(thetalist.cast<double>(), dthetalist.cast<double>(),
+					taumat.cast<double>(), Eigen::VectorXd(g.cast<double>()), Ftipmat.cast<double>(), Mlistd, Glistd, Slistd, dt, 1);
+			}, 1);
+			std::printf("%-6d steps %22.1f %12.1f %12.1f %12.2e %12.2e\n", N, singleTime * 1e-6, mixedTime * 1e-6,
+				referenceTime * 1e-6, (single[0].cast<double>() - reference[0]).cwiseAbs().maxCoeff(),
+				(mixed[0].cast<double>() - reference[0]).cwiseAbs().maxCoeff());
+		}
+	}
+
+	/* Serial against Parareal ForwardDynamicsTrajectory, one slice per thread
+	 * up to the cores of the machine and more slices than threads beyond */
+	void BenchParareal() {
+		std::vector<Eigen::MatrixXf> Mlist, Glist;
+		Eigen::MatrixXf Slist, M;
+		PumaArm(Slist, M);
+		int n = Slist.cols();
+		Eigen::VectorXf G(6);
+		G << 0.05f, 0.05f, 0.05f, 2, 2, 2;
+		for (int i = 0; i < n; i++) {
+			Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+			Glist.push_back(G.asDiagonal());
+		}
+		Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 0.1f)));
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::VectorXf thetalist = Eigen::VectorXf::LinSpaced(n, 0.1f, 0.6f), dthetalist = Eigen::VectorXf::Zero(n);
+		Eigen::VectorXf gravity = mr::GravityForces(thetalist, g, Mlist, Glist, Slist);
+		// 2 s of torques every 0.4 ms, integrated in steps of 0.1 ms, coarse steps of 2 ms
+		const int N = 5000, intRes = 4, coarseStep = 5;
+		const float dt = 4e-4f, tolerance = 1e-3f;
+		Eigen::MatrixXf taumat(N, n);
+		for (int k = 0; k < N; k++)
+			taumat.row(k) = (1 + 0.1f * std::sin(3.0f * k * dt)) * gravity.transpose();
+		Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+		std::vector<Eigen::MatrixXf> serial;
+		double serialTime = TimeCall([&]() {
+			serial = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat, Mlist, Glist, Slist, dt, intRes);
+		}, 1);
+
+		int cores = std::max(1u, std::thread::hardware_concurrency());
+		std::printf("\nParareal, %d steps, %d cores %5s %10s %12s %10s %12s\n", N, cores, "slices", "iterations", "ms",
+			"speedup", "max err");
+		std::printf("%-28s %5s %10s %12.1f %9.1fx\n", "serial", "", "", serialTime * 1e-6, 1.0);
+		for (int slices = 2; slices <= 64; slices *= 2) {
+			int threads = std::min(slices, cores);
+			mr::ThreadPool pool(threads);
+			std::vector<Eigen::MatrixXf> parallel;
+			int iterations = 0;
+			double time = TimeCall([&]() {
+				parallel = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat, Mlist, Glist, Slist, dt, intRes,
+					pool, tolerance, slices, coarseStep, &iterations);
+			}, 1);
+			char name[32];
+			std::snprintf(name, sizeof(name), "%d threads", threads);
+			std::printf("%-28s %5d %10d %12.1f %9.1fx %12.2e\n", name, slices, iterations, time * 1e-6, serialTime / time,
+				(parallel[0] - serial[0]).cwiseAbs().maxCoeff());
+		}
+	}
+
+}
+
+int main() {
+	BenchCodegen();
+	BenchParallelFKin();
+	BenchProjectToSO3();
+	BenchDistanceToSE3();
+	BenchDualQuaternion();
+	BenchAnalyticIK();
+	BenchJointPlanner();
+	BenchIKSeedCache();
+	BenchReachabilityMap();
+	BenchIKinBounded();
+	BenchResolvedRate();
+	BenchMPPI();
+	BenchILQR();
+	BenchCartesianPipeline();
+	BenchCartesianSamples();
+	BenchSE3Spline();
+	BenchInlinePrimitives();
+	BenchSimdVariants();
+	BenchMixedPrecision();
+	BenchParareal();
+	return 0;
+}
@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include "../include/modern_robotics.h"
+#include "reference.h"
+
+/*
+ * lib_diff.cpp
+ * Differential accuracy and performance harness: every public function of the
+ * float library against the double-precision implementation in backup/, on
+ * randomized robots and configurations, with the fast paths (KinematicState,
+ * Workspace, thread pool, dual quaternions, SIMD kernel variants, mixed
+ * precision) as rows of their own.
+ *
+ * Usage: lib_diff [dof] [robots] [configurations per robot] [seed] [tolerance]
+ *
+ * For every function it prints the largest absolute error, the median, 99th
+ * percentile and largest error relative to the reference, |f - d| / |d| in the
+ * max norm, and the time per call of both. Rows whose 99th percentile relative
+ * error exceeds the tolerance (1e-3 by default) are marked with a *.
+ */
+
+namespace {
+
+	/* Results flattened to one vector of doubles, so that the float and double
+	 * results of any function can be compared element by element */
+	void Append(std::vector<double>& out, double x) { out.push_back(x); }
+	void Append(std::vector<double>& out, bool x) { out.push_back(x ? 1 : 0); }
+
+	template <class Derived>
+	void Append(std::vector<double>& out, const Eigen::MatrixBase<Derived>& m) {
+		for (int j = 0; j < m.cols(); j++)
+			for (int i = 0; i < m.rows(); i++)
+				out.push_back(static_cast<double>(m(i, j)));
+	}
+
+	template <class T, class A>
+	void Append(std::vector<double>& out, const std::vector<T, A>& v) {
+		for (std::size_t i = 0; i < v.size(); i++)
+			Append(out, v[i]);
+	}
+
+	/* The errors and times gathered for one row of the report */
+	struct Stats {
+		std::string name;
+		std::vector<double> abs;
+		std::vector<double> rel;
+		double floatNs;
+		double doubleNs;
+		long items;
+	};
+
+	std::vector<Stats> rows;
+
+	Stats& Row(const std::string& name) {
+		for (std::size_t i = 0; i < rows.size(); i++)
+			if (rows[i].name == name) return rows[i];
+		Stats s;
+		s.name = name;
+		s.floatNs = s.doubleNs = 0;
+		s.items = 0;
+		rows.push_back(s);
+		return rows.back();
+	}
+
+	/* Calls f(i) and d(i) for i = 0 ... calls-1, each call covering items
+	 * evaluations, and adds their times and differences to the named row */
+	template <class F, class D>
+	void CompareItems(const std::string& name, int calls, int items, F f, D d) {
+		typedef decltype(f(0)) FloatResult;
+		typedef decltype(d(0)) DoubleResult;
+		std::vector<FloatResult, Eigen::aligned_allocator<FloatResult> > fr;
+		std::vector<DoubleResult, Eigen::aligned_allocator<DoubleResult> > dr;
+		fr.reserve(calls);
+		dr.reserve(calls);
+		// Once untimed, for the caches and any lazily built tables
+		f(0);
+		d(0);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < calls; i++) fr.push_back(f(i));
+		std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+		for (int i = 0; i < calls; i++) dr.push_back(d(i));
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		Stats& row = Row(name);
+		row.floatNs += std::chrono::duration<double, std::nano>(middle - start).count();
+		row.doubleNs += std::chrono::duration<double, std::nano>(end - middle).count();
+		row.items += static_cast<long>(calls) * items;
+		std::vector<double> a, b;
+		for (int i = 0; i < calls; i++) {
+			a.clear();
+			b.clear();
+			Append(a, fr[i]);
+			Append(b, dr[i]);
+			if (a.size() != b.size()) {
+				// A result of the wrong shape counts as an infinite error
+				row.abs.push_back(HUGE_VAL);
+				row.rel.push_back(HUGE_VAL);
+				continue;
+			}
+			double err = 0, scale = 0;
+			for (std::size_t k = 0; k < a.size(); k++) {
+				err = std::max(err, std::fabs(a[k] - b[k]));
+				scale = std::max(scale, std::fabs(b[k]));
+			}
+			if (std::isnan(err)) err = HUGE_VAL;
+			row.abs.push_back(err);
+			row.rel.push_back(scale > 0 ? err / scale : err);
+		}
+	}
+
+	template <class F, class D>
+	void Compare(const std::string& name, int calls, F f, D d) {
+		CompareItems(name, calls, 1, f, d);
+	}
+
+	double Percentile(std::vector<double> v, double p) {
+		if (v.empty()) return 0;
+		std::sort(v.begin(), v.end());
+		return v[static_cast<std::size_t>(p * (v.size() - 1) + 0.5)];
+	}
+
+	/* A robot and the same robot in double precision */
+	struct Robot {
+		Eigen::MatrixXf Slist;
+		std::vector<Eigen::MatrixXf> Mlist, Glist;
+		Eigen::MatrixXf M;
+		Eigen::MatrixXd SlistD;
+		std::vector<Eigen::MatrixXd> MlistD, GlistD;
+		Eigen::MatrixXd MD;
+	};
+
+	/* A random serial chain of n joints: link frames rotated at random and
+	 * displaced up to 0.3 m from the previous one, each joint about or along a
+	 * random axis through the origin of its link frame, one in six prismatic,
+	 * and links of 0.5 to 3 kg with principal inertias of 0.01 to 0.1 kg m^2 */
+	Robot RandomRobot(int n, std::mt19937& rng) {
+		std::uniform_real_distribution<float> unit(-1, 1);
+		std::uniform_real_distribution<float> mass(0.5f, 3);
+		std::uniform_real_distribution<float> inertia(0.01f, 0.1f);
+		std::uniform_int_distribution<int> kind(0, 5);
+		Robot r;
+		r.Slist.resize(6, n);
+		Eigen::Matrix4f M0i = Eigen::Matrix4f::Identity();
+		for (int i = 0; i <= n; i++) {
+			Eigen::Vector3f omg(unit(rng), unit(rng), unit(rng));
+			Eigen::Vector3f p(unit(rng), unit(rng), unit(rng));
+			Eigen::MatrixXf Mi = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(omg)), 0.3f * p);
+			r.Mlist.push_back(Mi);
+			M0i = M0i * Mi;
+			if (i == n) break;
+			Eigen::Vector3f axis = Eigen::Vector3f(unit(rng), unit(rng), unit(rng)).normalized();
+			Eigen::VectorXf A = Eigen::VectorXf::Zero(6);
+			if (kind(rng) == 0) A.tail(3) = axis;
+			else A.head(3) = axis;
+			r.Slist.col(i) = mr::Adjoint(M0i) * A;
+			Eigen::VectorXf g(6);
+			float m = mass(rng);
+			g << inertia(rng), inertia(rng), inertia(rng), m, m, m;
+			r.Glist.push_back(Eigen::MatrixXf(g.asDiagonal()));
+		}
+		r.M = M0i;
+		r.SlistD = r.Slist.cast<double>();
+		r.MD = r.M.cast<double>();
+		for (std::size_t i = 0; i < r.Mlist.size(); i++) r.MlistD.push_back(r.Mlist[i].cast<double>());
+		for (std::size_t i = 0; i < r.Glist.size(); i++) r.GlistD.push_back(r.Glist[i].cast<double>());
+		return r;
+	}
+
+	/* The inputs of one call, in float and double */
+	struct Sample {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Eigen::VectorXf theta, dtheta, ddtheta, tau, Ftip, guess, V;
+		Eigen::Vector3f omg, p;
+		Eigen::Matrix3f R, Rnoisy;
+		Eigen::Matrix4f T, Tnoisy;
+		float t;
+		Eigen::VectorXd thetaD, dthetaD, ddthetaD, tauD, FtipD, guessD, VD;
+		Eigen::Vector3d omgD, pD;
+		Eigen::Matrix3d RD, RnoisyD;
+		Eigen::Matrix4d TD, TnoisyD;
+		double tD;
+	};
+
+	typedef std::vector<Sample, Eigen::aligned_allocator<Sample> > Samples;
+
+	Sample RandomSample(const Robot& r, std::mt19937& rng) {
+		int n = r.Slist.cols();
+		std::uniform_real_distribution<float> unit(-1, 1);
+		std::uniform_real_distribution<float> fraction(0, 1);
+		Eigen::VectorXf u(5 * n + 18);
+		for (int i = 0; i < u.size(); i++) u(i) = unit(rng);
+		Sample s;
+		s.theta = 3.1f * u.segment(0, n);
+		s.dtheta = u.segment(n, n);
+		s.ddtheta = u.segment(2 * n, n);
+		s.tau = 5 * u.segment(3 * n, n);
+		s.guess = s.theta + 0.05f * u.segment(4 * n, n);
+		s.Ftip = u.segment(5 * n, 6);
+		s.V = 2 * u.segment(5 * n + 6, 6);
+		s.omg = 2 * u.segment<3>(5 * n + 12);
+		s.p = u.segment<3>(5 * n + 15);
+		s.R = mr::MatrixExp3(mr::VecToso3(s.omg));
+		s.T = mr::FKinSpace(r.M, r.Slist, s.theta);
+		// Off the manifold by up to 1e-2, either side of the TestIfSO3 threshold
+		float noise = std::pow(10.0f, -2 - 3 * fraction(rng));
+		s.Rnoisy = s.R + noise * Eigen::Matrix3f::Random();
+		s.Tnoisy = s.T;
+		s.Tnoisy.topRows<3>() += noise * Eigen::Matrix<float, 3, 4>::Random();
+		s.t = fraction(rng);
+		s.thetaD = s.theta.cast<double>();
+		s.dthetaD = s.dtheta.cast<double>();
+		s.ddthetaD = s.ddtheta.cast<double>();
+		s.tauD = s.tau.cast<double>();
+		s.FtipD = s.Ftip.cast<double>();
+		s.guessD = s.guess.cast<double>();
+		s.VD = s.V.cast<double>();
+		s.omgD = s.omg.cast<double>();
+		s.pD = s.p.cast<double>();
+		s.RD = s.R.cast<double>();
+		s.RnoisyD = s.Rnoisy.cast<double>();
+		s.TD = s.T.cast<double>();
+		s.TnoisyD = s.Tnoisy.cast<double>();
+		s.tD = s.t;
+		return s;
+	}
+
+	/* IK results as the joint vector followed by 1 for success, 0 for failure */
+	Eigen::VectorXf WithFlag(const Eigen::VectorXf& theta, bool ok) {
+		Eigen::VectorXf v(theta.size() + 1);
+		v << theta, ok ? 1.0f : 0.0f;
+		return v;
+	}
+
+	Eigen::VectorXd WithFlag(const Eigen::VectorXd& theta, bool ok) {
+		Eigen::VectorXd v(theta.size() + 1);
+		v << theta, ok ? 1.0 : 0.0;
+		return v;
+	}
+
+	/* The functions of the Modern Robotics library taking single poses, twists
+	 * and configurations */
+	void ComparePrimitives(const Robot& r, const Samples& S) {
+		int c = S.size();
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::Vector3d gD(0, 0, -9.8);
+		Compare("ad", c,
+			[&](int i) { return mr::ad(S[i].V); },
+			[&](int i) { return mr_reference::ad(S[i].VD); });
+		Compare("Normalize", c,
+			[&](int i) { return mr::Normalize(S[i].V); },
+			[&](int i) { return mr_reference::Normalize(S[i].VD); });
+		Compare("VecToso3", c,
+			[&](int i) { return mr::VecToso3(S[i].omg); },
+			[&](int i) { return mr_reference::VecToso3(S[i].omgD); });
+		Compare("so3ToVec", c,
+			[&](int i) { return mr::so3ToVec(mr::VecToso3(S[i].omg)); },
+			[&](int i) { return mr_reference::so3ToVec(mr_reference::VecToso3(S[i].omgD)); });
+		Compare("AxisAng3", c,
+			[&](int i) { return mr::AxisAng3(S[i].omg); },
+			[&](int i) { return mr_reference::AxisAng3(S[i].omgD); });
+		Compare("MatrixExp3", c,
+			[&](int i) { return mr::MatrixExp3(mr::VecToso3(S[i].omg)); },
+			[&](int i) { return mr_reference::MatrixExp3(mr_reference::VecToso3(S[i].omgD)); });
+		Compare("MatrixLog3", c,
+			[&](int i) { return mr::MatrixLog3(S[i].R); },
+			[&](int i) { return mr_reference::MatrixLog3(S[i].RD); });
+		Compare("RpToTrans", c,
+			[&](int i) { return mr::RpToTrans(S[i].R, S[i].p); },
+			[&](int i) { return mr_reference::RpToTrans(S[i].RD, S[i].pD); });
+		Compare("TransToRp", c,
+			[&](int i) { return mr::TransToRp(S[i].T); },
+			[&](int i) { return mr_reference::TransToRp(S[i].TD); });
+		Compare("VecTose3", c,
+			[&](int i) { return mr::VecTose3(S[i].V); },
+			[&](int i) { return mr_reference::VecTose3(S[i].VD); });
+		Compare("se3ToVec", c,
+			[&](int i) { return mr::se3ToVec(mr::VecTose3(S[i].V)); },
+			[&](int i) { return mr_reference::se3ToVec(mr_reference::VecTose3(S[i].VD)); });
+		Compare("Adjoint", c,
+			[&](int i) { return mr::Adjoint(S[i].T); },
+			[&](int i) { return mr_reference::Adjoint(S[i].TD); });
+		Compare("MatrixExp6", c,
+			[&](int i) { return mr::MatrixExp6(mr::VecTose3(S[i].V)); },
+			[&](int i) { return mr_reference::MatrixExp6(mr_reference::VecTose3(S[i].VD)); });
+		Compare("MatrixLog6", c,
+			[&](int i) { return mr::MatrixLog6(S[i].T); },
+			[&](int i) { return mr_reference::MatrixLog6(S[i].TD); });
+		Compare("TransInv", c,
+			[&](int i) { return mr::TransInv(S[i].T); },
+			[&](int i) { return mr_reference::TransInv(S[i].TD); });
+		Compare("RotInv", c,
+			[&](int i) { return mr::RotInv(S[i].R); },
+			[&](int i) { return mr_reference::RotInv(S[i].RD); });
+		Compare("ScrewToAxis", c,
+			[&](int i) { return mr::ScrewToAxis(S[i].p, S[i].omg.normalized(), S[i].t); },
+			[&](int i) { return mr_reference::ScrewToAxis(S[i].pD, S[i].omgD.normalized(), S[i].tD); });
+		Compare("AxisAng6", c,
+			[&](int i) { return mr::AxisAng6(S[i].V); },
+			[&](int i) { return mr_reference::AxisAng6(S[i].VD); });
+		Compare("ProjectToSO3", c,
+			[&](int i) { return mr::ProjectToSO3(S[i].Rnoisy); },
+			[&](int i) { return mr_reference::ProjectToSO3(S[i].RnoisyD); });
+		Compare("ProjectToSE3", c,
+			[&](int i) { return mr::ProjectToSE3(S[i].Tnoisy); },
+			[&](int i) { return mr_reference::ProjectToSE3(S[i].TnoisyD); });
+		Compare("DistanceToSO3", c,
+			[&](int i) { return static_cast<double>(mr::DistanceToSO3(S[i].Rnoisy)); },
+			[&](int i) { return mr_reference::DistanceToSO3(S[i].RnoisyD); });
+		Compare("DistanceToSE3", c,
+			[&](int i) { return static_cast<double>(mr::DistanceToSE3(S[i].Tnoisy)); },
+			[&](int i) { return mr_reference::DistanceToSE3(S[i].TnoisyD); });
+		Compare("TestIfSO3", c,
+			[&](int i) { return mr::TestIfSO3(S[i].Rnoisy); },
+			[&](int i) { return mr_reference::TestIfSO3(S[i].RnoisyD); });
+		Compare("TestIfSE3", c,
+			[&](int i) { return mr::TestIfSE3(S[i].Tnoisy); },
+			[&](int i) { return mr_reference::TestIfSE3(S[i].TnoisyD); });
+		Compare("CubicTimeScaling", c,
+			[&](int i) { return static_cast<double>(mr::CubicTimeScaling(2, 2 * S[i].t)); },
+			[&](int i) { return mr_reference::CubicTimeScaling(2, 2 * S[i].tD); });
+		Compare("QuinticTimeScaling", c,
+			[&](int i) { return static_cast<double>(mr::QuinticTimeScaling(2, 2 * S[i].t)); },
+			[&](int i) { return mr_reference::QuinticTimeScaling(2, 2 * S[i].tD); });
+
+		Compare("FKinSpace", c,
+			[&](int i) { return mr::FKinSpace(r.M, r.Slist, S[i].theta); },
+			[&](int i) { return mr_reference::FKinSpace(r.MD, r.SlistD, S[i].thetaD); });
+		Eigen::MatrixXf Blist = mr::Adjoint(mr::TransInv(r.M)) * r.Slist;
+		Eigen::MatrixXd BlistD = mr_reference::Adjoint(mr_reference::TransInv(r.MD)) * r.SlistD;
+		Compare("FKinBody", c,
+			[&](int i) { return mr::FKinBody(r.M, Blist, S[i].theta); },
+			[&](int i) { return mr_reference::FKinBody(r.MD, BlistD, S[i].thetaD); });
+		Compare("JacobianSpace", c,
+			[&](int i) { return mr::JacobianSpace(r.Slist, S[i].theta); },
+			[&](int i) { return mr_reference::JacobianSpace(r.SlistD, S[i].thetaD); });
+		Compare("JacobianBody", c,
+			[&](int i) { return mr::JacobianBody(Blist, S[i].theta); },
+			[&](int i) { return mr_reference::JacobianBody(BlistD, S[i].thetaD); });
+		// From 0.05 rad off the configuration that reaches the target
+		Compare("IKinSpace", c,
+			[&](int i) { Eigen::VectorXf q = S[i].guess; bool ok = mr::IKinSpace(r.Slist, r.M, S[i].T, q, 1e-3f, 1e-3f); return WithFlag(q, ok); },
+			[&](int i) { Eigen::VectorXd q = S[i].guessD; bool ok = mr_reference::IKinSpace(r.SlistD, r.MD, S[i].TD, q, 1e-3, 1e-3); return WithFlag(q, ok); });
+		Compare("IKinBody", c,
+			[&](int i) { Eigen::VectorXf q = S[i].guess; bool ok = mr::IKinBody(Blist, r.M, S[i].T, q, 1e-3f, 1e-3f); return WithFlag(q, ok); },
+			[&](int i) { Eigen::VectorXd q = S[i].guessD; bool ok = mr_reference::IKinBody(BlistD, r.MD, S[i].TD, q, 1e-3, 1e-3); return WithFlag(q, ok); });
+
+		Compare("InverseDynamics", c,
+			[&](int i) { return mr::InverseDynamics(S[i].theta, S[i].dtheta, S[i].ddtheta, g, S[i].Ftip, r.Mlist, r.Glist, r.Slist); },
+			[&](int i) { return mr_reference::InverseDynamics(S[i].thetaD, S[i].dthetaD, S[i].ddthetaD, gD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("GravityForces", c,
+			[&](int i) { return mr::GravityForces(S[i].theta, g, r.Mlist, r.Glist, r.Slist); },
+			[&](int i) { return mr_reference::GravityForces(S[i].thetaD, gD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("MassMatrix", c,
+			[&](int i) { return mr::MassMatrix(S[i].theta, r.Mlist, r.Glist, r.Slist); },
+			[&](int i) { return mr_reference::MassMatrix(S[i].thetaD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("VelQuadraticForces", c,
+			[&](int i) { return mr::VelQuadraticForces(S[i].theta, S[i].dtheta, r.Mlist, r.Glist, r.Slist); },
+			[&](int i) { return mr_reference::VelQuadraticForces(S[i].thetaD, S[i].dthetaD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("EndEffectorForces", c,
+			[&](int i) { return mr::EndEffectorForces(S[i].theta, S[i].Ftip, r.Mlist, r.Glist, r.Slist); },
+			[&](int i) { return mr_reference::EndEffectorForces(S[i].thetaD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("ForwardDynamics", c,
+			[&](int i) { return mr::ForwardDynamics(S[i].theta, S[i].dtheta, S[i].tau, g, S[i].Ftip, r.Mlist, r.Glist, r.Slist); },
+			[&](int i) { return mr_reference::ForwardDynamics(S[i].thetaD, S[i].dthetaD, S[i].tauD, gD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("EulerStep", c,
+			[&](int i) { Eigen::VectorXf q = S[i].theta, dq = S[i].dtheta; mr::EulerStep(q, dq, S[i].ddtheta, 0.01f); return std::vector<Eigen::VectorXf>{ q, dq }; },
+			[&](int i) { Eigen::VectorXd q = S[i].thetaD, dq = S[i].dthetaD; mr_reference::EulerStep(q, dq, S[i].ddthetaD, 0.01); return std::vector<Eigen::VectorXd>{ q, dq }; });
+		// Tracking the next sample, with the error integral standing in for the torques
+		Compare("ComputedTorque", c,
+			[&](int i) { const Sample& d = S[(i + 1) % S.size()];
+				return mr::ComputedTorque(S[i].theta, S[i].dtheta, S[i].tau, g, r.Mlist, r.Glist, r.Slist, d.theta, d.dtheta, d.ddtheta, 20, 10, 18); },
+			[&](int i) { const Sample& d = S[(i + 1) % S.size()];
+				return mr_reference::ComputedTorque(S[i].thetaD, S[i].dthetaD, S[i].tauD, gD, r.MlistD, r.GlistD, r.SlistD, d.thetaD, d.dthetaD, d.ddthetaD, 20, 10, 18); });
+	}
+
+	/* The trajectory generators and simulators, once per robot between the
+	 * first two configurations */
+	void CompareTrajectories(const Robot& r, const Samples& S) {
+		const int N = 100;
+		const Sample& a = S[0];
+		const Sample& b = S[1 % S.size()];
+		int n = r.Slist.cols();
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::Vector3d gD(0, 0, -9.8);
+		Eigen::MatrixXf thetamat = mr::JointTrajectory(a.theta, b.theta, 1, N, 5);
+		Eigen::MatrixXd thetamatD = thetamat.cast<double>();
+		Eigen::MatrixXf dthetamat = Eigen::MatrixXf::Zero(N, n), ddthetamat = Eigen::MatrixXf::Zero(N, n);
+		for (int i = 1; i + 1 < N; i++) {
+			dthetamat.row(i) = (thetamat.row(i + 1) - thetamat.row(i - 1)) * (N - 1) / 2.0f;
+			ddthetamat.row(i) = (thetamat.row(i + 1) - 2 * thetamat.row(i) + thetamat.row(i - 1)) * float((N - 1) * (N - 1));
+		}
+		Eigen::MatrixXd dthetamatD = dthetamat.cast<double>(), ddthetamatD = ddthetamat.cast<double>();
+		Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+		Eigen::MatrixXd FtipmatD = Eigen::MatrixXd::Zero(N, 6);
+		Eigen::MatrixXf taumat = Eigen::MatrixXf::Zero(N, n);
+		for (int i = 0; i < N; i++) taumat.row(i) = (a.tau + (b.tau - a.tau) * (i / float(N))).transpose();
+		Eigen::MatrixXd taumatD = taumat.cast<double>();
+
+		Compare("JointTrajectory", 1,
+			[&](int) { return mr::JointTrajectory(a.theta, b.theta, 1, N, 5); },
+			[&](int) { return mr_reference::JointTrajectory(a.thetaD, b.thetaD, 1, N, 5); });
+		Compare("ScrewTrajectory", 1,
+			[&](int) { return mr::ScrewTrajectory(a.T, b.T, 1, N, 3); },
+			[&](int) { return mr_reference::ScrewTrajectory(a.TD, b.TD, 1, N, 3); });
+		Compare("CartesianTrajectory", 1,
+			[&](int) { return mr::CartesianTrajectory(a.T, b.T, 1, N, 5); },
+			[&](int) { return mr_reference::CartesianTrajectory(a.TD, b.TD, 1, N, 5); });
+		Compare("InverseDynamicsTrajectory", 1,
+			[&](int) { return mr::InverseDynamicsTrajectory(thetamat, dthetamat, ddthetamat, g, Ftipmat, r.Mlist, r.Glist, r.Slist); },
+			[&](int) { return mr_reference::InverseDynamicsTrajectory(thetamatD, dthetamatD, ddthetamatD, gD, FtipmatD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("ForwardDynamicsTrajectory", 1,
+			[&](int) { return mr::ForwardDynamicsTrajectory(a.theta, a.dtheta, taumat, g, Ftipmat, r.Mlist, r.Glist, r.Slist, 0.01f, 4); },
+			[&](int) { return mr_reference::ForwardDynamicsTrajectory(a.thetaD, a.dthetaD, taumatD, gD, FtipmatD, r.MlistD, r.GlistD, r.SlistD, 0.01, 4); });
+		Compare("SimulateControl", 1,
+			[&](int) { return mr::SimulateControl(a.theta, a.dtheta, g, Ftipmat, r.Mlist, r.Glist, r.Slist,
+				thetamat, dthetamat, ddthetamat, g, r.Mlist, r.Glist, 20, 10, 18, 0.01f, 4); },
+			[&](int) { return mr_reference::SimulateControl(a.thetaD, a.dthetaD, gD, FtipmatD, r.MlistD, r.GlistD, r.SlistD,
+				thetamatD, dthetamatD, ddthetamatD, gD, r.MlistD, r.GlistD, 20, 10, 18, 0.01, 4); });
+
+		// Fast path: the same simulations with the state kept in double
+		Compare("ForwardDynamicsTrajectory mixed", 1,
+			[&](int) { return mr::ForwardDynamicsTrajectory(a.theta, a.dtheta, taumat, g, Ftipmat, r.Mlist, r.Glist, r.Slist, 0.01f, 4,
+				mr::StatePrecision::Mixed); },
+			[&](int) { return mr_reference::ForwardDynamicsTrajectory(a.thetaD, a.dthetaD, taumatD, gD, FtipmatD, r.MlistD, r.GlistD, r.SlistD, 0.01, 4); });
+		Compare("SimulateControl mixed", 1,
+			[&](int) { return mr::SimulateControl(a.theta, a.dtheta, g, Ftipmat, r.Mlist, r.Glist, r.Slist,
+				thetamat, dthetamat, ddthetamat, g, r.Mlist, r.Glist, 20, 10, 18, 0.01f, 4, mr::StatePrecision::Mixed); },
+			[&](int) { return mr_reference::SimulateControl(a.thetaD, a.dthetaD, gD, FtipmatD, r.MlistD, r.GlistD, r.SlistD,
+				thetamatD, dthetamatD, ddthetamatD, gD, r.MlistD, r.GlistD, 20, 10, 18, 0.01, 4); });
+	}
+
+	/* The faster entry points to the same functions, against the same reference */
+	void CompareFastPaths(const Robot& r, const Samples& S, mr::ThreadPool& pool) {
+		int c = S.size();
+		int n = r.Slist.cols();
+		Eigen::Vector3f g(0, 0, -9.8f);
+		Eigen::Vector3d gD(0, 0, -9.8);
+		mr::Workspace ws(n);
+		std::vector<mr::JointModel> joints = mr::ClassifyJoints(r.Slist);
+		mr::DualQuaternion MQ(Eigen::Matrix4f(r.M));
+
+		Compare("FKinSpace dual quaternion", c,
+			[&](int i) { return mr::FKinSpace(MQ, r.Slist, S[i].theta).Matrix(); },
+			[&](int i) { return mr_reference::FKinSpace(r.MD, r.SlistD, S[i].thetaD); });
+		Compare("FKinSpace thread pool", c,
+			[&](int i) { return mr::FKinSpace(r.M, r.Slist, S[i].theta, pool); },
+			[&](int i) { return mr_reference::FKinSpace(r.MD, r.SlistD, S[i].thetaD); });
+		Compare("JacobianSpace thread pool", c,
+			[&](int i) { return mr::JacobianSpace(r.Slist, S[i].theta, pool); },
+			[&](int i) { return mr_reference::JacobianSpace(r.SlistD, S[i].thetaD); });
+		Compare("FKinSpace KinematicState", c,
+			[&](int i) { return mr::FKinSpace(mr::KinematicState(r.Mlist, joints, S[i].theta)); },
+			[&](int i) { return mr_reference::FKinSpace(r.MD, r.SlistD, S[i].thetaD); });
+		Compare("JacobianSpace KinematicState", c,
+			[&](int i) { return mr::JacobianSpace(mr::KinematicState(r.Mlist, joints, S[i].theta)); },
+			[&](int i) { return mr_reference::JacobianSpace(r.SlistD, S[i].thetaD); });
+		Compare("InverseDynamics KinematicState", c,
+			[&](int i) { return mr::InverseDynamics(mr::KinematicState(r.Mlist, joints, S[i].theta), S[i].dtheta, S[i].ddtheta, g, S[i].Ftip, r.Glist, ws); },
+			[&](int i) { return mr_reference::InverseDynamics(S[i].thetaD, S[i].dthetaD, S[i].ddthetaD, gD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("ForwardDynamics KinematicState", c,
+			[&](int i) { return mr::ForwardDynamics(mr::KinematicState(r.Mlist, joints, S[i].theta), S[i].dtheta, S[i].tau, g, S[i].Ftip, r.Glist, ws); },
+			[&](int i) { return mr_reference::ForwardDynamics(S[i].thetaD, S[i].dthetaD, S[i].tauD, gD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("InverseDynamics Workspace", c,
+			[&](int i) { return mr::InverseDynamics(S[i].theta, S[i].dtheta, S[i].ddtheta, g, S[i].Ftip, r.Mlist, r.Glist, r.Slist, ws); },
+			[&](int i) { return mr_reference::InverseDynamics(S[i].thetaD, S[i].dthetaD, S[i].ddthetaD, gD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("MassMatrix Workspace", c,
+			[&](int i) { return mr::MassMatrix(S[i].theta, r.Mlist, r.Glist, r.Slist, ws); },
+			[&](int i) { return mr_reference::MassMatrix(S[i].thetaD, r.MlistD, r.GlistD, r.SlistD); });
+		Compare("ForwardDynamics Workspace", c,
+			[&](int i) { return mr::ForwardDynamics(S[i].theta, S[i].dtheta, S[i].tau, g, S[i].Ftip, r.Mlist, r.Glist, r.Slist, ws); },
+			[&](int i) { return mr_reference::ForwardDynamics(S[i].thetaD, S[i].dthetaD, S[i].tauD, gD, S[i].FtipD, r.MlistD, r.GlistD, r.SlistD); });
+
+		// The array kernels, every variant this processor runs, over all the
+		// configurations at once and timed per matrix
+		std::vector<float> expc(3 * c), rotations(9 * c), transforms(16 * c);
+		for (int i = 0; i < c; i++) {
+			Eigen::Vector3f::Map(&expc[3 * i]) = S[i].omg;
+			Eigen::Matrix4f::Map(&transforms[16 * i]) = S[i].Tnoisy;
+		}
+		std::vector<float> distances(c);
+		std::string active = mr::SimdVariant();
+		std::vector<std::string> variants = mr::SupportedSimdVariants();
+		for (std::size_t v = 0; v < variants.size(); v++) {
+			mr::SetSimdVariant(variants[v]);
+			CompareItems("MatrixExp3Batch " + variants[v], 1, c,
+				[&](int) { mr::MatrixExp3Batch(expc.data(), c, rotations.data()); return Eigen::Map<Eigen::MatrixXf>(rotations.data(), 9, c).eval(); },
+				[&](int) { Eigen::MatrixXd R(9, c);
+					for (int i = 0; i < c; i++) R.col(i) = Eigen::Map<Eigen::VectorXd>(mr_reference::MatrixExp3(mr_reference::VecToso3(S[i].omgD)).data(), 9);
+					return R; });
+			CompareItems("DistanceToSE3Batch " + variants[v], 1, c,
+				[&](int) { mr::DistanceToSE3Batch(transforms.data(), c, distances.data(), 0); return Eigen::Map<Eigen::VectorXf>(distances.data(), c).eval(); },
+				[&](int) { Eigen::VectorXd d(c);
+					for (int i = 0; i < c; i++) d(i) = mr_reference::DistanceToSE3(S[i].TnoisyD);
+					return d; });
+			CompareItems("JointTrajectory " + variants[v], 1, 1000,
+				[&](int) { return mr::JointTrajectory(S[0].theta, S[1 % c].theta, 1, 1000, 3); },
+				[&](int) { return mr_reference::JointTrajectory(S[0].thetaD, S[1 % c].thetaD, 1, 1000, 3); });
+		}
+		mr::SetSimdVariant(active);
+	}
+
+	void Report(double tolerance) {
+		std::printf("%-32s %8s %10s %10s %10s %10s %11s %11s\n", "function", "calls", "max abs", "rel med",
+			"rel p99", "rel max", "float ns", "double ns");
+		int flagged = 0;
+		for (std::size_t i = 0; i < rows.size(); i++) {
+			const Stats& s = rows[i];
+			double p99 = Percentile(s.rel, 0.99);
+			bool flag = !(p99 <= tolerance);
+			flagged += flag;
+			std::printf("%-32s %8d %10.2e %10.2e %10.2e %10.2e %11.1f %11.1f %s\n", s.name.c_str(), static_cast<int>(s.rel.size()),
+				Percentile(s.abs, 1), Percentile(s.rel, 0.5), p99, Percentile(s.rel, 1),
+				s.floatNs / s.items, s.doubleNs / s.items, flag ? "*" : "");
+		}
+		std::printf("\n%d of %d rows with a 99th percentile relative error above %.1e\n", flagged, static_cast<int>(rows.size()), tolerance);
+	}
+
+}
+
+int main(int argc, char** argv) {
+	int dof = argc > 1 ? std::atoi(argv[1]) : 6;
+	int robots = argc > 2 ? std::atoi(argv[2]) : 20;
+	int samples = argc > 3 ? std::atoi(argv[3]) : 100;
+	unsigned seed = argc > 4 ? static_cast<unsigned>(std::atoi(argv[4])) : 1;
+	double tolerance = argc > 5 ? std::atof(argv[5]) : 1e-3;
+	if (dof < 1 || robots < 1 || samples < 2) {
+		std::fprintf(stderr, "usage: %s [dof >= 1] [robots >= 1] [configurations >= 2] [seed] [tolerance]\n", argv[0]);
+		return 1;
+	}
+
+	std::mt19937 rng(seed);
+	std::srand(seed);
+	mr::ThreadPool pool;
+	std::printf("%d robots of %d joints, %d configurations each, seed %u, %s kernels, %d threads\n\n",
+		robots, dof, samples, seed, mr::SimdVariant().c_str(), pool.Size());
+	for (int k = 0; k < robots; k++) {
+		Robot r = RandomRobot(dof, rng);
+		Samples S;
+		for (int i = 0; i < samples; i++) S.push_back(RandomSample(r, rng));
+		ComparePrimitives(r, S);
+		CompareTrajectories(r, S);
+		CompareFastPaths(r, S, pool);
+	}
+	Report(tolerance);
+	return 0;
+}
@@ -1,6 +1,10 @@
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <Eigen/Dense>
 #include "../include/modern_robotics.h"
+#include "reference.h"
 #include "gtest/gtest.h"
 
 # define M_PI           3.14159265358979323846  /* pi */
@@ -55,6 +59,9 @@ TEST(MRTest, JacobianBodyTest) {
 	Eigen::MatrixXf tmp_result = mr::JacobianBody(b_list, theta);
 	// std::cout << tmp_result << std::endl;
 	ASSERT_TRUE(mr::JacobianBody(b_list, theta).isApprox(result, 4));
+	// An empty chain has an empty Jacobian
+	ASSERT_EQ(0, mr::JacobianBody(Eigen::MatrixXf(6, 0), Eigen::VectorXf(0)).cols());
+	ASSERT_EQ(0, mr::JacobianSpace(Eigen::MatrixXf(6, 0), Eigen::VectorXf(0)).cols());
 }
 
 TEST(MRTest, adTest) {
@@ -1224,4 +1231,1290 @@ TEST(MRTest, SimulateControlTest) {
 
 	ASSERT_TRUE(traj_tau_timestep.isApprox(result_taumat, 4));
 	ASSERT_TRUE(traj_theta_timestep.isApprox(result_thetamat, 4));
-}
\ No newline at end of file
+}
+// The three-link UR5 chain used throughout the dynamics tests above
+static void ThreeLinkRobot(std::vector<Eigen::MatrixXf>& Mlist, std::vector<Eigen::MatrixXf>& Glist, Eigen::MatrixXf& Slist) {
+	Eigen::Matrix4f M01;
+	M01 << 1, 0, 0, 0,
+		0, 1, 0, 0,
+		0, 0, 1, 0.089159,
+		0, 0, 0, 1;
+	Eigen::Matrix4f M12;
+	M12 << 0, 0, 1, 0.28,
+		0, 1, 0, 0.13585,
+		-1, 0, 0, 0,
+		0, 0, 0, 1;
+	Eigen::Matrix4f M23;
+	M23 << 1, 0, 0, 0,
+		0, 1, 0, -0.1197,
+		0, 0, 1, 0.395,
+		0, 0, 0, 1;
+	Eigen::Matrix4f M34;
+	M34 << 1, 0, 0, 0,
+		0, 1, 0, 0,
+		0, 0, 1, 0.14225,
+		0, 0, 0, 1;
+	Mlist.clear();
+	Mlist.push_back(M01);
+	Mlist.push_back(M12);
+	Mlist.push_back(M23);
+	Mlist.push_back(M34);
+
+	Eigen::VectorXf G1(6);
+	G1 << 0.010267, 0.010267, 0.00666, 3.7, 3.7, 3.7;
+	Eigen::VectorXf G2(6);
+	G2 << 0.22689, 0.22689, 0.0151074, 8.393, 8.393, 8.393;
+	Eigen::VectorXf G3(6);
+	G3 << 0.0494433, 0.0494433, 0.004095, 2.275, 2.275, 2.275;
+	Glist.clear();
+	Glist.push_back(G1.asDiagonal());
+	Glist.push_back(G2.asDiagonal());
+	Glist.push_back(G3.asDiagonal());
+
+	Eigen::MatrixXf SlistT(3, 6);
+	SlistT << 1, 0, 1, 0, 1, 0,
+		0, 1, 0, -0.089, 0, 0,
+		0, 1, 0, -0.089, 0, 0.425;
+	Slist = SlistT.transpose();
+}
+
+TEST(MRTest, WorkspaceTest) {
+	mr::Workspace ws(3);
+	ASSERT_EQ(mr::Workspace::RequiredSize(3), ws.Capacity());
+	ASSERT_EQ(0u, ws.Used());
+	{
+		mr::Workspace::Frame frame(ws);
+		Eigen::Map<Eigen::MatrixXf> A = ws.Matrix(6, 3);
+		Eigen::Map<Eigen::VectorXf> v = ws.Vector(4);
+		ASSERT_EQ(22u, ws.Used());
+		ASSERT_EQ(A.data() + 18, v.data());
+	}
+	ASSERT_EQ(0u, ws.Used());
+	EXPECT_THROW(ws.Vector(int(ws.Capacity()) + 1), std::bad_alloc);
+	ws.Reset();
+	ws.Reserve(7);
+	ASSERT_EQ(7, ws.Dof());
+	ASSERT_EQ(mr::Workspace::RequiredSize(7), ws.Capacity());
+}
+
+TEST(MRTest, DynamicsWorkspaceTest) {
+	std::vector<Eigen::MatrixXf> Mlist;
+	std::vector<Eigen::MatrixXf> Glist;
+	Eigen::MatrixXf Slist;
+	ThreeLinkRobot(Mlist, Glist, Slist);
+	Eigen::VectorXf thetalist(3);
+	thetalist << 0.1, 0.1, 0.1;
+	Eigen::VectorXf dthetalist(3);
+	dthetalist << 0.1, 0.2, 0.3;
+	Eigen::VectorXf taulist(3);
+	taulist << 0.5, 0.6, 0.7;
+	Eigen::VectorXf g(3);
+	g << 0, 0, -9.8;
+	Eigen::VectorXf Ftip(6);
+	Ftip << 1, 1, 1, 1, 1, 1;
+
+	mr::Workspace ws;
+	Eigen::MatrixXf M = mr::MassMatrix(thetalist, Mlist, Glist, Slist, ws);
+	Eigen::VectorXf bias = mr::VelQuadraticForces(thetalist, dthetalist, Mlist, Glist, Slist, ws)
+		+ mr::GravityForces(thetalist, g, Mlist, Glist, Slist, ws)
+		+ mr::EndEffectorForces(thetalist, Ftip, Mlist, Glist, Slist, ws);
+	Eigen::VectorXf ddthetalist = mr::ForwardDynamics(thetalist, dthetalist, taulist, g, Ftip, Mlist, Glist, Slist, ws);
+	ASSERT_EQ(0u, ws.Used());
+
+	Eigen::VectorXf expected = M.ldlt().solve(taulist - bias);
+	ASSERT_TRUE(ddthetalist.isApprox(expected, 1e-4));
+	Eigen::VectorXf tau = mr::InverseDynamics(thetalist, dthetalist, ddthetalist, g, Ftip, Mlist, Glist, Slist, ws);
+	ASSERT_TRUE(tau.isApprox(taulist, 1e-3));
+
+	// A trajectory through a workspace leaves it empty and at its original size
+	std::size_t capacity = ws.Capacity();
+	int N = 20;
+	Eigen::MatrixXf taumat = Eigen::MatrixXf::Ones(N, 3);
+	Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+	std::vector<Eigen::MatrixXf> traj = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, 0.01, 4, ws);
+	std::vector<Eigen::MatrixXf> reference = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, 0.01, 4);
+	ASSERT_EQ(0u, ws.Used());
+	ASSERT_EQ(capacity, ws.Capacity());
+	ASSERT_TRUE(traj.at(0).isApprox(reference.at(0)));
+	ASSERT_TRUE(traj.at(1).isApprox(reference.at(1)));
+}
+
+TEST(MRTest, FKinSpaceCacheTest) {
+	Eigen::MatrixXf M(4, 4);
+	M << -1, 0, 0, 0,
+		0, 1, 0, 6,
+		0, 0, -1, 2,
+		0, 0, 0, 1;
+	Eigen::MatrixXf Slist(6, 3);
+	Slist << 0, 0, 0,
+		0, 0, 0,
+		1, 0, -1,
+		4, 0, -6,
+		0, 1, 0,
+		0, 0, -0.1;
+	Eigen::VectorXf thetalist(3);
+	thetalist << M_PI / 2.0, 3, M_PI;
+
+	mr::FKinSpaceCache cache(M, Slist, thetalist);
+	ASSERT_TRUE(cache.Transform().isApprox(mr::FKinSpace(M, Slist, thetalist), 1e-5));
+
+	Eigen::VectorXf moved = thetalist;
+	moved(2) = 0.3;
+	Eigen::MatrixXf whatIf = cache.WhatIf(2, 0.3);
+	ASSERT_TRUE(cache.Thetalist().isApprox(thetalist));
+	ASSERT_TRUE(whatIf.isApprox(mr::FKinSpace(M, Slist, moved), 1e-5));
+
+	ASSERT_EQ(2, cache.Update(moved));
+	ASSERT_TRUE(cache.Transform().isApprox(whatIf, 1e-5));
+	ASSERT_EQ(3, cache.Update(moved));
+
+	moved(1) = -1.2;
+	ASSERT_EQ(1, cache.Update(moved));
+	ASSERT_TRUE(cache.Transform().isApprox(mr::FKinSpace(M, Slist, moved), 1e-5));
+}
+
+TEST(MRTest, KinematicStateTest) {
+	std::vector<Eigen::MatrixXf> Mlist;
+	std::vector<Eigen::MatrixXf> Glist;
+	Eigen::MatrixXf Slist;
+	ThreeLinkRobot(Mlist, Glist, Slist);
+	Eigen::VectorXf thetalist(3);
+	thetalist << 0.1, -0.7, 1.3;
+	Eigen::VectorXf dthetalist(3);
+	dthetalist << 0.1, 0.2, 0.3;
+	Eigen::VectorXf ddthetalist(3);
+	ddthetalist << 2, 1.5, 1;
+	Eigen::VectorXf g(3);
+	g << 0, 0, -9.8;
+	Eigen::VectorXf Ftip(6);
+	Ftip << 1, 1, 1, 1, 1, 1;
+
+	Eigen::MatrixXf M = Eigen::MatrixXf::Identity(4, 4);
+	for (std::size_t i = 0; i < Mlist.size(); i++)
+		M = M * Mlist[i];
+	Eigen::MatrixXf Blist = mr::Adjoint(mr::TransInv(M)) * Slist;
+
+	mr::KinematicState state(Mlist, Slist, thetalist);
+	ASSERT_TRUE(mr::FKinSpace(state).isApprox(mr::FKinSpace(M, Slist, thetalist), 1e-5));
+	ASSERT_TRUE(mr::FKinBody(state).isApprox(mr::FKinBody(M, Blist, thetalist), 1e-5));
+	ASSERT_TRUE(mr::JacobianSpace(state).isApprox(mr::JacobianSpace(Slist, thetalist), 1e-5));
+	ASSERT_TRUE(mr::JacobianBody(state).isApprox(mr::JacobianBody(Blist, thetalist), 1e-4));
+	ASSERT_NEAR(std::sin(-0.7f), state.Sin()(1), 1e-6);
+	ASSERT_NEAR(std::cos(-0.7f), state.Cos()(1), 1e-6);
+
+	mr::Workspace ws;
+	ASSERT_TRUE(mr::InverseDynamics(state, dthetalist, ddthetalist, g, Ftip, Glist, ws).isApprox(
+		mr::InverseDynamics(thetalist, dthetalist, ddthetalist, g, Ftip, Mlist, Glist, Slist), 1e-5));
+	ASSERT_TRUE(mr::MassMatrix(state, Glist, ws).isApprox(mr::MassMatrix(thetalist, Mlist, Glist, Slist), 1e-5));
+	ASSERT_TRUE(mr::ForwardDynamics(state, dthetalist, ddthetalist, g, Ftip, Glist, ws).isApprox(
+		mr::ForwardDynamics(thetalist, dthetalist, ddthetalist, g, Ftip, Mlist, Glist, Slist), 1e-4));
+}
+
+TEST(MRTest, ClassifyJointTest) {
+	Eigen::Vector3f q(3, 0, 1);
+	Eigen::Vector3f z(0, 0, 1);
+	Eigen::Vector3f s = Eigen::Vector3f(1, 2, 2) / 3;
+	Eigen::VectorXf prismatic(6);
+	prismatic << 0, 0, 0, 0, 1, 0;
+
+	mr::JointModel revolute = mr::ClassifyJoint(mr::ScrewToAxis(q, z, 0));
+	ASSERT_EQ(mr::JointType::Revolute, revolute.type);
+	ASSERT_EQ(2, revolute.axis);
+	mr::JointModel helical = mr::ClassifyJoint(mr::ScrewToAxis(q, s, 0.5));
+	ASSERT_EQ(mr::JointType::Helical, helical.type);
+	ASSERT_EQ(-1, helical.axis);
+	ASSERT_NEAR(0.5, helical.pitch, 1e-6);
+	mr::JointModel slider = mr::ClassifyJoint(prismatic);
+	ASSERT_EQ(mr::JointType::Prismatic, slider.type);
+	ASSERT_EQ(1, slider.axis);
+	mr::JointModel general = mr::ClassifyJoint(2 * mr::ScrewToAxis(q, z, 0));
+	ASSERT_EQ(mr::JointType::General, general.type);
+
+	std::vector<mr::JointModel> joints;
+	joints.push_back(revolute);
+	joints.push_back(mr::ClassifyJoint(mr::ScrewToAxis(q, -z, 0)));
+	joints.push_back(mr::ClassifyJoint(mr::ScrewToAxis(q, s, 0)));
+	joints.push_back(helical);
+	joints.push_back(slider);
+	joints.push_back(general);
+	for (std::size_t i = 0; i < joints.size(); i++) {
+		for (float theta = -2.5; theta < 3; theta += 0.7) {
+			Eigen::VectorXf S = joints[i].S;
+			Eigen::MatrixXf expected = mr::MatrixExp6(mr::VecTose3(S * theta));
+			ASSERT_TRUE(mr::MatrixExp6(joints[i], theta).isApprox(expected, 1e-5));
+		}
+	}
+}
+
+TEST(MRTest, PrismaticJacobianTest) {
+	// RPR chain mixing coordinate-aligned and general axes
+	Eigen::MatrixXf M(4, 4);
+	M << 1, 0, 0, 1,
+		0, 1, 0, 0,
+		0, 0, 1, 2,
+		0, 0, 0, 1;
+	Eigen::MatrixXf Slist(6, 3);
+	Slist.col(0) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(0, 0, 1), 0);
+	Slist.col(1) << 0, 0, 0, 0.6, 0, 0.8;
+	Slist.col(2) = mr::ScrewToAxis(Eigen::Vector3f(1, 0, 2), Eigen::Vector3f(0, 0.6, 0.8), 0.1);
+	Eigen::VectorXf thetalist(3);
+	thetalist << 0.4, 0.3, -1.1;
+
+	// Columns of the space Jacobian are Adjoint(e^[S1]theta1 ... e^[Si-1]thetai-1) * Si
+	Eigen::MatrixXf Js(6, 3);
+	Eigen::MatrixXf T = Eigen::MatrixXf::Identity(4, 4);
+	for (int i = 0; i < 3; i++) {
+		Js.col(i) = mr::Adjoint(T) * Slist.col(i);
+		T = T * mr::MatrixExp6(mr::VecTose3(Slist.col(i) * thetalist(i)));
+	}
+	ASSERT_TRUE(mr::JacobianSpace(Slist, thetalist).isApprox(Js, 1e-5));
+	ASSERT_TRUE(mr::FKinSpace(M, Slist, thetalist).isApprox(T * M, 1e-5));
+
+	Eigen::MatrixXf Blist = mr::Adjoint(mr::TransInv(M)) * Slist;
+	Eigen::MatrixXf Jb = mr::Adjoint(mr::TransInv(T * M)) * Js;
+	ASSERT_TRUE(mr::JacobianBody(Blist, thetalist).isApprox(Jb, 1e-4));
+	ASSERT_TRUE(mr::FKinBody(M, Blist, thetalist).isApprox(T * M, 1e-5));
+}
+
+TEST(MRTest, ThreadPoolTest) {
+	mr::ThreadPool pool(4);
+	ASSERT_EQ(4, pool.Size());
+	std::vector<int> visits(1000, 0);
+	pool.ParallelFor(0, 1000, [&](int i) { visits[i]++; });
+	for (int i = 0; i < 1000; i++)
+		ASSERT_EQ(1, visits[i]);
+
+	// A loop started from inside a body runs on the calling thread
+	std::vector<int> inner(64, 0);
+	pool.ParallelFor(0, 8, [&](int i) {
+		pool.ParallelFor(0, 8, [&](int j) { inner[8 * i + j]++; });
+	});
+	for (int i = 0; i < 64; i++)
+		ASSERT_EQ(1, inner[i]);
+
+	ASSERT_THROW(pool.ParallelFor(0, 100, [](int i) { if (i == 37) throw std::runtime_error("body"); }),
+		std::runtime_error);
+	pool.ParallelFor(0, 1000, [&](int i) { visits[i]--; });
+	for (int i = 0; i < 1000; i++)
+		ASSERT_EQ(0, visits[i]);
+}
+
+TEST(MRTest, ParallelFKinTest) {
+	// A 64-joint chain of revolute, prismatic and helical joints
+	int n = 64;
+	std::srand(56);
+	Eigen::MatrixXf Slist(6, n);
+	for (int i = 0; i < n; i++) {
+		Eigen::Vector3f q = Eigen::Vector3f::Random();
+		Eigen::Vector3f s = Eigen::Vector3f::Random().normalized();
+		if (i % 7 == 3)
+			Slist.col(i) << 0, 0, 0, s;
+		else
+			Slist.col(i) = mr::ScrewToAxis(q, s, i % 5 == 0 ? 0.1f : 0);
+	}
+	Eigen::VectorXf thetalist = 0.3 * Eigen::VectorXf::Random(n);
+	Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 1));
+
+	for (int threads = 1; threads <= 4; threads++) {
+		mr::ThreadPool pool(threads);
+		std::vector<Eigen::MatrixXf> frames = mr::FKinSpaceFrames(Slist, thetalist, pool);
+		ASSERT_EQ(n + 1, static_cast<int>(frames.size()));
+		for (int i = 0; i <= n; i += 9)
+			ASSERT_TRUE(frames[i].isApprox(mr::FKinSpace(Eigen::MatrixXf::Identity(4, 4), Slist.leftCols(i), thetalist.head(i)), 1e-4));
+		ASSERT_TRUE(mr::FKinSpace(M, Slist, thetalist, pool).isApprox(mr::FKinSpace(M, Slist, thetalist), 1e-4));
+		ASSERT_TRUE(mr::JacobianSpace(Slist, thetalist, pool).isApprox(mr::JacobianSpace(Slist, thetalist), 1e-4));
+	}
+}
+
+TEST(MRTest, ProjectToSO3Test) {
+	Eigen::Matrix3f M;
+	M << 0.675, 0.150, 0.720,
+		0.370, 0.771, -0.511,
+		-0.630, 0.619, 0.472;
+	Eigen::Matrix3f result;
+	result << 0.67901136, 0.14894516, 0.71885945,
+		0.37320708, 0.77319584, -0.51272279,
+		-0.63218672, 0.61642804, 0.46942137;
+	ASSERT_TRUE(mr::ProjectToSO3(M).isApprox(result, 1e-5));
+
+	// Drifted rotations, compared with the SVD projection
+	std::srand(57);
+	std::vector<float> batch(9 * 50);
+	std::vector<Eigen::Matrix3f> expected;
+	for (int i = 0; i < 50; i++) {
+		Eigen::Vector3f axis = Eigen::Vector3f::Random();
+		Eigen::Matrix3f drifted = mr::MatrixExp3(mr::VecToso3(axis)) + 0.05 * Eigen::Matrix3f::Random();
+		Eigen::JacobiSVD<Eigen::Matrix3f> svd(drifted, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		expected.push_back(svd.matrixU() * svd.matrixV().transpose());
+		ASSERT_TRUE(mr::ProjectToSO3(drifted).isApprox(expected[i], 1e-5));
+		Eigen::Map<Eigen::Matrix3f> slot(&batch[9 * i]);
+		slot = drifted;
+	}
+	mr::ProjectToSO3Batch(batch.data(), 50, batch.data());
+	for (int i = 0; i < 50; i++) {
+		Eigen::Matrix3f R = Eigen::Map<Eigen::Matrix3f>(&batch[9 * i]);
+		ASSERT_TRUE(R.isApprox(expected[i], 1e-5));
+		ASSERT_TRUE(mr::TestIfSO3(R));
+	}
+
+	// A reflection keeps the SVD behaviour
+	Eigen::Matrix3f reflection = Eigen::Vector3f(1, 1, -1).asDiagonal();
+	Eigen::Matrix3f flipped = Eigen::Matrix3f::Identity();
+	ASSERT_TRUE(mr::ProjectToSO3(reflection).isApprox(flipped));
+
+	Eigen::Matrix4f T = mr::RpToTrans(M, Eigen::Vector3f(1, 2, 3));
+	T.row(3) << 0.1, 0, 0, 0.9;
+	Eigen::Matrix4f Texpected = mr::RpToTrans(result, Eigen::Vector3f(1, 2, 3));
+	ASSERT_TRUE(mr::ProjectToSE3(T).isApprox(Texpected, 1e-5));
+	Eigen::Matrix4f Tbatch;
+	mr::ProjectToSE3Batch(T.data(), 1, Tbatch.data());
+	ASSERT_TRUE(Tbatch.isApprox(Texpected, 1e-5));
+}
+
+TEST(MRTest, DistanceToSE3BatchTest) {
+	// 100 poses: exact, slightly drifted, badly drifted and reflected
+	const int count = 100;
+	std::srand(58);
+	std::vector<float> poses(16 * count);
+	std::vector<Eigen::Matrix4f> original;
+	for (int i = 0; i < count; i++) {
+		Eigen::Matrix4f T = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f::Random())), Eigen::Vector3f::Random());
+		if (i % 4 == 1)
+			T.topLeftCorner<3, 3>() += 1e-5 * Eigen::Matrix3f::Random();
+		else if (i % 4 == 2)
+			T.topLeftCorner<3, 3>() += 0.1 * Eigen::Matrix3f::Random();
+		else if (i % 4 == 3)
+			T.col(2) *= -1;
+		original.push_back(T);
+		std::copy(T.data(), T.data() + 16, &poses[16 * i]);
+	}
+
+	std::vector<float> distances(count);
+	std::vector<std::uint64_t> valid(2);
+	std::size_t passed = mr::DistanceToSE3Batch(poses.data(), count, distances.data(), valid.data());
+	std::size_t expectedPassed = 0;
+	for (int i = 0; i < count; i++) {
+		// The definition, as in the documentation of DistanceToSE3
+		Eigen::Matrix3f R = original[i].topLeftCorner<3, 3>();
+		float expected = 1.0e9;
+		if (R.determinant() > 0) {
+			Eigen::Matrix4f m = Eigen::Matrix4f::Zero();
+			m.topLeftCorner<3, 3>() = R.transpose() * R;
+			m.row(3) = original[i].row(3);
+			expected = (m - Eigen::Matrix4f::Identity()).norm();
+		}
+		ASSERT_NEAR(expected, distances[i], 1e-5);
+		ASSERT_NEAR(expected, mr::DistanceToSE3(original[i]), 1e-5);
+		bool bit = (valid[i / 64] >> (i % 64)) & 1;
+		ASSERT_EQ(mr::TestIfSE3(original[i]), bit);
+		ASSERT_EQ(i % 4 < 2, bit);
+		expectedPassed += bit;
+	}
+	ASSERT_EQ(expectedPassed, passed);
+	ASSERT_EQ(0u, valid[1] >> (count - 64));
+
+	// Rotations only, read from the same poses
+	std::vector<float> rotations(9 * count);
+	for (int i = 0; i < count; i++) {
+		Eigen::Map<Eigen::Matrix3f> R(&rotations[9 * i]);
+		R = original[i].topLeftCorner<3, 3>();
+	}
+	std::vector<std::uint64_t> validSO3(2);
+	ASSERT_EQ(passed, mr::DistanceToSO3Batch(rotations.data(), count, 0, validSO3.data()));
+	ASSERT_TRUE(validSO3 == valid);
+
+	// Repairing projects exactly the poses that failed
+	ASSERT_EQ(passed, mr::RepairSE3Batch(poses.data(), count, 0, 0));
+	for (int i = 0; i < count; i++) {
+		Eigen::Map<Eigen::Matrix4f> T(&poses[16 * i]);
+		if (i % 4 < 2)
+			ASSERT_EQ(original[i], T);
+		else
+			ASSERT_TRUE(T.isApprox(mr::ProjectToSE3(original[i])));
+	}
+	ASSERT_EQ(static_cast<std::size_t>(count), mr::DistanceToSE3Batch(poses.data(), count, 0, 0));
+	ASSERT_EQ(passed, mr::RepairSO3Batch(rotations.data(), count, 0, 0));
+}
+
+TEST(MRTest, DualQuaternionTest) {
+	Eigen::Matrix4f M;
+	M << -1, 0, 0, 0,
+		0, 1, 0, 6,
+		0, 0, -1, 2,
+		0, 0, 0, 1;
+	mr::DualQuaternion Mdq(M);
+	ASSERT_TRUE(Mdq.Matrix().isApprox(M, 1e-6));
+	ASSERT_TRUE(Mdq.Inverse().Matrix().isApprox(mr::TransInv(M), 1e-6));
+
+	// Revolute, prismatic, helical and a screw with |w| != 1
+	Eigen::MatrixXf Slist(6, 4);
+	Slist.col(0) = mr::ScrewToAxis(Eigen::Vector3f(1, 2, 0), Eigen::Vector3f(0, 0, 1), 0);
+	Slist.col(1) << 0, 0, 0, 0.6, 0, 0.8;
+	Slist.col(2) = mr::ScrewToAxis(Eigen::Vector3f(0, 1, 1), Eigen::Vector3f(0.6, 0.8, 0), 0.3);
+	Slist.col(3) = 2 * mr::ScrewToAxis(Eigen::Vector3f(-1, 0, 2), Eigen::Vector3f(0, 0.8, -0.6), 0.1);
+	for (int i = 0; i < 4; i++) {
+		for (float theta = -2.5; theta < 3; theta += 0.7) {
+			Eigen::VectorXf S = Slist.col(i);
+			Eigen::MatrixXf expected = mr::MatrixExp6(mr::VecTose3(S * theta));
+			mr::DualQuaternion X = mr::DualQuaternion::Exp(S, theta);
+			ASSERT_TRUE(X.Matrix().isApprox(expected, 1e-5));
+			// Log recovers the exponential coordinates of the same motion
+			ASSERT_TRUE(mr::DualQuaternion::Exp(X.Log(), 1).Matrix().isApprox(expected, 1e-5));
+			ASSERT_TRUE((X * Mdq).Matrix().isApprox(expected * M, 1e-5));
+		}
+	}
+
+	Eigen::VectorXf thetalist(4);
+	thetalist << 0.3, -1.2, 2.0, 0.7;
+	ASSERT_TRUE(mr::FKinSpace(Mdq, Slist, thetalist).Matrix().isApprox(mr::FKinSpace(M, Slist, thetalist), 1e-5));
+	Eigen::MatrixXf Blist = mr::Adjoint(mr::TransInv(M)) * Slist;
+	ASSERT_TRUE(mr::FKinBody(Mdq, Blist, thetalist).Matrix().isApprox(mr::FKinBody(M, Blist, thetalist), 1e-5));
+
+	// Normalize restores a unit dual quaternion after drift
+	mr::DualQuaternion X = mr::FKinSpace(Mdq, Slist, thetalist);
+	Eigen::Quaternionf real = X.Real(), dual = X.Dual();
+	dual.coeffs() += 0.01f * real.coeffs();
+	real.coeffs() *= 1.01f;
+	dual.coeffs() *= 1.01f;
+	mr::DualQuaternion drifted(real, dual);
+	drifted.Normalize();
+	ASSERT_NEAR(1, drifted.Real().norm(), 1e-6);
+	ASSERT_NEAR(0, drifted.Real().coeffs().dot(drifted.Dual().coeffs()), 1e-6);
+	ASSERT_TRUE(drifted.Matrix().isApprox(X.Matrix(), 1e-4));
+
+	// ScLERP follows the screw motion between the two ends
+	mr::DualQuaternion Xend = mr::FKinSpace(Mdq, Slist, 0.5f * thetalist);
+	Eigen::MatrixXf expc6 = mr::MatrixLog6(mr::TransInv(X.Matrix()) * Xend.Matrix());
+	for (float s = 0; s <= 1; s += 0.25) {
+		Eigen::MatrixXf expected = X.Matrix() * mr::MatrixExp6(expc6 * s);
+		ASSERT_TRUE(mr::ScLERP(X, Xend, s).Matrix().isApprox(expected, 1e-4));
+	}
+}
+
+/* Every closed-form solution reaches T, and one of them is the configuration T came from */
+static void CheckAnalyticIK(const Eigen::MatrixXf& Slist, const Eigen::Matrix4f& M) {
+	mr::AnalyticIK ik(Slist, M);
+	ASSERT_TRUE(ik.Analytic());
+	std::srand(60);
+	for (int trial = 0; trial < 50; trial++) {
+		Eigen::VectorXf thetalist = 3 * Eigen::VectorXf::Random(6);
+		Eigen::Matrix4f T = mr::FKinSpace(M, Slist, thetalist);
+		std::vector<Eigen::VectorXf> solutions = ik.Solutions(T);
+		ASSERT_FALSE(solutions.empty());
+		ASSERT_LE(solutions.size(), 8u);
+		float nearest = 1e9;
+		for (std::size_t i = 0; i < solutions.size(); i++) {
+			ASSERT_TRUE(mr::FKinSpace(M, Slist, solutions[i]).isApprox(T, 1e-3));
+			Eigen::VectorXf diff = solutions[i] - thetalist;
+			for (int j = 0; j < 6; j++)
+				diff(j) = std::remainder(diff(j), 2 * float(M_PI));
+			nearest = std::min(nearest, diff.cwiseAbs().maxCoeff());
+		}
+		ASSERT_LT(nearest, 1e-2);
+
+		Eigen::VectorXf guess = thetalist + 0.05f * Eigen::VectorXf::Random(6);
+		ASSERT_TRUE(ik.Solve(T, guess, 0.001, 0.0001));
+		ASSERT_TRUE(guess.isApprox(thetalist, 1e-2));
+	}
+}
+
+TEST(MRTest, AnalyticIKTest) {
+	// PUMA-style: a shoulder offset, parallel shoulder and elbow axes
+	Eigen::Vector3f c(0.5, 0.1, 1.3);
+	Eigen::MatrixXf Slist(6, 6);
+	Slist.col(0) = mr::ScrewToAxis(Eigen::Vector3f::Zero(), Eigen::Vector3f(0, 0, 1), 0);
+	Slist.col(1) = mr::ScrewToAxis(Eigen::Vector3f(0.1, 0, 0.5), Eigen::Vector3f(0, 1, 0), 0);
+	Slist.col(2) = mr::ScrewToAxis(Eigen::Vector3f(0.1, 0, 1.0), Eigen::Vector3f(0, 1, 0), 0);
+	Slist.col(3) = mr::ScrewToAxis(c, Eigen::Vector3f(1, 0, 0), 0);
+	Slist.col(4) = mr::ScrewToAxis(c, Eigen::Vector3f(0, 1, 0), 0);
+	Slist.col(5) = mr::ScrewToAxis(c, Eigen::Vector3f(1, 0, 0), 0);
+	Eigen::Matrix4f M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.6, 0.1, 1.3));
+	CheckAnalyticIK(Slist, M);
+
+	// Intersecting shoulder axes, elbow axis skew to the wrist
+	c << 0.7, 0, 0.6;
+	Slist.col(1) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0.4), Eigen::Vector3f(0, 1, 0), 0);
+	Slist.col(2) = mr::ScrewToAxis(Eigen::Vector3f(0.4, 0, 0.4), Eigen::Vector3f(0, 1, 0), 0);
+	Slist.col(3) = mr::ScrewToAxis(c, Eigen::Vector3f(1, 0, 0), 0);
+	Slist.col(4) = mr::ScrewToAxis(c, Eigen::Vector3f(0, 0, 1), 0);
+	Slist.col(5) = mr::ScrewToAxis(c, Eigen::Vector3f(1, 0, 0), 0);
+	M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.8, 0, 0.6));
+	CheckAnalyticIK(Slist, M);
+
+	// UR5: no spherical wrist, so Solve runs IKinSpace
+	float W1 = 0.109, W2 = 0.082, L1 = 0.425, L2 = 0.392, H1 = 0.089, H2 = 0.095;
+	Eigen::MatrixXf SlistT(6, 6);
+	SlistT << 0, 0, 1, 0, 0, 0,
+		0, 1, 0, -H1, 0, 0,
+		0, 1, 0, -H1, 0, L1,
+		0, 1, 0, -H1, 0, L1 + L2,
+		0, 0, -1, -W1, L1 + L2, 0,
+		0, 1, 0, H2 - H1, 0, L1 + L2;
+	M << -1, 0, 0, L1 + L2,
+		0, 0, 1, W1 + W2,
+		0, 1, 0, H1 - H2,
+		0, 0, 0, 1;
+	mr::AnalyticIK ur5(SlistT.transpose(), M);
+	ASSERT_FALSE(ur5.Analytic());
+	ASSERT_TRUE(ur5.Solutions(M).empty());
+	Eigen::VectorXf thetalist(6);
+	thetalist << 0.3, -0.5, 0.8, 0.2, 0.4, -0.1;
+	Eigen::Matrix4f T = mr::FKinSpace(M, SlistT.transpose(), thetalist);
+	Eigen::VectorXf guess = thetalist + 0.05f * Eigen::VectorXf::Ones(6);
+	ASSERT_TRUE(ur5.Solve(T, guess, 0.001, 0.0001));
+	ASSERT_TRUE(mr::FKinSpace(M, SlistT.transpose(), guess).isApprox(T, 1e-3));
+}
+
+TEST(MRTest, KdTreeTest) {
+	std::srand(61);
+	mr::KdTree tree(4);
+	std::vector<Eigen::VectorXf> points;
+	for (int i = 0; i < 500; i++) {
+		points.push_back(Eigen::VectorXf::Random(4));
+		ASSERT_EQ(i, tree.Insert(points.back()));
+	}
+	tree.Remove(7);
+	for (int trial = 0; trial < 50; trial++) {
+		Eigen::VectorXf q = Eigen::VectorXf::Random(4);
+		std::vector<std::pair<float, int> > expected;
+		for (int i = 0; i < 500; i++)
+			if (i != 7)
+				expected.push_back(std::make_pair((points[i] - q).norm(), i));
+		std::sort(expected.begin(), expected.end());
+		std::vector<int> nearest = tree.KNearest(q, 5);
+		ASSERT_EQ(5u, nearest.size());
+		for (int k = 0; k < 5; k++)
+			ASSERT_EQ(expected[k].second, nearest[k]);
+		ASSERT_EQ(expected[0].second, tree.Nearest(q));
+	}
+	ASSERT_TRUE(tree.Point(3).isApprox(points[3]));
+}
+
+TEST(MRTest, JointPlannerTest) {
+	// A wall across the middle of a 2-joint space, passable only above theta2 = 1
+	mr::JointPlanner::StateValidity valid = [](const Eigen::VectorXf& q) {
+		return !(std::abs(q(0)) < 0.2f && q(1) < 1.0f);
+	};
+	Eigen::Vector2f lower(-3, -3), upper(3, 3), start(-1, -1), goal(1, -1);
+	mr::ThreadPool pool(3);
+	mr::JointPlanner planners[2] = { mr::JointPlanner(lower, upper, valid, 0.01f),
+		mr::JointPlanner(lower, upper, valid, 0.01f, &pool) };
+	ASSERT_FALSE(planners[0].EdgeValid(start, goal));
+	for (int p = 0; p < 2; p++) {
+		mr::JointPlanner& planner = planners[p];
+		Eigen::MatrixXf paths[2] = { planner.RRTConnect(start, goal, 0.3f, 5000), planner.LazyPRM(start, goal, 300, 8) };
+		for (int k = 0; k < 2; k++) {
+			Eigen::MatrixXf path = paths[k];
+			ASSERT_GE(path.rows(), 3);
+			Eigen::MatrixXf shortened = planner.Shortcut(path, 100);
+			float length = 0, shortenedLength = 0;
+			for (int i = 1; i < path.rows(); i++)
+				length += (path.row(i) - path.row(i - 1)).norm();
+			for (int i = 1; i < shortened.rows(); i++) {
+				shortenedLength += (shortened.row(i) - shortened.row(i - 1)).norm();
+				ASSERT_TRUE(planner.EdgeValid(shortened.row(i - 1).transpose(), shortened.row(i).transpose()));
+			}
+			ASSERT_LE(shortenedLength, length + 1e-4);
+			ASSERT_TRUE(shortened.row(0).transpose().isApprox(start));
+			ASSERT_TRUE(shortened.row(shortened.rows() - 1).transpose().isApprox(goal));
+
+			// Time-scaled along the path from rest to rest
+			Eigen::MatrixXf traj = mr::JointPathTrajectory(shortened, 2, 50, 5);
+			ASSERT_EQ(50, traj.rows());
+			ASSERT_TRUE(traj.row(0).isApprox(shortened.row(0)));
+			ASSERT_TRUE(traj.row(49).isApprox(shortened.row(shortened.rows() - 1)));
+			for (int i = 0; i < 50; i++)
+				ASSERT_TRUE(valid(traj.row(i).transpose()));
+		}
+	}
+
+	// Walled in by a ring: no path
+	mr::JointPlanner::StateValidity ring = [](const Eigen::VectorXf& q) { return q.norm() < 2 || q.norm() > 2.4f; };
+	mr::JointPlanner planner(lower, upper, ring, 0.01f);
+	Eigen::Vector2f outside(2.7f, 0);
+	ASSERT_EQ(0, planner.RRTConnect(start, outside, 0.3f, 500).rows());
+	ASSERT_EQ(0, planner.LazyPRM(start, outside, 200, 8).rows());
+	// and none from inside the wall
+	ASSERT_EQ(0, planner.LazyPRM(start, Eigen::Vector2f(2.2f, 0), 200, 8).rows());
+}
+
+TEST(MRTest, IKSeedCacheTest) {
+	Eigen::MatrixXf SlistT(3, 6);
+	SlistT << 0, 0, 1, 4, 0, 0,
+		0, 0, 0, 0, 1, 0,
+		0, 0, -1, -6, 0, -0.1;
+	Eigen::MatrixXf Slist = SlistT.transpose();
+	Eigen::Matrix4f M;
+	M << -1, 0, 0, 0,
+		0, 1, 0, 6,
+		0, 0, -1, 2,
+		0, 0, 0, 1;
+	mr::IKSeedCache cache(Slist, M, 3);
+	Eigen::VectorXf thetalist(3);
+	ASSERT_FALSE(cache.Seed(M, thetalist));
+
+	// Least recently used goes first
+	std::vector<Eigen::VectorXf> solutions;
+	std::vector<Eigen::MatrixXf> poses;
+	for (int i = 0; i < 4; i++) {
+		solutions.push_back(Eigen::Vector3f(0.5f * i, 0.1f, 0.2f));
+		poses.push_back(mr::FKinSpace(M, Slist, solutions[i]));
+	}
+	for (int i = 0; i < 3; i++)
+		cache.Insert(poses[i], solutions[i]);
+	ASSERT_TRUE(cache.Seed(poses[0], thetalist));
+	ASSERT_TRUE(thetalist.isApprox(solutions[0]));
+	cache.Insert(poses[3], solutions[3]);
+	ASSERT_EQ(3u, cache.Size());
+	for (int i = 0; i < 4; i++) {
+		ASSERT_TRUE(cache.Seed(poses[i], thetalist));
+		ASSERT_EQ(i != 1, thetalist.isApprox(solutions[i]));
+	}
+
+	// Clustered targets solved concurrently, each from the same poor guess
+	mr::IKSeedCache shared(Slist, M, 64);
+	mr::ThreadPool pool(4);
+	std::srand(62);
+	std::vector<Eigen::MatrixXf> targets;
+	for (int i = 0; i < 400; i++)
+		targets.push_back(mr::FKinSpace(M, Slist, Eigen::Vector3f(1.5f, 2.5f, 3) + 0.2f * Eigen::Vector3f::Random()));
+	std::vector<char> solved(targets.size());
+	pool.ParallelFor(0, static_cast<int>(targets.size()), [&](int i) {
+		Eigen::VectorXf guess = Eigen::Vector3f(1.5f, 2.5f, 3);
+		solved[i] = shared.Solve(targets[i], guess, 0.001f, 0.0001f)
+			&& mr::FKinSpace(M, Slist, guess).isApprox(targets[i], 1e-3);
+	});
+	for (std::size_t i = 0; i < targets.size(); i++)
+		ASSERT_TRUE(solved[i]);
+	ASSERT_EQ(64u, shared.Size());
+}
+
+TEST(MRTest, ReachabilityMapTest) {
+	// A planar 2R arm with unit links reaches the annulus 0 <= r <= 2 in z = 0
+	Eigen::MatrixXf Slist(6, 2);
+	Slist.col(0) = mr::ScrewToAxis(Eigen::Vector3f::Zero(), Eigen::Vector3f(0, 0, 1), 0);
+	Slist.col(1) = mr::ScrewToAxis(Eigen::Vector3f(1, 0, 0), Eigen::Vector3f(0, 0, 1), 0);
+	Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(2, 0, 0));
+	Eigen::VectorXf lower = -float(M_PI) * Eigen::VectorXf::Ones(2), upper = -lower;
+	mr::ReachabilityMap map(Eigen::Vector3f(-2.5f, -2.5f, -0.05f), Eigen::Vector3i(50, 50, 1), 0.1f);
+	mr::ThreadPool pool(3), single(1);
+	map.Sample(M, Slist, lower, upper, 100000, pool, 7);
+
+	std::size_t total = 0;
+	for (int i = 0; i < 50; i++)
+		for (int j = 0; j < 50; j++) {
+			Eigen::Vector3f center(-2.45f + 0.1f * i, -2.45f + 0.1f * j, 0);
+			const mr::ReachabilityMap::Voxel& voxel = map.Voxels()[map.Index(center)];
+			total += voxel.count;
+			if (center.norm() > 2.1f) {
+				ASSERT_EQ(0u, voxel.count);
+			}
+			else if (center.norm() < 1.9f) {
+				ASSERT_GT(voxel.count, 0u);
+			}
+			ASSERT_LE(voxel.minSingularValue, voxel.manipulability + 1e-4f);
+		}
+	ASSERT_EQ(100000u, total);
+	ASSERT_EQ(-1, map.Index(Eigen::Vector3f(0, 0, 1)));
+
+	// Both statistics only depend on theta2, which fixes the reach r = sqrt(2 + 2 cos theta2)
+	Eigen::MatrixXf Blist = mr::Adjoint(mr::TransInv(M)) * Slist;
+	float best = 0;
+	for (int k = 0; k <= 1000; k++) {
+		Eigen::Vector2f thetalist(0, float(M_PI) * k / 1000);
+		float r = std::sqrt(2 + 2 * std::cos(thetalist(1)));
+		if (r < std::sqrt(2.0f) || r > std::sqrt(2 * 1.1f * 1.1f))
+			continue;
+		Eigen::MatrixXf Jb = mr::JacobianBody(Blist, thetalist);
+		best = std::max(best, std::sqrt((Jb.transpose() * Jb).determinant()));
+	}
+	const mr::ReachabilityMap::Voxel& voxel = map.Voxels()[map.Index(Eigen::Vector3f(1.05f, 1.05f, 0))];
+	ASSERT_NEAR(best, voxel.manipulability, 0.02 * best);
+
+	// Independent of the number of threads
+	mr::ReachabilityMap serial(map.Lower(), map.Size(), map.VoxelSize());
+	serial.Sample(M, Slist, lower, upper, 100000, single, 7);
+	for (std::size_t i = 0; i < map.Voxels().size(); i++) {
+		ASSERT_EQ(map.Voxels()[i].count, serial.Voxels()[i].count);
+		ASSERT_EQ(map.Voxels()[i].manipulability, serial.Voxels()[i].manipulability);
+	}
+
+	std::string path = ::testing::TempDir() + "reachability.bin";
+	ASSERT_TRUE(map.Save(path));
+	mr::ReachabilityMap loaded(Eigen::Vector3f::Zero(), Eigen::Vector3i(1, 1, 1), 1);
+	ASSERT_TRUE(loaded.Load(path));
+	ASSERT_EQ(map.Size(), loaded.Size());
+	ASSERT_TRUE(map.Lower().isApprox(loaded.Lower()));
+	for (std::size_t i = 0; i < map.Voxels().size(); i++)
+		ASSERT_EQ(0, std::memcmp(&map.Voxels()[i], &loaded.Voxels()[i], sizeof(mr::ReachabilityMap::Voxel)));
+	std::remove(path.c_str());
+	ASSERT_FALSE(loaded.Load(path));
+}
+
+TEST(MRTest, IKinBoundedTest) {
+	// A 7R arm with alternating vertical and horizontal axes
+	Eigen::MatrixXf Slist(6, 7);
+	for (int i = 0; i < 7; i++)
+		Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0.3f * i), i % 2 ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(0, 0, 1), 0);
+	Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 2.1f));
+	Eigen::MatrixXf Blist = mr::Adjoint(mr::TransInv(M)) * Slist;
+	Eigen::VectorXf lower = -1.5f * Eigen::VectorXf::Ones(7), upper = -lower;
+	lower(0) = -std::numeric_limits<float>::infinity();
+	upper(0) = std::numeric_limits<float>::infinity();
+	std::srand(64);
+	int solved = 0, unboundedInside = 0;
+	float boundedOffset = 0, unboundedOffset = 0;
+	for (int trial = 0; trial < 100; trial++) {
+		Eigen::VectorXf goal = 1.3f * Eigen::VectorXf::Random(7);
+		Eigen::MatrixXf T = mr::FKinSpace(M, Slist, goal);
+		Eigen::VectorXf guess = goal + 0.6f * Eigen::VectorXf::Random(7);
+		Eigen::VectorXf space = guess, body = guess, unbounded = guess;
+		bool spaceOk = mr::IKinSpaceBounded(Slist, M, T, space, lower, upper, 1e-3f, 1e-4f);
+		bool bodyOk = mr::IKinBodyBounded(Blist, M, T, body, lower, upper, 1e-3f, 1e-4f);
+		ASSERT_TRUE((space.array() >= lower.array()).all() && (space.array() <= upper.array()).all());
+		ASSERT_TRUE((body.array() >= lower.array()).all() && (body.array() <= upper.array()).all());
+		if (spaceOk) {
+			ASSERT_TRUE(mr::FKinSpace(M, Slist, space).isApprox(T, 1e-3));
+		}
+		if (bodyOk) {
+			ASSERT_TRUE(mr::FKinBody(M, Blist, body).isApprox(T, 1e-3));
+		}
+		solved += spaceOk && bodyOk;
+		if (mr::IKinSpace(Slist, M, T, unbounded, 1e-3f, 1e-4f)) {
+			unboundedInside += (unbounded.array() >= lower.array()).all() && (unbounded.array() <= upper.array()).all();
+			if (spaceOk) {
+				boundedOffset += space.tail(6).norm();
+				unboundedOffset += unbounded.tail(6).norm();
+			}
+		}
+	}
+	ASSERT_GE(solved, 90);
+	ASSERT_GT(solved, unboundedInside);
+	// The spare joint keeps the limited joints nearer the middle of their range
+	ASSERT_LT(boundedOffset, unboundedOffset);
+}
+
+TEST(MRTest, ResolvedRateControllerTest) {
+	Eigen::MatrixXf Slist(6, 7);
+	for (int i = 0; i < 7; i++)
+		Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f(0, 0, 0.3f * i), i % 2 ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(0, 0, 1), 0);
+	Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0, 0, 2.1f));
+	float dt = 0.002f;
+	mr::ResolvedRateController controller(M, Slist, dt, 5, 0.01f);
+	Eigen::VectorXf maxVelocity = Eigen::VectorXf::Constant(7, 1.0f), maxAcceleration = Eigen::VectorXf::Constant(7, 5.0f);
+	controller.SetLimits(maxVelocity, maxAcceleration);
+
+	Eigen::VectorXf goal(7), thetalist(7);
+	goal << 0.3, 0.5, -0.2, 0.8, 0.1, -0.6, 0.4;
+	thetalist << 0.1, 0.2, 0.1, 0.4, 0.3, -0.2, 0.0;
+	Eigen::Matrix4f Tsd = mr::FKinSpace(M, Slist, goal);
+	Eigen::VectorXf previous = Eigen::VectorXf::Zero(7);
+	for (int tick = 0; tick < 2000; tick++) {
+		const Eigen::VectorXf& dthetalist = controller.Step(thetalist, Tsd);
+		ASSERT_TRUE((dthetalist.cwiseAbs().array() <= maxVelocity.array() + 1e-5f).all());
+		ASSERT_TRUE(((dthetalist - previous).cwiseAbs().array() <= maxAcceleration.array() * dt + 1e-5f).all());
+		previous = dthetalist;
+		thetalist += dt * dthetalist;
+	}
+	ASSERT_LT(controller.Error().norm(), 1e-3);
+	ASSERT_TRUE(mr::FKinSpace(M, Slist, thetalist).isApprox(Tsd, 1e-3));
+
+	// The error twist is the one IKinSpace steps along
+	Eigen::MatrixXf Tfk = mr::FKinSpace(M, Slist, 0.5f * thetalist);
+	controller.Reset();
+	controller.Step(0.5f * thetalist, Tsd);
+	Eigen::VectorXf Vs = mr::Adjoint(Tfk) * mr::se3ToVec(mr::MatrixLog6(mr::TransInv(Tfk) * Tsd));
+	ASSERT_TRUE(controller.Error().isApprox(Vs, 1e-4));
+}
+
+/* A three-link arm in a vertical plane, joints about y, half-metre links of unit mass */
+static void PlanarArm(std::vector<Eigen::MatrixXf>& Mlist, std::vector<Eigen::MatrixXf>& Glist, Eigen::MatrixXf& Slist) {
+	Mlist.clear();
+	Glist.clear();
+	Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.25f, 0, 0)));
+	Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.5f, 0, 0)));
+	Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.5f, 0, 0)));
+	Mlist.push_back(mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.25f, 0, 0)));
+	Eigen::VectorXf G(6);
+	G << 0.02f, 0.02f, 0.02f, 1, 1, 1;
+	for (int i = 0; i < 3; i++)
+		Glist.push_back(G.asDiagonal());
+	Slist.resize(6, 3);
+	for (int i = 0; i < 3; i++)
+		Slist.col(i) = mr::ScrewToAxis(Eigen::Vector3f(0.5f * i, 0, 0), Eigen::Vector3f(0, 1, 0), 0);
+}
+
+TEST(MRTest, MPPIControllerTest) {
+	std::vector<Eigen::MatrixXf> Mlist, Glist;
+	Eigen::MatrixXf Slist;
+	PlanarArm(Mlist, Glist, Slist);
+	Eigen::Vector3f g(0, 0, -9.8f);
+	float dt = 0.01f;
+	int horizon = 30, steps = 200;
+	Eigen::MatrixXf reference = mr::JointTrajectory(Eigen::VectorXf::Zero(3), Eigen::VectorXf::Constant(3, 0.8f), 1.0f, 101, 5);
+	Eigen::MatrixXf window(horizon + 1, 3);
+	Eigen::VectorXf start(3);
+	start << 0.2f, -0.2f, 0.1f;
+
+	// Tracking error from a disturbed start, with and without the sampled correction
+	float error[2];
+	Eigen::MatrixXf taus[2];
+	for (int k = 0; k < 2; k++) {
+		mr::ThreadPool pool(3);
+		mr::MPPIController controller(g, Mlist, Glist, Slist, dt, horizon, 128, pool);
+		controller.SetNoise((k ? 1.0f : 1e-6f) * Eigen::Vector3f(1, 0.4f, 0.1f));
+		controller.SetCost(100, 1, 0);
+		Eigen::VectorXf thetalist = start, dthetalist = Eigen::VectorXf::Zero(3);
+		error[k] = 0;
+		taus[k].resize(steps, 3);
+		for (int step = 0; step < steps; step++) {
+			for (int j = 0; j <= horizon; j++)
+				window.row(j) = reference.row(std::min(step + j, 100));
+			taus[k].row(step) = controller.Step(thetalist, dthetalist, window).transpose();
+			Eigen::VectorXf ddthetalist = mr::ForwardDynamics(thetalist, dthetalist, taus[k].row(step).transpose(), g,
+				Eigen::VectorXf::Zero(6), Mlist, Glist, Slist);
+			mr::EulerStep(thetalist, dthetalist, ddthetalist, dt);
+			error[k] += (thetalist.transpose() - reference.row(std::min(step + 1, 100))).squaredNorm();
+		}
+	}
+	ASSERT_LT(error[1], 0.5f * error[0]);
+
+	// With a fixed seed the torques do not depend on the number of threads
+	for (int threads = 1; threads <= 4; threads += 3) {
+		mr::ThreadPool pool(threads);
+		mr::MPPIController controller(g, Mlist, Glist, Slist, dt, horizon, 128, pool);
+		controller.SetNoise(Eigen::Vector3f(1, 0.4f, 0.1f));
+		controller.SetCost(100, 1, 0);
+		Eigen::VectorXf thetalist = start, dthetalist = Eigen::VectorXf::Zero(3);
+		for (int step = 0; step < 20; step++) {
+			for (int j = 0; j <= horizon; j++)
+				window.row(j) = reference.row(std::min(step + j, 100));
+			Eigen::VectorXf taulist = controller.Step(thetalist, dthetalist, window);
+			ASSERT_TRUE(taulist.transpose() == taus[1].row(step));
+			Eigen::VectorXf ddthetalist = mr::ForwardDynamics(thetalist, dthetalist, taulist, g,
+				Eigen::VectorXf::Zero(6), Mlist, Glist, Slist);
+			mr::EulerStep(thetalist, dthetalist, ddthetalist, dt);
+		}
+	}
+}
+
+TEST(MRTest, ILQROptimizerTest) {
+	std::vector<Eigen::MatrixXf> Mlist, Glist;
+	Eigen::MatrixXf Slist;
+	PlanarArm(Mlist, Glist, Slist);
+	Eigen::Vector3f g(0, 0, -9.8f);
+	float dt = 0.01f;
+	int N = 101;
+	Eigen::MatrixXf reference = mr::JointTrajectory(Eigen::VectorXf::Zero(3), Eigen::VectorXf::Constant(3, 0.8f), 1.0f, N, 5);
+	Eigen::VectorXf thetalist(3), dthetalist = Eigen::VectorXf::Zero(3);
+	thetalist << 0.3f, -0.3f, 0.1f;
+
+	mr::ThreadPool pool(3);
+	mr::ILQROptimizer optimizer(g, Mlist, Glist, Slist, dt, pool);
+	ASSERT_FALSE(optimizer.Optimize(thetalist, dthetalist, reference, 0));
+	float initial = optimizer.Cost();
+	ASSERT_TRUE(optimizer.Optimize(thetalist, dthetalist, reference));
+	ASSERT_LT(optimizer.Cost(), 0.5f * initial);
+	ASSERT_LT((optimizer.Positions().row(N - 1) - reference.row(N - 1)).norm(), 1e-2);
+
+	// The torques reproduce the states through ForwardDynamics and EulerStep
+	Eigen::VectorXf q = thetalist, dq = dthetalist;
+	for (int k = 0; k + 1 < N; k++) {
+		Eigen::VectorXf ddq = mr::ForwardDynamics(q, dq, optimizer.Torques().row(k).transpose(), g, Eigen::VectorXf::Zero(6),
+			Mlist, Glist, Slist);
+		ASSERT_TRUE(ddq.transpose().isApprox(optimizer.Accelerations().row(k), 1e-4));
+		mr::EulerStep(q, dq, ddq, dt);
+	}
+	ASSERT_TRUE(q.transpose().isApprox(optimizer.Positions().row(N - 1), 1e-4));
+	ASSERT_TRUE(optimizer.Accelerations().row(N - 1).isZero(1e-3));
+
+	// and serve as the reference of SimulateControl
+	Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+	std::vector<Eigen::MatrixXf> traj = mr::SimulateControl(thetalist, dthetalist, g, Ftipmat, Mlist, Glist, Slist,
+		optimizer.Positions(), optimizer.Velocities(), optimizer.Accelerations(), g, Mlist, Glist, 20, 10, 18, dt, 1);
+	// (row k of its result is the state after step k)
+	ASSERT_LT((traj[1].topRows(N - 1) - optimizer.Positions().bottomRows(N - 1)).cwiseAbs().maxCoeff(), 1e-2);
+
+	// A custom cost: reach a goal at the end with the least torque above gravity
+	Eigen::VectorXf goal(3);
+	goal << 0.5f, -0.4f, 0.2f;
+	mr::ILQROptimizer::CostFunction cost = [&](int k, const Eigen::VectorXf& x, const Eigen::VectorXf& u,
+		mr::ILQROptimizer::CostExpansion* expansion) {
+		if (k == N - 1) {
+			Eigen::VectorXf e(6);
+			e << x.head(3) - goal, x.tail(3);
+			if (expansion) {
+				expansion->lx += 2000 * e;
+				expansion->lxx.diagonal().array() += 2000;
+			}
+			return 1000 * e.squaredNorm();
+		}
+		if (expansion) {
+			expansion->lu += 2e-3f * u;
+			expansion->luu.diagonal().array() += 2e-3f;
+		}
+		return 1e-3f * u.squaredNorm();
+	};
+	optimizer.SetCost(cost);
+	optimizer.Optimize(thetalist, dthetalist, reference, 200);
+	ASSERT_LT((optimizer.Positions().row(N - 1).transpose() - goal).norm(), 1e-2);
+	ASSERT_LT(optimizer.Velocities().row(N - 1).norm(), 5e-2);
+
+	// The result does not depend on the number of threads
+	mr::ThreadPool serial(1);
+	mr::ILQROptimizer single(g, Mlist, Glist, Slist, dt, serial);
+	single.SetCost(cost);
+	single.Optimize(thetalist, dthetalist, reference, 200);
+	ASSERT_TRUE(single.Torques() == optimizer.Torques());
+}
+
+TEST(MRTest, CartesianTorquePipelineTest) {
+	std::vector<Eigen::MatrixXf> Mlist, Glist;
+	Eigen::MatrixXf Slist;
+	PlanarArm(Mlist, Glist, Slist);
+	Eigen::MatrixXf M = mr::RpToTrans(Eigen::Matrix3f::Identity(), Eigen::Vector3f(1.5f, 0, 0));
+	Eigen::VectorXf g(3);
+	g << 0, 0, -9.8f;
+	Eigen::VectorXf thetastart(3), thetaend(3);
+	thetastart << 0.3f, -0.5f, 0.4f;
+	thetaend << 0.6f, -0.9f, 0.2f;
+	Eigen::MatrixXf Xstart = mr::FKinSpace(M, Slist, thetastart);
+	Eigen::MatrixXf Xend = mr::FKinSpace(M, Slist, thetaend);
+	float Tf = 2;
+	int N = 300;
+
+	// The same chain run one stage at a time over stored matrices
+	std::vector<Eigen::MatrixXf> poses = mr::CartesianTrajectory(Xstart, Xend, Tf, N, 5);
+	Eigen::MatrixXf thetamat(N + 2, 3);
+	Eigen::VectorXf thetalist = thetastart;
+	for (int k = 0; k < N; k++) {
+		ASSERT_TRUE(mr::IKinSpace(Slist, M, poses[k], thetalist, 1e-4f, 1e-5f));
+		thetamat.row(k + 1) = thetalist.transpose();
+	}
+	thetamat.row(0) = thetamat.row(2);
+	thetamat.row(N + 1) = thetamat.row(N - 1);
+	float dt = Tf / (N - 1);
+	Eigen::MatrixXf dthetamat = (thetamat.bottomRows(N) - thetamat.topRows(N)) / (2 * dt);
+	Eigen::MatrixXf ddthetamat = (thetamat.bottomRows(N) - 2 * thetamat.middleRows(1, N) + thetamat.topRows(N)) / (dt * dt);
+	Eigen::MatrixXf taumat = mr::InverseDynamicsTrajectory(thetamat.middleRows(1, N), dthetamat, ddthetamat, g,
+		Eigen::MatrixXf::Zero(N, 6), Mlist, Glist, Slist);
+
+	int expected = 0;
+	mr::TrajectorySink sink = [&](int k, const Eigen::VectorXf& theta, const Eigen::VectorXf& dtheta,
+		const Eigen::VectorXf& ddtheta, const Eigen::VectorXf& tau) {
+		ASSERT_EQ(k, expected++);
+		ASSERT_TRUE(theta.transpose().isApprox(thetamat.row(k + 1), 1e-4));
+		ASSERT_TRUE(dtheta.transpose().isApprox(dthetamat.row(k), 1e-4));
+		ASSERT_TRUE(ddtheta.transpose().isApprox(ddthetamat.row(k), 1e-4));
+		ASSERT_TRUE(tau.transpose().isApprox(taumat.row(k), 1e-3));
+	};
+	ASSERT_TRUE(mr::CartesianTorquePipeline(Xstart, Xend, Tf, N, 5, thetastart, M, Slist, 1e-4f, 1e-5f, g, Mlist, Glist, sink, 2));
+	ASSERT_EQ(expected, N);
+	// Rest to rest
+	ASSERT_TRUE(dthetamat.row(0).isZero(1e-6));
+
+	// An exception from the sink stops the pipeline
+	mr::TrajectorySink failing = [](int k, const Eigen::VectorXf&, const Eigen::VectorXf&, const Eigen::VectorXf&,
+		const Eigen::VectorXf&) {
+		if (k == 100)
+			throw std::runtime_error("stop");
+	};
+	ASSERT_THROW(mr::CartesianTorquePipeline(Xstart, Xend, Tf, 100000, 5, thetastart, M, Slist, 1e-4f, 1e-5f, g, Mlist, Glist,
+		failing, 2), std::runtime_error);
+}
+
+TEST(MRTest, CartesianSamplesTest) {
+	Eigen::MatrixXf Xstart = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(0.3f, -0.2f, 0.5f))),
+		Eigen::Vector3f(1, 0, 1));
+	Eigen::MatrixXf Xend = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(-1.2f, 0.8f, 1.9f))),
+		Eigen::Vector3f(0.1f, 0.4f, 2));
+	Eigen::MatrixXf Xturn = mr::RpToTrans(mr::RotInv(mr::TransToRp(Xstart)[0]), Eigen::Vector3f(0, 0, 0));
+	float Tf = 2;
+	int N = 201;
+	float dt = Tf / (N - 1);
+	mr::CartesianSamples samples;
+	for (int method = 3; method <= 5; method += 2) {
+		for (int end = 0; end < 3; end++) {
+			// A general rotation, none at all, and Rstart^T twice over
+			Eigen::MatrixXf Xe = end == 0 ? Xend : end == 1 ? Eigen::MatrixXf(Xstart) : Xturn;
+			mr::CartesianTrajectory(Xstart, Xe, Tf, N, method, samples, true);
+			ASSERT_EQ(samples.positions.rows(), N);
+			Eigen::Quaternionf qstart(Eigen::Matrix3f(Xstart.topLeftCorner(3, 3)));
+			Eigen::Quaternionf qend(Eigen::Matrix3f(Xe.topLeftCorner(3, 3)));
+			for (int i = 0; i < N; i++) {
+				float st = method == 3 ? mr::CubicTimeScaling(Tf, dt * i) : mr::QuinticTimeScaling(Tf, dt * i);
+				Eigen::Quaternionf q(samples.quaternions(i, 0), samples.quaternions(i, 1), samples.quaternions(i, 2),
+					samples.quaternions(i, 3));
+				ASSERT_NEAR(std::abs(q.dot(qstart.slerp(st, qend))), 1, 1e-5);
+				Eigen::Vector3f p = st * Xe.topRightCorner(3, 1) + (1 - st) * Xstart.topRightCorner(3, 1);
+				ASSERT_LT((samples.positions.row(i).transpose() - p).norm(), 1e-5);
+				if (i == 0 || i == N - 1) {
+					ASSERT_TRUE(samples.linearVelocities.row(i).isZero(1e-5));
+					ASSERT_TRUE(samples.angularVelocities.row(i).isZero(1e-5));
+					continue;
+				}
+				// Against central differences of the neighbouring samples
+				Eigen::Vector3f v = (samples.positions.row(i + 1) - samples.positions.row(i - 1)).transpose() / (2 * dt);
+				ASSERT_LT((samples.linearVelocities.row(i).transpose() - v).norm(), 1e-2);
+				Eigen::Quaternionf qprev(samples.quaternions(i - 1, 0), samples.quaternions(i - 1, 1),
+					samples.quaternions(i - 1, 2), samples.quaternions(i - 1, 3));
+				Eigen::Quaternionf qnext(samples.quaternions(i + 1, 0), samples.quaternions(i + 1, 1),
+					samples.quaternions(i + 1, 2), samples.quaternions(i + 1, 3));
+				Eigen::AngleAxisf delta(qnext * qprev.conjugate());
+				Eigen::Vector3f w = delta.angle() * delta.axis() / (2 * dt);
+				ASSERT_LT((samples.angularVelocities.row(i).transpose() - w).norm(), 1e-2);
+			}
+		}
+	}
+
+	// Without velocities, which stay empty
+	mr::CartesianTrajectory(Xstart, Xend, Tf, 5, 5, samples);
+	ASSERT_EQ(samples.quaternions.rows(), 5);
+	ASSERT_EQ(samples.angularVelocities.rows(), 0);
+}
+
+TEST(MRTest, SE3SplineTest) {
+	// Control poses along one screw motion: the spline moves at its constant twist
+	Eigen::VectorXf Omega(6);
+	Omega << 0.2f, -0.1f, 0.3f, 0.5f, 0.1f, -0.2f;
+	Eigen::MatrixXf T0 = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(0.4f, 0.1f, -0.3f))), Eigen::Vector3f(1, 2, 0));
+	std::vector<Eigen::MatrixXf> controls;
+	for (int j = 0; j < 6; j++)
+		controls.push_back(T0 * mr::MatrixExp6(mr::VecTose3(j * Omega)));
+	float dt = 0.5f;
+	mr::SE3Spline screw(controls, dt, 1);
+	ASSERT_NEAR(screw.StartTime(), 1, 1e-6);
+	ASSERT_NEAR(screw.EndTime(), 2.5f, 1e-6);
+	Eigen::Matrix<float, 6, 1> Vb, dVb;
+	for (float t = 1; t <= 2.5f; t += 0.1f) {
+		Eigen::Matrix4f T = screw.Evaluate(t, Vb, dVb);
+		// B1 + B2 + B3 = 1 + 3u at u, one increment past T_i
+		ASSERT_TRUE(T.isApprox(T0 * mr::MatrixExp6(mr::VecTose3((1 + 2 * (t - 1)) * Omega)), 1e-4));
+		ASSERT_TRUE(Vb.isApprox(Omega / dt, 1e-4));
+		ASSERT_TRUE(dVb.isZero(1e-4));
+	}
+
+	// General control poses: the twist and its rate against differences, and continuity at the knots
+	std::srand(7);
+	controls.clear();
+	for (int j = 0; j < 8; j++)
+		controls.push_back(mr::MatrixExp6(mr::VecTose3(Eigen::VectorXf::Random(6))));
+	mr::SE3Spline spline(controls, dt);
+	const float h = 1e-2f;
+	Eigen::Matrix<float, 6, 1> Vplus, Vminus, dVplus, dVminus;
+	for (float t = 0.05f; t < spline.EndTime() - 0.05f; t += 0.07f) {
+		Eigen::Matrix4f T = spline.Evaluate(t, Vb, dVb);
+		Eigen::Matrix4f Tplus = spline.Evaluate(t + h, Vplus, dVplus);
+		Eigen::Matrix4f Tminus = spline.Evaluate(t - h, Vminus, dVminus);
+		ASSERT_TRUE(T.isApprox(spline.Evaluate(t), 1e-6));
+		Eigen::VectorXf V = mr::se3ToVec(mr::MatrixLog6(mr::TransInv(Tminus) * Tplus)) / (2 * h);
+		ASSERT_LT((V - Vb).norm(), 2e-2 * (1 + Vb.norm()));
+		ASSERT_LT((dVb - (Vplus - Vminus) / (2 * h)).norm(), 2e-2 * (1 + dVb.norm()));
+	}
+	for (int knot = 1; knot < 5; knot++) {
+		float t = knot * dt;
+		Eigen::Matrix4f Tplus = spline.Evaluate(t + 1e-4f, Vplus, dVplus);
+		Eigen::Matrix4f Tminus = spline.Evaluate(t - 1e-4f, Vminus, dVminus);
+		ASSERT_TRUE(Tplus.isApprox(Tminus, 1e-3));
+		ASSERT_LT((Vplus - Vminus).norm(), 1e-2 * (1 + Vplus.norm()));
+		ASSERT_LT((dVplus - dVminus).norm(), 1e-2 * (1 + dVplus.norm()));
+	}
+
+	// Batch evaluation into arrays
+	Eigen::VectorXf times = Eigen::VectorXf::LinSpaced(50, 0, spline.EndTime());
+	mr::CartesianSamples samples;
+	spline.Evaluate(times, samples, true);
+	for (int k = 0; k < 50; k++) {
+		Eigen::Matrix4f T = spline.Evaluate(times(k), Vb, dVb);
+		Eigen::Quaternionf q(samples.quaternions(k, 0), samples.quaternions(k, 1), samples.quaternions(k, 2), samples.quaternions(k, 3));
+		ASSERT_TRUE(q.toRotationMatrix().isApprox(T.topLeftCorner<3, 3>(), 1e-5));
+		ASSERT_TRUE(samples.positions.row(k).transpose().isApprox(T.topRightCorner<3, 1>(), 1e-5));
+		ASSERT_TRUE(samples.angularVelocities.row(k).transpose().isApprox(T.topLeftCorner<3, 3>() * Vb.head<3>(), 1e-5));
+		ASSERT_TRUE(samples.linearVelocities.row(k).transpose().isApprox(T.topLeftCorner<3, 3>() * Vb.tail<3>(), 1e-5));
+		if (k > 0) {
+			ASSERT_GT(samples.quaternions.row(k).dot(samples.quaternions.row(k - 1)), 0);
+		}
+	}
+
+	// Fitting a dense log of the spline recovers it
+	int S = 200;
+	Eigen::VectorXf logTimes = Eigen::VectorXf::LinSpaced(S, 0, spline.EndTime());
+	std::vector<Eigen::MatrixXf> log(S);
+	for (int k = 0; k < S; k++)
+		log[k] = spline.Evaluate(logTimes(k));
+	mr::SE3Spline fitted = mr::SE3Spline::Fit(log, logTimes, dt);
+	ASSERT_EQ(fitted.Controls().size(), controls.size());
+	for (int k = 0; k < S; k++)
+		ASSERT_TRUE(fitted.Evaluate(logTimes(k)).isApprox(log[k], 1e-3));
+}
+
+TEST(MRTest, SimdVariantTest) {
+	std::vector<std::string> variants = mr::SupportedSimdVariants();
+	ASSERT_FALSE(variants.empty());
+	ASSERT_EQ("baseline", variants.back());
+	ASSERT_EQ(variants.front(), mr::SimdVariant());
+	ASSERT_FALSE(mr::SetSimdVariant("mmx"));
+	ASSERT_EQ(variants.front(), mr::SimdVariant());
+
+	std::srand(72);
+	const int count = 200;
+	Eigen::MatrixXf expc3 = Eigen::MatrixXf::Random(3, count);
+	expc3.col(0).setZero();
+	expc3.col(1) *= 1e-7f;
+	expc3.col(2) *= 3;
+	std::vector<float> poses(16 * count);
+	for (int i = 0; i < count; i++) {
+		Eigen::Matrix4f T = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(expc3.col(i))), Eigen::Vector3f::Random());
+		if (i % 3 == 1)
+			T.topLeftCorner<3, 3>() += 0.01f * Eigen::Matrix3f::Random();
+		else if (i % 3 == 2)
+			T.col(0) *= -1;
+		std::copy(T.data(), T.data() + 16, &poses[16 * i]);
+	}
+	Eigen::MatrixXf Xstart = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(0.3f, -0.2f, 0.5f))), Eigen::Vector3f(1, 0, 1));
+	Eigen::MatrixXf Xend = mr::RpToTrans(mr::MatrixExp3(mr::VecToso3(Eigen::Vector3f(-1.2f, 0.8f, 1.9f))), Eigen::Vector3f(0, 1, 2));
+	std::vector<Eigen::MatrixXf> screw = mr::ScrewTrajectory(Xstart, Xend, 2, 101, 3);
+	Eigen::VectorXf thetastart(2), thetaend(2);
+	thetastart << 1, -2;
+	thetaend << 0.5f, 3;
+
+	// Every variant this processor runs against the Eigen functions
+	for (std::size_t v = 0; v < variants.size(); v++) {
+		ASSERT_TRUE(mr::SetSimdVariant(variants[v]));
+		ASSERT_EQ(variants[v], mr::SimdVariant());
+
+		Eigen::MatrixXf R(3, 3 * count);
+		mr::MatrixExp3Batch(expc3.data(), count, R.data());
+		for (int i = 0; i < count; i++)
+			ASSERT_LT((R.middleCols(3 * i, 3) - mr::MatrixExp3(mr::VecToso3(expc3.col(i)))).norm(), 1e-5);
+
+		std::vector<float> distances(count);
+		std::vector<std::uint64_t> valid(4);
+		std::size_t passed = mr::DistanceToSE3Batch(poses.data(), count, distances.data(), valid.data());
+		std::size_t expected = 0;
+		for (int i = 0; i < count; i++) {
+			Eigen::Map<const Eigen::Matrix4f> T(&poses[16 * i]);
+			ASSERT_NEAR(mr::DistanceToSE3(T), distances[i], 1e-5);
+			ASSERT_EQ(mr::TestIfSE3(T), static_cast<bool>((valid[i / 64] >> (i % 64)) & 1));
+			expected += mr::TestIfSE3(T);
+		}
+		ASSERT_EQ(expected, passed);
+
+		mr::CartesianSamples samples;
+		mr::CartesianTrajectory(Xstart, Xend, 2, 101, 3, samples, true);
+		for (int i = 0; i < 101; i += 10) {
+			// The shorter way round, so that screw and slerp agree on the rotation
+			Eigen::Quaternionf q(samples.quaternions(i, 0), samples.quaternions(i, 1), samples.quaternions(i, 2), samples.quaternions(i, 3));
+			ASSERT_NEAR(1, q.norm(), 1e-5);
+			ASSERT_TRUE(q.toRotationMatrix().isApprox(screw[i].topLeftCorner(3, 3), 1e-4));
+		}
+		Eigen::MatrixXf traj = mr::JointTrajectory(thetastart, thetaend, 4, 9, 5);
+		for (int i = 0; i < 9; i++) {
+			float s = mr::QuinticTimeScaling(4, 0.5f * i);
+			ASSERT_TRUE(traj.row(i).transpose().isApprox(thetastart + s * (thetaend - thetastart), 1e-5));
+		}
+	}
+	ASSERT_TRUE(mr::SetSimdVariant(variants.front()));
+}
+
+TEST(MRTest, MixedPrecisionTest) {
+	std::vector<Eigen::MatrixXf> Mlist, Glist;
+	Eigen::MatrixXf Slist;
+	PlanarArm(Mlist, Glist, Slist);
+	std::vector<Eigen::MatrixXd> Mlistd, Glistd;
+	for (std::size_t i = 0; i < Mlist.size(); i++)
+		Mlistd.push_back(Mlist[i].cast<double>());
+	for (std::size_t i = 0; i < Glist.size(); i++)
+		Glistd.push_back(Glist[i].cast<double>());
+	Eigen::MatrixXd Slistd = Slist.cast<double>();
+	Eigen::Vector3f g(0, 0, -9.8f);
+	Eigen::VectorXf thetalist(3), dthetalist = Eigen::VectorXf::Zero(3);
+	thetalist << 0.1f, -0.2f, 0.3f;
+
+	// 5000 small steps under gravity and a slowly varying torque, against the double implementation
+	int N = 5000;
+	float dt = 1.0f / N;
+	Eigen::VectorXf gravity = mr::GravityForces(thetalist, g, Mlist, Glist, Slist);
+	Eigen::MatrixXf taumat(N, 3);
+	for (int k = 0; k < N; k++)
+		taumat.row(k) = (1 + 0.1f * std::sin(3.0f * k * dt)) * gravity.transpose();
+	Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+	std::vector<Eigen::MatrixXd> reference = mr_reference::ForwardDynamicsTrajectory(thetalist.cast<double>(),
+		dthetalist.cast<double>(), taumat.cast<double>(), Eigen::VectorXd(g.cast<double>()), Ftipmat.cast<double>(),
+		Mlistd, Glistd, Slistd, dt, 1);
+	std::vector<Eigen::MatrixXf> single = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, dt, 1);
+	std::vector<Eigen::MatrixXf> mixed = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, dt, 1, mr::StatePrecision::Mixed);
+	double singleError = (single[0].cast<double>() - reference[0]).cwiseAbs().maxCoeff();
+	double mixedError = (mixed[0].cast<double>() - reference[0]).cwiseAbs().maxCoeff();
+	ASSERT_LT(mixedError, 5e-7);
+	ASSERT_LT(5 * mixedError, singleError);
+	ASSERT_LT((mixed[1].cast<double>() - reference[1]).cwiseAbs().maxCoeff(), 5e-6);
+
+	// Tracking a joint trajectory with a model error, the error integral included
+	N = 2000;
+	dt = 1.0f / N;
+	Eigen::MatrixXf thetamatd = mr::JointTrajectory(thetalist, Eigen::VectorXf::Constant(3, 0.5f), 1, N, 5);
+	Eigen::MatrixXf dthetamatd = Eigen::MatrixXf::Zero(N, 3), ddthetamatd = Eigen::MatrixXf::Zero(N, 3);
+	std::vector<Eigen::MatrixXf> Gtildelist;
+	for (std::size_t i = 0; i < Glist.size(); i++)
+		Gtildelist.push_back(1.1f * Glist[i]);
+	std::vector<Eigen::MatrixXd> Gtildelistd;
+	for (std::size_t i = 0; i < Gtildelist.size(); i++)
+		Gtildelistd.push_back(Gtildelist[i].cast<double>());
+	Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+	float Kp = 20, Ki = 10, Kd = 18;
+	std::vector<Eigen::MatrixXd> referenceControl = mr_reference::SimulateControl(thetalist.cast<double>(),
+		dthetalist.cast<double>(), Eigen::VectorXd(g.cast<double>()), Ftipmat.cast<double>(), Mlistd, Glistd, Slistd,
+		thetamatd.cast<double>(), dthetamatd.cast<double>(), ddthetamatd.cast<double>(), Eigen::VectorXd(g.cast<double>()),
+		Mlistd, Gtildelistd, Kp, Ki, Kd, dt, 1);
+	std::vector<Eigen::MatrixXf> singleControl = mr::SimulateControl(thetalist, dthetalist, g, Ftipmat, Mlist, Glist, Slist,
+		thetamatd, dthetamatd, ddthetamatd, g, Mlist, Gtildelist, Kp, Ki, Kd, dt, 1);
+	std::vector<Eigen::MatrixXf> mixedControl = mr::SimulateControl(thetalist, dthetalist, g, Ftipmat, Mlist, Glist, Slist,
+		thetamatd, dthetamatd, ddthetamatd, g, Mlist, Gtildelist, Kp, Ki, Kd, dt, 1, mr::StatePrecision::Mixed);
+	singleError = (singleControl[1].cast<double>() - referenceControl[1]).cwiseAbs().maxCoeff();
+	mixedError = (mixedControl[1].cast<double>() - referenceControl[1]).cwiseAbs().maxCoeff();
+	ASSERT_LT(mixedError, 2e-7);
+	ASSERT_LT(5 * mixedError, singleError);
+}
+
+TEST(MRTest, PararealTest) {
+	std::vector<Eigen::MatrixXf> Mlist, Glist;
+	Eigen::MatrixXf Slist;
+	PlanarArm(Mlist, Glist, Slist);
+	Eigen::Vector3f g(0, 0, -9.8f);
+	Eigen::VectorXf thetalist(3), dthetalist(3);
+	thetalist << 0.1f, -0.2f, 0.3f;
+	dthetalist << 0.2f, 0, -0.1f;
+	int N = 801;
+	float dt = 0.002f;
+	Eigen::MatrixXf taumat(N, 3);
+	for (int k = 0; k < N; k++)
+		taumat.row(k) << std::sin(2.0f * k * dt), 0.5f * std::cos(3.0f * k * dt), 0.2f;
+	Eigen::MatrixXf Ftipmat = Eigen::MatrixXf::Zero(N, 6);
+	std::vector<Eigen::MatrixXf> serial = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, dt, 4);
+
+	// More slices than threads, so that the iteration runs whatever the machine
+	mr::ThreadPool pool(2);
+	int iterations = 0;
+	std::vector<Eigen::MatrixXf> exact = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, dt, 4, pool, 0, 8, 2, &iterations);
+	ASSERT_TRUE(exact[0] == serial[0]);
+	ASSERT_TRUE(exact[1] == serial[1]);
+	ASSERT_LE(iterations, 8);
+
+	std::vector<Eigen::MatrixXf> converged = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, dt, 4, pool, 1e-4f, 8, 2, &iterations);
+	ASSERT_LT(iterations, 8);
+	ASSERT_LT((converged[0] - serial[0]).cwiseAbs().maxCoeff(), 2e-5);
+	ASSERT_LT((converged[1] - serial[1]).cwiseAbs().maxCoeff(), 2e-4);
+
+	// A single slice is the serial integration
+	std::vector<Eigen::MatrixXf> single = mr::ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat,
+		Mlist, Glist, Slist, dt, 4, pool, 1e-5f, 1);
+	ASSERT_TRUE(single[0] == serial[0]);
+}
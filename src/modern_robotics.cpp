@@ -1,4 +1,5 @@
 #include "../include/modern_robotics.h"
+#include "simd_kernels.h"
 
 /*
  * modernRobotics.cpp
@@ -6,21 +7,33 @@
  * Provides useful Jacobian and frame representation functions
  */
 #include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <random>
+#include <thread>
 #include <vector>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
 # define M_PI           3.14159265358979323846  /* pi */
 
 namespace mr {
 
-	/* Function: Find if the value is negligible enough to consider 0
-	 * Inputs: value to be checked as a float
-	 * Returns: Boolean of true-ignore or false-can't ignore
-	 */
-	bool NearZero(const float val) {
-		return (std::abs(val) < .000001);
-	}
-
 	/*
 	 * Function: Calculate the 6x6 matrix [adV] of the given 6-vector
 	 * Input: Eigen::VectorXf (6x1)
@@ -51,30 +64,6 @@ namespace mr {
 	}
 
 
-	/* Function: Returns the skew symmetric matrix representation of an angular velocity vector
-	 * Input: Eigen::Vector3f 3x1 angular velocity vector
-	 * Returns: Eigen::MatrixXf 3x3 skew symmetric matrix
-	 */
-	Eigen::Matrix3f VecToso3(const Eigen::Vector3f& omg) {
-		Eigen::Matrix3f m_ret;
-		m_ret << 0, -omg(2), omg(1),
-			omg(2), 0, -omg(0),
-			-omg(1), omg(0), 0;
-		return m_ret;
-	}
-
-
-	/* Function: Returns angular velocity vector represented by the skew symmetric matrix
-	 * Inputs: Eigen::MatrixXf 3x3 skew symmetric matrix
-	 * Returns: Eigen::Vector3f 3x1 angular velocity
-	 */
-	Eigen::Vector3f so3ToVec(const Eigen::MatrixXf& so3mat) {
-		Eigen::Vector3f v_ret;
-		v_ret << so3mat(2, 1), so3mat(0, 2), so3mat(1, 0);
-		return v_ret;
-	}
-
-
 	/* Function: Translates an exponential rotation into it's individual components
 	 * Inputs: Exponential rotation (rotation matrix in terms of a rotation axis
 	 *				and the angle of rotation)
@@ -106,6 +95,126 @@ namespace mr {
 	}
 
 
+	namespace {
+
+		/* The processor features each kernel variant needs */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+		bool SupportsSSE4() {
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse4.2");
+		}
+
+		bool SupportsAVX2() {
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		}
+
+		bool SupportsAVX512() {
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx512f");
+		}
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		/* The OS saves the register state in mask on context switches */
+		bool OSSavesState(unsigned long long mask) {
+			int r[4];
+			__cpuid(r, 1);
+			return ((r[2] >> 27) & 1) && (_xgetbv(0) & mask) == mask;
+		}
+
+		bool SupportsSSE4() {
+			int r[4];
+			__cpuid(r, 1);
+			return (r[2] >> 20) & 1;
+		}
+
+		bool SupportsAVX2() {
+			int r[4];
+			__cpuid(r, 1);
+			bool fma = (r[2] >> 12) & 1;
+			__cpuidex(r, 7, 0);
+			return fma && ((r[1] >> 5) & 1) && OSSavesState(0x6);
+		}
+
+		bool SupportsAVX512() {
+			int r[4];
+			__cpuidex(r, 7, 0);
+			return ((r[1] >> 16) & 1) && OSSavesState(0xe6);
+		}
+#else
+		bool SupportsSSE4() { return false; }
+		bool SupportsAVX2() { return false; }
+		bool SupportsAVX512() { return false; }
+#endif
+		bool SupportsBaseline() { return true; }
+
+		struct SimdVariantEntry {
+			const SimdKernelTable& (*table)();
+			bool (*supported)();
+		};
+
+		/* The variants compiled in, widest first */
+		const SimdVariantEntry simdVariants[] = {
+#ifdef MR_SIMD_AVX512
+			{ SimdKernelsAVX512, SupportsAVX512 },
+#endif
+#ifdef MR_SIMD_AVX2
+			{ SimdKernelsAVX2, SupportsAVX2 },
+#endif
+#ifdef MR_SIMD_SSE4
+			{ SimdKernelsSSE4, SupportsSSE4 },
+#endif
+			{ SimdKernelsBaseline, SupportsBaseline }
+		};
+
+		const SimdKernelTable* DetectKernels() {
+			for (const SimdVariantEntry& variant : simdVariants) {
+				if (variant.supported())
+					return &variant.table();
+			}
+			return &SimdKernelsBaseline();
+		}
+
+		/* Chosen at load time; null only for calls from static initializers that run first */
+		std::atomic<const SimdKernelTable*> activeKernels(DetectKernels());
+
+		const SimdKernelTable& Kernels() {
+			const SimdKernelTable* kernels = activeKernels.load(std::memory_order_relaxed);
+			if (!kernels) {
+				kernels = DetectKernels();
+				activeKernels.store(kernels, std::memory_order_relaxed);
+			}
+			return *kernels;
+		}
+
+	}
+
+	std::string SimdVariant() {
+		return Kernels().name;
+	}
+
+	std::vector<std::string> SupportedSimdVariants() {
+		std::vector<std::string> names;
+		for (const SimdVariantEntry& variant : simdVariants) {
+			if (variant.supported())
+				names.push_back(variant.table().name);
+		}
+		return names;
+	}
+
+	bool SetSimdVariant(const std::string& name) {
+		for (const SimdVariantEntry& variant : simdVariants) {
+			if (name == variant.table().name && variant.supported()) {
+				activeKernels.store(&variant.table(), std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void MatrixExp3Batch(const float* expc3, std::size_t count, float* R) {
+		Kernels().matrixExp3(expc3, count, R);
+	}
+
 	/* Function: Computes the matrix logarithm of a rotation matrix
 	 * Inputs: Rotation matrix
 	 * Returns: matrix logarithm of a rotation
@@ -185,18 +294,6 @@ namespace mr {
 	}
 
 
-	/* Function: Translates a transformation matrix into a spatial velocity vector
-	 * Inputs: Transformation matrix
-	 * Returns: Spatial velocity vector [angular velocity, linear velocity]
-	 */
-	Eigen::VectorXf se3ToVec(const Eigen::MatrixXf& T) {
-		Eigen::VectorXf m_ret(6);
-		m_ret << T(2, 1), T(0, 2), T(1, 0), T(0, 3), T(1, 3), T(2, 3);
-
-		return m_ret;
-	}
-
-
 	/* Function: Provides the adjoint representation of a transformation matrix
 	 *			 Used to change the frame of reference for spatial velocity vectors
 	 * Inputs: 4x4 Transformation matrix SE(3)
@@ -269,6 +366,201 @@ namespace mr {
 	}
 
 
+	namespace {
+		typedef Eigen::Matrix<float, 6, 1> Vector6f;
+		typedef Eigen::Matrix<float, 6, 6> Matrix6f;
+		typedef Eigen::Ref<const Eigen::VectorXf> VectorRef;
+
+		/* Fixed-size TransInv */
+		Eigen::Matrix4f TransInvFixed(const Eigen::Matrix4f& T) {
+			Eigen::Matrix4f inv = Eigen::Matrix4f::Identity();
+			inv.topLeftCorner<3, 3>() = T.topLeftCorner<3, 3>().transpose();
+			inv.topRightCorner<3, 1>() = -inv.topLeftCorner<3, 3>() * T.topRightCorner<3, 1>();
+			return inv;
+		}
+
+		/* Fixed-size Adjoint */
+		Matrix6f AdjointFixed(const Eigen::Matrix4f& T) {
+			Eigen::Matrix3f R = T.topLeftCorner<3, 3>();
+			Matrix6f ad_ret;
+			ad_ret << R, Eigen::Matrix3f::Zero(),
+				VecToso3(T.topRightCorner<3, 1>()) * R, R;
+			return ad_ret;
+		}
+
+		/* Fixed-size MatrixExp6(VecTose3(S*theta)) given s = sin(|omg|*theta) and
+		 * c = cos(|omg|*theta) */
+		Eigen::Matrix4f MatrixExp6SinCos(const Vector6f& S, float theta, float s, float c) {
+			float omgnorm = S.head<3>().norm();
+			float angle = omgnorm * theta;
+			Eigen::Vector3f linear = S.tail<3>() * theta;
+			Eigen::Matrix4f m_ret = Eigen::Matrix4f::Identity();
+			if (NearZero(angle)) {
+				m_ret.topRightCorner<3, 1>() = linear;
+				return m_ret;
+			}
+			Eigen::Matrix3f omgmat = VecToso3(S.head<3>() / omgnorm);
+			Eigen::Matrix3f omgmat2 = omgmat * omgmat;
+			m_ret.topLeftCorner<3, 3>() = Eigen::Matrix3f::Identity() + s * omgmat + (1 - c) * omgmat2;
+			m_ret.topRightCorner<3, 1>() = (Eigen::Matrix3f::Identity() * angle + (1 - c) * omgmat
+				+ (angle - s) * omgmat2) * linear / angle;
+			return m_ret;
+		}
+
+		/* Fixed-size MatrixExp6(VecTose3(S*theta)) */
+		Eigen::Matrix4f MatrixExp6Fixed(const Vector6f& S, float theta) {
+			float angle = S.head<3>().norm() * theta;
+			return MatrixExp6SinCos(S, theta, std::sin(angle), std::cos(angle));
+		}
+
+		/* The coordinate axis that v is a multiple of, or -1 */
+		int CoordinateAxis(const Eigen::Vector3f& v) {
+			for (int k = 0; k < 3; k++) {
+				if (NearZero(v((k + 1) % 3)) && NearZero(v((k + 2) % 3)))
+					return k;
+			}
+			return -1;
+		}
+
+		JointModel ClassifyScrew(const Vector6f& S) {
+			JointModel joint;
+			joint.S = S;
+			joint.pitch = 0;
+			Eigen::Vector3f omg = S.head<3>();
+			Eigen::Vector3f v = S.tail<3>();
+			if (NearZero(omg.norm())) {
+				joint.type = JointType::Prismatic;
+				joint.axis = CoordinateAxis(v);
+			}
+			else if (std::abs(omg.norm() - 1) < 1e-5) {
+				joint.pitch = omg.dot(v);
+				joint.type = NearZero(joint.pitch) ? JointType::Revolute : JointType::Helical;
+				if (joint.type == JointType::Revolute)
+					joint.pitch = 0;
+				joint.axis = CoordinateAxis(omg);
+			}
+			else {
+				joint.type = JointType::General;
+				joint.axis = -1;
+			}
+			return joint;
+		}
+
+		/* e^[S]theta for a classified joint given s = sin(|omg|*theta), c = cos(|omg|*theta).
+		 * With a unit omg, omg^2 v = (omg.v) omg - v collapses the translation to
+		 * s*v + (1-c)*(omg x v) + (theta-s)*h*omg */
+		Eigen::Matrix4f JointExpSinCos(const JointModel& joint, float theta, float s, float c) {
+			Eigen::Matrix4f m_ret = Eigen::Matrix4f::Identity();
+			Eigen::Vector3f omg = joint.S.head<3>();
+			Eigen::Vector3f v = joint.S.tail<3>();
+			if (joint.type == JointType::Prismatic) {
+				m_ret.topRightCorner<3, 1>() = v * theta;
+				return m_ret;
+			}
+			if (joint.type == JointType::General)
+				return MatrixExp6SinCos(joint.S, theta, s, c);
+
+			if (joint.axis >= 0) {
+				// Only the 2x2 block in the plane normal to the axis moves
+				int k = joint.axis;
+				int a = (k + 1) % 3;
+				int b = (k + 2) % 3;
+				float ss = omg(k) > 0 ? s : -s;
+				m_ret(a, a) = c;
+				m_ret(a, b) = -ss;
+				m_ret(b, a) = ss;
+				m_ret(b, b) = c;
+			}
+			else {
+				Eigen::Matrix3f omgmat = VecToso3(omg);
+				m_ret.topLeftCorner<3, 3>() += s * omgmat + (1 - c) * (omgmat * omgmat);
+			}
+			Eigen::Vector3f p = s * v + (1 - c) * omg.cross(v);
+			if (joint.type == JointType::Helical)
+				p += (theta - s) * joint.pitch * omg;
+			m_ret.topRightCorner<3, 1>() = p;
+			return m_ret;
+		}
+
+		Eigen::Matrix4f JointExpFixed(const JointModel& joint, float theta) {
+			if (joint.type == JointType::Prismatic)
+				return JointExpSinCos(joint, theta, 0, 1);
+			float angle = joint.S.head<3>().norm() * theta;
+			return JointExpSinCos(joint, theta, std::sin(angle), std::cos(angle));
+		}
+
+		/* Adjoint(T) * S for a classified joint without forming the 6x6 adjoint */
+		Vector6f AdjointScrew(const Eigen::Matrix4f& T, const JointModel& joint) {
+			Eigen::Matrix3f R = T.topLeftCorner<3, 3>();
+			Eigen::Vector3f p = T.topRightCorner<3, 1>();
+			Vector6f V;
+			if (joint.type == JointType::Prismatic) {
+				V.head<3>().setZero();
+				if (joint.axis >= 0)
+					V.tail<3>() = R.col(joint.axis) * joint.S(3 + joint.axis);
+				else
+					V.tail<3>() = R * joint.S.tail<3>();
+				return V;
+			}
+			Eigen::Vector3f Romg;
+			if (joint.axis >= 0)
+				Romg = R.col(joint.axis) * joint.S(joint.axis);
+			else
+				Romg = R * joint.S.head<3>();
+			V.head<3>() = Romg;
+			V.tail<3>() = p.cross(Romg) + R * joint.S.tail<3>();
+			return V;
+		}
+
+		/* FKinSpace, FKinBody, JacobianSpace and JacobianBody over joint(i), the
+		 * JointModel of joint i, so that chains classified once by ClassifyJoints
+		 * skip ClassifyScrew. The Jacobians are written over a copy of the screw
+		 * axis list, whose first (space) or last (body) column is already right. */
+		template <class Joint>
+		Eigen::Matrix4f FKinSpaceKernel(const Eigen::Matrix4f& M, const Joint& joint, const VectorRef& thetalist) {
+			Eigen::Matrix4f T = M;
+			for (int i = thetalist.size() - 1; i > -1; i--)
+				T = JointExpFixed(joint(i), thetalist(i)) * T;
+			return T;
+		}
+
+		template <class Joint>
+		Eigen::Matrix4f FKinBodyKernel(const Eigen::Matrix4f& M, const Joint& joint, const VectorRef& thetalist) {
+			Eigen::Matrix4f T = M;
+			for (int i = 0; i < thetalist.size(); i++)
+				T = T * JointExpFixed(joint(i), thetalist(i));
+			return T;
+		}
+
+		template <class Joint>
+		void JacobianSpaceKernel(const Joint& joint, const VectorRef& thetalist, Eigen::MatrixXf& Js) {
+			int n = thetalist.size();
+			if (n == 0)
+				return;
+			Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+			JointModel current = joint(0);
+			for (int i = 1; i < n; i++) {
+				T = T * JointExpFixed(current, thetalist(i - 1));
+				current = joint(i);
+				Js.col(i) = AdjointScrew(T, current);
+			}
+		}
+
+		template <class Joint>
+		void JacobianBodyKernel(const Joint& joint, const VectorRef& thetalist, Eigen::MatrixXf& Jb) {
+			int n = thetalist.size();
+			if (n == 0)
+				return;
+			Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+			JointModel current = joint(n - 1);
+			for (int i = n - 2; i >= 0; i--) {
+				T = T * JointExpFixed(current, -thetalist(i + 1));
+				current = joint(i);
+				Jb.col(i) = AdjointScrew(T, current);
+			}
+		}
+	}
+
 	/* Function: Compute end effector frame (used for current spatial position calculation)
 	 * Inputs: Home configuration (position and orientation) of end-effector
 	 *		   The joint screw axes in the space frame when the manipulator
@@ -279,11 +571,7 @@ namespace mr {
 	 * Notes: FK means Forward Kinematics
 	 */
 	Eigen::MatrixXf FKinSpace(const Eigen::MatrixXf& M, const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetaList) {
-		Eigen::MatrixXf T = M;
-		for (int i = (thetaList.size() - 1); i > -1; i--) {
-			T = MatrixExp6(VecTose3(Slist.col(i)*thetaList(i))) * T;
-		}
-		return T;
+		return FKinSpaceKernel(M, [&](int i) { return ClassifyScrew(Slist.col(i)); }, thetaList);
 	}
 
 	/*
@@ -297,13 +585,157 @@ namespace mr {
 	 * Notes: FK means Forward Kinematics
 	 */
 	Eigen::MatrixXf FKinBody(const Eigen::MatrixXf& M, const Eigen::MatrixXf& Blist, const Eigen::VectorXf& thetaList) {
-		Eigen::MatrixXf T = M;
-		for (int i = 0; i < thetaList.size(); i++) {
-			T = T * MatrixExp6(VecTose3(Blist.col(i)*thetaList(i)));
+		return FKinBodyKernel(M, [&](int i) { return ClassifyScrew(Blist.col(i)); }, thetaList);
+	}
+
+
+	FKinSpaceCache::FKinSpaceCache(const Eigen::MatrixXf& M, const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalist)
+		: M_(M), joints_(ClassifyJoints(Slist)), thetalist_(thetalist), exps_(thetalist.size()), prefix_(thetalist.size() + 1) {
+		prefix_[0] = Eigen::Matrix4f::Identity();
+		for (int i = 0; i < thetalist_.size(); i++) {
+			exps_[i] = JointExpFixed(joints_[i], thetalist_(i));
+			prefix_[i + 1] = prefix_[i] * exps_[i];
+		}
+	}
+
+	int FKinSpaceCache::Update(const Eigen::VectorXf& thetalist) {
+		int n = thetalist_.size();
+		eigen_assert(thetalist.size() == n);
+		int first = 0;
+		while (first < n && thetalist(first) == thetalist_(first))
+			first++;
+		for (int i = first; i < n; i++) {
+			if (thetalist(i) != thetalist_(i)) {
+				thetalist_(i) = thetalist(i);
+				exps_[i] = JointExpFixed(joints_[i], thetalist_(i));
+			}
+			prefix_[i + 1] = prefix_[i] * exps_[i];
+		}
+		return first;
+	}
+
+	Eigen::MatrixXf FKinSpaceCache::Transform() const {
+		return prefix_.back() * M_;
+	}
+
+	Eigen::MatrixXf FKinSpaceCache::WhatIf(int i, float theta) const {
+		eigen_assert(i >= 0 && i < thetalist_.size());
+		Eigen::Matrix4f T = prefix_[i] * JointExpFixed(joints_[i], theta);
+		for (int j = i + 1; j < thetalist_.size(); j++)
+			T = T * exps_[j];
+		return T * M_;
+	}
+
+	namespace {
+
+		/* e^[S]theta as a dual quaternion. For |w| = 1 and v = h w + vp with vp
+		 * perpendicular to w, this is
+		 *   qr = (cos(theta/2), sin(theta/2) w)
+		 *   qd = (-h theta/2 sin(theta/2), sin(theta/2) vp + h theta/2 cos(theta/2) w)
+		 * Other screws are scaled to |w| = 1, and prismatic joints give (1, 0) + eps (0, v theta/2). */
+		DualQuaternion JointExpDQ(const Vector6f& S, float theta) {
+			Eigen::Vector3f omg = S.head<3>();
+			Eigen::Vector3f v = S.tail<3>();
+			float k = omg.norm();
+			if (NearZero(k)) {
+				Eigen::Vector3f half = 0.5f * theta * v;
+				return DualQuaternion(Eigen::Quaternionf::Identity(), Eigen::Quaternionf(0, half(0), half(1), half(2)));
+			}
+			omg /= k;
+			v /= k;
+			theta *= k;
+			float h = omg.dot(v);
+			Eigen::Vector3f vp = v - h * omg;
+			float s = std::sin(0.5f * theta), c = std::cos(0.5f * theta);
+			float ht = 0.5f * h * theta;
+			Eigen::Vector3f r = s * omg;
+			Eigen::Vector3f d = s * vp + ht * c * omg;
+			return DualQuaternion(Eigen::Quaternionf(c, r(0), r(1), r(2)), Eigen::Quaternionf(-ht * s, d(0), d(1), d(2)));
 		}
+
+	}
+
+	DualQuaternion::DualQuaternion() : real_(Eigen::Quaternionf::Identity()), dual_(0, 0, 0, 0) {}
+
+	DualQuaternion::DualQuaternion(const Eigen::Quaternionf& real, const Eigen::Quaternionf& dual) : real_(real), dual_(dual) {}
+
+	DualQuaternion::DualQuaternion(const Eigen::Matrix4f& T) : real_(Eigen::Matrix3f(T.topLeftCorner<3, 3>())) {
+		real_.normalize();
+		Eigen::Vector3f p = T.topRightCorner<3, 1>();
+		dual_ = Eigen::Quaternionf(0, p(0), p(1), p(2)) * real_;
+		dual_.coeffs() *= 0.5f;
+	}
+
+	DualQuaternion DualQuaternion::Exp(const Eigen::VectorXf& S, float theta) {
+		return JointExpDQ(S, theta);
+	}
+
+	Eigen::Vector3f DualQuaternion::Translation() const {
+		return 2 * (dual_ * real_.conjugate()).vec();
+	}
+
+	Eigen::Matrix4f DualQuaternion::Matrix() const {
+		Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+		T.topLeftCorner<3, 3>() = real_.toRotationMatrix();
+		T.topRightCorner<3, 1>() = Translation();
 		return T;
 	}
 
+	Eigen::VectorXf DualQuaternion::Log() const {
+		// q and -q are the same motion; the one with a nonnegative scalar part has theta <= pi
+		float sign = real_.w() < 0 ? -1.0f : 1.0f;
+		Eigen::Vector3f rv = sign * real_.vec();
+		Eigen::Vector3f dv = sign * dual_.vec();
+		float s = rv.norm();
+		Eigen::VectorXf expc6(6);
+		if (s < 1e-6f) {
+			// (Nearly) a pure translation
+			expc6 << 2 * rv, 2 * (dual_ * real_.conjugate()).vec();
+			return expc6;
+		}
+		float c = sign * real_.w();
+		float theta = 2 * std::atan2(s, c);
+		Eigen::Vector3f omg = rv / s;
+		float htheta = -2 * sign * dual_.w() / s;
+		Eigen::Vector3f vp = (dv - 0.5f * htheta * c * omg) / s;
+		expc6 << omg * theta, vp * theta + htheta * omg;
+		return expc6;
+	}
+
+	DualQuaternion DualQuaternion::operator*(const DualQuaternion& other) const {
+		Eigen::Quaternionf dual = real_ * other.dual_;
+		dual.coeffs() += (dual_ * other.real_).coeffs();
+		return DualQuaternion(real_ * other.real_, dual);
+	}
+
+	DualQuaternion DualQuaternion::Inverse() const {
+		return DualQuaternion(real_.conjugate(), dual_.conjugate());
+	}
+
+	void DualQuaternion::Normalize() {
+		float n = real_.norm();
+		real_.coeffs() /= n;
+		dual_.coeffs() /= n;
+		dual_.coeffs() -= real_.coeffs().dot(dual_.coeffs()) * real_.coeffs();
+	}
+
+	DualQuaternion ScLERP(const DualQuaternion& Xstart, const DualQuaternion& Xend, float s) {
+		return Xstart * DualQuaternion::Exp((Xstart.Inverse() * Xend).Log(), s);
+	}
+
+	DualQuaternion FKinSpace(const DualQuaternion& M, const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalist) {
+		DualQuaternion T;
+		for (int i = 0; i < thetalist.size(); i++)
+			T = T * JointExpDQ(Slist.col(i), thetalist(i));
+		return T * M;
+	}
+
+	DualQuaternion FKinBody(const DualQuaternion& M, const Eigen::MatrixXf& Blist, const Eigen::VectorXf& thetalist) {
+		DualQuaternion T = M;
+		for (int i = 0; i < thetalist.size(); i++)
+			T = T * JointExpDQ(Blist.col(i), thetalist(i));
+		return T;
+	}
 
 	/* Function: Gives the space Jacobian
 	 * Inputs: Screw axis in home position, joint configuration
@@ -311,15 +743,7 @@ namespace mr {
 	 */
 	Eigen::MatrixXf JacobianSpace(const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& thetaList) {
 		Eigen::MatrixXf Js = Slist;
-		Eigen::MatrixXf T = Eigen::MatrixXf::Identity(4, 4);
-		Eigen::VectorXf sListTemp(Slist.col(0).size());
-		for (int i = 1; i < thetaList.size(); i++) {
-			sListTemp << Slist.col(i - 1) * thetaList(i - 1);
-			T = T * MatrixExp6(VecTose3(sListTemp));
-			// std::cout << "array: " << sListTemp << std::endl;
-			Js.col(i) = Adjoint(T) * Slist.col(i);
-		}
-
+		JacobianSpaceKernel([&](int i) { return ClassifyScrew(Slist.col(i)); }, thetaList, Js);
 		return Js;
 	}
 
@@ -330,31 +754,182 @@ namespace mr {
 	 */
 	Eigen::MatrixXf JacobianBody(const Eigen::MatrixXf& Blist, const Eigen::MatrixXf& thetaList) {
 		Eigen::MatrixXf Jb = Blist;
-		Eigen::MatrixXf T = Eigen::MatrixXf::Identity(4, 4);
-		Eigen::VectorXf bListTemp(Blist.col(0).size());
-		for (int i = thetaList.size() - 2; i >= 0; i--) {
-			bListTemp << Blist.col(i + 1) * thetaList(i + 1);
-			T = T * MatrixExp6(VecTose3(-1 * bListTemp));
-			// std::cout << "array: " << sListTemp << std::endl;
-			Jb.col(i) = Adjoint(T) * Blist.col(i);
-		}
+		JacobianBodyKernel([&](int i) { return ClassifyScrew(Blist.col(i)); }, thetaList, Jb);
 		return Jb;
 	}
 
-	Eigen::MatrixXf TransInv(const Eigen::MatrixXf& transform) {
-		auto rp = mr::TransToRp(transform);
-		auto Rt = rp.at(0).transpose();
-		auto t = -(Rt * rp.at(1));
-		Eigen::MatrixXf inv(4, 4);
-		inv = Eigen::MatrixXf::Zero(4,4);
-		inv.block(0, 0, 3, 3) = Rt;
-		inv.block(0, 3, 3, 1) = t;
-		inv(3, 3) = 1;
-		return inv;
+	struct ThreadPool::Impl {
+		Impl() : body(0), next(0), end(0), grain(1), active(0), generation(0), stop(false) {}
+
+		/* Claims chunks of the current loop until none are left */
+		void Run() {
+			for (;;) {
+				int i = next.fetch_add(grain);
+				if (i >= end) return;
+				int last = std::min(i + grain, end);
+				try {
+					for (; i < last; i++)
+						(*body)(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!error) error = std::current_exception();
+					next = end;
+				}
+			}
+		}
+
+		void Work() {
+			inside = true;
+			unsigned seen = 0;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stop || generation != seen; });
+					if (stop) return;
+					seen = generation;
+				}
+				Run();
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--active == 0) done.notify_one();
+			}
+		}
+
+		std::vector<std::thread> workers;
+		std::mutex loop;     // held for the duration of a loop
+		std::mutex mutex;    // guards the fields below
+		std::condition_variable wake;
+		std::condition_variable done;
+		const std::function<void(int)>* body;
+		std::atomic<int> next;
+		int end;
+		int grain;
+		int active;
+		unsigned generation;
+		bool stop;
+		std::exception_ptr error;
+
+		static thread_local bool inside;
+	};
+
+	thread_local bool ThreadPool::Impl::inside = false;
+
+	ThreadPool::ThreadPool(int threads) : impl_(new Impl) {
+		if (threads <= 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		for (int i = 1; i < threads; i++)
+			impl_->workers.push_back(std::thread(&Impl::Work, impl_.get()));
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(impl_->mutex);
+			impl_->stop = true;
+		}
+		impl_->wake.notify_all();
+		for (std::size_t i = 0; i < impl_->workers.size(); i++)
+			impl_->workers[i].join();
+	}
+
+	int ThreadPool::Size() const {
+		return impl_->workers.size() + 1;
+	}
+
+	void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int)>& body) {
+		if (impl_->workers.empty() || Impl::inside || end - begin <= 1) {
+			for (int i = begin; i < end; i++)
+				body(i);
+			return;
+		}
+		std::lock_guard<std::mutex> loop(impl_->loop);
+		{
+			std::lock_guard<std::mutex> lock(impl_->mutex);
+			impl_->body = &body;
+			impl_->next = begin;
+			impl_->end = end;
+			impl_->grain = std::max(1, (end - begin) / (4 * Size()));
+			impl_->active = impl_->workers.size();
+			impl_->error = std::exception_ptr();
+			impl_->generation++;
+		}
+		impl_->wake.notify_all();
+		Impl::inside = true;
+		impl_->Run();
+		Impl::inside = false;
+		std::exception_ptr error;
+		{
+			std::unique_lock<std::mutex> lock(impl_->mutex);
+			impl_->done.wait(lock, [&]() { return impl_->active == 0; });
+			error = impl_->error;
+		}
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	namespace {
+
+		/* One block per thread, but no block shorter than 8 joints */
+		int PrefixBlocks(const ThreadPool& pool, int n) {
+			return std::max(1, std::min(pool.Size(), n / 8));
+		}
+
+		/* The blocked parallel prefix product behind FKinSpaceFrames. prefix[i] ends up
+		 * as e^[S1]theta1 ... e^[Si]thetai; with Js set, the Jacobian columns are filled
+		 * in the same pass. Without either only the total product is formed. */
+		Eigen::Matrix4f ParallelPrefixProduct(const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalist,
+			ThreadPool& pool, Eigen::Matrix4f* prefix, Eigen::MatrixXf* Js) {
+			int n = thetalist.size();
+			std::vector<JointModel> joints = ClassifyJoints(Slist);
+			int blocks = PrefixBlocks(pool, n);
+			KinematicState::TransformList local(blocks);
+			KinematicState::TransformList offset(blocks);
+			pool.ParallelFor(0, blocks, [&](int b) {
+				Eigen::Matrix4f P = Eigen::Matrix4f::Identity();
+				for (int i = n * b / blocks; i < n * (b + 1) / blocks; i++) {
+					P = P * JointExpFixed(joints[i], thetalist(i));
+					if (prefix) prefix[i + 1] = P;
+				}
+				local[b] = P;
+			});
+			offset[0] = Eigen::Matrix4f::Identity();
+			for (int b = 1; b < blocks; b++)
+				offset[b] = offset[b - 1] * local[b - 1];
+			if (prefix) {
+				prefix[0] = Eigen::Matrix4f::Identity();
+				pool.ParallelFor(0, blocks, [&](int b) {
+					for (int i = n * b / blocks; i < n * (b + 1) / blocks; i++) {
+						if (b > 0)
+							prefix[i + 1] = offset[b] * prefix[i + 1];
+						if (Js)
+							Js->col(i) = AdjointScrew(prefix[i], joints[i]);
+					}
+				});
+			}
+			return offset[blocks - 1] * local[blocks - 1];
+		}
+
+	}
+
+	std::vector<Eigen::MatrixXf> FKinSpaceFrames(const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalist, ThreadPool& pool) {
+		KinematicState::TransformList prefix(thetalist.size() + 1);
+		ParallelPrefixProduct(Slist, thetalist, pool, prefix.data(), 0);
+		return std::vector<Eigen::MatrixXf>(prefix.begin(), prefix.end());
+	}
+
+	Eigen::MatrixXf FKinSpace(const Eigen::MatrixXf& M, const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalist, ThreadPool& pool) {
+		if (PrefixBlocks(pool, thetalist.size()) == 1)
+			return FKinSpace(M, Slist, thetalist);
+		Eigen::Matrix4f Mfixed = M;
+		return ParallelPrefixProduct(Slist, thetalist, pool, 0, 0) * Mfixed;
 	}
 
-	Eigen::MatrixXf RotInv(const Eigen::MatrixXf& rotMatrix) {
-		return rotMatrix.transpose();
+	Eigen::MatrixXf JacobianSpace(const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalist, ThreadPool& pool) {
+		if (PrefixBlocks(pool, thetalist.size()) == 1)
+			return JacobianSpace(Slist, thetalist);
+		KinematicState::TransformList prefix(thetalist.size() + 1);
+		Eigen::MatrixXf Js(6, thetalist.size());
+		ParallelPrefixProduct(Slist, thetalist, pool, prefix.data(), &Js);
+		return Js;
 	}
 
 	Eigen::VectorXf ScrewToAxis(Eigen::Vector3f q, Eigen::Vector3f s, float h) {
@@ -364,6 +939,21 @@ namespace mr {
 		return axis;
 	}
 
+	JointModel ClassifyJoint(const Eigen::VectorXf& S) {
+		return ClassifyScrew(S);
+	}
+
+	std::vector<JointModel> ClassifyJoints(const Eigen::MatrixXf& Slist) {
+		std::vector<JointModel> joints;
+		for (int i = 0; i < Slist.cols(); i++)
+			joints.push_back(ClassifyScrew(Slist.col(i)));
+		return joints;
+	}
+
+	Eigen::MatrixXf MatrixExp6(const JointModel& joint, float theta) {
+		return JointExpFixed(joint, theta);
+	}
+
 	Eigen::VectorXf AxisAng6(const Eigen::VectorXf& expc6) {
 		Eigen::VectorXf v_ret(7);
 		float theta = Eigen::Vector3f(expc6(0), expc6(1), expc6(2)).norm();
@@ -373,40 +963,164 @@ namespace mr {
 		return v_ret;
 	}
 
+	namespace {
+
+		/* The SVD projection, kept for matrices with det(M) <= 0 */
+		Eigen::Matrix3f ProjectToSO3SVD(const Eigen::Matrix3f& M) {
+			Eigen::JacobiSVD<Eigen::Matrix3f> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
+			Eigen::Matrix3f R = svd.matrixU() * svd.matrixV().transpose();
+			if (R.determinant() < 0)
+				// In this case the result may be far from M; reverse sign of 3rd column
+				R.col(2) *= -1;
+			return R;
+		}
+
+		/* For det(M) > 0 the closest rotation is the orthogonal polar factor of M,
+		 * found by Higham's scaled Newton iteration X <- (g X + X^-T / g) / 2 with
+		 * g = (|X^-1| / |X|)^1/2. X^-T is the cofactor matrix over det(X), so each
+		 * step costs one 3x3 cofactor matrix. Convergence is quadratic, and a
+		 * drifted rotation needs two or three steps. */
+		Eigen::Matrix3f ProjectToSO3Fixed(const Eigen::Matrix3f& M) {
+			Eigen::Matrix3f X = M;
+			for (int iter = 0; iter < 20; iter++) {
+				Eigen::Matrix3f C;
+				C.col(0) = X.col(1).cross(X.col(2));
+				C.col(1) = X.col(2).cross(X.col(0));
+				C.col(2) = X.col(0).cross(X.col(1));
+				float det = X.col(0).dot(C.col(0));
+				float norm = X.norm();
+				if (!(det > 1e-6f * norm * norm * norm))
+					return ProjectToSO3SVD(M);
+				Eigen::Matrix3f Xinvt = C / det;
+				float g = std::sqrt(std::sqrt(Xinvt.squaredNorm() / (norm * norm)));
+				Eigen::Matrix3f next = 0.5f * (g * X + Xinvt / g);
+				float step = (next - X).squaredNorm();
+				X = next;
+				if (step < 1e-12f)
+					break;
+			}
+			return X;
+		}
+
+	}
+
 	Eigen::MatrixXf ProjectToSO3(const Eigen::MatrixXf& M) {
-		Eigen::JacobiSVD<Eigen::MatrixXf> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
-		Eigen::MatrixXf R = svd.matrixU() * svd.matrixV().transpose();
-		if (R.determinant() < 0)
-			// In this case the result may be far from M; reverse sign of 3rd column
-			R.col(2) *= -1;
-		return R;
+		return ProjectToSO3Fixed(M);
 	}
 
 	Eigen::MatrixXf ProjectToSE3(const Eigen::MatrixXf& M) {
-		Eigen::Matrix3f R = M.block<3, 3>(0, 0);
-		Eigen::Vector3f t = M.block<3, 1>(0, 3);
-		Eigen::MatrixXf T = RpToTrans(ProjectToSO3(R), t);
+		Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+		T.topLeftCorner<3, 3>() = ProjectToSO3Fixed(M.block<3, 3>(0, 0));
+		T.topRightCorner<3, 1>() = M.block<3, 1>(0, 3);
 		return T;
 	}
 
+	void ProjectToSO3Batch(const float* matrices, std::size_t count, float* projected) {
+		for (std::size_t i = 0; i < count; i++) {
+			Eigen::Map<Eigen::Matrix3f>(projected + 9 * i) = ProjectToSO3Fixed(Eigen::Map<const Eigen::Matrix3f>(matrices + 9 * i));
+		}
+	}
+
+	void ProjectToSE3Batch(const float* matrices, std::size_t count, float* projected) {
+		for (std::size_t i = 0; i < count; i++) {
+			Eigen::Map<const Eigen::Matrix4f> M(matrices + 16 * i);
+			Eigen::Map<Eigen::Matrix4f> T(projected + 16 * i);
+			Eigen::Matrix3f R = ProjectToSO3Fixed(M.topLeftCorner<3, 3>());
+			Eigen::Vector3f p = M.topRightCorner<3, 1>();
+			T.setIdentity();
+			T.topLeftCorner<3, 3>() = R;
+			T.topRightCorner<3, 1>() = p;
+		}
+	}
+
+	namespace {
+
+		/* DistanceToSO3 of the top-left 3x3 block of a column-major matrix with leading
+		 * dimension ld, without temporaries: |R^T R - I|^2 from the six distinct dot
+		 * products of the columns. */
+		float DistanceToSO3Kernel(const float* m, int ld) {
+			const float* a = m;
+			const float* b = m + ld;
+			const float* c = m + 2 * ld;
+			float bxc0 = b[1] * c[2] - b[2] * c[1];
+			float bxc1 = b[2] * c[0] - b[0] * c[2];
+			float bxc2 = b[0] * c[1] - b[1] * c[0];
+			if (!(a[0] * bxc0 + a[1] * bxc1 + a[2] * bxc2 > 0))
+				return 1.0e9;
+			float aa = a[0] * a[0] + a[1] * a[1] + a[2] * a[2] - 1;
+			float bb = b[0] * b[0] + b[1] * b[1] + b[2] * b[2] - 1;
+			float cc = c[0] * c[0] + c[1] * c[1] + c[2] * c[2] - 1;
+			float ab = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+			float ac = a[0] * c[0] + a[1] * c[1] + a[2] * c[2];
+			float bc = b[0] * c[0] + b[1] * c[1] + b[2] * c[2];
+			return std::sqrt(aa * aa + bb * bb + cc * cc + 2 * (ab * ab + ac * ac + bc * bc));
+		}
+
+		/* DistanceToSE3 of a column-major 4x4 matrix: the rotation block as above plus
+		 * the deviation of the last row from [0 0 0 1] */
+		float DistanceToSE3Kernel(const float* m) {
+			float d = DistanceToSO3Kernel(m, 4);
+			if (d == 1.0e9f)
+				return d;
+			float w = m[15] - 1;
+			return std::sqrt(d * d + m[3] * m[3] + m[7] * m[7] + m[11] * m[11] + w * w);
+		}
+
+		/* Runs the distance kernel over count matrices of the given size, 64 at a time,
+		 * filling distances and the validity mask, and hands each invalid one to repair */
+		template <class Repair>
+		std::size_t DistanceBatch(const float* matrices, int size, std::size_t count, float* distances,
+			std::uint64_t* valid, void (*distance)(const float*, std::size_t, float*), const Repair& repair) {
+			std::size_t passed = 0;
+			float block[64];
+			for (std::size_t word = 0; word * 64 < count; word++) {
+				std::uint64_t bits = 0;
+				std::size_t end = std::min(count, word * 64 + 64);
+				float* d = distances ? distances + word * 64 : block;
+				distance(matrices + size * word * 64, end - word * 64, d);
+				for (std::size_t i = word * 64; i < end; i++) {
+					if (std::abs(d[i - word * 64]) < 1e-3) {
+						bits |= std::uint64_t(1) << (i - word * 64);
+						passed++;
+					}
+					else {
+						repair(i);
+					}
+				}
+				if (valid)
+					valid[word] = bits;
+			}
+			return passed;
+		}
+
+		void RepairNone(std::size_t) {}
+
+	}
+
 	float DistanceToSO3(const Eigen::Matrix3f& M) {
-		if (M.determinant() > 0)
-			return (M.transpose() * M - Eigen::Matrix3f::Identity()).norm();
-		else
-			return 1.0e9;
+		return DistanceToSO3Kernel(M.data(), 3);
 	}
 
 	float DistanceToSE3(const Eigen::Matrix4f& T) {
-		Eigen::Matrix3f matR = T.block<3, 3>(0, 0);
-		if (matR.determinant() > 0) {
-			Eigen::Matrix4f m_ret;
-			m_ret << matR.transpose()*matR, Eigen::Vector3f::Zero(3),
-				T.row(3);
-			m_ret = m_ret - Eigen::Matrix4f::Identity();
-			return m_ret.norm();
-		}
-		else
-			return 1.0e9;
+		return DistanceToSE3Kernel(T.data());
+	}
+
+	std::size_t DistanceToSO3Batch(const float* matrices, std::size_t count, float* distances, std::uint64_t* valid) {
+		return DistanceBatch(matrices, 9, count, distances, valid, Kernels().distanceToSO3, RepairNone);
+	}
+
+	std::size_t DistanceToSE3Batch(const float* matrices, std::size_t count, float* distances, std::uint64_t* valid) {
+		return DistanceBatch(matrices, 16, count, distances, valid, Kernels().distanceToSE3, RepairNone);
+	}
+
+	std::size_t RepairSO3Batch(float* matrices, std::size_t count, float* distances, std::uint64_t* valid) {
+		return DistanceBatch(matrices, 9, count, distances, valid, Kernels().distanceToSO3,
+			[&](std::size_t i) { ProjectToSO3Batch(matrices + 9 * i, 1, matrices + 9 * i); });
+	}
+
+	std::size_t RepairSE3Batch(float* matrices, std::size_t count, float* distances, std::uint64_t* valid) {
+		return DistanceBatch(matrices, 16, count, distances, valid, Kernels().distanceToSE3,
+			[&](std::size_t i) { ProjectToSE3Batch(matrices + 16 * i, 1, matrices + 16 * i); });
 	}
 
 	bool TestIfSO3(const Eigen::Matrix3f& M) {
@@ -420,20 +1134,23 @@ namespace mr {
 		Eigen::VectorXf& thetalist, float eomg, float ev) {
 		int i = 0;
 		int maxiterations = 20;
-		Eigen::MatrixXf Tfk = FKinBody(M, Blist, thetalist);
+		// The joints are classified once for every iteration
+		std::vector<JointModel> joints = ClassifyJoints(Blist);
+		auto joint = [&](int j) -> const JointModel& { return joints[j]; };
+		Eigen::MatrixXf Tfk = FKinBodyKernel(M, joint, thetalist);
 		Eigen::MatrixXf Tdiff = TransInv(Tfk)*T;
 		Eigen::VectorXf Vb = se3ToVec(MatrixLog6(Tdiff));
 		Eigen::Vector3f angular(Vb(0), Vb(1), Vb(2));
 		Eigen::Vector3f linear(Vb(3), Vb(4), Vb(5));
 
 		bool err = (angular.norm() > eomg || linear.norm() > ev);
-		Eigen::MatrixXf Jb;
+		Eigen::MatrixXf Jb = Blist;
 		while (err && i < maxiterations) {
-			Jb = JacobianBody(Blist, thetalist);
+			JacobianBodyKernel(joint, thetalist, Jb);
 			thetalist += Jb.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(Vb);
 			i += 1;
 			// iterate
-			Tfk = FKinBody(M, Blist, thetalist);
+			Tfk = FKinBodyKernel(M, joint, thetalist);
 			Tdiff = TransInv(Tfk)*T;
 			Vb = se3ToVec(MatrixLog6(Tdiff));
 			angular = Eigen::Vector3f(Vb(0), Vb(1), Vb(2));
@@ -447,20 +1164,22 @@ namespace mr {
 		Eigen::VectorXf& thetalist, float eomg, float ev) {
 		int i = 0;
 		int maxiterations = 20;
-		Eigen::MatrixXf Tfk = FKinSpace(M, Slist, thetalist);
+		std::vector<JointModel> joints = ClassifyJoints(Slist);
+		auto joint = [&](int j) -> const JointModel& { return joints[j]; };
+		Eigen::MatrixXf Tfk = FKinSpaceKernel(M, joint, thetalist);
 		Eigen::MatrixXf Tdiff = TransInv(Tfk)*T;
 		Eigen::VectorXf Vs = Adjoint(Tfk)*se3ToVec(MatrixLog6(Tdiff));
 		Eigen::Vector3f angular(Vs(0), Vs(1), Vs(2));
 		Eigen::Vector3f linear(Vs(3), Vs(4), Vs(5));
 
 		bool err = (angular.norm() > eomg || linear.norm() > ev);
-		Eigen::MatrixXf Js;
+		Eigen::MatrixXf Js = Slist;
 		while (err && i < maxiterations) {
-			Js = JacobianSpace(Slist, thetalist);
+			JacobianSpaceKernel(joint, thetalist, Js);
 			thetalist += Js.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(Vs);
 			i += 1;
 			// iterate
-			Tfk = FKinSpace(M, Slist, thetalist);
+			Tfk = FKinSpaceKernel(M, joint, thetalist);
 			Tdiff = TransInv(Tfk)*T;
 			Vs = Adjoint(Tfk)*se3ToVec(MatrixLog6(Tdiff));
 			angular = Eigen::Vector3f(Vs(0), Vs(1), Vs(2));
@@ -470,67 +1189,890 @@ namespace mr {
 		return !err;
 	}
 
-	/*
-	* Function: This function uses forward-backward Newton-Euler iterations to solve the
-	* equation:
-	* taulist = Mlist(thetalist) * ddthetalist + c(thetalist, dthetalist) ...
-	*           + g(thetalist) + Jtr(thetalist) * Ftip
-	* Inputs:
-	*  thetalist: n-vector of joint variables
-	*  dthetalist: n-vector of joint rates
-	*  ddthetalist: n-vector of joint accelerations
-	*  g: Gravity vector g
-	*  Ftip: Spatial force applied by the end-effector expressed in frame {n+1}
-	*  Mlist: List of link frames {i} relative to {i-1} at the home position
-	*  Glist: Spatial inertia matrices Gi of the links
-	*  Slist: Screw axes Si of the joints in a space frame, in the format
-	*         of a matrix with the screw axes as the columns.
-	*
-	* Outputs:
-	*  taulist: The n-vector of required joint forces/torques
-	*
-	*/
-	Eigen::VectorXf InverseDynamics(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& ddthetalist,
-									const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
-									const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
-	    // the size of the lists
-		int n = thetalist.size();
-
-		Eigen::MatrixXf Mi = Eigen::MatrixXf::Identity(4, 4);
-		Eigen::MatrixXf Ai = Eigen::MatrixXf::Zero(6,n);
-		std::vector<Eigen::MatrixXf> AdTi;
-		for (int i = 0; i < n+1; i++) {
-			AdTi.push_back(Eigen::MatrixXf::Zero(6,6));
+	namespace {
+
+		/*
+		 * The damped least-squares step toward the twist V with the joints kept in
+		 * [lower, upper]: the free joint crossing its limit furthest is stopped at the
+		 * limit and the step re-solved for the others, until none crosses. Spare
+		 * freedom moves the limited joints toward the middle of their range.
+		 */
+		Eigen::VectorXf BoundedStep(const Eigen::MatrixXf& J, const Vector6f& V, const Eigen::VectorXf& thetalist,
+			const Eigen::VectorXf& lower, const Eigen::VectorXf& upper) {
+			int n = thetalist.size();
+			const float damping = 1e-4f;   // lambda^2
+			Eigen::VectorXf step = Eigen::VectorXf::Zero(n);
+			Eigen::VectorXf toMiddle = Eigen::VectorXf::Zero(n);
+			for (int i = 0; i < n; i++)
+				if (std::isfinite(lower(i)) && std::isfinite(upper(i)))
+					toMiddle(i) = 0.1f * (0.5f * (lower(i) + upper(i)) - thetalist(i));
+			std::vector<int> free;
+			for (int i = 0; i < n; i++)
+				free.push_back(i);
+			while (!free.empty()) {
+				Eigen::MatrixXf Jf(6, free.size());
+				Eigen::VectorXf z(free.size());
+				for (std::size_t k = 0; k < free.size(); k++) {
+					Jf.col(k) = J.col(free[k]);
+					z(k) = toMiddle(free[k]);
+					step(free[k]) = 0;
+				}
+				// dq = Jf^+ (r - Jf z) + z with Jf^+ = Jf^T (Jf Jf^T + lambda^2 I)^-1
+				Vector6f residual = V - J * step - Jf * z;
+				Matrix6f A = Jf * Jf.transpose() + damping * Matrix6f::Identity();
+				Eigen::VectorXf dq = Jf.transpose() * A.ldlt().solve(residual) + z;
+				int worst = -1;
+				float worstExcess = 0;
+				for (std::size_t k = 0; k < free.size(); k++) {
+					int i = free[k];
+					step(i) = dq(k);
+					float excess = std::max(thetalist(i) + dq(k) - upper(i), lower(i) - thetalist(i) - dq(k));
+					if (excess > worstExcess) {
+						worst = static_cast<int>(k);
+						worstExcess = excess;
+					}
+				}
+				if (worst < 0)
+					break;
+				int i = free[worst];
+				step(i) = std::max(lower(i), std::min(upper(i), thetalist(i) + step(i))) - thetalist(i);
+				free.erase(free.begin() + worst);
+			}
+			return step;
 		}
-		Eigen::MatrixXf Vi = Eigen::MatrixXf::Zero(6,n+1);    // velocity
-		Eigen::MatrixXf Vdi = Eigen::MatrixXf::Zero(6,n+1);   // acceleration
-
-		Vdi.block(3, 0, 3, 1) = - g;
-		AdTi[n] = mr::Adjoint(mr::TransInv(Mlist[n]));
-		Eigen::VectorXf Fi = Ftip;
 
-		Eigen::VectorXf taulist = Eigen::VectorXf::Zero(n);
-
-		// forward pass
-		for (int i = 0; i < n; i++) {
-			Mi = Mi * Mlist[i];
-			Ai.col(i) = mr::Adjoint(mr::TransInv(Mi))*Slist.col(i);
-
-			AdTi[i] = mr::Adjoint(mr::MatrixExp6(mr::VecTose3(Ai.col(i)*-thetalist(i)))
-			          * mr::TransInv(Mlist[i]));
-
-			Vi.col(i+1) = AdTi[i] * Vi.col(i) + Ai.col(i) * dthetalist(i);
-			Vdi.col(i+1) = AdTi[i] * Vdi.col(i) + Ai.col(i) * ddthetalist(i)
-						   + ad(Vi.col(i+1)) * Ai.col(i) * dthetalist(i); // this index is different from book!
-		}
+	}
 
-		// backward pass
-		for (int i = n-1; i >= 0; i--) {
-			Fi = AdTi[i+1].transpose() * Fi + Glist[i] * Vdi.col(i+1)
-			     - ad(Vi.col(i+1)).transpose() * (Glist[i] * Vi.col(i+1));
-			taulist(i) = Fi.transpose() * Ai.col(i);
+	bool IKinBodyBounded(const Eigen::MatrixXf& Blist, const Eigen::MatrixXf& M, const Eigen::MatrixXf& T,
+		Eigen::VectorXf& thetalist, const Eigen::VectorXf& thetalower, const Eigen::VectorXf& thetaupper, float eomg, float ev) {
+		int i = 0;
+		int maxiterations = 50;
+		thetalist = thetalist.cwiseMax(thetalower).cwiseMin(thetaupper);
+		std::vector<JointModel> joints = ClassifyJoints(Blist);
+		auto joint = [&](int j) -> const JointModel& { return joints[j]; };
+		Eigen::MatrixXf Jb = Blist;
+		Eigen::MatrixXf Tfk = FKinBodyKernel(M, joint, thetalist);
+		Eigen::MatrixXf Tdiff = TransInv(Tfk)*T;
+		Vector6f Vb = se3ToVec(MatrixLog6(Tdiff));
+		bool err = (Vb.head<3>().norm() > eomg || Vb.tail<3>().norm() > ev);
+		while (err && i < maxiterations) {
+			JacobianBodyKernel(joint, thetalist, Jb);
+			thetalist += BoundedStep(Jb, Vb, thetalist, thetalower, thetaupper);
+			i += 1;
+			// iterate
+			Tfk = FKinBodyKernel(M, joint, thetalist);
+			Tdiff = TransInv(Tfk)*T;
+			Vb = se3ToVec(MatrixLog6(Tdiff));
+			err = (Vb.head<3>().norm() > eomg || Vb.tail<3>().norm() > ev);
 		}
-		return taulist;
+		return !err;
+	}
+
+	bool IKinSpaceBounded(const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& M, const Eigen::MatrixXf& T,
+		Eigen::VectorXf& thetalist, const Eigen::VectorXf& thetalower, const Eigen::VectorXf& thetaupper, float eomg, float ev) {
+		int i = 0;
+		int maxiterations = 50;
+		thetalist = thetalist.cwiseMax(thetalower).cwiseMin(thetaupper);
+		std::vector<JointModel> joints = ClassifyJoints(Slist);
+		auto joint = [&](int j) -> const JointModel& { return joints[j]; };
+		Eigen::MatrixXf Js = Slist;
+		Eigen::MatrixXf Tfk = FKinSpaceKernel(M, joint, thetalist);
+		Eigen::MatrixXf Tdiff = TransInv(Tfk)*T;
+		Vector6f Vs = Adjoint(Tfk)*se3ToVec(MatrixLog6(Tdiff));
+		bool err = (Vs.head<3>().norm() > eomg || Vs.tail<3>().norm() > ev);
+		while (err && i < maxiterations) {
+			JacobianSpaceKernel(joint, thetalist, Js);
+			thetalist += BoundedStep(Js, Vs, thetalist, thetalower, thetaupper);
+			i += 1;
+			// iterate
+			Tfk = FKinSpaceKernel(M, joint, thetalist);
+			Tdiff = TransInv(Tfk)*T;
+			Vs = Adjoint(Tfk)*se3ToVec(MatrixLog6(Tdiff));
+			err = (Vs.head<3>().norm() > eomg || Vs.tail<3>().norm() > ev);
+		}
+		return !err;
+	}
+
+	namespace {
+
+		/* p rotated by theta about the axis through r with unit direction w */
+		Eigen::Vector3f RotateAbout(const Eigen::Vector3f& w, const Eigen::Vector3f& r, float theta, const Eigen::Vector3f& p) {
+			return r + Eigen::AngleAxisf(theta, w) * (p - r);
+		}
+
+		/* The solutions of A cos(theta) + B sin(theta) = C, allowing for round-off
+		 * at the edge of the workspace */
+		int SolveCosSin(float A, float B, float C, float* theta) {
+			float rho = std::sqrt(A * A + B * B);
+			if (rho < 1e-7f)
+				return 0;
+			float x = C / rho;
+			if (std::abs(x) > 1 + 1e-4f)
+				return 0;
+			float phi = std::atan2(B, A);
+			float d = std::acos(std::max(-1.0f, std::min(1.0f, x)));
+			theta[0] = phi + d;
+			theta[1] = phi - d;
+			return d < 1e-6f ? 1 : 2;
+		}
+
+		/* Rotating p about the axis (w, r) gives r + w w.u + cos(theta) u' + sin(theta) w x u'
+		 * with u = p - r and u' its part perpendicular to w. */
+
+		/* Paden-Kahan subproblem 1: theta with e^[w, r]theta p = q */
+		float PadenKahan1(const Eigen::Vector3f& w, const Eigen::Vector3f& r, const Eigen::Vector3f& p, const Eigen::Vector3f& q) {
+			Eigen::Vector3f u = p - r, v = q - r;
+			Eigen::Vector3f up = u - w * w.dot(u), vp = v - w * w.dot(v);
+			return std::atan2(w.dot(up.cross(vp)), up.dot(vp));
+		}
+
+		/* Paden-Kahan subproblem 2: theta1, theta2 with e^[w1]theta1 e^[w2]theta2 p = q
+		 * for two axes meeting in r */
+		int PadenKahan2(const Eigen::Vector3f& w1, const Eigen::Vector3f& w2, const Eigen::Vector3f& r,
+			const Eigen::Vector3f& p, const Eigen::Vector3f& q, float (*theta)[2]) {
+			Eigen::Vector3f u = p - r, v = q - r;
+			float a = w1.dot(w2);
+			float alpha = (a * w2.dot(u) - w1.dot(v)) / (a * a - 1);
+			float beta = (a * w1.dot(v) - w2.dot(u)) / (a * a - 1);
+			Eigen::Vector3f n = w1.cross(w2);
+			float gamma2 = (u.squaredNorm() - alpha * alpha - beta * beta - 2 * alpha * beta * a) / n.squaredNorm();
+			if (gamma2 < -1e-4f * (1 + u.squaredNorm()))
+				return 0;
+			float gamma = std::sqrt(std::max(0.0f, gamma2));
+			int count = gamma < 1e-6f ? 1 : 2;
+			for (int k = 0; k < count; k++) {
+				// c = e^[w2]theta2 p = e^-[w1]theta1 q
+				Eigen::Vector3f c = r + alpha * w1 + beta * w2 + (k ? -gamma : gamma) * n;
+				theta[k][0] = PadenKahan1(w1, r, c, q);
+				theta[k][1] = PadenKahan1(w2, r, p, c);
+			}
+			return count;
+		}
+
+		/* Paden-Kahan subproblem 3: theta with |q - e^[w, r]theta p| = delta */
+		int PadenKahan3(const Eigen::Vector3f& w, const Eigen::Vector3f& r, const Eigen::Vector3f& p,
+			const Eigen::Vector3f& q, float delta, float* theta) {
+			Eigen::Vector3f u = p - r;
+			Eigen::Vector3f up = u - w * w.dot(u);
+			Eigen::Vector3f x = q - r - w * w.dot(u);
+			return SolveCosSin(2 * x.dot(up), 2 * x.dot(w.cross(up)), x.squaredNorm() + up.squaredNorm() - delta * delta, theta);
+		}
+
+		/* Paden-Kahan subproblem 4: theta with d.(e^[w, r]theta p) = delta */
+		int PadenKahan4(const Eigen::Vector3f& w, const Eigen::Vector3f& r, const Eigen::Vector3f& p,
+			const Eigen::Vector3f& d, float delta, float* theta) {
+			Eigen::Vector3f u = p - r;
+			Eigen::Vector3f up = u - w * w.dot(u);
+			return SolveCosSin(d.dot(up), d.dot(w.cross(up)), delta - d.dot(r) - d.dot(w) * w.dot(u), theta);
+		}
+
+		/* The point where two axes (w1, p1) and (w2, p2) meet, if they do */
+		bool AxesMeet(const Eigen::Vector3f& w1, const Eigen::Vector3f& p1, const Eigen::Vector3f& w2,
+			const Eigen::Vector3f& p2, Eigen::Vector3f& point) {
+			Eigen::Vector3f n = w1.cross(w2);
+			if (n.norm() < 1e-4f)
+				return false;
+			Eigen::Vector3f d = p2 - p1;
+			if (std::abs(d.dot(n)) / n.norm() > 1e-4f * (1 + d.norm()))
+				return false;
+			Eigen::Vector3f q1 = p1 + w1 * d.cross(w2).dot(n) / n.squaredNorm();
+			Eigen::Vector3f q2 = p2 + w2 * d.cross(w1).dot(n) / n.squaredNorm();
+			point = 0.5f * (q1 + q2);
+			return true;
+		}
+
+		float WrapAngle(float theta) {
+			theta = std::fmod(theta, 2 * float(M_PI));
+			if (theta > float(M_PI))
+				theta -= 2 * float(M_PI);
+			else if (theta <= -float(M_PI))
+				theta += 2 * float(M_PI);
+			return theta;
+		}
+
+	}
+
+	AnalyticIK::AnalyticIK(const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& M)
+		: Slist_(Slist), joints_(ClassifyJoints(Slist)), M_(M), structure_(None) {
+		if (Slist.rows() != 6 || Slist.cols() != 6)
+			return;
+		for (int i = 0; i < 6; i++) {
+			Eigen::Vector3f w = Slist.block<3, 1>(0, i), v = Slist.block<3, 1>(3, i);
+			// revolute joints only: a unit axis and zero pitch
+			if (std::abs(w.norm() - 1) > 1e-4f || std::abs(w.dot(v)) > 1e-4f)
+				return;
+			omg_.col(i) = w;
+			point_.col(i) = w.cross(v);
+		}
+		Eigen::Vector3f wrist56;
+		if (!AxesMeet(omg_.col(3), point_.col(3), omg_.col(4), point_.col(4), wrist_)
+			|| !AxesMeet(omg_.col(4), point_.col(4), omg_.col(5), point_.col(5), wrist56)
+			|| (wrist56 - wrist_).norm() > 1e-4f * (1 + wrist_.norm()))
+			return;
+		if (AxesMeet(omg_.col(0), point_.col(0), omg_.col(1), point_.col(1), shoulder_))
+			structure_ = IntersectingShoulder;
+		else if (omg_.col(1).cross(omg_.col(2)).norm() < 1e-4f && omg_.col(0).cross(omg_.col(1)).norm() > 1e-4f)
+			structure_ = ParallelElbow;
+	}
+
+	/* Adds the wrist solutions for one placement of the wrist center. W is
+	 * e^[S4]theta4 e^[S5]theta5 e^[S6]theta6, which leaves the wrist center fixed. */
+	void AnalyticIK::WristSolutions(const Eigen::Matrix4f& W, const Eigen::Vector3f& arm,
+		std::vector<Eigen::VectorXf>& solutions) const {
+		Eigen::Vector3f w4 = omg_.col(3), w5 = omg_.col(4), w6 = omg_.col(5);
+		// A point on axis 6 only moves with joints 4 and 5
+		Eigen::Vector3f p = wrist_ + w6;
+		Eigen::Vector3f q = W.topLeftCorner<3, 3>() * p + W.topRightCorner<3, 1>();
+		float theta45[2][2];
+		int count = PadenKahan2(w4, w5, wrist_, p, q, theta45);
+		// and a point off axis 6 then fixes joint 6
+		Eigen::Vector3f x = wrist_ + (w5 - w6 * w6.dot(w5)).normalized();
+		for (int k = 0; k < count; k++) {
+			Eigen::Matrix4f T45 = JointExpFixed(joints_[3], theta45[k][0]) * JointExpFixed(joints_[4], theta45[k][1]);
+			Eigen::Matrix4f T6 = TransInvFixed(T45) * W;
+			Eigen::Vector3f y = T6.topLeftCorner<3, 3>() * x + T6.topRightCorner<3, 1>();
+			Eigen::VectorXf thetalist(6);
+			thetalist << arm, theta45[k][0], theta45[k][1], PadenKahan1(w6, wrist_, x, y);
+			solutions.push_back(thetalist);
+		}
+	}
+
+	std::vector<Eigen::VectorXf> AnalyticIK::Solutions(const Eigen::MatrixXf& T) const {
+		std::vector<Eigen::VectorXf> solutions;
+		if (structure_ == None)
+			return solutions;
+		Eigen::Matrix4f Tsd = T;
+		// e^[S1]theta1 ... e^[S6]theta6 = T M^-1 takes the wrist center to pw
+		Eigen::Matrix4f TMinv = Tsd * TransInvFixed(M_);
+		Eigen::Vector3f pw = TMinv.topLeftCorner<3, 3>() * wrist_ + TMinv.topRightCorner<3, 1>();
+
+		// Joints 1-3 placing the wrist center
+		std::vector<Eigen::Vector3f> arms;
+		float theta1[2], theta3[2], theta12[2][2];
+		if (structure_ == IntersectingShoulder) {
+			// Joints 1 and 2 keep the distance to the shoulder, which fixes joint 3
+			int count3 = PadenKahan3(omg_.col(2), point_.col(2), wrist_, shoulder_, (pw - shoulder_).norm(), theta3);
+			for (int i = 0; i < count3; i++) {
+				Eigen::Vector3f q = RotateAbout(omg_.col(2), point_.col(2), theta3[i], wrist_);
+				int count12 = PadenKahan2(omg_.col(0), omg_.col(1), shoulder_, q, pw, theta12);
+				for (int j = 0; j < count12; j++)
+					arms.push_back(Eigen::Vector3f(theta12[j][0], theta12[j][1], theta3[i]));
+			}
+		}
+		else {
+			// Joints 2 and 3 keep the component along their common direction, which
+			// fixes joint 1; the distance to axis 2 then fixes joint 3
+			Eigen::Vector3f w2 = omg_.col(1);
+			int count1 = PadenKahan4(omg_.col(0), point_.col(0), pw, w2, w2.dot(wrist_), theta1);
+			for (int i = 0; i < count1; i++) {
+				Eigen::Vector3f p = RotateAbout(omg_.col(0), point_.col(0), theta1[i], pw);
+				int count3 = PadenKahan3(omg_.col(2), point_.col(2), wrist_, point_.col(1), (p - point_.col(1)).norm(), theta3);
+				for (int j = 0; j < count3; j++) {
+					Eigen::Vector3f q = RotateAbout(omg_.col(2), point_.col(2), theta3[j], wrist_);
+					arms.push_back(Eigen::Vector3f(-theta1[i], PadenKahan1(w2, point_.col(1), q, p), theta3[j]));
+				}
+			}
+		}
+
+		// The wrist, for each arm
+		std::vector<Eigen::VectorXf> candidates;
+		for (std::size_t i = 0; i < arms.size(); i++) {
+			Eigen::Matrix4f T123 = Eigen::Matrix4f::Identity();
+			for (int j = 0; j < 3; j++)
+				T123 = T123 * JointExpFixed(joints_[j], arms[i](j));
+			WristSolutions(TransInvFixed(T123) * TMinv, arms[i], candidates);
+		}
+
+		// Keep the distinct candidates that reach T; unreachable targets leave
+		// near-misses from the clamped subproblems
+		float tolerance = 1e-3f * (1 + Tsd.topRightCorner<3, 1>().norm());
+		for (std::size_t i = 0; i < candidates.size(); i++) {
+			for (int j = 0; j < 6; j++)
+				candidates[i](j) = WrapAngle(candidates[i](j));
+			Eigen::Matrix4f Tfk = FKinSpaceKernel(M_, [&](int j) -> const JointModel& { return joints_[j]; }, candidates[i]);
+			if ((Tfk - Tsd).norm() > tolerance)
+				continue;
+			bool duplicate = false;
+			for (std::size_t j = 0; j < solutions.size() && !duplicate; j++)
+				duplicate = (solutions[j] - candidates[i]).cwiseAbs().maxCoeff() < 1e-4f;
+			if (!duplicate)
+				solutions.push_back(candidates[i]);
+		}
+		return solutions;
+	}
+
+	bool AnalyticIK::Solve(const Eigen::MatrixXf& T, Eigen::VectorXf& thetalist, float eomg, float ev) const {
+		if (structure_ != None) {
+			std::vector<Eigen::VectorXf> solutions = Solutions(T);
+			if (solutions.empty())
+				return false;
+			// The solution nearest to the initial guess, kept on the guess's side of 2 pi
+			Eigen::VectorXf best;
+			float bestDistance = 0;
+			for (std::size_t i = 0; i < solutions.size(); i++) {
+				Eigen::VectorXf step = solutions[i] - thetalist;
+				for (int j = 0; j < 6; j++)
+					step(j) = WrapAngle(step(j));
+				if (best.size() == 0 || step.norm() < bestDistance) {
+					best = thetalist + step;
+					bestDistance = step.norm();
+				}
+			}
+			thetalist = best;
+		}
+		// Polishes a closed-form solution to eomg and ev, or solves numerically
+		return IKinSpace(Slist_, M_, T, thetalist, eomg, ev);
+	}
+
+	struct IKSeedCache::Impl {
+		Impl(const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& M, std::size_t capacity, float rotationWeight)
+			: Slist(Slist), M(M), capacity(capacity), rotationWeight(rotationWeight), index(12) {}
+
+		/* The point of T in the pose metric */
+		Eigen::VectorXf Key(const Eigen::MatrixXf& T) const {
+			Eigen::VectorXf key(12);
+			key.head<3>() = T.block<3, 1>(0, 3);
+			for (int j = 0; j < 3; j++)
+				key.segment<3>(3 + 3 * j) = rotationWeight * T.block<3, 1>(0, j);
+			return key;
+		}
+
+		/* Marks entry i as the most recently used */
+		void Touch(int i) { recent.splice(recent.begin(), recent, position[i]); }
+
+		/* Drops the removed entries from the tree, reinserting the others */
+		void Rebuild() {
+			KdTree rebuilt(12);
+			std::vector<Eigen::VectorXf> kept;
+			std::vector<std::list<int>::iterator> keptPosition;
+			for (std::list<int>::iterator it = recent.begin(); it != recent.end(); ++it) {
+				int i = rebuilt.Insert(index.Point(*it));
+				kept.push_back(solutions[*it]);
+				keptPosition.push_back(it);
+				*it = i;
+			}
+			index = rebuilt;
+			solutions.swap(kept);
+			position.swap(keptPosition);
+		}
+
+		Eigen::MatrixXf Slist, M;
+		std::size_t capacity;
+		float rotationWeight;
+
+		std::mutex mutex;
+		KdTree index;
+		std::vector<Eigen::VectorXf> solutions;               // by index in the tree
+		std::list<int> recent;                                 // live indices, most recently used first
+		std::vector<std::list<int>::iterator> position;        // of every live index in recent
+	};
+
+	IKSeedCache::IKSeedCache(const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& M, std::size_t capacity, float rotationWeight)
+		: impl_(new Impl(Slist, M, std::max<std::size_t>(capacity, 1), rotationWeight)) {}
+
+	IKSeedCache::~IKSeedCache() {}
+
+	std::size_t IKSeedCache::Size() const {
+		std::lock_guard<std::mutex> lock(impl_->mutex);
+		return impl_->recent.size();
+	}
+
+	void IKSeedCache::Insert(const Eigen::MatrixXf& T, const Eigen::VectorXf& thetalist) {
+		Impl& c = *impl_;
+		Eigen::VectorXf key = c.Key(T);
+		std::lock_guard<std::mutex> lock(c.mutex);
+		// The same pose again replaces the old solution
+		int nearest = c.index.Nearest(key);
+		if (nearest >= 0 && (c.index.Point(nearest) - key).norm() < 1e-6f) {
+			c.solutions[nearest] = thetalist;
+			c.Touch(nearest);
+			return;
+		}
+		int i = c.index.Insert(key);
+		c.solutions.push_back(thetalist);
+		c.recent.push_front(i);
+		c.position.push_back(c.recent.begin());
+		if (c.recent.size() > c.capacity) {
+			int oldest = c.recent.back();
+			c.index.Remove(oldest);
+			c.solutions[oldest] = Eigen::VectorXf();
+			c.recent.pop_back();
+		}
+		// Keeps the dropped entries to at most half of the tree
+		if (static_cast<std::size_t>(c.index.Size()) > 2 * c.capacity)
+			c.Rebuild();
+	}
+
+	bool IKSeedCache::Seed(const Eigen::MatrixXf& T, Eigen::VectorXf& thetalist) {
+		Impl& c = *impl_;
+		Eigen::VectorXf key = c.Key(T);
+		std::lock_guard<std::mutex> lock(c.mutex);
+		int nearest = c.index.Nearest(key);
+		if (nearest < 0)
+			return false;
+		thetalist = c.solutions[nearest];
+		c.Touch(nearest);
+		return true;
+	}
+
+	bool IKSeedCache::Solve(const Eigen::MatrixXf& T, Eigen::VectorXf& thetalist, float eomg, float ev) {
+		Eigen::VectorXf guess = thetalist;
+		bool seeded = Seed(T, thetalist);
+		bool success = IKinSpace(impl_->Slist, impl_->M, T, thetalist, eomg, ev);
+		if (!success && seeded) {
+			thetalist = guess;
+			success = IKinSpace(impl_->Slist, impl_->M, T, thetalist, eomg, ev);
+		}
+		if (success)
+			Insert(T, thetalist);
+		return success;
+	}
+
+	namespace {
+
+		/* se3ToVec(MatrixLog6(T)) on fixed-size types */
+		Vector6f Log6Fixed(const Eigen::Matrix4f& T) {
+			Eigen::Matrix3f R = T.topLeftCorner<3, 3>();
+			Eigen::Vector3f p = T.topRightCorner<3, 1>();
+			float acosinput = (R.trace() - 1) / 2.0f;
+			Eigen::Vector3f omg = Eigen::Vector3f::Zero();
+			if (acosinput <= -1) {
+				if (!NearZero(1 + R(2, 2)))
+					omg = (1.0f / std::sqrt(2 * (1 + R(2, 2))))*Eigen::Vector3f(R(0, 2), R(1, 2), 1 + R(2, 2));
+				else if (!NearZero(1 + R(1, 1)))
+					omg = (1.0f / std::sqrt(2 * (1 + R(1, 1))))*Eigen::Vector3f(R(0, 1), 1 + R(1, 1), R(2, 1));
+				else
+					omg = (1.0f / std::sqrt(2 * (1 + R(0, 0))))*Eigen::Vector3f(1 + R(0, 0), R(1, 0), R(2, 0));
+				omg *= float(M_PI);
+			}
+			else {
+				// The angle from both its sine and cosine keeps small rotations accurate
+				Eigen::Vector3f w(R(2, 1) - R(1, 2), R(0, 2) - R(2, 0), R(1, 0) - R(0, 1));
+				float sine = 0.5f * w.norm();
+				if (sine > 0)
+					omg = std::atan2(sine, acosinput) / (2 * sine) * w;
+			}
+			Vector6f V;
+			if (NearZero(omg.norm())) {
+				V << Eigen::Vector3f::Zero(), p;
+				return V;
+			}
+			float theta = omg.norm();
+			Eigen::Matrix3f omgmat = VecToso3(omg);
+			Eigen::Matrix3f logExpand = Eigen::Matrix3f::Identity() - omgmat / 2.0f
+				+ (1.0f / theta - 1.0f / std::tan(theta / 2.0f) / 2) * omgmat * omgmat / theta;
+			V << omg, logExpand * p;
+			return V;
+		}
+
+	}
+
+	ResolvedRateController::ResolvedRateController(const Eigen::MatrixXf& M, const Eigen::MatrixXf& Slist,
+		float dt, float gain, float damping)
+		: M_(M), joints_(ClassifyJoints(Slist)), dt_(dt), gain_(gain), damping_(damping),
+		maxVelocity_(Eigen::VectorXf::Constant(Slist.cols(), std::numeric_limits<float>::infinity())),
+		maxAcceleration_(maxVelocity_), dthetalist_(Eigen::VectorXf::Zero(Slist.cols())), Js_(6, Slist.cols()),
+		error_(Vector6f::Zero()) {}
+
+	void ResolvedRateController::SetLimits(const Eigen::VectorXf& dthetamax, const Eigen::VectorXf& ddthetamax) {
+		maxVelocity_ = dthetamax;
+		maxAcceleration_ = ddthetamax;
+	}
+
+	const Eigen::VectorXf& ResolvedRateController::Step(const Eigen::VectorXf& thetalist, const Eigen::Matrix4f& Tsd) {
+		return Step(thetalist, Tsd, Vector6f::Zero());
+	}
+
+	const Eigen::VectorXf& ResolvedRateController::Step(const Eigen::VectorXf& thetalist, const Eigen::Matrix4f& Tsd,
+		const Vector6f& Vd) {
+		int n = static_cast<int>(joints_.size());
+		// Forward kinematics and the space Jacobian in one pass
+		Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+		for (int i = 0; i < n; i++) {
+			Js_.col(i) = AdjointScrew(T, joints_[i]);
+			T = T * JointExpFixed(joints_[i], thetalist(i));
+		}
+		T = T * M_;
+		error_ = AdjointFixed(T) * Log6Fixed(TransInvFixed(T) * Tsd);
+
+		// Damped least squares through the 6x6 system
+		Matrix6f A = Js_.lazyProduct(Js_.transpose());
+		A.diagonal().array() += damping_ * damping_;
+		Vector6f y = A.ldlt().solve(Vd + gain_ * error_);
+
+		// The velocity limits scale the whole step, the acceleration limits the change from the last one
+		float scale = 1;
+		for (int i = 0; i < n; i++) {
+			float dtheta = Js_.col(i).dot(y);
+			if (std::abs(dtheta) * scale > maxVelocity_(i))
+				scale = maxVelocity_(i) / std::abs(dtheta);
+		}
+		float blend = 1;
+		for (int i = 0; i < n; i++) {
+			float change = scale * Js_.col(i).dot(y) - dthetalist_(i);
+			if (std::abs(change) * blend > maxAcceleration_(i) * dt_)
+				blend = maxAcceleration_(i) * dt_ / std::abs(change);
+		}
+		for (int i = 0; i < n; i++)
+			dthetalist_(i) += blend * (scale * Js_.col(i).dot(y) - dthetalist_(i));
+		return dthetalist_;
+	}
+
+	Workspace::Workspace(int dof) : top_(0), dof_(0) {
+		Reserve(dof);
+	}
+
+	void Workspace::Reserve(int dof) {
+		if (dof > dof_)
+			dof_ = dof;
+		std::size_t size = RequiredSize(dof_);
+		if (slab_.size() < size)
+			slab_.resize(size);
+	}
+
+	void Workspace::Reset() {
+		top_ = 0;
+	}
+
+	Eigen::Map<Eigen::MatrixXf> Workspace::Matrix(int rows, int cols) {
+		return Eigen::Map<Eigen::MatrixXf>(Allocate(std::size_t(rows) * cols), rows, cols);
+	}
+
+	Eigen::Map<Eigen::VectorXf> Workspace::Vector(int size) {
+		return Eigen::Map<Eigen::VectorXf>(Allocate(size), size);
+	}
+
+	std::size_t Workspace::RequiredSize(int dof) {
+		// The link transforms and the Newton-Euler recursion take 54n + 48 floats;
+		// ForwardDynamics and ComputedTorque add the mass matrix and a few n-vectors
+		std::size_t n = dof;
+		return n * n + 64 * n + 64;
+	}
+
+	float* Workspace::Allocate(std::size_t count) {
+		if (top_ + count > slab_.size())
+			throw std::bad_alloc();
+		float* ptr = slab_.data() + top_;
+		top_ += count;
+		return ptr;
+	}
+
+	namespace {
+		/* Overwrites the lower triangle of a symmetric positive definite A with its
+		 * Cholesky factor L, A = L L^T */
+		void CholeskyFactorInPlace(Eigen::Ref<Eigen::MatrixXf> A) {
+			int n = A.rows();
+			for (int j = 0; j < n; ++j) {
+				float d = A(j, j);
+				for (int k = 0; k < j; ++k)
+					d -= A(j, k) * A(j, k);
+				d = std::sqrt(d);
+				A(j, j) = d;
+				for (int i = j + 1; i < n; ++i) {
+					float s = A(i, j);
+					for (int k = 0; k < j; ++k)
+						s -= A(i, k) * A(j, k);
+					A(i, j) = s / d;
+				}
+			}
+		}
+
+		/* Overwrites b with the solution of L L^T x = b for a factor from CholeskyFactorInPlace */
+		void CholeskySubstituteInPlace(const Eigen::Ref<const Eigen::MatrixXf>& L, Eigen::Ref<Eigen::VectorXf> b) {
+			int n = L.rows();
+			for (int i = 0; i < n; ++i) {
+				for (int k = 0; k < i; ++k)
+					b(i) -= L(i, k) * b(k);
+				b(i) /= L(i, i);
+			}
+			for (int i = n - 1; i >= 0; --i) {
+				for (int k = i + 1; k < n; ++k)
+					b(i) -= L(k, i) * b(k);
+				b(i) /= L(i, i);
+			}
+		}
+
+		/* Solves A*x = b for a symmetric positive definite A, overwriting A with its
+		 * Cholesky factor and b with x */
+		void CholeskySolveInPlace(Eigen::Ref<Eigen::MatrixXf> A, Eigen::Ref<Eigen::VectorXf> b) {
+			CholeskyFactorInPlace(A);
+			CholeskySubstituteInPlace(A, b);
+		}
+
+		/* The configuration-dependent half of InverseDynamics: the screw axes Ai of the
+		 * joints in their link frames (6 x n) and the adjoints of T_{i,i-1} (n+1 6x6
+		 * blocks side by side). jointExp(i) supplies e^[Si]thetai, from which
+		 * e^-[Ai]thetai = Mi^-1 * e^-[Si]thetai * M(i-1) */
+		template <typename JointExp>
+		void LinkTransformsKernel(const JointExp& jointExp, int n, const std::vector<Eigen::MatrixXf>& Mlist,
+			const Eigen::MatrixXf& Slist, Eigen::Ref<Eigen::MatrixXf> Ai, Eigen::Ref<Eigen::MatrixXf> AdTi) {
+			Eigen::Matrix4f Mprev = Eigen::Matrix4f::Identity();
+			Eigen::Matrix4f Mlisti;
+			for (int i = 0; i < n; i++) {
+				Mlisti = Mlist[i];
+				Eigen::Matrix4f Mi = Mprev * Mlisti;
+				Eigen::Matrix4f Miinv = TransInvFixed(Mi);
+				Ai.col(i) = AdjointFixed(Miinv) * Vector6f(Slist.col(i));
+				AdTi.block<6, 6>(0, 6 * i) = AdjointFixed(Miinv * TransInvFixed(jointExp(i)) * Mprev);
+				Mprev = Mi;
+			}
+			Mlisti = Mlist[n];
+			AdTi.block<6, 6>(0, 6 * n) = AdjointFixed(TransInvFixed(Mlisti));
+		}
+
+		/* The velocity-dependent half of InverseDynamics: the forward-backward recursion
+		 * over precomputed link transforms. Vi and Vdi live in ws. */
+		void NewtonEulerKernel(const Eigen::Ref<const Eigen::MatrixXf>& Ai, const Eigen::Ref<const Eigen::MatrixXf>& AdTi,
+			const VectorRef& dthetalist, const VectorRef& ddthetalist, const Eigen::Vector3f& g, const Vector6f& Ftip,
+			const std::vector<Eigen::MatrixXf>& Glist, Workspace& ws, Eigen::Ref<Eigen::VectorXf> taulist) {
+			int n = Ai.cols();
+			Workspace::Frame frame(ws);
+			Eigen::Map<Eigen::MatrixXf> Vi = ws.Matrix(6, n + 1);    // velocity
+			Eigen::Map<Eigen::MatrixXf> Vdi = ws.Matrix(6, n + 1);   // acceleration
+			Vi.col(0).setZero();
+			Vdi.col(0).setZero();
+			Vdi.block<3, 1>(3, 0) = -g;
+
+			// forward pass
+			for (int i = 0; i < n; i++) {
+				Vector6f A = Ai.col(i);
+				Matrix6f AdT = AdTi.block<6, 6>(0, 6 * i);
+				Vector6f V = AdT * Vector6f(Vi.col(i)) + A * dthetalist(i);
+				// [adV]A = [w x Aw; v x Aw + w x Av]
+				Vector6f adVA;
+				adVA << V.head<3>().cross(A.head<3>()),
+					V.tail<3>().cross(A.head<3>()) + V.head<3>().cross(A.tail<3>());
+				Vdi.col(i + 1) = AdT * Vector6f(Vdi.col(i)) + A * ddthetalist(i)
+								 + adVA * dthetalist(i); // this index is different from book!
+				Vi.col(i + 1) = V;
+			}
+
+			// backward pass
+			Vector6f Fi = Ftip;
+			for (int i = n - 1; i >= 0; i--) {
+				Matrix6f AdT = AdTi.block<6, 6>(0, 6 * (i + 1));
+				Matrix6f G = Glist[i];
+				Vector6f V = Vi.col(i + 1);
+				// [adV]^T P = -[w x Pw + v x Pv; w x Pv]
+				Vector6f P = G * V;
+				Vector6f adVTP;
+				adVTP << V.head<3>().cross(P.head<3>()) + V.tail<3>().cross(P.tail<3>()),
+					V.head<3>().cross(P.tail<3>());
+				Fi = AdT.transpose() * Fi + G * Vector6f(Vdi.col(i + 1)) + adVTP;
+				taulist(i) = Fi.dot(Vector6f(Ai.col(i)));
+			}
+		}
+
+		/* The composite-rigid-body algorithm over the same link transforms: Ic is the
+		 * inertia of links i..n-1 in frame {i}, and column i of M is Ic*Ai carried
+		 * back toward the base and projected on each joint axis */
+		void MassMatrixKernel(const Eigen::Ref<const Eigen::MatrixXf>& Ai, const Eigen::Ref<const Eigen::MatrixXf>& AdTi,
+			const std::vector<Eigen::MatrixXf>& Glist, Eigen::Ref<Eigen::MatrixXf> M) {
+			int n = Ai.cols();
+			Matrix6f Ic = Matrix6f::Zero();
+			for (int i = n - 1; i >= 0; i--) {
+				if (i < n - 1) {
+					Matrix6f AdT = AdTi.block<6, 6>(0, 6 * (i + 1));
+					Ic = AdT.transpose() * (Ic * AdT);
+				}
+				Ic += Glist[i];
+				Vector6f F = Ic * Vector6f(Ai.col(i));
+				M(i, i) = F.dot(Vector6f(Ai.col(i)));
+				for (int j = i - 1; j >= 0; j--) {
+					F = AdTi.block<6, 6>(0, 6 * (j + 1)).transpose() * F;
+					M(j, i) = M(i, j) = F.dot(Vector6f(Ai.col(j)));
+				}
+			}
+		}
+
+		/* Solves M*ddthetalist = taulist - (c + g + Jtr*Ftip); the three bias terms are
+		 * linear in g and Ftip, so a single Newton-Euler pass with ddthetalist = 0
+		 * produces their sum */
+		void ForwardDynamicsKernel(const Eigen::Ref<const Eigen::MatrixXf>& Ai, const Eigen::Ref<const Eigen::MatrixXf>& AdTi,
+			const VectorRef& dthetalist, const VectorRef& taulist, const Eigen::Vector3f& g, const Vector6f& Ftip,
+			const std::vector<Eigen::MatrixXf>& Glist, Workspace& ws, Eigen::Ref<Eigen::VectorXf> ddthetalist) {
+			int n = Ai.cols();
+			Workspace::Frame frame(ws);
+			Eigen::Map<Eigen::MatrixXf> M = ws.Matrix(n, n);
+			Eigen::Map<Eigen::VectorXf> dummylist = ws.Vector(n);
+			dummylist.setZero();
+			NewtonEulerKernel(Ai, AdTi, dthetalist, dummylist, g, Ftip, Glist, ws, ddthetalist);
+			ddthetalist = taulist - ddthetalist;
+			MassMatrixKernel(Ai, AdTi, Glist, M);
+			// Cholesky since M is positive definite
+			CholeskySolveInPlace(M, ddthetalist);
+		}
+
+		/* Link transforms of the chain at thetalist, allocated from ws by the caller's frame */
+		struct LinkTransforms {
+			LinkTransforms(const VectorRef& thetalist, const std::vector<Eigen::MatrixXf>& Mlist,
+				const Eigen::MatrixXf& Slist, Workspace& ws)
+				: Ai(ws.Matrix(6, thetalist.size())), AdTi(ws.Matrix(6, 6 * (thetalist.size() + 1))) {
+				LinkTransformsKernel([&](int i) { return JointExpFixed(ClassifyScrew(Slist.col(i)), thetalist(i)); },
+					thetalist.size(), Mlist, Slist, Ai, AdTi);
+			}
+			Eigen::Map<Eigen::MatrixXf> Ai;
+			Eigen::Map<Eigen::MatrixXf> AdTi;
+		};
+
+		void InverseDynamicsKernel(const VectorRef& thetalist, const VectorRef& dthetalist, const VectorRef& ddthetalist,
+			const Eigen::Vector3f& g, const Vector6f& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
+			const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, Workspace& ws,
+			Eigen::Ref<Eigen::VectorXf> taulist) {
+			Workspace::Frame frame(ws);
+			LinkTransforms links(thetalist, Mlist, Slist, ws);
+			NewtonEulerKernel(links.Ai, links.AdTi, dthetalist, ddthetalist, g, Ftip, Glist, ws, taulist);
+		}
+
+		void MassMatrixKernel(const VectorRef& thetalist, const std::vector<Eigen::MatrixXf>& Mlist,
+			const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, Workspace& ws,
+			Eigen::Ref<Eigen::MatrixXf> M) {
+			Workspace::Frame frame(ws);
+			LinkTransforms links(thetalist, Mlist, Slist, ws);
+			MassMatrixKernel(links.Ai, links.AdTi, Glist, M);
+		}
+
+		void ForwardDynamicsKernel(const VectorRef& thetalist, const VectorRef& dthetalist, const VectorRef& taulist,
+			const Eigen::Vector3f& g, const Vector6f& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
+			const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, Workspace& ws,
+			Eigen::Ref<Eigen::VectorXf> ddthetalist) {
+			Workspace::Frame frame(ws);
+			LinkTransforms links(thetalist, Mlist, Slist, ws);
+			ForwardDynamicsKernel(links.Ai, links.AdTi, dthetalist, taulist, g, Ftip, Glist, ws, ddthetalist);
+		}
+
+		void ComputedTorqueKernel(const VectorRef& thetalist, const VectorRef& dthetalist, const VectorRef& eint,
+			const Eigen::Vector3f& g, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+			const Eigen::MatrixXf& Slist, const VectorRef& thetalistd, const VectorRef& dthetalistd, const VectorRef& ddthetalistd,
+			float Kp, float Ki, float Kd, Workspace& ws, Eigen::Ref<Eigen::VectorXf> tau_computed) {
+			int n = thetalist.size();
+			Workspace::Frame frame(ws);
+			LinkTransforms links(thetalist, Mlist, Slist, ws);
+			Eigen::Map<Eigen::MatrixXf> M = ws.Matrix(n, n);
+			Eigen::Map<Eigen::VectorXf> e = ws.Vector(n);
+			e = thetalistd - thetalist;  // position err
+			e = Kp * e + Ki * (eint + e) + Kd * (dthetalistd - dthetalist);
+			MassMatrixKernel(links.Ai, links.AdTi, Glist, M);
+			NewtonEulerKernel(links.Ai, links.AdTi, dthetalist, ddthetalistd, g, Vector6f::Zero(), Glist, ws, tau_computed);
+			tau_computed.noalias() += M * e;
+		}
+	}
+
+	KinematicState::KinematicState(const std::vector<Eigen::MatrixXf>& Mlist, const Eigen::MatrixXf& Slist,
+		const Eigen::VectorXf& thetalist)
+		: KinematicState(Mlist, ClassifyJoints(Slist), thetalist) {
+	}
+
+	KinematicState::KinematicState(const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<JointModel>& joints,
+		const Eigen::VectorXf& thetalist)
+		: thetalist_(thetalist), sin_(thetalist.size()), cos_(thetalist.size()), exps_(thetalist.size()),
+		  prefix_(thetalist.size() + 1), Js_(6, thetalist.size()), Ai_(6, thetalist.size()),
+		  AdTi_(6, 6 * (thetalist.size() + 1)) {
+		int n = thetalist.size();
+		M_ = Eigen::Matrix4f::Identity();
+		for (int i = 0; i < n + 1; i++) {
+			Eigen::Matrix4f Mlisti = Mlist[i];
+			M_ = M_ * Mlisti;
+		}
+		Eigen::MatrixXf Slist(6, n);
+		prefix_[0] = Eigen::Matrix4f::Identity();
+		for (int i = 0; i < n; i++) {
+			Slist.col(i) = joints[i].S;
+			if (joints[i].type == JointType::Prismatic) {
+				sin_(i) = 0;
+				cos_(i) = 1;
+			}
+			else {
+				float angle = joints[i].S.head<3>().norm() * thetalist(i);
+				sin_(i) = std::sin(angle);
+				cos_(i) = std::cos(angle);
+			}
+			exps_[i] = JointExpSinCos(joints[i], thetalist(i), sin_(i), cos_(i));
+			Js_.col(i) = AdjointScrew(prefix_[i], joints[i]);
+			prefix_[i + 1] = prefix_[i] * exps_[i];
+		}
+		T_ = prefix_[n] * M_;
+		LinkTransformsKernel([&](int i) { return exps_[i]; }, n, Mlist, Slist, Ai_, AdTi_);
+	}
+
+	Eigen::MatrixXf FKinSpace(const KinematicState& state) {
+		return state.EndEffector();
+	}
+
+	Eigen::MatrixXf FKinBody(const KinematicState& state) {
+		return state.EndEffector();
+	}
+
+	Eigen::MatrixXf JacobianSpace(const KinematicState& state) {
+		return state.Jacobian();
+	}
+
+	Eigen::MatrixXf JacobianBody(const KinematicState& state) {
+		Matrix6f AdTinv = AdjointFixed(TransInvFixed(state.EndEffector()));
+		return AdTinv * state.Jacobian();
+	}
+
+	Eigen::VectorXf InverseDynamics(const KinematicState& state, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& ddthetalist,
+		const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Glist, Workspace& ws) {
+		ws.Reserve(state.Dof());
+		Eigen::VectorXf taulist(state.Dof());
+		NewtonEulerKernel(state.Ai(), state.AdTi(), dthetalist, ddthetalist, Eigen::Vector3f(g), Vector6f(Ftip),
+			Glist, ws, taulist);
+		return taulist;
+	}
+
+	Eigen::MatrixXf MassMatrix(const KinematicState& state, const std::vector<Eigen::MatrixXf>& Glist, Workspace& ws) {
+		ws.Reserve(state.Dof());
+		Eigen::MatrixXf M(state.Dof(), state.Dof());
+		MassMatrixKernel(state.Ai(), state.AdTi(), Glist, M);
+		return M;
+	}
+
+	Eigen::VectorXf ForwardDynamics(const KinematicState& state, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& taulist,
+		const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Glist, Workspace& ws) {
+		ws.Reserve(state.Dof());
+		Eigen::VectorXf ddthetalist(state.Dof());
+		ForwardDynamicsKernel(state.Ai(), state.AdTi(), dthetalist, taulist, Eigen::Vector3f(g), Vector6f(Ftip),
+			Glist, ws, ddthetalist);
+		return ddthetalist;
+	}
+
+	/*
+	* Function: This function uses forward-backward Newton-Euler iterations to solve the
+	* equation:
+	* taulist = Mlist(thetalist) * ddthetalist + c(thetalist, dthetalist) ...
+	*           + g(thetalist) + Jtr(thetalist) * Ftip
+	* Inputs:
+	*  thetalist: n-vector of joint variables
+	*  dthetalist: n-vector of joint rates
+	*  ddthetalist: n-vector of joint accelerations
+	*  g: Gravity vector g
+	*  Ftip: Spatial force applied by the end-effector expressed in frame {n+1}
+	*  Mlist: List of link frames {i} relative to {i-1} at the home position
+	*  Glist: Spatial inertia matrices Gi of the links
+	*  Slist: Screw axes Si of the joints in a space frame, in the format
+	*         of a matrix with the screw axes as the columns.
+	*
+	* Outputs:
+	*  taulist: The n-vector of required joint forces/torques
+	*
+	*/
+	Eigen::VectorXf InverseDynamics(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& ddthetalist,
+									const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
+									const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
+		Workspace ws(thetalist.size());
+		return InverseDynamics(thetalist, dthetalist, ddthetalist, g, Ftip, Mlist, Glist, Slist, ws);
+	}
+
+	Eigen::VectorXf InverseDynamics(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& ddthetalist,
+									const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
+									const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, Workspace& ws) {
+		int n = thetalist.size();
+		ws.Reserve(n);
+		Eigen::VectorXf taulist(n);
+		InverseDynamicsKernel(thetalist, dthetalist, ddthetalist, Eigen::Vector3f(g), Vector6f(Ftip),
+			Mlist, Glist, Slist, ws, taulist);
+		return taulist;
 	}
 
 	/*
@@ -550,11 +2092,21 @@ namespace mr {
 	 */
 	Eigen::VectorXf GravityForces(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& g,
 									const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
-	    int n = thetalist.size();
-		Eigen::VectorXf dummylist = Eigen::VectorXf::Zero(n);
-		Eigen::VectorXf dummyForce = Eigen::VectorXf::Zero(6);
-		Eigen::VectorXf grav = mr::InverseDynamics(thetalist, dummylist, dummylist, g,
-                                                dummyForce, Mlist, Glist, Slist);
+		Workspace ws(thetalist.size());
+		return GravityForces(thetalist, g, Mlist, Glist, Slist, ws);
+	}
+
+	Eigen::VectorXf GravityForces(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& g,
+									const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist,
+									Workspace& ws) {
+		int n = thetalist.size();
+		ws.Reserve(n);
+		Workspace::Frame frame(ws);
+		Eigen::Map<Eigen::VectorXf> dummylist = ws.Vector(n);
+		dummylist.setZero();
+		Eigen::VectorXf grav(n);
+		InverseDynamicsKernel(thetalist, dummylist, dummylist, Eigen::Vector3f(g), Vector6f::Zero(),
+			Mlist, Glist, Slist, ws, grav);
 		return grav;
 	}
 
@@ -577,17 +2129,17 @@ namespace mr {
 	 */
 	Eigen::MatrixXf MassMatrix(const Eigen::VectorXf& thetalist,
                                 const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
+		Workspace ws(thetalist.size());
+		return MassMatrix(thetalist, Mlist, Glist, Slist, ws);
+	}
+
+	Eigen::MatrixXf MassMatrix(const Eigen::VectorXf& thetalist,
+                                const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist,
+                                Workspace& ws) {
 		int n = thetalist.size();
-		Eigen::VectorXf dummylist = Eigen::VectorXf::Zero(n);
-		Eigen::VectorXf dummyg = Eigen::VectorXf::Zero(3);
-		Eigen::VectorXf dummyforce = Eigen::VectorXf::Zero(6);
-		Eigen::MatrixXf M = Eigen::MatrixXf::Zero(n,n);
-		for (int i = 0; i < n; i++) {
-			Eigen::VectorXf ddthetalist = Eigen::VectorXf::Zero(n);
-			ddthetalist(i) = 1;
-			M.col(i) = mr::InverseDynamics(thetalist, dummylist, ddthetalist,
-                             dummyg, dummyforce, Mlist, Glist, Slist);
-		}
+		ws.Reserve(n);
+		Eigen::MatrixXf M(n, n);
+		MassMatrixKernel(thetalist, Mlist, Glist, Slist, ws, M);
 		return M;
 	}
 
@@ -609,12 +2161,21 @@ namespace mr {
 	 */
 	Eigen::VectorXf VelQuadraticForces(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist,
                                 const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
+		Workspace ws(thetalist.size());
+		return VelQuadraticForces(thetalist, dthetalist, Mlist, Glist, Slist, ws);
+	}
+
+	Eigen::VectorXf VelQuadraticForces(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist,
+                                const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist,
+                                Workspace& ws) {
 		int n = thetalist.size();
-		Eigen::VectorXf dummylist = Eigen::VectorXf::Zero(n);
-		Eigen::VectorXf dummyg = Eigen::VectorXf::Zero(3);
-		Eigen::VectorXf dummyforce = Eigen::VectorXf::Zero(6);
-		Eigen::VectorXf c = mr::InverseDynamics(thetalist, dthetalist, dummylist,
-                             dummyg, dummyforce, Mlist, Glist, Slist);
+		ws.Reserve(n);
+		Workspace::Frame frame(ws);
+		Eigen::Map<Eigen::VectorXf> dummylist = ws.Vector(n);
+		dummylist.setZero();
+		Eigen::VectorXf c(n);
+		InverseDynamicsKernel(thetalist, dthetalist, dummylist, Eigen::Vector3f::Zero(), Vector6f::Zero(),
+			Mlist, Glist, Slist, ws, c);
 		return c;
 	}
 
@@ -636,12 +2197,21 @@ namespace mr {
 	 */
 	Eigen::VectorXf EndEffectorForces(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& Ftip,
 								const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
-		int n = thetalist.size();
-		Eigen::VectorXf dummylist = Eigen::VectorXf::Zero(n);
-		Eigen::VectorXf dummyg = Eigen::VectorXf::Zero(3);
+		Workspace ws(thetalist.size());
+		return EndEffectorForces(thetalist, Ftip, Mlist, Glist, Slist, ws);
+	}
 
-		Eigen::VectorXf JTFtip = mr::InverseDynamics(thetalist, dummylist, dummylist,
-                             dummyg, Ftip, Mlist, Glist, Slist);
+	Eigen::VectorXf EndEffectorForces(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& Ftip,
+								const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist,
+								Workspace& ws) {
+		int n = thetalist.size();
+		ws.Reserve(n);
+		Workspace::Frame frame(ws);
+		Eigen::Map<Eigen::VectorXf> dummylist = ws.Vector(n);
+		dummylist.setZero();
+		Eigen::VectorXf JTFtip(n);
+		InverseDynamicsKernel(thetalist, dummylist, dummylist, Eigen::Vector3f::Zero(), Vector6f(Ftip),
+			Mlist, Glist, Slist, ws, JTFtip);
 		return JTFtip;
 	}
 
@@ -667,16 +2237,18 @@ namespace mr {
 	Eigen::VectorXf ForwardDynamics(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& taulist,
 									const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
 									const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist) {
+		Workspace ws(thetalist.size());
+		return ForwardDynamics(thetalist, dthetalist, taulist, g, Ftip, Mlist, Glist, Slist, ws);
+	}
 
-		Eigen::VectorXf totalForce = taulist - mr::VelQuadraticForces(thetalist, dthetalist, Mlist, Glist, Slist)
-                 							 - mr::GravityForces(thetalist, g, Mlist, Glist, Slist)
-                                             - mr::EndEffectorForces(thetalist, Ftip, Mlist, Glist, Slist);
-
-		Eigen::MatrixXf M = mr::MassMatrix(thetalist, Mlist, Glist, Slist);
-
-		// Use LDLT since M is positive definite
-        Eigen::VectorXf ddthetalist = M.ldlt().solve(totalForce);
-
+	Eigen::VectorXf ForwardDynamics(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& taulist,
+									const Eigen::VectorXf& g, const Eigen::VectorXf& Ftip, const std::vector<Eigen::MatrixXf>& Mlist,
+									const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, Workspace& ws) {
+		int n = thetalist.size();
+		ws.Reserve(n);
+		Eigen::VectorXf ddthetalist(n);
+		ForwardDynamicsKernel(thetalist, dthetalist, taulist, Eigen::Vector3f(g), Vector6f(Ftip),
+			Mlist, Glist, Slist, ws, ddthetalist);
 		return ddthetalist;
 	}
 
@@ -686,9 +2258,48 @@ namespace mr {
 		return;
 	}
 
+	namespace {
+
+		/* A vector held in double and summed into with Kahan's compensated summation */
+		struct CompensatedVector {
+			explicit CompensatedVector(const Eigen::VectorXf& start)
+				: sum(start.cast<double>()), carry(Eigen::VectorXd::Zero(start.size())) {}
+
+			void Add(int i, double x) {
+				double y = x - carry(i);
+				double t = sum(i) + y;
+				carry(i) = (t - sum(i)) - y;
+				sum(i) = t;
+			}
+
+			Eigen::VectorXd sum;
+			Eigen::VectorXd carry;
+		};
+
+		/* EulerStep on the double state, which is then rounded into the float
+		 * copies the dynamics read */
+		void CompensatedEulerStep(CompensatedVector& theta, CompensatedVector& dtheta, const Eigen::VectorXf& ddthetalist,
+			double dt, Eigen::VectorXf& thetalist, Eigen::VectorXf& dthetalist) {
+			for (int i = 0; i < thetalist.size(); i++) {
+				theta.Add(i, dtheta.sum(i) * dt);
+				dtheta.Add(i, ddthetalist(i) * dt);
+				thetalist(i) = static_cast<float>(theta.sum(i));
+				dthetalist(i) = static_cast<float>(dtheta.sum(i));
+			}
+		}
+
+	}
+
 	Eigen::MatrixXf InverseDynamicsTrajectory(const Eigen::MatrixXf& thetamat, const Eigen::MatrixXf& dthetamat, const Eigen::MatrixXf& ddthetamat,
 		const Eigen::VectorXf& g, const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
 		const Eigen::MatrixXf& Slist) {
+		Workspace ws(thetamat.cols());
+		return InverseDynamicsTrajectory(thetamat, dthetamat, ddthetamat, g, Ftipmat, Mlist, Glist, Slist, ws);
+	}
+
+	Eigen::MatrixXf InverseDynamicsTrajectory(const Eigen::MatrixXf& thetamat, const Eigen::MatrixXf& dthetamat, const Eigen::MatrixXf& ddthetamat,
+		const Eigen::VectorXf& g, const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+		const Eigen::MatrixXf& Slist, Workspace& ws) {
 		Eigen::MatrixXf thetamatT = thetamat.transpose();
 		Eigen::MatrixXf dthetamatT = dthetamat.transpose();
 		Eigen::MatrixXf ddthetamatT = ddthetamat.transpose();
@@ -696,9 +2307,12 @@ namespace mr {
 
 		int N = thetamat.rows();  // trajectory points
 		int dof = thetamat.cols();
+		ws.Reserve(dof);
+		Eigen::Vector3f gvec(g);
 		Eigen::MatrixXf taumatT = Eigen::MatrixXf::Zero(dof, N);
 		for (int i = 0; i < N; ++i) {
-			taumatT.col(i) = InverseDynamics(thetamatT.col(i), dthetamatT.col(i), ddthetamatT.col(i), g, FtipmatT.col(i), Mlist, Glist, Slist);
+			InverseDynamicsKernel(thetamatT.col(i), dthetamatT.col(i), ddthetamatT.col(i), gvec, Vector6f(FtipmatT.col(i)),
+				Mlist, Glist, Slist, ws, taumatT.col(i));
 		}
 		Eigen::MatrixXf taumat = taumatT.transpose();
 		return taumat;
@@ -706,22 +2320,37 @@ namespace mr {
 
 	std::vector<Eigen::MatrixXf> ForwardDynamicsTrajectory(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::MatrixXf& taumat,
 		const Eigen::VectorXf& g, const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
-		const Eigen::MatrixXf& Slist, float dt, int intRes) {
+		const Eigen::MatrixXf& Slist, float dt, int intRes, StatePrecision precision) {
+		Workspace ws(thetalist.size());
+		return ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat, Mlist, Glist, Slist, dt, intRes, ws, precision);
+	}
+
+	std::vector<Eigen::MatrixXf> ForwardDynamicsTrajectory(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::MatrixXf& taumat,
+		const Eigen::VectorXf& g, const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+		const Eigen::MatrixXf& Slist, float dt, int intRes, Workspace& ws, StatePrecision precision) {
 		Eigen::MatrixXf taumatT = taumat.transpose();
 		Eigen::MatrixXf FtipmatT = Ftipmat.transpose();
 		int N = taumat.rows();  // force/torque points
 		int dof = taumat.cols();
+		ws.Reserve(dof);
+		Eigen::Vector3f gvec(g);
 		Eigen::MatrixXf thetamatT = Eigen::MatrixXf::Zero(dof, N);
 		Eigen::MatrixXf dthetamatT = Eigen::MatrixXf::Zero(dof, N);
 		thetamatT.col(0) = thetalist;
 		dthetamatT.col(0) = dthetalist;
 		Eigen::VectorXf thetacurrent = thetalist;
 		Eigen::VectorXf dthetacurrent = dthetalist;
-		Eigen::VectorXf ddthetalist;
+		Eigen::VectorXf ddthetalist(dof);
+		bool mixed = precision == StatePrecision::Mixed;
+		CompensatedVector theta(thetalist), dtheta(dthetalist);
 		for (int i = 0; i < N - 1; ++i) {
 			for (int j = 0; j < intRes; ++j) {
-				ddthetalist = ForwardDynamics(thetacurrent, dthetacurrent, taumatT.col(i), g, FtipmatT.col(i), Mlist, Glist, Slist);
-				EulerStep(thetacurrent, dthetacurrent, ddthetalist, 1.0*dt / intRes);
+				ForwardDynamicsKernel(thetacurrent, dthetacurrent, taumatT.col(i), gvec, Vector6f(FtipmatT.col(i)),
+					Mlist, Glist, Slist, ws, ddthetalist);
+				if (mixed)
+					CompensatedEulerStep(theta, dtheta, ddthetalist, static_cast<double>(dt) / intRes, thetacurrent, dthetacurrent);
+				else
+					EulerStep(thetacurrent, dthetacurrent, ddthetalist, 1.0*dt / intRes);
 			}
 			thetamatT.col(i + 1) = thetacurrent;
 			dthetamatT.col(i + 1) = dthetacurrent;
@@ -732,18 +2361,155 @@ namespace mr {
 		return JointTraj_ret;
 	}
 
+	namespace {
+
+		/* The fine propagator of the Parareal ForwardDynamicsTrajectory: the
+		 * serial integration over time steps [begin, end), writing the state
+		 * after each into columns begin+1 ... end */
+		void FinePropagate(Eigen::VectorXf& thetalist, Eigen::VectorXf& dthetalist, int begin, int end,
+			const Eigen::MatrixXf& taumatT, const Eigen::MatrixXf& FtipmatT, const Eigen::Vector3f& g,
+			const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist,
+			float dt, int intRes, Workspace& ws, Eigen::MatrixXf& thetamatT, Eigen::MatrixXf& dthetamatT) {
+			Eigen::VectorXf ddthetalist(thetalist.size());
+			for (int i = begin; i < end; ++i) {
+				for (int j = 0; j < intRes; ++j) {
+					ForwardDynamicsKernel(thetalist, dthetalist, taumatT.col(i), g, Vector6f(FtipmatT.col(i)),
+						Mlist, Glist, Slist, ws, ddthetalist);
+					EulerStep(thetalist, dthetalist, ddthetalist, 1.0*dt / intRes);
+				}
+				thetamatT.col(i + 1) = thetalist;
+				dthetamatT.col(i + 1) = dthetalist;
+			}
+		}
+
+		/* The coarse propagator: one Euler step per stride time steps, at the
+		 * forces of the first of them */
+		void CoarsePropagate(Eigen::VectorXf& thetalist, Eigen::VectorXf& dthetalist, int begin, int end, int stride,
+			const Eigen::MatrixXf& taumatT, const Eigen::MatrixXf& FtipmatT, const Eigen::Vector3f& g,
+			const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist,
+			float dt, Workspace& ws) {
+			Eigen::VectorXf ddthetalist(thetalist.size());
+			for (int i = begin; i < end; i += stride) {
+				ForwardDynamicsKernel(thetalist, dthetalist, taumatT.col(i), g, Vector6f(FtipmatT.col(i)),
+					Mlist, Glist, Slist, ws, ddthetalist);
+				EulerStep(thetalist, dthetalist, ddthetalist, dt * std::min(stride, end - i));
+			}
+		}
+
+	}
+
+	std::vector<Eigen::MatrixXf> ForwardDynamicsTrajectory(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::MatrixXf& taumat,
+		const Eigen::VectorXf& g, const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+		const Eigen::MatrixXf& Slist, float dt, int intRes, ThreadPool& pool, float tolerance, int slices, int coarseStep, int* iterations) {
+		int N = taumat.rows();  // force/torque points
+		int dof = taumat.cols();
+		int S = std::min(slices > 0 ? slices : pool.Size(), N - 1);
+		if (S <= 1) {
+			if (iterations) *iterations = 1;
+			return ForwardDynamicsTrajectory(thetalist, dthetalist, taumat, g, Ftipmat, Mlist, Glist, Slist, dt, intRes);
+		}
+		Eigen::MatrixXf taumatT = taumat.transpose();
+		Eigen::MatrixXf FtipmatT = Ftipmat.transpose();
+		Eigen::Vector3f gvec(g);
+		int stride = std::max(coarseStep, 1);
+		Eigen::MatrixXf thetamatT = Eigen::MatrixXf::Zero(dof, N);
+		Eigen::MatrixXf dthetamatT = Eigen::MatrixXf::Zero(dof, N);
+		thetamatT.col(0) = thetalist;
+		dthetamatT.col(0) = dthetalist;
+
+		// Slice s covers the time steps [first[s], first[s + 1]) and has a workspace of its own
+		std::vector<int> first(S + 1);
+		std::vector<std::unique_ptr<Workspace> > ws(S);
+		for (int s = 0; s <= S; s++)
+			first[s] = static_cast<int>(static_cast<long long>(N - 1) * s / S);
+		for (int s = 0; s < S; s++)
+			ws[s].reset(new Workspace(dof));
+
+		// The start states of the slices (column S is the end of the horizon),
+		// the starts the last fine sweep ran from, and the coarse and fine
+		// propagations of those
+		Eigen::MatrixXf theta(dof, S + 1), dtheta(dof, S + 1);
+		Eigen::MatrixXf thetaStart(dof, S), dthetaStart(dof, S);
+		Eigen::MatrixXf thetaCoarse(dof, S), dthetaCoarse(dof, S);
+		Eigen::MatrixXf thetaFine(dof, S), dthetaFine(dof, S);
+		theta.col(0) = thetalist;
+		dtheta.col(0) = dthetalist;
+		Eigen::VectorXf thetacurrent(dof), dthetacurrent(dof);
+		for (int s = 0; s < S; s++) {
+			thetacurrent = theta.col(s);
+			dthetacurrent = dtheta.col(s);
+			CoarsePropagate(thetacurrent, dthetacurrent, first[s], first[s + 1], stride, taumatT, FtipmatT, gvec,
+				Mlist, Glist, Slist, dt, *ws[0]);
+			thetaCoarse.col(s) = theta.col(s + 1) = thetacurrent;
+			dthetaCoarse.col(s) = dtheta.col(s + 1) = dthetacurrent;
+		}
+
+		// Slices before k started their last fine sweep from the serial state and are final
+		int k = 0;
+		while (k < S) {
+			thetaStart = theta.leftCols(S);
+			dthetaStart = dtheta.leftCols(S);
+			pool.ParallelFor(k, S, [&](int s) {
+				Eigen::VectorXf th = thetaStart.col(s), dth = dthetaStart.col(s);
+				FinePropagate(th, dth, first[s], first[s + 1], taumatT, FtipmatT, gvec, Mlist, Glist, Slist,
+					dt, intRes, *ws[s], thetamatT, dthetamatT);
+				thetaFine.col(s) = th;
+				dthetaFine.col(s) = dth;
+			});
+			++k;
+			float change = 0;
+			for (int s = k - 1; s < S; s++) {
+				if (theta.col(s) == thetaStart.col(s) && dtheta.col(s) == dthetaStart.col(s)) {
+					// The coarse terms cancel; taken as is, the serial state carries over exactly
+					thetacurrent = thetaFine.col(s);
+					dthetacurrent = dthetaFine.col(s);
+				}
+				else {
+					thetacurrent = theta.col(s);
+					dthetacurrent = dtheta.col(s);
+					CoarsePropagate(thetacurrent, dthetacurrent, first[s], first[s + 1], stride, taumatT, FtipmatT, gvec,
+						Mlist, Glist, Slist, dt, *ws[0]);
+					// The difference of the coarse results first, which is small once converging
+					Eigen::VectorXf thetaNext = thetaFine.col(s) + (thetacurrent - thetaCoarse.col(s));
+					Eigen::VectorXf dthetaNext = dthetaFine.col(s) + (dthetacurrent - dthetaCoarse.col(s));
+					thetaCoarse.col(s) = thetacurrent;
+					dthetaCoarse.col(s) = dthetacurrent;
+					thetacurrent = thetaNext;
+					dthetacurrent = dthetaNext;
+				}
+				change = std::max(change, (thetacurrent - theta.col(s + 1)).cwiseAbs().maxCoeff());
+				change = std::max(change, (dthetacurrent - dtheta.col(s + 1)).cwiseAbs().maxCoeff());
+				theta.col(s + 1) = thetacurrent;
+				dtheta.col(s + 1) = dthetacurrent;
+			}
+			if (!(change > tolerance))
+				break;
+		}
+		if (iterations) *iterations = k;
+
+		std::vector<Eigen::MatrixXf> JointTraj_ret;
+		JointTraj_ret.push_back(thetamatT.transpose());
+		JointTraj_ret.push_back(dthetamatT.transpose());
+		return JointTraj_ret;
+	}
+
 	Eigen::VectorXf ComputedTorque(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& eint,
 		const Eigen::VectorXf& g, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
 		const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalistd, const Eigen::VectorXf& dthetalistd, const Eigen::VectorXf& ddthetalistd,
 		float Kp, float Ki, float Kd) {
+		Workspace ws(thetalist.size());
+		return ComputedTorque(thetalist, dthetalist, eint, g, Mlist, Glist, Slist, thetalistd, dthetalistd, ddthetalistd, Kp, Ki, Kd, ws);
+	}
 
-		Eigen::VectorXf e = thetalistd - thetalist;  // position err
-		Eigen::VectorXf tau_feedforward = MassMatrix(thetalist, Mlist, Glist, Slist)*(Kp*e + Ki * (eint + e) + Kd * (dthetalistd - dthetalist));
-
-		Eigen::VectorXf Ftip = Eigen::VectorXf::Zero(6);
-		Eigen::VectorXf tau_inversedyn = InverseDynamics(thetalist, dthetalist, ddthetalistd, g, Ftip, Mlist, Glist, Slist);
-
-		Eigen::VectorXf tau_computed = tau_feedforward + tau_inversedyn;
+	Eigen::VectorXf ComputedTorque(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& eint,
+		const Eigen::VectorXf& g, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+		const Eigen::MatrixXf& Slist, const Eigen::VectorXf& thetalistd, const Eigen::VectorXf& dthetalistd, const Eigen::VectorXf& ddthetalistd,
+		float Kp, float Ki, float Kd, Workspace& ws) {
+		int n = thetalist.size();
+		ws.Reserve(n);
+		Eigen::VectorXf tau_computed(n);
+		ComputedTorqueKernel(thetalist, dthetalist, eint, Eigen::Vector3f(g), Mlist, Glist, Slist,
+			thetalistd, dthetalistd, ddthetalistd, Kp, Ki, Kd, ws, tau_computed);
 		return tau_computed;
 	}
 
@@ -760,87 +2526,1420 @@ namespace mr {
 	}
 
 	Eigen::MatrixXf JointTrajectory(const Eigen::VectorXf& thetastart, const Eigen::VectorXf& thetaend, float Tf, int N, int method) {
-		float timegap = Tf / (N - 1);
-		Eigen::MatrixXf trajT = Eigen::MatrixXf::Zero(thetastart.size(), N);
-		float st;
-		for (int i = 0; i < N; ++i) {
-			if (method == 3)
-				st = CubicTimeScaling(Tf, timegap*i);
-			else
-				st = QuinticTimeScaling(Tf, timegap*i);
-			trajT.col(i) = st * thetaend + (1 - st)*thetastart;
-		}
-		Eigen::MatrixXf traj = trajT.transpose();
+		Eigen::VectorXf st(N);
+		Kernels().timeScaling(method, 0, 1.0f / (N - 1), N, 1 / Tf, st.data(), 0);
+		Eigen::MatrixXf traj = st * thetaend.transpose() + (1 - st.array()).matrix() * thetastart.transpose();
 		return traj;
 	}
 	std::vector<Eigen::MatrixXf> ScrewTrajectory(const Eigen::MatrixXf& Xstart, const Eigen::MatrixXf& Xend, float Tf, int N, int method) {
 		float timegap = Tf / (N - 1);
 		std::vector<Eigen::MatrixXf> traj(N);
+		// Xstart e^(log(Xstart^-1 Xend) s) by screw interpolation of dual quaternions
+		DualQuaternion start = DualQuaternion(Eigen::Matrix4f(Xstart));
+		Eigen::VectorXf expc6 = (start.Inverse() * DualQuaternion(Eigen::Matrix4f(Xend))).Log();
 		float st;
 		for (int i = 0; i < N; ++i) {
 			if (method == 3)
 				st = CubicTimeScaling(Tf, timegap*i);
 			else
 				st = QuinticTimeScaling(Tf, timegap*i);
-			Eigen::MatrixXf Ttemp = MatrixLog6(TransInv(Xstart)*Xend);
-			traj.at(i) = Xstart * MatrixExp6(Ttemp*st);
+			traj.at(i) = (start * DualQuaternion::Exp(expc6, st)).Matrix();
 		}
 		return traj;
 	}
 
 	std::vector<Eigen::MatrixXf> CartesianTrajectory(const Eigen::MatrixXf& Xstart, const Eigen::MatrixXf& Xend, float Tf, int N, int method) {
-		float timegap = Tf / (N - 1);
+		CartesianSamples samples;
+		CartesianTrajectory(Xstart, Xend, Tf, N, method, samples);
 		std::vector<Eigen::MatrixXf> traj(N);
-		std::vector<Eigen::MatrixXf> Rpstart = TransToRp(Xstart);
-		std::vector<Eigen::MatrixXf> Rpend = TransToRp(Xend);
-		Eigen::Matrix3f Rstart = Rpstart[0]; Eigen::Vector3f pstart = Rpstart[1];
-		Eigen::Matrix3f Rend = Rpend[0]; Eigen::Vector3f pend = Rpend[1];
+		for (int i = 0; i < N; ++i) {
+			Eigen::Quaternionf qi(samples.quaternions(i, 0), samples.quaternions(i, 1), samples.quaternions(i, 2),
+				samples.quaternions(i, 3));
+			Eigen::MatrixXf traji(4, 4);
+			traji << qi.toRotationMatrix(), samples.positions.row(i).transpose(),
+				0, 0, 0, 1;
+			traj.at(i) = traji;
+		}
+		return traj;
+	}
+
+	namespace {
+		/* Samples begin ... begin+count-1 of CartesianTrajectory into rows 0 ... count-1 */
+		void SampleCartesianTrajectory(const Eigen::MatrixXf& Xstart, const Eigen::MatrixXf& Xend, float Tf, int N, int method,
+			int begin, int count, CartesianSamples& samples, bool velocities) {
+			Eigen::Matrix4f Tstart = Xstart, Tend = Xend;
+			Eigen::Vector3f pstart = Tstart.topRightCorner<3, 1>(), pend = Tend.topRightCorner<3, 1>();
+			Eigen::Quaternionf qstart(Eigen::Matrix3f(Tstart.topLeftCorner<3, 3>()));
+			// Rstart^T Rend = e^[omg]theta as the unit quaternion (cos(theta/2), sin(theta/2) omg),
+			// taken with w >= 0 for the shorter way round
+			Eigen::Quaternionf qrel = qstart.conjugate() * Eigen::Quaternionf(Eigen::Matrix3f(Tend.topLeftCorner<3, 3>()));
+			if (qrel.w() < 0)
+				qrel.coeffs() = -qrel.coeffs();
+			float sinHalf = qrel.vec().norm();
+			float theta = 2 * std::atan2(sinHalf, qrel.w());
+			Eigen::Vector3f omg = sinHalf > 0 ? Eigen::Vector3f(qrel.vec() / sinHalf) : Eigen::Vector3f::UnitZ();
+			// qstart (c, s omg) = c qstart + s (qstart (0, omg))
+			Eigen::Quaternionf qomg = qstart * Eigen::Quaternionf(0, omg(0), omg(1), omg(2));
+			Eigen::Vector4f a(qstart.w(), qstart.x(), qstart.y(), qstart.z());
+			Eigen::Vector4f b(qomg.w(), qomg.x(), qomg.y(), qomg.z());
+
+			const SimdKernelTable& kernels = Kernels();
+			Eigen::ArrayXf st(count), sdot(velocities ? count : 0);
+			kernels.timeScaling(method, begin, 1.0f / (N - 1), count, 1 / Tf,
+				st.data(), velocities ? sdot.data() : 0);
+			samples.positions.resize(count, 3);
+			for (int j = 0; j < 3; j++)
+				samples.positions.col(j) = (pstart(j) + st * (pend(j) - pstart(j))).matrix();
+			samples.quaternions.resize(count, 4);
+			kernels.slerp(a.data(), b.data(), 0.5f * theta, st.data(), count, samples.quaternions.data(), count);
+
+			if (!velocities) {
+				samples.linearVelocities.resize(0, 3);
+				samples.angularVelocities.resize(0, 3);
+				return;
+			}
+			Eigen::Vector3f omgs = theta * (qstart * omg);
+			samples.linearVelocities.resize(count, 3);
+			samples.angularVelocities.resize(count, 3);
+			for (int j = 0; j < 3; j++) {
+				samples.linearVelocities.col(j) = ((pend(j) - pstart(j)) * sdot).matrix();
+				samples.angularVelocities.col(j) = (omgs(j) * sdot).matrix();
+			}
+		}
+	}
+
+	void CartesianTrajectory(const Eigen::MatrixXf& Xstart, const Eigen::MatrixXf& Xend, float Tf, int N, int method,
+		CartesianSamples& samples, bool velocities) {
+		SampleCartesianTrajectory(Xstart, Xend, Tf, N, method, 0, N, samples, velocities);
+	}
+
+	Eigen::MatrixXf JointPathTrajectory(const Eigen::MatrixXf& path, float Tf, int N, int method) {
+		int K = path.rows();
+		// Arc length at every waypoint
+		std::vector<float> length(K, 0);
+		for (int i = 1; i < K; ++i)
+			length[i] = length[i - 1] + (path.row(i) - path.row(i - 1)).norm();
+		float timegap = Tf / (N - 1);
+		Eigen::MatrixXf traj(N, path.cols());
+		int segment = 0;
 		float st;
 		for (int i = 0; i < N; ++i) {
 			if (method == 3)
 				st = CubicTimeScaling(Tf, timegap*i);
 			else
 				st = QuinticTimeScaling(Tf, timegap*i);
-			Eigen::Matrix3f Ri = Rstart * MatrixExp3(MatrixLog3(Rstart.transpose() * Rend)*st);
-			Eigen::Vector3f pi = st*pend + (1 - st)*pstart;
-			Eigen::MatrixXf traji(4, 4);
-			traji << Ri, pi,
-				0, 0, 0, 1;
-			traj.at(i) = traji;
+			if (K == 1) {
+				traj.row(i) = path.row(0);
+				continue;
+			}
+			float s = st * length[K - 1];
+			while (segment < K - 2 && length[segment + 1] < s)
+				segment++;
+			float span = length[segment + 1] - length[segment];
+			float u = span > 0 ? std::max(0.0f, std::min(1.0f, (s - length[segment]) / span)) : 0;
+			traj.row(i) = (1 - u) * path.row(segment) + u * path.row(segment + 1);
 		}
 		return traj;
 	}
+
+	namespace {
+		/* Samples per block passed between the pipeline stages */
+		const int PipelineBlock = 64;
+
+		/* A block of consecutive samples, one per column */
+		struct SampleBlock {
+			int begin;
+			Eigen::MatrixXf data;
+			bool converged;
+		};
+
+		/* A bounded blocking queue; Close wakes every waiter and fails their calls */
+		class BlockQueue {
+		public:
+			explicit BlockQueue(std::size_t capacity) : capacity_(capacity), closed_(false) {}
+
+			bool Push(SampleBlock& block) {
+				std::unique_lock<std::mutex> lock(mutex_);
+				notFull_.wait(lock, [&]() { return closed_ || blocks_.size() < capacity_; });
+				if (closed_)
+					return false;
+				blocks_.push_back(SampleBlock());
+				std::swap(blocks_.back(), block);
+				notEmpty_.notify_one();
+				return true;
+			}
+
+			/* Fails once the queue is closed and drained */
+			bool Pop(SampleBlock& block) {
+				std::unique_lock<std::mutex> lock(mutex_);
+				notEmpty_.wait(lock, [&]() { return closed_ || !blocks_.empty(); });
+				if (blocks_.empty())
+					return false;
+				std::swap(block, blocks_.front());
+				blocks_.pop_front();
+				notFull_.notify_one();
+				return true;
+			}
+
+			/* With drain, blocks already queued can still be popped */
+			void Close(bool drain) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				closed_ = true;
+				if (!drain)
+					blocks_.clear();
+				notFull_.notify_all();
+				notEmpty_.notify_all();
+			}
+
+		private:
+			std::size_t capacity_;
+			bool closed_;
+			std::deque<SampleBlock> blocks_;
+			std::mutex mutex_;
+			std::condition_variable notFull_, notEmpty_;
+		};
+	}
+
+	bool CartesianTorquePipeline(const Eigen::MatrixXf& Xstart, const Eigen::MatrixXf& Xend, float Tf, int N, int method,
+		const Eigen::VectorXf& thetalist0, const Eigen::MatrixXf& M, const Eigen::MatrixXf& Slist, float eomg, float ev,
+		const Eigen::VectorXf& g, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+		const TrajectorySink& sink, int capacity) {
+		int n = thetalist0.size();
+		float timegap = Tf / (N - 1);
+		BlockQueue poses(capacity), joints(capacity);
+		std::exception_ptr error;
+		std::mutex errorMutex;
+		// A failing stage records the first error and closes both queues so nobody waits on it
+		auto fail = [&]() {
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error)
+					error = std::current_exception();
+			}
+			poses.Close(false);
+			joints.Close(false);
+		};
+
+		// Stage 1: the poses of CartesianTrajectory, as 16 x count blocks
+		std::thread poseStage([&]() {
+			try {
+				CartesianSamples samples;
+				for (int begin = 0; begin < N; begin += PipelineBlock) {
+					int count = std::min(PipelineBlock, N - begin);
+					SampleCartesianTrajectory(Xstart, Xend, Tf, N, method, begin, count, samples, false);
+					SampleBlock block = { begin, Eigen::MatrixXf(16, count), true };
+					for (int j = 0; j < count; j++) {
+						Eigen::Quaternionf q(samples.quaternions(j, 0), samples.quaternions(j, 1), samples.quaternions(j, 2),
+							samples.quaternions(j, 3));
+						Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+						T.topLeftCorner<3, 3>() = q.toRotationMatrix();
+						T.topRightCorner<3, 1>() = samples.positions.row(j).transpose();
+						block.data.col(j) = Eigen::Map<Eigen::VectorXf>(T.data(), 16);
+					}
+					if (!poses.Push(block))
+						return;
+				}
+				poses.Close(true);
+			}
+			catch (...) {
+				fail();
+			}
+		});
+
+		// Stage 2: IKinSpace warm-started from the previous sample, as n x count blocks
+		std::thread ikStage([&]() {
+			try {
+				Eigen::VectorXf thetalist = thetalist0;
+				Eigen::MatrixXf T(4, 4);
+				SampleBlock in = SampleBlock();
+				while (poses.Pop(in)) {
+					int count = in.data.cols();
+					SampleBlock out = { in.begin, Eigen::MatrixXf(n, count), true };
+					for (int j = 0; j < count; j++) {
+						T = Eigen::Map<const Eigen::Matrix4f>(in.data.col(j).data());
+						out.converged = IKinSpace(Slist, M, T, thetalist, eomg, ev) && out.converged;
+						out.data.col(j) = thetalist;
+					}
+					if (!joints.Push(out))
+						return;
+				}
+				joints.Close(true);
+			}
+			catch (...) {
+				fail();
+			}
+		});
+
+		// Stage 3, here: each sample goes out once the next one is known
+		bool converged = true;
+		try {
+			Workspace ws(n);
+			Eigen::Vector3f gvec(g);
+			Eigen::VectorXf previous(n), current(n), next(n), dthetalist(n), ddthetalist(n), taulist(n);
+			int k = 0;
+			auto emit = [&]() {
+				dthetalist = (next - previous) / (2 * timegap);
+				ddthetalist = (next - 2 * current + previous) / (timegap * timegap);
+				InverseDynamicsKernel(current, dthetalist, ddthetalist, gvec, Vector6f::Zero(), Mlist, Glist, Slist, ws, taulist);
+				sink(k, current, dthetalist, ddthetalist, taulist);
+				k++;
+			};
+			SampleBlock in = SampleBlock();
+			int received = 0;
+			while (joints.Pop(in)) {
+				converged = converged && in.converged;
+				for (int j = 0; j < in.data.cols(); j++, received++) {
+					next = in.data.col(j);
+					if (received == 0) {
+						current = next;
+						continue;
+					}
+					if (received == 1)
+						previous = next;  // mirrored before the start
+					emit();
+					previous = current;
+					current = next;
+				}
+			}
+			if (received == N) {
+				next = N > 1 ? previous : current;  // mirrored past the end
+				if (N == 1)
+					previous = current;
+				emit();
+			}
+		}
+		catch (...) {
+			fail();
+		}
+		poseStage.join();
+		ikStage.join();
+		if (error)
+			std::rethrow_exception(error);
+		return converged;
+	}
+
+	KdTree::KdTree(int dim) : dim_(dim) {}
+
+	int KdTree::Insert(const Eigen::VectorXf& p) {
+		int index = Size();
+		points_.insert(points_.end(), p.data(), p.data() + dim_);
+		left_.push_back(-1);
+		right_.push_back(-1);
+		removed_.push_back(0);
+		// Descend from the root, splitting on the coordinates in turn
+		int node = 0;
+		for (int depth = 0; index > 0; depth++) {
+			int axis = depth % dim_;
+			std::vector<int>& child = p(axis) < points_[std::size_t(dim_) * node + axis] ? left_ : right_;
+			if (child[node] < 0) {
+				child[node] = index;
+				break;
+			}
+			node = child[node];
+		}
+		return index;
+	}
+
+	void KdTree::Clear() {
+		points_.clear();
+		left_.clear();
+		right_.clear();
+		removed_.clear();
+	}
+
+	/* Adds the points of the subtree at node to the max-heap of the k nearest so far */
+	void KdTree::Search(int node, int depth, const float* q, std::size_t k, std::vector<std::pair<float, int> >& heap) const {
+		if (node < 0)
+			return;
+		const float* p = &points_[std::size_t(dim_) * node];
+		if (!removed_[node]) {
+			float d2 = 0;
+			for (int j = 0; j < dim_; j++)
+				d2 += (q[j] - p[j]) * (q[j] - p[j]);
+			if (heap.size() < k) {
+				heap.push_back(std::make_pair(d2, node));
+				std::push_heap(heap.begin(), heap.end());
+			}
+			else if (d2 < heap.front().first) {
+				std::pop_heap(heap.begin(), heap.end());
+				heap.back() = std::make_pair(d2, node);
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+		int axis = depth % dim_;
+		float diff = q[axis] - p[axis];
+		Search(diff < 0 ? left_[node] : right_[node], depth + 1, q, k, heap);
+		// The far side only if the splitting plane is closer than the k-th nearest
+		if (heap.size() < k || diff * diff < heap.front().first)
+			Search(diff < 0 ? right_[node] : left_[node], depth + 1, q, k, heap);
+	}
+
+	int KdTree::Nearest(const Eigen::VectorXf& q) const {
+		std::vector<int> nearest = KNearest(q, 1);
+		return nearest.empty() ? -1 : nearest[0];
+	}
+
+	std::vector<int> KdTree::KNearest(const Eigen::VectorXf& q, int k) const {
+		std::vector<std::pair<float, int> > heap;
+		if (k > 0 && Size() > 0)
+			Search(0, 0, q.data(), k, heap);
+		std::sort_heap(heap.begin(), heap.end());
+		std::vector<int> indices(heap.size());
+		for (std::size_t i = 0; i < heap.size(); i++)
+			indices[i] = heap[i].second;
+		return indices;
+	}
+
+	namespace {
+
+		const signed char EdgeUnknown = 0, EdgeFree = 1, EdgeBlocked = -1;
+
+		/* The steps 1..steps along an edge in coarse-to-fine order: the midpoint,
+		 * then the quarter points, and so on (bit-reversed counting) */
+		std::vector<int> CoarseToFine(int steps) {
+			int bits = 0;
+			while ((1 << bits) <= steps)
+				bits++;
+			std::vector<int> order;
+			order.reserve(steps);
+			for (int r = 1; r < (1 << bits); r++) {
+				int i = 0;
+				for (int b = 0; b < bits; b++)
+					i |= ((r >> b) & 1) << (bits - 1 - b);
+				if (i >= 1 && i <= steps)
+					order.push_back(i);
+			}
+			return order;
+		}
+
+		/* One tree of RRT-Connect */
+		struct RRTTree {
+			KdTree index;
+			std::vector<int> parent;
+
+			explicit RRTTree(int dim) : index(dim) {}
+			int Add(const Eigen::VectorXf& q, int from) {
+				parent.push_back(from);
+				return index.Insert(q);
+			}
+		};
+
+	}
+
+	JointPlanner::JointPlanner(const Eigen::VectorXf& lower, const Eigen::VectorXf& upper, const StateValidity& valid,
+		float resolution, ThreadPool* pool)
+		: lower_(lower), upper_(upper), valid_(valid), resolution_(resolution), pool_(pool), roadmap_(lower.size()) {}
+
+	Eigen::VectorXf JointPlanner::Sample() {
+		std::uniform_real_distribution<float> unit(0, 1);
+		Eigen::VectorXf q(lower_.size());
+		for (int i = 0; i < q.size(); i++)
+			q(i) = lower_(i) + (upper_(i) - lower_(i)) * unit(rng_);
+		return q;
+	}
+
+	bool JointPlanner::EdgeValid(const Eigen::VectorXf& a, const Eigen::VectorXf& b) const {
+		int steps = std::max(1, static_cast<int>(std::ceil((b - a).norm() / resolution_)));
+		std::vector<int> order = CoarseToFine(steps);
+		// Each task checks a run of the order; the coarse states all fall into the first runs
+		const int run = 8;
+		int tasks = (static_cast<int>(order.size()) + run - 1) / run;
+		std::atomic<bool> blocked(false);
+		std::function<void(int)> check = [&](int task) {
+			int end = std::min(static_cast<int>(order.size()), (task + 1) * run);
+			for (int i = task * run; i < end && !blocked.load(std::memory_order_relaxed); i++) {
+				float s = float(order[i]) / steps;
+				if (!valid_((1 - s) * a + s * b))
+					blocked = true;
+			}
+		};
+		if (pool_ && tasks > 1)
+			pool_->ParallelFor(0, tasks, check);
+		else
+			for (int task = 0; task < tasks && !blocked; task++)
+				check(task);
+		return !blocked;
+	}
+
+	Eigen::MatrixXf JointPlanner::RRTConnect(const Eigen::VectorXf& start, const Eigen::VectorXf& goal, float step, int maxIterations) {
+		int n = start.size();
+		RRTTree trees[2] = { RRTTree(n), RRTTree(n) };
+		trees[0].Add(start, -1);
+		trees[1].Add(goal, -1);
+		// Grows tree by at most step toward q; the new node, or -1 if the edge is blocked
+		auto extend = [&](RRTTree& tree, const Eigen::VectorXf& q, bool& reached) -> int {
+			int near = tree.index.Nearest(q);
+			Eigen::VectorXf from = tree.index.Point(near);
+			float distance = (q - from).norm();
+			reached = distance <= step;
+			Eigen::VectorXf to = reached ? q : Eigen::VectorXf(from + (q - from) * (step / distance));
+			return EdgeValid(from, to) ? tree.Add(to, near) : -1;
+		};
+		for (int iteration = 0; iteration < maxIterations; iteration++) {
+			// The trees take turns at growing toward a sample
+			int grown = iteration % 2;
+			bool reached;
+			int added = extend(trees[grown], Sample(), reached);
+			if (added < 0)
+				continue;
+			// and the other one then greedily grows toward the new node
+			Eigen::VectorXf target = trees[grown].index.Point(added);
+			int last;
+			do
+				last = extend(trees[1 - grown], target, reached);
+			while (last >= 0 && !reached);
+			if (last < 0)
+				continue;
+
+			// Both trees now hold target: start .. target from one, target .. goal from the other
+			int meet[2];
+			meet[grown] = added;
+			meet[1 - grown] = last;
+			std::vector<int> fromStart, toGoal;
+			for (int i = meet[0]; i >= 0; i = trees[0].parent[i])
+				fromStart.push_back(i);
+			for (int i = trees[1].parent[meet[1]]; i >= 0; i = trees[1].parent[i])
+				toGoal.push_back(i);
+			Eigen::MatrixXf path(fromStart.size() + toGoal.size(), n);
+			int row = 0;
+			for (std::size_t i = fromStart.size(); i-- > 0;)
+				path.row(row++) = trees[0].index.Point(fromStart[i]).transpose();
+			for (std::size_t i = 0; i < toGoal.size(); i++)
+				path.row(row++) = trees[1].index.Point(toGoal[i]).transpose();
+			return path;
+		}
+		return Eigen::MatrixXf(0, n);
+	}
+
+	/* Inserts q into the roadmap with unchecked edges to its nearest nodes */
+	int JointPlanner::AddRoadmapNode(const Eigen::VectorXf& q, int neighbors) {
+		std::vector<int> near = roadmap_.KNearest(q, neighbors);
+		int node = roadmap_.Insert(q);
+		incident_.push_back(std::vector<int>());
+		for (std::size_t i = 0; i < near.size(); i++) {
+			Edge edge = { node, near[i], (q - roadmap_.Point(near[i])).norm(), EdgeUnknown };
+			incident_[node].push_back(static_cast<int>(edges_.size()));
+			incident_[near[i]].push_back(static_cast<int>(edges_.size()));
+			edges_.push_back(edge);
+		}
+		return node;
+	}
+
+	Eigen::MatrixXf JointPlanner::LazyPRM(const Eigen::VectorXf& start, const Eigen::VectorXf& goal, int samples, int neighbors) {
+		int n = start.size();
+		// Grow the roadmap to samples free nodes, checking each batch of candidates in parallel
+		for (int round = 0; roadmap_.Size() < samples && round < 100; round++) {
+			int batch = samples - roadmap_.Size();
+			std::vector<Eigen::VectorXf> candidates(batch);
+			for (int i = 0; i < batch; i++)
+				candidates[i] = Sample();
+			std::vector<char> free(batch);
+			std::function<void(int)> check = [&](int i) { free[i] = valid_(candidates[i]); };
+			if (pool_)
+				pool_->ParallelFor(0, batch, check);
+			else
+				for (int i = 0; i < batch; i++)
+					check(i);
+			for (int i = 0; i < batch; i++)
+				if (free[i])
+					AddRoadmapNode(candidates[i], neighbors);
+		}
+		if (!valid_(start) || !valid_(goal))
+			return Eigen::MatrixXf(0, n);
+
+		// Join start and goal through overlay nodes and edges past the end of the
+		// roadmap, which are taken out again once the query is answered
+		int nodes0 = roadmap_.Size();
+		std::size_t edges0 = edges_.size();
+		int source = nodes0, target = nodes0 + 1;
+		auto point = [&](int u) -> Eigen::VectorXf {
+			return u == source ? start : u == target ? goal : Eigen::VectorXf(roadmap_.Point(u));
+		};
+		incident_.resize(nodes0 + 2);
+		std::vector<int> joined;
+		auto join = [&](int a, int b) {
+			Edge edge = { a, b, (point(a) - point(b)).norm(), EdgeUnknown };
+			incident_[a].push_back(static_cast<int>(edges_.size()));
+			incident_[b].push_back(static_cast<int>(edges_.size()));
+			edges_.push_back(edge);
+		};
+		for (int end = source; end <= target; end++) {
+			std::vector<int> near = roadmap_.KNearest(point(end), neighbors);
+			for (std::size_t i = 0; i < near.size(); i++) {
+				join(end, near[i]);
+				joined.push_back(near[i]);
+			}
+		}
+		join(source, target);
+
+		Eigen::MatrixXf path(0, n);
+		for (;;) {
+			// A* to the goal over every edge not known to be blocked
+			std::vector<float> cost(nodes0 + 2, std::numeric_limits<float>::infinity());
+			std::vector<int> via(nodes0 + 2, -1);
+			typedef std::pair<float, int> Entry;
+			std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > open;
+			cost[source] = 0;
+			open.push(Entry((start - goal).norm(), source));
+			while (!open.empty()) {
+				Entry top = open.top();
+				open.pop();
+				int u = top.second;
+				if (u == target)
+					break;
+				if (top.first > cost[u] + (point(u) - goal).norm() + 1e-6f)
+					continue;
+				for (std::size_t i = 0; i < incident_[u].size(); i++) {
+					const Edge& edge = edges_[incident_[u][i]];
+					if (edge.state == EdgeBlocked)
+						continue;
+					int v = edge.a == u ? edge.b : edge.a;
+					if (cost[u] + edge.length < cost[v]) {
+						cost[v] = cost[u] + edge.length;
+						via[v] = incident_[u][i];
+						open.push(Entry(cost[v] + (point(v) - goal).norm(), v));
+					}
+				}
+			}
+			if (via[target] < 0)
+				break;
+
+			// Check the unchecked edges of the shortest path, all at once
+			std::vector<int> nodes(1, target), unchecked;
+			for (int v = target; v != source;) {
+				const Edge& edge = edges_[via[v]];
+				if (edge.state == EdgeUnknown)
+					unchecked.push_back(via[v]);
+				v = edge.a == v ? edge.b : edge.a;
+				nodes.push_back(v);
+			}
+			std::function<void(int)> check = [&](int i) {
+				Edge& edge = edges_[unchecked[i]];
+				edge.state = EdgeValid(point(edge.a), point(edge.b)) ? EdgeFree : EdgeBlocked;
+			};
+			if (pool_)
+				pool_->ParallelFor(0, static_cast<int>(unchecked.size()), check);
+			else
+				for (std::size_t i = 0; i < unchecked.size(); i++)
+					check(static_cast<int>(i));
+			bool free = true;
+			for (std::size_t i = 0; i < unchecked.size(); i++)
+				free = free && edges_[unchecked[i]].state == EdgeFree;
+			if (!free)
+				continue;
+
+			path.resize(nodes.size(), n);
+			for (std::size_t i = 0; i < nodes.size(); i++)
+				path.row(i) = point(nodes[nodes.size() - 1 - i]).transpose();
+			break;
+		}
+
+		// The overlay edges are the last ones on every incidence list
+		for (std::size_t i = 0; i < joined.size(); i++)
+			incident_[joined[i]].pop_back();
+		incident_.resize(nodes0);
+		edges_.resize(edges0);
+		return path;
+	}
+
+	Eigen::MatrixXf JointPlanner::Shortcut(const Eigen::MatrixXf& path, int attempts) {
+		std::vector<Eigen::VectorXf> points(path.rows());
+		for (int i = 0; i < path.rows(); i++)
+			points[i] = path.row(i).transpose();
+		std::uniform_real_distribution<float> unit(0, 1);
+		for (int attempt = 0; attempt < attempts && points.size() > 2; attempt++) {
+			// Two random points on different segments i < j of the path
+			std::uniform_int_distribution<int> segment(0, static_cast<int>(points.size()) - 2);
+			int i = segment(rng_), j = segment(rng_);
+			if (i == j)
+				continue;
+			if (i > j)
+				std::swap(i, j);
+			float s = unit(rng_), t = unit(rng_);
+			Eigen::VectorXf a = (1 - s) * points[i] + s * points[i + 1];
+			Eigen::VectorXf b = (1 - t) * points[j] + t * points[j + 1];
+			if (!EdgeValid(a, b))
+				continue;
+			std::vector<Eigen::VectorXf> shorter(points.begin(), points.begin() + i + 1);
+			shorter.push_back(a);
+			shorter.push_back(b);
+			shorter.insert(shorter.end(), points.begin() + j + 1, points.end());
+			points.swap(shorter);
+		}
+		Eigen::MatrixXf shortened(points.size(), path.cols());
+		for (std::size_t i = 0; i < points.size(); i++)
+			shortened.row(i) = points[i].transpose();
+		return shortened;
+	}
+
+	ReachabilityMap::ReachabilityMap(const Eigen::Vector3f& lower, const Eigen::Vector3i& size, float voxel)
+		: lower_(lower), size_(size), voxel_(voxel) {
+		Voxel empty = { 0, 0, 0 };
+		voxels_.assign(std::size_t(size.x()) * size.y() * size.z(), empty);
+	}
+
+	int ReachabilityMap::Index(const Eigen::Vector3f& p) const {
+		Eigen::Vector3f cell = (p - lower_) / voxel_;
+		for (int j = 0; j < 3; j++)
+			if (!(cell(j) >= 0 && cell(j) < size_(j)))
+				return -1;
+		return int(cell.x()) + size_.x() * (int(cell.y()) + size_.y() * int(cell.z()));
+	}
+
+	void ReachabilityMap::Sample(const Eigen::MatrixXf& M, const Eigen::MatrixXf& Slist,
+		const Eigen::VectorXf& thetalower, const Eigen::VectorXf& thetaupper, std::size_t samples, ThreadPool& pool, unsigned seed) {
+		std::vector<JointModel> joints = ClassifyJoints(Slist);
+		Eigen::Matrix4f home = M;
+		int n = Slist.cols();
+		// Each task draws a fixed run of samples from its own generator, so the
+		// result does not depend on how the tasks are spread over the threads
+		const std::size_t run = 4096;
+		int tasks = static_cast<int>((samples + run - 1) / run);
+		std::mutex merge;
+		pool.ParallelFor(0, tasks, [&](int task) {
+			std::seed_seq sequence = { seed, static_cast<unsigned>(task) };
+			std::mt19937 rng(sequence);
+			std::uniform_real_distribution<float> unit(0, 1);
+			std::size_t count = std::min(run, samples - task * run);
+			std::vector<std::pair<int, Eigen::Vector2f> > hits;
+			hits.reserve(count);
+			Eigen::VectorXf thetalist(n), eigenvalues;
+			Eigen::Matrix<float, 6, Eigen::Dynamic> Js(6, n), Jb(6, n);
+			for (std::size_t k = 0; k < count; k++) {
+				for (int i = 0; i < n; i++)
+					thetalist(i) = thetalower(i) + (thetaupper(i) - thetalower(i)) * unit(rng);
+				// Forward kinematics and the space Jacobian in one pass
+				Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+				for (int i = 0; i < n; i++) {
+					Js.col(i) = AdjointScrew(T, joints[i]);
+					T = T * JointExpFixed(joints[i], thetalist(i));
+				}
+				T = T * home;
+				int index = Index(T.topRightCorner<3, 1>());
+				if (index < 0)
+					continue;
+				// Singular values of Jb from the eigenvalues of the smaller Gram matrix
+				Jb.noalias() = AdjointFixed(TransInvFixed(T)) * Js;
+				if (n >= 6)
+					eigenvalues = Eigen::SelfAdjointEigenSolver<Matrix6f>(Matrix6f(Jb * Jb.transpose()), Eigen::EigenvaluesOnly).eigenvalues();
+				else
+					eigenvalues = Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf>(Jb.transpose() * Jb, Eigen::EigenvaluesOnly).eigenvalues();
+				float manipulability = std::sqrt(std::max(0.0f, eigenvalues.prod()));
+				float smallest = std::sqrt(std::max(0.0f, eigenvalues(0)));
+				hits.push_back(std::make_pair(index, Eigen::Vector2f(manipulability, smallest)));
+			}
+			std::lock_guard<std::mutex> lock(merge);
+			for (std::size_t k = 0; k < hits.size(); k++) {
+				Voxel& voxel = voxels_[hits[k].first];
+				voxel.count++;
+				voxel.manipulability = std::max(voxel.manipulability, hits[k].second(0));
+				voxel.minSingularValue = std::max(voxel.minSingularValue, hits[k].second(1));
+			}
+		});
+	}
+
+	namespace {
+
+		struct ReachabilityHeader {
+			char magic[8];
+			std::uint32_t size[3];
+			float lower[3];
+			float voxel;
+			std::uint32_t zero;
+		};
+
+		const char ReachabilityMagic[8] = { 'M', 'R', 'R', 'E', 'A', 'C', 'H', '1' };
+
+	}
+
+	bool ReachabilityMap::Save(const std::string& path) const {
+		static_assert(sizeof(ReachabilityHeader) == 40 && sizeof(Voxel) == 12, "the file layout is fixed");
+		ReachabilityHeader header;
+		std::memcpy(header.magic, ReachabilityMagic, 8);
+		for (int j = 0; j < 3; j++) {
+			header.size[j] = size_(j);
+			header.lower[j] = lower_(j);
+		}
+		header.voxel = voxel_;
+		header.zero = 0;
+		std::ofstream file(path.c_str(), std::ios::binary);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(voxels_.data()), voxels_.size() * sizeof(Voxel));
+		return bool(file);
+	}
+
+	bool ReachabilityMap::Load(const std::string& path) {
+		ReachabilityHeader header;
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, ReachabilityMagic, 8) != 0)
+			return false;
+		std::vector<Voxel> voxels(std::size_t(header.size[0]) * header.size[1] * header.size[2]);
+		if (!file.read(reinterpret_cast<char*>(voxels.data()), voxels.size() * sizeof(Voxel)))
+			return false;
+		lower_ = Eigen::Vector3f(header.lower[0], header.lower[1], header.lower[2]);
+		size_ = Eigen::Vector3i(header.size[0], header.size[1], header.size[2]);
+		voxel_ = header.voxel;
+		voxels_.swap(voxels);
+		return true;
+	}
 	std::vector<Eigen::MatrixXf> SimulateControl(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& g,
 		const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
 		const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& thetamatd, const Eigen::MatrixXf& dthetamatd, const Eigen::MatrixXf& ddthetamatd,
 		const Eigen::VectorXf& gtilde, const std::vector<Eigen::MatrixXf>& Mtildelist, const std::vector<Eigen::MatrixXf>& Gtildelist,
-		float Kp, float Ki, float Kd, float dt, int intRes) {
+		float Kp, float Ki, float Kd, float dt, int intRes, StatePrecision precision) {
+		Workspace ws(thetalist.size());
+		return SimulateControl(thetalist, dthetalist, g, Ftipmat, Mlist, Glist, Slist, thetamatd, dthetamatd, ddthetamatd,
+			gtilde, Mtildelist, Gtildelist, Kp, Ki, Kd, dt, intRes, ws, precision);
+	}
+
+	std::vector<Eigen::MatrixXf> SimulateControl(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist, const Eigen::VectorXf& g,
+		const Eigen::MatrixXf& Ftipmat, const std::vector<Eigen::MatrixXf>& Mlist, const std::vector<Eigen::MatrixXf>& Glist,
+		const Eigen::MatrixXf& Slist, const Eigen::MatrixXf& thetamatd, const Eigen::MatrixXf& dthetamatd, const Eigen::MatrixXf& ddthetamatd,
+		const Eigen::VectorXf& gtilde, const std::vector<Eigen::MatrixXf>& Mtildelist, const std::vector<Eigen::MatrixXf>& Gtildelist,
+		float Kp, float Ki, float Kd, float dt, int intRes, Workspace& ws, StatePrecision precision) {
 		Eigen::MatrixXf FtipmatT = Ftipmat.transpose();
 		Eigen::MatrixXf thetamatdT = thetamatd.transpose();
 		Eigen::MatrixXf dthetamatdT = dthetamatd.transpose();
 		Eigen::MatrixXf ddthetamatdT = ddthetamatd.transpose();
 		int m = thetamatdT.rows(); int n = thetamatdT.cols();
+		ws.Reserve(m);
+		Eigen::Vector3f gvec(g);
+		Eigen::Vector3f gtildevec(gtilde);
 		Eigen::VectorXf thetacurrent = thetalist;
 		Eigen::VectorXf dthetacurrent = dthetalist;
 		Eigen::VectorXf eint = Eigen::VectorXf::Zero(m);
 		Eigen::MatrixXf taumatT = Eigen::MatrixXf::Zero(m, n);
 		Eigen::MatrixXf thetamatT = Eigen::MatrixXf::Zero(m, n);
-		Eigen::VectorXf taulist;
-		Eigen::VectorXf ddthetalist;
+		Eigen::VectorXf taulist(m);
+		Eigen::VectorXf ddthetalist(m);
+		bool mixed = precision == StatePrecision::Mixed;
+		CompensatedVector theta(thetalist), dtheta(dthetalist), eintMixed(eint);
 		for (int i = 0; i < n; ++i) {
-			taulist = ComputedTorque(thetacurrent, dthetacurrent, eint, gtilde, Mtildelist, Gtildelist, Slist, thetamatdT.col(i),
-				dthetamatdT.col(i), ddthetamatdT.col(i), Kp, Ki, Kd);
+			ComputedTorqueKernel(thetacurrent, dthetacurrent, eint, gtildevec, Mtildelist, Gtildelist, Slist, thetamatdT.col(i),
+				dthetamatdT.col(i), ddthetamatdT.col(i), Kp, Ki, Kd, ws, taulist);
 			for (int j = 0; j < intRes; ++j) {
-				ddthetalist = ForwardDynamics(thetacurrent, dthetacurrent, taulist, g, FtipmatT.col(i), Mlist, Glist, Slist);
-				EulerStep(thetacurrent, dthetacurrent, ddthetalist, dt / intRes);
+				ForwardDynamicsKernel(thetacurrent, dthetacurrent, taulist, gvec, Vector6f(FtipmatT.col(i)),
+					Mlist, Glist, Slist, ws, ddthetalist);
+				if (mixed)
+					CompensatedEulerStep(theta, dtheta, ddthetalist, static_cast<double>(dt) / intRes, thetacurrent, dthetacurrent);
+				else
+					EulerStep(thetacurrent, dthetacurrent, ddthetalist, dt / intRes);
 			}
 			taumatT.col(i) = taulist;
 			thetamatT.col(i) = thetacurrent;
-			eint += dt * (thetamatdT.col(i) - thetacurrent);
+			if (mixed) {
+				for (int k = 0; k < m; k++) {
+					eintMixed.Add(k, dt * (thetamatdT(k, i) - theta.sum(k)));
+					eint(k) = static_cast<float>(eintMixed.sum(k));
+				}
+			}
+			else {
+				eint += dt * (thetamatdT.col(i) - thetacurrent);
+			}
 		}
 		std::vector<Eigen::MatrixXf> ControlTauTraj_ret;
 		ControlTauTraj_ret.push_back(taumatT.transpose());
 		ControlTauTraj_ret.push_back(thetamatT.transpose());
 		return ControlTauTraj_ret;
 	}
+
+	namespace {
+		/* Rollouts per run; each run has its own workspace and generator */
+		const int MPPIRunLength = 16;
+	}
+
+	struct MPPIController::Run {
+		explicit Run(int n) : ws(n), thetalist(n), dthetalist(n), taulist(n), ddthetalist(n), thetalistd(n), dthetalistd(n) {}
+
+		Workspace ws;
+		std::mt19937 rng;
+		std::normal_distribution<float> normal;
+		Eigen::VectorXf thetalist, dthetalist, taulist, ddthetalist, thetalistd, dthetalistd;
+	};
+
+	MPPIController::MPPIController(const Eigen::Vector3f& g, const std::vector<Eigen::MatrixXf>& Mlist,
+		const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, float dt, int horizon, int rollouts, ThreadPool& pool)
+		: g_(g), Mlist_(Mlist), Glist_(Glist), Slist_(Slist), joints_(ClassifyJoints(Slist)), dt_(dt), horizon_(horizon),
+		rollouts_(rollouts), pool_(pool),
+		sigma_(Eigen::VectorXf::Ones(Slist.cols())),
+		tauMax_(Eigen::VectorXf::Constant(Slist.cols(), std::numeric_limits<float>::infinity())),
+		positionWeight_(100), velocityWeight_(10), controlWeight_(0), temperature_(1),
+		nominal_(Eigen::MatrixXf::Zero(Slist.cols(), horizon)), feedforward_(Slist.cols(), horizon), noise_(Slist.cols() * horizon, rollouts),
+		costs_(rollouts), taulist_(Eigen::VectorXf::Zero(Slist.cols())) {
+		for (int r = 0; r * MPPIRunLength < rollouts; r++)
+			runs_.push_back(std::unique_ptr<Run>(new Run(Slist.cols())));
+		Seed(0);
+	}
+
+	MPPIController::~MPPIController() {}
+
+	void MPPIController::SetNoise(const Eigen::VectorXf& sigma) { sigma_ = sigma; }
+
+	void MPPIController::SetCost(float positionWeight, float velocityWeight, float controlWeight) {
+		positionWeight_ = positionWeight;
+		velocityWeight_ = velocityWeight;
+		controlWeight_ = controlWeight;
+	}
+
+	void MPPIController::SetTemperature(float temperature) { temperature_ = temperature; }
+
+	void MPPIController::SetTorqueLimits(const Eigen::VectorXf& tauMax) { tauMax_ = tauMax; }
+
+	void MPPIController::Seed(unsigned seed) {
+		for (std::size_t r = 0; r < runs_.size(); r++) {
+			std::seed_seq sequence = { seed, static_cast<unsigned>(r) };
+			runs_[r]->rng.seed(sequence);
+			runs_[r]->normal.reset();
+		}
+	}
+
+	void MPPIController::Reset() {
+		nominal_.setZero();
+		taulist_.setZero();
+	}
+
+	const Eigen::VectorXf& MPPIController::Step(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist,
+		const Eigen::MatrixXf& thetamatd) {
+		int n = Slist_.cols();
+		// Inverse dynamics of the reference; the samples perturb the nominal correction to it
+		int last = static_cast<int>(thetamatd.rows()) - 1;
+		Run& first = *runs_[0];
+		for (int t = 0; t < horizon_; t++) {
+			int t0 = std::min(t, last), t1 = std::min(t + 1, last), t2 = std::min(t + 2, last);
+			first.thetalistd = thetamatd.row(t0).transpose();
+			first.dthetalistd = (thetamatd.row(t1) - thetamatd.row(t0)).transpose() / dt_;
+			first.ddthetalist = (thetamatd.row(t2) - 2 * thetamatd.row(t1) + thetamatd.row(t0)).transpose() / (dt_ * dt_);
+			InverseDynamicsKernel(first.thetalistd, first.dthetalistd, first.ddthetalist, g_, Vector6f::Zero(),
+				Mlist_, Glist_, Slist_, first.ws, feedforward_.col(t));
+		}
+
+		// The body captures two pointers only, which std::function stores without allocating
+		struct Inputs { const Eigen::VectorXf* thetalist; const Eigen::VectorXf* dthetalist; const Eigen::MatrixXf* thetamatd; };
+		Inputs inputs = { &thetalist, &dthetalist, &thetamatd };
+		const Inputs* in = &inputs;
+		std::function<void(int)> rollouts = [this, in](int r) {
+			int n = Slist_.cols();
+			int last = static_cast<int>(in->thetamatd->rows()) - 1;
+			Run& run = *runs_[r];
+			int end = std::min(rollouts_, (r + 1) * MPPIRunLength);
+			for (int k = r * MPPIRunLength; k < end; k++) {
+				run.thetalist = *in->thetalist;
+				run.dthetalist = *in->dthetalist;
+				float cost = 0;
+				for (int t = 0; t < horizon_; t++) {
+					for (int i = 0; i < n; i++) {
+						// Rollout 0 replays the nominal itself; the rest record the noise actually applied
+						float noise = k == 0 ? 0.0f : sigma_(i) * run.normal(run.rng);
+						float tau = feedforward_(i, t) + nominal_(i, t) + noise;
+						run.taulist(i) = std::max(-tauMax_(i), std::min(tauMax_(i), tau));
+						noise_(t * n + i, k) = run.taulist(i) - feedforward_(i, t) - nominal_(i, t);
+					}
+					{
+						// ForwardDynamics with the joints classified once, at construction
+						Workspace::Frame frame(run.ws);
+						Eigen::Map<Eigen::MatrixXf> Ai = run.ws.Matrix(6, n), AdTi = run.ws.Matrix(6, 6 * (n + 1));
+						LinkTransformsKernel([&](int i) { return JointExpFixed(joints_[i], run.thetalist(i)); },
+							n, Mlist_, Slist_, Ai, AdTi);
+						ForwardDynamicsKernel(Ai, AdTi, run.dthetalist, run.taulist, g_, Vector6f::Zero(), Glist_, run.ws, run.ddthetalist);
+					}
+					EulerStep(run.thetalist, run.dthetalist, run.ddthetalist, dt_);
+					int row = std::min(t + 1, last), previous = std::min(t, last);
+					run.thetalistd = in->thetamatd->row(row).transpose();
+					run.dthetalistd = (in->thetamatd->row(row) - in->thetamatd->row(previous)).transpose() / dt_;
+					cost += positionWeight_ * (run.thetalist - run.thetalistd).squaredNorm()
+						+ velocityWeight_ * (run.dthetalist - run.dthetalistd).squaredNorm()
+						+ controlWeight_ * (run.taulist - feedforward_.col(t)).squaredNorm();
+				}
+				costs_(k) = cost;
+			}
+		};
+		pool_.ParallelFor(0, static_cast<int>(runs_.size()), rollouts);
+
+		// Path-integral weights, shifted by the best cost against underflow
+		float best = costs_.minCoeff();
+		for (int k = 0; k < rollouts_; k++)
+			costs_(k) = std::exp(-(costs_(k) - best) / temperature_);
+		costs_ /= costs_.sum();
+		Eigen::Map<Eigen::VectorXf> nominal(nominal_.data(), n * horizon_);
+		nominal.noalias() += noise_ * costs_;
+
+		// Apply the first torque and shift the rest for the next cycle
+		taulist_ = (feedforward_.col(0) + nominal_.col(0)).cwiseMax(-tauMax_).cwiseMin(tauMax_);
+		for (int t = 0; t + 1 < horizon_; t++)
+			nominal_.col(t) = nominal_.col(t + 1);
+		return taulist_;
+	}
+
+	namespace {
+		/* Knots linearized per run, and the step sizes 1, 1/2, ... tried per iteration */
+		const int ILQRRunLength = 8;
+		const int ILQRStepSizes = 8;
+	}
+
+	struct ILQROptimizer::Run {
+		explicit Run(int n)
+			: ws(n), x(2 * n), u(n), ddthetalist(n), plus(n), minus(n), M(n, n), column(n) {}
+
+		Workspace ws;
+		Eigen::VectorXf x, u, ddthetalist, plus, minus;
+		Eigen::MatrixXf M;
+		Eigen::VectorXf column;
+		Eigen::MatrixXf X, U;  // a candidate trajectory of the line search
+		float cost;
+	};
+
+	ILQROptimizer::ILQROptimizer(const Eigen::Vector3f& g, const std::vector<Eigen::MatrixXf>& Mlist,
+		const std::vector<Eigen::MatrixXf>& Glist, const Eigen::MatrixXf& Slist, float dt, ThreadPool& pool)
+		: g_(g), Mlist_(Mlist), Glist_(Glist), Slist_(Slist), joints_(ClassifyJoints(Slist)), dt_(dt), pool_(pool),
+		positionWeight_(100), velocityWeight_(1), controlWeight_(1e-4f), finalWeight_(1000), cost_(0), iterations_(0) {
+	}
+
+	ILQROptimizer::~ILQROptimizer() {}
+
+	void ILQROptimizer::SetCost(float positionWeight, float velocityWeight, float controlWeight, float finalWeight) {
+		positionWeight_ = positionWeight;
+		velocityWeight_ = velocityWeight;
+		controlWeight_ = controlWeight;
+		finalWeight_ = finalWeight;
+		custom_ = CostFunction();
+	}
+
+	void ILQROptimizer::SetCost(const CostFunction& cost) { custom_ = cost; }
+
+	float ILQROptimizer::TrackingCost(int k, const Eigen::VectorXf& x, const Eigen::VectorXf& u, CostExpansion* expansion) const {
+		int n = joints_.size();
+		bool last = k == xd_.cols() - 1;
+		float wp = last ? finalWeight_ : positionWeight_;
+		float wv = last ? finalWeight_ : velocityWeight_;
+		float wu = last ? 0 : controlWeight_;
+		float cost = wp * (x.head(n) - xd_.col(k).head(n)).squaredNorm() + wv * (x.tail(n) - xd_.col(k).tail(n)).squaredNorm()
+			+ wu * u.squaredNorm();
+		if (expansion) {
+			expansion->lx.head(n) += 2 * wp * (x.head(n) - xd_.col(k).head(n));
+			expansion->lx.tail(n) += 2 * wv * (x.tail(n) - xd_.col(k).tail(n));
+			expansion->lxx.diagonal().head(n).array() += 2 * wp;
+			expansion->lxx.diagonal().tail(n).array() += 2 * wv;
+			expansion->lu += 2 * wu * u;
+			expansion->luu.diagonal().array() += 2 * wu;
+		}
+		return cost;
+	}
+
+	float ILQROptimizer::StageCost(int k, const Eigen::VectorXf& x, const Eigen::VectorXf& u, CostExpansion* expansion) const {
+		return custom_ ? custom_(k, x, u, expansion) : TrackingCost(k, x, u, expansion);
+	}
+
+	void ILQROptimizer::Accelerations(Run& run, const Eigen::Ref<const Eigen::VectorXf>& x,
+		const Eigen::Ref<const Eigen::VectorXf>& u, Eigen::Ref<Eigen::VectorXf> ddthetalist) {
+		int n = joints_.size();
+		Workspace::Frame frame(run.ws);
+		Eigen::Map<Eigen::MatrixXf> Ai = run.ws.Matrix(6, n), AdTi = run.ws.Matrix(6, 6 * (n + 1));
+		LinkTransformsKernel([&](int i) { return JointExpFixed(joints_[i], x(i)); }, n, Mlist_, Slist_, Ai, AdTi);
+		ForwardDynamicsKernel(Ai, AdTi, x.tail(n), u, g_, Vector6f::Zero(), Glist_, run.ws, ddthetalist);
+	}
+
+	void ILQROptimizer::Linearize(Run& run, int k) {
+		int n = joints_.size();
+		const float h = 1e-3f;
+		Eigen::MatrixXf& A = A_[k];
+		Eigen::MatrixXf& B = B_[k];
+		// x' = x + dt [dtheta; ddtheta(x, u)], differentiated centrally in x
+		A.setIdentity();
+		A.topRightCorner(n, n).diagonal().array() += dt_;
+		run.x = X_.col(k);
+		for (int j = 0; j < 2 * n; j++) {
+			run.x(j) = X_(j, k) + h;
+			Accelerations(run, run.x, U_.col(k), run.plus);
+			run.x(j) = X_(j, k) - h;
+			Accelerations(run, run.x, U_.col(k), run.minus);
+			run.x(j) = X_(j, k);
+			A.col(j).tail(n) += (dt_ / (2 * h)) * (run.plus - run.minus);
+		}
+		// and exactly in u, through the inverse mass matrix: M is factorized once
+		// and each column of B is then two triangular solves
+		MassMatrixKernel(X_.col(k).head(n), Mlist_, Glist_, Slist_, run.ws, run.M);
+		CholeskyFactorInPlace(run.M);
+		B.setZero();
+		for (int j = 0; j < n; j++) {
+			run.column.setZero();
+			run.column(j) = dt_;
+			CholeskySubstituteInPlace(run.M, run.column);
+			B.col(j).tail(n) = run.column;
+		}
+
+		CostExpansion& e = expansions_[k];
+		e.lx.setZero();
+		e.lu.setZero();
+		e.lxx.setZero();
+		e.luu.setZero();
+		e.lux.setZero();
+		run.u = U_.col(k);
+		StageCost(k, run.x, run.u, &e);
+	}
+
+	float ILQROptimizer::Rollout(Run& run, float alpha) {
+		int n = joints_.size(), N = X_.cols();
+		float cost = 0;
+		run.X.col(0) = X_.col(0);
+		run.x = X_.col(0);
+		for (int k = 0; k + 1 < N; k++) {
+			run.u = U_.col(k) + alpha * kff_.col(k);
+			run.u.noalias() += K_[k] * (run.x - X_.col(k));
+			run.U.col(k) = run.u;
+			cost += StageCost(k, run.x, run.u, 0);
+			Accelerations(run, run.x, run.u, run.ddthetalist);
+			run.x.head(n) += dt_ * run.x.tail(n);
+			run.x.tail(n) += dt_ * run.ddthetalist;
+			if (!run.x.allFinite())
+				return std::numeric_limits<float>::infinity();
+			run.X.col(k + 1) = run.x;
+		}
+		run.U.col(N - 1).setZero();
+		run.u.setZero();
+		return cost + StageCost(N - 1, run.x, run.u, 0);
+	}
+
+	bool ILQROptimizer::BackwardPass(float mu, float& dV1, float& dV2) {
+		int N = X_.cols();
+		const CostExpansion& final = expansions_[N - 1];
+		Vx_ = final.lx;
+		Vxx_ = final.lxx;
+		dV1 = dV2 = 0;
+		for (int k = N - 2; k >= 0; k--) {
+			const Eigen::MatrixXf& A = A_[k];
+			const Eigen::MatrixXf& B = B_[k];
+			const CostExpansion& e = expansions_[k];
+			Qx_ = e.lx;
+			Qx_.noalias() += A.transpose() * Vx_;
+			Qu_ = e.lu;
+			Qu_.noalias() += B.transpose() * Vx_;
+			Qxx_ = e.lxx;
+			Qxx_.noalias() += A.transpose() * Vxx_ * A;
+			Quu_ = e.luu;
+			Quu_.noalias() += B.transpose() * Vxx_ * B;
+			Quu_.diagonal().array() += mu;
+			Qux_ = e.lux;
+			Qux_.noalias() += B.transpose() * Vxx_ * A;
+			llt_.compute(Quu_);
+			if (llt_.info() != Eigen::Success)
+				return false;
+			kff_.col(k) = -llt_.solve(Qu_);
+			K_[k] = -llt_.solve(Qux_);
+			dV1 += kff_.col(k).dot(Qu_);
+			dV2 += 0.5f * kff_.col(k).dot(Quu_ * kff_.col(k));
+			// Vx = Qx + K^T Quu k + K^T Qu + Qux^T k, and likewise Vxx
+			Vx_ = Qx_;
+			Vx_.noalias() += K_[k].transpose() * (Quu_ * kff_.col(k) + Qu_) + Qux_.transpose() * kff_.col(k);
+			Vxx_ = Qxx_;
+			Vxx_.noalias() += K_[k].transpose() * Quu_ * K_[k];
+			Vxx_.noalias() += K_[k].transpose() * Qux_;
+			Vxx_.noalias() += Qux_.transpose() * K_[k];
+			Vxx_ = 0.5f * (Vxx_ + Vxx_.transpose()).eval();
+		}
+		return true;
+	}
+
+	bool ILQROptimizer::Optimize(const Eigen::VectorXf& thetalist, const Eigen::VectorXf& dthetalist,
+		const Eigen::MatrixXf& thetamatd, int maxIterations, float tolerance) {
+		int n = joints_.size(), N = thetamatd.rows();
+		int linearizeRuns = (N - 1 + ILQRRunLength - 1) / ILQRRunLength;
+		while (static_cast<int>(runs_.size()) < std::max(linearizeRuns, ILQRStepSizes))
+			runs_.push_back(std::unique_ptr<Run>(new Run(n)));
+		for (std::size_t r = 0; r < runs_.size(); r++) {
+			runs_[r]->X.resize(2 * n, N);
+			runs_[r]->U.resize(n, N);
+		}
+		A_.resize(N - 1, Eigen::MatrixXf(2 * n, 2 * n));
+		B_.resize(N - 1, Eigen::MatrixXf(2 * n, n));
+		K_.assign(N - 1, Eigen::MatrixXf::Zero(n, 2 * n));
+		kff_.setZero(n, N - 1);
+		CostExpansion zero = { Eigen::VectorXf(2 * n), Eigen::VectorXf(n), Eigen::MatrixXf(2 * n, 2 * n),
+			Eigen::MatrixXf(n, n), Eigen::MatrixXf(n, 2 * n) };
+		expansions_.resize(N, zero);
+
+		// The reference with finite-difference velocities, and InverseDynamics along it as the first guess
+		xd_.resize(2 * n, N);
+		xd_.topRows(n) = thetamatd.transpose();
+		for (int k = 0; k < N; k++) {
+			int next = std::min(k + 1, N - 1), previous = next - 1;
+			xd_.col(k).tail(n) = (thetamatd.row(next) - thetamatd.row(previous)).transpose() / dt_;
+		}
+		X_.setZero(2 * n, N);
+		X_.col(0) << thetalist, dthetalist;
+		U_.resize(n, N);
+		Run& first = *runs_[0];
+		for (int k = 0; k + 1 < N; k++) {
+			first.column = (xd_.col(k + 1).tail(n) - xd_.col(k).tail(n)) / dt_;
+			InverseDynamicsKernel(xd_.col(k).head(n), xd_.col(k).tail(n), first.column, g_, Vector6f::Zero(),
+				Mlist_, Glist_, Slist_, first.ws, U_.col(k));
+		}
+		cost_ = Rollout(first, 0);
+		X_ = first.X;
+		U_ = first.U;
+
+		bool converged = false, linearize = true;
+		float mu = 0;
+		const float muMin = 1e-6f, muMax = 1e10f;
+		for (iterations_ = 0; iterations_ < maxIterations && !converged; iterations_++) {
+			if (linearize) {
+				std::function<void(int)> knots = [this, N](int r) {
+					int end = std::min(N - 1, (r + 1) * ILQRRunLength);
+					for (int k = r * ILQRRunLength; k < end; k++)
+						Linearize(*runs_[r], k);
+				};
+				pool_.ParallelFor(0, linearizeRuns, knots);
+				CostExpansion& final = expansions_[N - 1];
+				final.lx.setZero();
+				final.lxx.setZero();
+				first.x = X_.col(N - 1);
+				first.u.setZero();
+				StageCost(N - 1, first.x, first.u, &final);
+				linearize = false;
+			}
+
+			float dV1, dV2;
+			while (!BackwardPass(mu, dV1, dV2)) {
+				mu = std::max(10 * mu, muMin);
+				if (mu > muMax)
+					return false;
+			}
+
+			// Every step size at once; the largest with enough decrease wins
+			std::function<void(int)> steps = [this](int a) {
+				runs_[a]->cost = Rollout(*runs_[a], std::ldexp(1.0f, -a));
+			};
+			pool_.ParallelFor(0, ILQRStepSizes, steps);
+			int accepted = -1;
+			for (int a = 0; a < ILQRStepSizes && accepted < 0; a++) {
+				float alpha = std::ldexp(1.0f, -a);
+				float expected = -(alpha * dV1 + alpha * alpha * dV2);
+				float actual = cost_ - runs_[a]->cost;
+				if (actual > 0 && (expected <= 0 || actual > 0.1f * expected))
+					accepted = a;
+			}
+			if (accepted < 0) {
+				mu = std::max(10 * mu, muMin);
+				if (mu > muMax)
+					break;
+				continue;
+			}
+			float previous = cost_;
+			cost_ = runs_[accepted]->cost;
+			X_.swap(runs_[accepted]->X);
+			U_.swap(runs_[accepted]->U);
+			mu = mu * 0.1f < muMin ? 0 : mu * 0.1f;
+			linearize = true;
+			converged = previous - cost_ < tolerance * previous;
+		}
+
+		// Row N-1 keeps the final state from accelerating
+		InverseDynamicsKernel(X_.col(N - 1).head(n), X_.col(N - 1).tail(n), Eigen::VectorXf::Zero(n), g_, Vector6f::Zero(),
+			Mlist_, Glist_, Slist_, first.ws, U_.col(N - 1));
+		thetamat_ = X_.topRows(n).transpose();
+		dthetamat_ = X_.bottomRows(n).transpose();
+		taumat_ = U_.transpose();
+		ddthetamat_.resize(N, n);
+		for (int k = 0; k < N; k++) {
+			Accelerations(first, X_.col(k), U_.col(k), first.ddthetalist);
+			ddthetamat_.row(k) = first.ddthetalist.transpose();
+		}
+		return converged;
+	}
+
+	namespace {
+		/* [adV] W, the Lie bracket of two twists */
+		Vector6f LieBracket(const Vector6f& V, const Vector6f& W) {
+			Vector6f bracket;
+			bracket << V.head<3>().cross(W.head<3>()), V.tail<3>().cross(W.head<3>()) + V.head<3>().cross(W.tail<3>());
+			return bracket;
+		}
+
+		/* One segment of a cumulative cubic B-spline from its first control pose and
+		 * the three increments after it; V and dV, when given, in units of u */
+		Eigen::Matrix4f SplineSegment(const Eigen::Matrix4f& T, const Eigen::Matrix<float, 6, 3>& omegas, float u,
+			Vector6f* V, Vector6f* dV) {
+			float u2 = u * u, u3 = u2 * u;
+			Eigen::Vector3f B((5 + 3 * u - 3 * u2 + u3) / 6, (1 + 3 * u + 3 * u2 - 2 * u3) / 6, u3 / 6);
+			Eigen::Vector3f dB((3 - 6 * u + 3 * u2) / 6, (3 + 6 * u - 6 * u2) / 6, u2 / 2);
+			Eigen::Vector3f ddB(u - 1, 1 - 2 * u, u);
+			Eigen::Matrix4f pose = T;
+			if (V) {
+				V->setZero();
+				dV->setZero();
+			}
+			for (int j = 0; j < 3; j++) {
+				Vector6f omega = omegas.col(j);
+				Eigen::Matrix4f A = MatrixExp6Fixed(omega, B(j));
+				pose = pose * A;
+				if (V) {
+					Matrix6f AdAinv = AdjointFixed(TransInvFixed(A));
+					Vector6f step = dB(j) * omega;
+					*V = AdAinv * *V + step;
+					*dV = AdAinv * *dV + ddB(j) * omega + LieBracket(*V, step);
+				}
+			}
+			return pose;
+		}
+	}
+
+	SE3Spline::SE3Spline(const std::vector<Eigen::MatrixXf>& controls, float dt, float t0)
+		: controls_(controls.size()), omegas_(6, controls.size()), dt_(dt), t0_(t0) {
+		eigen_assert(controls.size() >= 4);
+		omegas_.col(0).setZero();
+		for (std::size_t j = 0; j < controls.size(); j++) {
+			controls_[j] = controls[j];
+			if (j > 0)
+				omegas_.col(j) = Log6Fixed(TransInvFixed(controls_[j - 1]) * controls_[j]);
+		}
+	}
+
+	namespace {
+		/* The segment of a spline with m control poses that t falls in, and u */
+		int SplineLocate(float t, float t0, float dt, int m, float& u) {
+			float s = (t - t0) / dt;
+			int i = std::max(0, std::min(m - 4, static_cast<int>(std::floor(s))));
+			u = std::max(0.0f, std::min(1.0f, s - i));
+			return i;
+		}
+
+		/* Solves A*x = b for a symmetric positive definite A given by its lower band,
+		 * band(d, j) = A(j + d, j) for d below the bandwidth, overwriting band with the
+		 * Cholesky factor and b with x. The factor keeps the band, so the cost is
+		 * linear in the size of A. */
+		void BandedCholeskySolveInPlace(Eigen::Ref<Eigen::MatrixXf> band, Eigen::Ref<Eigen::VectorXf> b) {
+			int w = band.rows(), n = band.cols();
+			for (int j = 0; j < n; ++j) {
+				float d = std::sqrt(band(0, j));
+				band(0, j) = d;
+				int below = std::min(w - 1, n - 1 - j);
+				for (int i = 1; i <= below; ++i)
+					band(i, j) /= d;
+				// The rank-one update of the trailing block stays inside the band
+				for (int k = 1; k <= below; ++k)
+					for (int i = k; i <= below; ++i)
+						band(i - k, j + k) -= band(i, j) * band(k, j);
+			}
+			for (int j = 0; j < n; ++j) {
+				b(j) /= band(0, j);
+				int below = std::min(w - 1, n - 1 - j);
+				for (int i = 1; i <= below; ++i)
+					b(j + i) -= band(i, j) * b(j);
+			}
+			for (int j = n - 1; j >= 0; --j) {
+				int below = std::min(w - 1, n - 1 - j);
+				for (int i = 1; i <= below; ++i)
+					b(j) -= band(i, j) * b(j + i);
+				b(j) /= band(0, j);
+			}
+		}
+	}
+
+	Eigen::Matrix4f SE3Spline::Evaluate(float t) const {
+		float u;
+		int i = SplineLocate(t, t0_, dt_, controls_.size(), u);
+		return SplineSegment(controls_[i], omegas_.middleCols<3>(i + 1), u, 0, 0);
+	}
+
+	Eigen::Matrix4f SE3Spline::Evaluate(float t, Eigen::Matrix<float, 6, 1>& Vb, Eigen::Matrix<float, 6, 1>& dVb) const {
+		float u;
+		int i = SplineLocate(t, t0_, dt_, controls_.size(), u);
+		Eigen::Matrix4f T = SplineSegment(controls_[i], omegas_.middleCols<3>(i + 1), u, &Vb, &dVb);
+		Vb /= dt_;
+		dVb /= dt_ * dt_;
+		return T;
+	}
+
+	void SE3Spline::Evaluate(const Eigen::VectorXf& times, CartesianSamples& samples, bool velocities) const {
+		int N = times.size();
+		samples.positions.resize(N, 3);
+		samples.quaternions.resize(N, 4);
+		samples.linearVelocities.resize(velocities ? N : 0, 3);
+		samples.angularVelocities.resize(velocities ? N : 0, 3);
+		Vector6f Vb, dVb;
+		Eigen::Quaternionf previous(1, 0, 0, 0);
+		for (int k = 0; k < N; k++) {
+			Eigen::Matrix4f T = velocities ? Evaluate(times(k), Vb, dVb) : Evaluate(times(k));
+			Eigen::Matrix3f R = T.topLeftCorner<3, 3>();
+			Eigen::Quaternionf q(R);
+			// The sign nearest the previous sample, for a continuous array
+			if (q.dot(previous) < 0)
+				q.coeffs() = -q.coeffs();
+			previous = q;
+			samples.positions.row(k) = T.topRightCorner<3, 1>().transpose();
+			samples.quaternions.row(k) << q.w(), q.x(), q.y(), q.z();
+			if (velocities) {
+				samples.angularVelocities.row(k) = (R * Vb.head<3>()).transpose();
+				samples.linearVelocities.row(k) = (R * Vb.tail<3>()).transpose();
+			}
+		}
+	}
+
+	SE3Spline SE3Spline::Fit(const std::vector<Eigen::MatrixXf>& poses, const Eigen::VectorXf& times, float dt, int iterations) {
+		int S = times.size();
+		float t0 = times(0);
+		int segments = std::max(1, static_cast<int>(std::ceil((times(S - 1) - t0) / dt - 1e-4f)));
+		int m = segments + 3;
+		// Control pose j weighs most at t0 + (j-1) dt; start it at the logged pose nearest that time
+		std::vector<Eigen::MatrixXf> controls(m);
+		for (int j = 0; j < m; j++) {
+			float t = t0 + (j - 1) * dt;
+			int k = std::lower_bound(times.data(), times.data() + S, t) - times.data();
+			if (k == S || (k > 0 && t - times(k - 1) < times(k) - t))
+				k--;
+			controls[j] = poses[k];
+		}
+		SE3Spline spline(controls, dt, t0);
+
+		// Gauss-Newton on right perturbations T_j e^[delta_j], each sample touching four control
+		// poses, so the normal matrix H is banded and only its lower band is kept: H(c + d, c) = band(d, c)
+		typedef Eigen::Matrix<float, 6, 24> Jacobian;
+		Eigen::MatrixXf band(24, 6 * m);
+		Eigen::VectorXf g(6 * m);
+		const float h = 1e-3f;
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			band.setZero();
+			g.setZero();
+			for (int k = 0; k < S; k++) {
+				float u;
+				int i = SplineLocate(times(k), t0, dt, m, u);
+				Eigen::Matrix4f inverse = TransInvFixed(Eigen::Matrix4f(poses[k]));
+				Eigen::Matrix4f local[4];
+				for (int j = 0; j < 4; j++)
+					local[j] = spline.controls_[i + j];
+				auto residual = [&]() {
+					Eigen::Matrix<float, 6, 3> omegas;
+					for (int j = 0; j < 3; j++)
+						omegas.col(j) = Log6Fixed(TransInvFixed(local[j]) * local[j + 1]);
+					return Log6Fixed(inverse * SplineSegment(local[0], omegas, u, 0, 0));
+				};
+				Vector6f r = residual();
+				Jacobian J;
+				for (int p = 0; p < 24; p++) {
+					Eigen::Matrix4f saved = local[p / 6];
+					Vector6f delta = Vector6f::Zero();
+					delta(p % 6) = h;
+					local[p / 6] = saved * MatrixExp6Fixed(delta, 1);
+					Vector6f plus = residual();
+					local[p / 6] = saved * MatrixExp6Fixed(-delta, 1);
+					J.col(p) = (plus - residual()) / (2 * h);
+					local[p / 6] = saved;
+				}
+				Eigen::Matrix<float, 24, 24> JtJ = J.transpose() * J;
+				for (int c = 0; c < 24; c++)
+					for (int d = 0; c + d < 24; d++)
+						band(d, 6 * i + c) += JtJ(c + d, c);
+				g.segment<24>(6 * i).noalias() += J.transpose() * r;
+			}
+			// A little damping keeps control poses that no sample reaches in place
+			band.row(0).array() += 1e-6f * (1 + band.row(0).maxCoeff());
+			Eigen::VectorXf step = -g;
+			BandedCholeskySolveInPlace(band, step);
+			for (int j = 0; j < m; j++)
+				controls[j] = spline.controls_[j] * MatrixExp6Fixed(step.segment<6>(6 * j), 1);
+			spline = SE3Spline(controls, dt, t0);
+			if (step.lpNorm<Eigen::Infinity>() < 1e-6f)
+				break;
+		}
+		return spline;
+	}
 }
@@ -0,0 +1,11 @@
+/*
+ * reference.cpp
+ * Compiles backup/modern_robotics.cpp into namespace mr_reference. Its
+ * #include of include/modern_robotics.h meets the float header, already
+ * included here, and is skipped; the declarations come from the backup
+ * header instead.
+ */
+#include "../include/modern_robotics.h"
+#define mr mr_reference
+#include "../backup/modern_robotics.h"
+#include "../backup/modern_robotics.cpp"
@@ -0,0 +1,11 @@
+#pragma once
+
+/*
+ * reference.h
+ * The double-precision implementation kept in backup/ as namespace
+ * mr_reference, for checking the float library against it. Include after
+ * modern_robotics.h; src/reference.cpp compiles the definitions.
+ */
+#define mr mr_reference
+#include "../backup/modern_robotics.h"
+#undef mr
@@ -0,0 +1,165 @@
+#include "simd_kernels.h"
+
+/*
+ * simd_kernels.cpp
+ * Array kernels written as plain loops over floats for the compiler to
+ * vectorize. This file is compiled once per instruction set, with
+ * MR_SIMD_TABLE and MR_SIMD_NAME naming the table it exports; without them
+ * it is the baseline variant.
+ *
+ * Everything but the table function has internal linkage, and the C sqrtf
+ * stands in for std::sqrt: an inline function with external linkage would be
+ * emitted by every variant, and the linker would keep whichever it saw first.
+ */
+#include <math.h>
+
+#ifndef MR_SIMD_TABLE
+#define MR_SIMD_TABLE SimdKernelsBaseline
+#define MR_SIMD_NAME "baseline"
+#endif
+
+namespace mr {
+
+	namespace {
+
+		/* sin and cos of x by reduction to [-pi/4, pi/4] and the minimax
+		 * polynomials of the Cephes library, accurate to a few ulp for |x| < 8192 */
+		inline void SinCos(float x, float& sine, float& cosine) {
+			int q = static_cast<int>(x * 0.636619772f + (x < 0 ? -0.5f : 0.5f));
+			float fq = static_cast<float>(q);
+			float r = ((x - fq * 1.5703125f) - fq * 4.837512969970703125e-4f) - fq * 7.54978995489188216e-8f;
+			float r2 = r * r;
+			float sr = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+			float cr = 1 - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+			float s = (q & 1) ? cr : sr;
+			float c = (q & 1) ? sr : cr;
+			sine = (q & 2) ? -s : s;
+			cosine = ((q + 1) & 2) ? -c : c;
+		}
+
+		void TimeScaling(int method, int first, float dtau, int count, float rate, float* s, float* sdot) {
+			if (method == 3) {
+				for (int i = 0; i < count; i++) {
+					float tau = (first + i) * dtau;
+					s[i] = (3 - 2 * tau) * tau * tau;
+				}
+				if (sdot) {
+					for (int i = 0; i < count; i++) {
+						float tau = (first + i) * dtau;
+						sdot[i] = 6 * rate * tau * (1 - tau);
+					}
+				}
+			}
+			else {
+				for (int i = 0; i < count; i++) {
+					float tau = (first + i) * dtau;
+					s[i] = ((6 * tau - 15) * tau + 10) * tau * tau * tau;
+				}
+				if (sdot) {
+					for (int i = 0; i < count; i++) {
+						float tau = (first + i) * dtau;
+						float v = tau * (1 - tau);
+						sdot[i] = 30 * rate * v * v;
+					}
+				}
+			}
+		}
+
+		void Slerp(const float* a, const float* b, float angle, const float* s, int count, float* q, int ld) {
+			float* q0 = q;
+			float* q1 = q + ld;
+			float* q2 = q + 2 * ld;
+			float* q3 = q + 3 * ld;
+			// Copied so that the loop need not check the outputs against a and b
+			float a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+			float b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3];
+			for (int i = 0; i < count; i++) {
+				float sine, cosine;
+				SinCos(angle * s[i], sine, cosine);
+				q0[i] = a0 * cosine + b0 * sine;
+				q1[i] = a1 * cosine + b1 * sine;
+				q2[i] = a2 * cosine + b2 * sine;
+				q3[i] = a3 * cosine + b3 * sine;
+			}
+		}
+
+		/* R = I + A [w] + B [w]^2 with A = sin(t)/t and B = (1 - cos(t))/t^2 taken
+		 * from the half angle, 2 sin(t/2) cos(t/2)/t and 2 (sin(t/2)/t)^2. The
+		 * coefficients are computed 64 vectors at a time, apart from writing the
+		 * 3x3 matrices, which does not vectorize. */
+		void MatrixExp3(const float* expc3, std::size_t count, float* R) {
+			float A[64], B[64];
+			for (std::size_t begin = 0; begin < count; begin += 64) {
+				int block = static_cast<int>(count - begin < 64 ? count - begin : 64);
+				const float* e = expc3 + 3 * begin;
+				for (int i = 0; i < block; i++) {
+					float t2 = e[3 * i] * e[3 * i] + e[3 * i + 1] * e[3 * i + 1] + e[3 * i + 2] * e[3 * i + 2];
+					float t = sqrtf(t2);
+					float sh, ch;
+					SinCos(0.5f * t, sh, ch);
+					bool small = t2 < 1e-12f;
+					float tinv = 1 / (small ? 1 : t);
+					A[i] = small ? 1 : 2 * sh * ch * tinv;
+					B[i] = small ? 0.5f : 2 * sh * sh * tinv * tinv;
+				}
+				for (int i = 0; i < block; i++) {
+					float x = e[3 * i], y = e[3 * i + 1], z = e[3 * i + 2];
+					float t2 = x * x + y * y + z * z;
+					float* m = R + 9 * (begin + i);
+					m[0] = 1 + B[i] * (x * x - t2);
+					m[1] = B[i] * x * y + A[i] * z;
+					m[2] = B[i] * x * z - A[i] * y;
+					m[3] = B[i] * x * y - A[i] * z;
+					m[4] = 1 + B[i] * (y * y - t2);
+					m[5] = B[i] * y * z + A[i] * x;
+					m[6] = B[i] * x * z + A[i] * y;
+					m[7] = B[i] * y * z - A[i] * x;
+					m[8] = 1 + B[i] * (z * z - t2);
+				}
+			}
+		}
+
+		/* |R^T R - I|^2 from the six distinct dot products of the columns of the
+		 * top-left 3x3 block, and det R, of a column-major matrix with leading
+		 * dimension ld */
+		inline float SquaredDistanceSO3(const float* m, int ld, float& det) {
+			const float* a = m;
+			const float* b = m + ld;
+			const float* c = m + 2 * ld;
+			det = a[0] * (b[1] * c[2] - b[2] * c[1]) + a[1] * (b[2] * c[0] - b[0] * c[2]) + a[2] * (b[0] * c[1] - b[1] * c[0]);
+			float aa = a[0] * a[0] + a[1] * a[1] + a[2] * a[2] - 1;
+			float bb = b[0] * b[0] + b[1] * b[1] + b[2] * b[2] - 1;
+			float cc = c[0] * c[0] + c[1] * c[1] + c[2] * c[2] - 1;
+			float ab = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+			float ac = a[0] * c[0] + a[1] * c[1] + a[2] * c[2];
+			float bc = b[0] * c[0] + b[1] * c[1] + b[2] * c[2];
+			return aa * aa + bb * bb + cc * cc + 2 * (ab * ab + ac * ac + bc * bc);
+		}
+
+		void DistanceToSO3(const float* matrices, std::size_t count, float* distances) {
+			for (std::size_t i = 0; i < count; i++) {
+				float det;
+				float d = sqrtf(SquaredDistanceSO3(matrices + 9 * i, 3, det));
+				distances[i] = det > 0 ? d : 1.0e9f;
+			}
+		}
+
+		void DistanceToSE3(const float* matrices, std::size_t count, float* distances) {
+			for (std::size_t i = 0; i < count; i++) {
+				const float* m = matrices + 16 * i;
+				float det;
+				float d2 = SquaredDistanceSO3(m, 4, det);
+				float w = m[15] - 1;
+				float d = sqrtf(d2 + m[3] * m[3] + m[7] * m[7] + m[11] * m[11] + w * w);
+				distances[i] = det > 0 ? d : 1.0e9f;
+			}
+		}
+
+	}
+
+	const SimdKernelTable& MR_SIMD_TABLE() {
+		static const SimdKernelTable table = { MR_SIMD_NAME, TimeScaling, Slerp, MatrixExp3, DistanceToSO3, DistanceToSE3 };
+		return table;
+	}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * simd_kernels.h
+ * The array kernels that src/simd_kernels.cpp provides once per instruction
+ * set. The library is built for a baseline instruction set; the same kernel
+ * source is compiled again with -msse4.2, -mavx2 -mfma and -mavx512f where
+ * the compiler supports them, and modern_robotics.cpp picks the widest table
+ * the processor runs at load time (see SimdVariant in modern_robotics.h).
+ *
+ * Only plain data crosses this interface, so that no Eigen template or other
+ * inline function is shared, and possibly merged by the linker, between
+ * objects compiled for different instruction sets.
+ */
+#include <cstddef>
+
+namespace mr {
+
+	struct SimdKernelTable {
+		const char* name;
+
+		/* s(tau) of the cubic (method 3) or quintic time scaling at tau = (first + i) dtau,
+		 * i = 0 ... count-1, and rate ds/dtau in sdot unless it is null */
+		void (*timeScaling)(int method, int first, float dtau, int count, float rate, float* s, float* sdot);
+
+		/* q_j(i) = a_j cos(angle s_i) + b_j sin(angle s_i), j = 0 ... 3, into the
+		 * columns of a column-major count x 4 matrix with leading dimension ld */
+		void (*slerp)(const float* a, const float* b, float angle, const float* s, int count, float* q, int ld);
+
+		/* Rodrigues' formula for count exponential coordinates of 3 floats each into
+		 * column-major 3x3 rotations */
+		void (*matrixExp3)(const float* expc3, std::size_t count, float* R);
+
+		/* DistanceToSO3 and DistanceToSE3 of count column-major 3x3 or 4x4 matrices */
+		void (*distanceToSO3)(const float* matrices, std::size_t count, float* distances);
+		void (*distanceToSE3)(const float* matrices, std::size_t count, float* distances);
+	};
+
+	/* One per compiled variant, MR_SIMD_SSE4 etc. tell which are present */
+	const SimdKernelTable& SimdKernelsBaseline();
+	const SimdKernelTable& SimdKernelsSSE4();
+	const SimdKernelTable& SimdKernelsAVX2();
+	const SimdKernelTable& SimdKernelsAVX512();
+
+}
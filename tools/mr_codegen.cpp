@@ -0,0 +1,865 @@
+/*
+ * mr_codegen: emits straight-line C++ for the kinematics and dynamics of one fixed robot.
+ *
+ * Usage: mr_codegen <robot description> <output header>
+ *
+ * For a fixed robot Slist, Mlist and Glist are constants, so every loop of the generic
+ * mr:: functions can be unrolled and every product with a constant zero or one dropped.
+ * The generator evaluates the textbook recursions on a symbolic scalar that folds
+ * constants as it goes and shares repeated subexpressions, then prints what is left
+ * as a sequence of float temporaries.
+ *
+ * The description is a whitespace separated text file, '#' starts a comment:
+ *   name <identifier>        namespace of the generated functions
+ *   dof <n>
+ *   S w1 w2 w3 v1 v2 v3      n lines, screw axes in the space frame
+ *   M r11 r12 r13 p1 ... p3  n+1 lines, the top three rows of M_{i-1,i}
+ *   Gdiag d1 ... d6          n lines, either a diagonal spatial inertia
+ *   G g11 g12 ... g66        or all 36 entries row by row
+ *
+ * The generated header defines, inside namespace <name>:
+ *   FKinSpace, JacobianSpace, InverseDynamics (RNEA), MassMatrix (CRBA),
+ *   ForwardDynamics (ABA), and Slist, Mlist, Glist returning the description.
+ */
+#include <Eigen/Dense>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+	/* A scalar of the generated code: either a constant known to the generator or
+	 * the name of a variable declared in the generated function body. */
+	struct Expr {
+		Expr() : constant(true), value(0) {}
+		bool constant;
+		double value;
+		std::string name;
+	};
+
+	Expr Const(double value) {
+		// Snap round-off from composing the constant transforms
+		if (std::abs(value) < 1e-12) value = 0;
+		if (std::abs(value - 1) < 1e-12) value = 1;
+		if (std::abs(value + 1) < 1e-12) value = -1;
+		Expr e;
+		e.value = value;
+		return e;
+	}
+
+	bool IsConst(const Expr& e, double value) { return e.constant && e.value == value; }
+
+	std::string Literal(double value) {
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "%.9g", value);
+		std::string s(buf);
+		if (s.find_first_of(".en") == std::string::npos) s += ".0";
+		return s + "f";
+	}
+
+	std::string Ref(const Expr& e) { return e.constant ? Literal(e.value) : e.name; }
+
+	/* Adds the identifiers in a line of generated code to names, skipping numbers */
+	void Identifiers(const std::string& code, std::set<std::string>& names) {
+		std::string::size_type i = 0;
+		while (i < code.size()) {
+			unsigned char c = code[i];
+			if (std::isalpha(c) || c == '_') {
+				std::string::size_type start = i;
+				while (i < code.size() && (std::isalnum(static_cast<unsigned char>(code[i])) || code[i] == '_')) i++;
+				names.insert(code.substr(start, i - start));
+			}
+			else if (std::isdigit(c)) {
+				while (i < code.size() && (std::isalnum(static_cast<unsigned char>(code[i])) || code[i] == '.' || code[i] == '_')) i++;
+			}
+			else i++;
+		}
+	}
+
+	/* Collects the body of one generated function. Identical right-hand sides are
+	 * emitted once, so shared subexpressions cost nothing, and variables that no
+	 * output depends on are not emitted at all. */
+	class Emitter {
+	public:
+		Emitter() : count_(0) {}
+
+		Expr Declare(const std::string& name, const std::string& rhs) {
+			Statement s = { name, rhs };
+			statements_.push_back(s);
+			Expr e;
+			e.constant = false;
+			e.name = name;
+			return e;
+		}
+
+		Expr Temp(const std::string& rhs) {
+			std::map<std::string, std::string>::const_iterator it = cache_.find(rhs);
+			if (it != cache_.end()) {
+				Expr e;
+				e.constant = false;
+				e.name = it->second;
+				return e;
+			}
+			std::ostringstream name;
+			name << "t" << count_++;
+			cache_[rhs] = name.str();
+			return Declare(name.str(), rhs);
+		}
+
+		void Line(const std::string& line) {
+			Statement s = { std::string(), line };
+			statements_.push_back(s);
+		}
+
+		/* The body, swept backwards from the plain lines (the outputs) so that only
+		 * the variables they reach are declared */
+		std::string Body() const {
+			std::set<std::string> live;
+			std::vector<bool> keep(statements_.size(), false);
+			for (std::size_t k = statements_.size(); k-- > 0;) {
+				const Statement& s = statements_[k];
+				if (!s.name.empty() && !live.count(s.name)) continue;
+				keep[k] = true;
+				Identifiers(s.code, live);
+			}
+			std::ostringstream body;
+			for (std::size_t k = 0; k < statements_.size(); k++) {
+				if (!keep[k]) continue;
+				const Statement& s = statements_[k];
+				if (s.name.empty()) body << "\t\t" << s.code << "\n";
+				else body << "\t\tconst float " << s.name << " = " << s.code << ";\n";
+			}
+			return body.str();
+		}
+
+	private:
+		/* A declaration of name = code, or a plain line of code when name is empty */
+		struct Statement {
+			std::string name;
+			std::string code;
+		};
+
+		std::vector<Statement> statements_;
+		int count_;
+		std::map<std::string, std::string> cache_;
+	};
+
+	Emitter* emitter = 0;
+
+	Expr Binary(const Expr& a, const char* op, const Expr& b, bool commutative) {
+		std::string x = Ref(a), y = Ref(b);
+		if (commutative && y < x) std::swap(x, y);
+		return emitter->Temp(x + " " + op + " " + y);
+	}
+
+	Expr operator-(const Expr& a) {
+		if (a.constant) return Const(-a.value);
+		return emitter->Temp("-" + a.name);
+	}
+
+	Expr operator+(const Expr& a, const Expr& b) {
+		if (a.constant && b.constant) return Const(a.value + b.value);
+		if (IsConst(a, 0)) return b;
+		if (IsConst(b, 0)) return a;
+		if (b.constant && b.value < 0) return Binary(a, "-", Const(-b.value), false);
+		if (a.constant && a.value < 0) return Binary(b, "-", Const(-a.value), false);
+		return Binary(a, "+", b, true);
+	}
+
+	Expr operator-(const Expr& a, const Expr& b) {
+		if (a.constant && b.constant) return Const(a.value - b.value);
+		if (IsConst(b, 0)) return a;
+		if (IsConst(a, 0)) return -b;
+		if (!a.constant && !b.constant && a.name == b.name) return Const(0);
+		if (b.constant && b.value < 0) return Binary(a, "+", Const(-b.value), true);
+		return Binary(a, "-", b, false);
+	}
+
+	Expr operator*(const Expr& a, const Expr& b) {
+		if (a.constant && b.constant) return Const(a.value * b.value);
+		if (IsConst(a, 0) || IsConst(b, 0)) return Const(0);
+		if (IsConst(a, 1)) return b;
+		if (IsConst(b, 1)) return a;
+		if (IsConst(a, -1)) return -b;
+		if (IsConst(b, -1)) return -a;
+		return Binary(a, "*", b, true);
+	}
+
+	Expr operator/(const Expr& a, const Expr& b) {
+		if (IsConst(a, 0)) return Const(0);
+		if (b.constant) return a * Const(1.0 / b.value);
+		return Binary(a, "/", b, false);
+	}
+
+	Expr& operator+=(Expr& a, const Expr& b) { return a = a + b; }
+
+	/* Small fixed-size symbolic matrices */
+	struct Vec3 { Expr e[3]; };
+	struct Rot { Expr e[3][3]; };
+	struct Transform { Rot R; Vec3 p; };
+	struct Twist { Expr e[6]; };  // [w; v], or a wrench [m; f]
+	struct Mat6 { Expr e[6][6]; };
+
+	Vec3 Top(const Twist& V) { Vec3 r; for (int i = 0; i < 3; i++) r.e[i] = V.e[i]; return r; }
+	Vec3 Bottom(const Twist& V) { Vec3 r; for (int i = 0; i < 3; i++) r.e[i] = V.e[i + 3]; return r; }
+
+	Twist Stack(const Vec3& w, const Vec3& v) {
+		Twist r;
+		for (int i = 0; i < 3; i++) { r.e[i] = w.e[i]; r.e[i + 3] = v.e[i]; }
+		return r;
+	}
+
+	Vec3 operator+(const Vec3& a, const Vec3& b) { Vec3 r; for (int i = 0; i < 3; i++) r.e[i] = a.e[i] + b.e[i]; return r; }
+	Vec3 operator-(const Vec3& a, const Vec3& b) { Vec3 r; for (int i = 0; i < 3; i++) r.e[i] = a.e[i] - b.e[i]; return r; }
+	Twist operator+(const Twist& a, const Twist& b) { Twist r; for (int i = 0; i < 6; i++) r.e[i] = a.e[i] + b.e[i]; return r; }
+	Twist operator-(const Twist& a, const Twist& b) { Twist r; for (int i = 0; i < 6; i++) r.e[i] = a.e[i] - b.e[i]; return r; }
+	Twist operator*(const Twist& a, const Expr& s) { Twist r; for (int i = 0; i < 6; i++) r.e[i] = a.e[i] * s; return r; }
+
+	Vec3 Cross(const Vec3& a, const Vec3& b) {
+		Vec3 r;
+		r.e[0] = a.e[1] * b.e[2] - a.e[2] * b.e[1];
+		r.e[1] = a.e[2] * b.e[0] - a.e[0] * b.e[2];
+		r.e[2] = a.e[0] * b.e[1] - a.e[1] * b.e[0];
+		return r;
+	}
+
+	Expr Dot(const Twist& a, const Twist& b) {
+		Expr r = Const(0);
+		for (int i = 0; i < 6; i++) r += a.e[i] * b.e[i];
+		return r;
+	}
+
+	Vec3 operator*(const Rot& R, const Vec3& v) {
+		Vec3 r;
+		for (int i = 0; i < 3; i++)
+			r.e[i] = R.e[i][0] * v.e[0] + R.e[i][1] * v.e[1] + R.e[i][2] * v.e[2];
+		return r;
+	}
+
+	Vec3 TransposeTimes(const Rot& R, const Vec3& v) {
+		Vec3 r;
+		for (int i = 0; i < 3; i++)
+			r.e[i] = R.e[0][i] * v.e[0] + R.e[1][i] * v.e[1] + R.e[2][i] * v.e[2];
+		return r;
+	}
+
+	Rot operator*(const Rot& a, const Rot& b) {
+		Rot r;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				r.e[i][j] = a.e[i][0] * b.e[0][j] + a.e[i][1] * b.e[1][j] + a.e[i][2] * b.e[2][j];
+		return r;
+	}
+
+	Transform operator*(const Transform& a, const Transform& b) {
+		Transform r;
+		r.R = a.R * b.R;
+		r.p = a.R * b.p + a.p;
+		return r;
+	}
+
+	Transform ConstTransform(const Eigen::Matrix4d& T) {
+		Transform r;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) r.R.e[i][j] = Const(T(i, j));
+			r.p.e[i] = Const(T(i, 3));
+		}
+		return r;
+	}
+
+	Twist ConstTwist(const Eigen::Matrix<double, 6, 1>& V) {
+		Twist r;
+		for (int i = 0; i < 6; i++) r.e[i] = Const(V(i));
+		return r;
+	}
+
+	Mat6 ConstMat6(const Eigen::Matrix<double, 6, 6>& G) {
+		Mat6 r;
+		for (int i = 0; i < 6; i++)
+			for (int j = 0; j < 6; j++) r.e[i][j] = Const(G(i, j));
+		return r;
+	}
+
+	Twist operator*(const Mat6& A, const Twist& V) {
+		Twist r;
+		for (int i = 0; i < 6; i++) {
+			r.e[i] = Const(0);
+			for (int j = 0; j < 6; j++) r.e[i] += A.e[i][j] * V.e[j];
+		}
+		return r;
+	}
+
+	/* [AdT]V = [Rw; p x Rw + Rv] */
+	Twist AdApply(const Transform& T, const Twist& V) {
+		Vec3 w = T.R * Top(V);
+		return Stack(w, Cross(T.p, w) + T.R * Bottom(V));
+	}
+
+	/* [AdT]^T F = [R^T(m - p x f); R^T f] */
+	Twist AdTransposeApply(const Transform& T, const Twist& F) {
+		return Stack(TransposeTimes(T.R, Top(F) - Cross(T.p, Bottom(F))), TransposeTimes(T.R, Bottom(F)));
+	}
+
+	/* [AdT] = [R 0; [p]R R] as a symbolic 6x6, zero blocks included */
+	Mat6 AdMatrix(const Transform& T) {
+		Mat6 X;
+		for (int j = 0; j < 3; j++) {
+			Vec3 col;
+			for (int i = 0; i < 3; i++) col.e[i] = T.R.e[i][j];
+			Vec3 pR = Cross(T.p, col);
+			for (int i = 0; i < 3; i++) {
+				X.e[i][j] = col.e[i];
+				X.e[i][j + 3] = Const(0);
+				X.e[i + 3][j] = pR.e[i];
+				X.e[i + 3][j + 3] = col.e[i];
+			}
+		}
+		return X;
+	}
+
+	/* X^T A X */
+	Mat6 Congruence(const Mat6& X, const Mat6& A) {
+		Mat6 AX, r;
+		for (int i = 0; i < 6; i++)
+			for (int j = 0; j < 6; j++) {
+				AX.e[i][j] = Const(0);
+				for (int k = 0; k < 6; k++) AX.e[i][j] += A.e[i][k] * X.e[k][j];
+			}
+		for (int i = 0; i < 6; i++)
+			for (int j = i; j < 6; j++) {
+				r.e[i][j] = Const(0);
+				for (int k = 0; k < 6; k++) r.e[i][j] += X.e[k][i] * AX.e[k][j];
+				r.e[j][i] = r.e[i][j];
+			}
+		return r;
+	}
+
+	/* [adV]W = [w x Ww; v x Ww + w x Wv] */
+	Twist AdTwist(const Twist& V, const Twist& W) {
+		return Stack(Cross(Top(V), Top(W)), Cross(Bottom(V), Top(W)) + Cross(Top(V), Bottom(W)));
+	}
+
+	/* [adV]^T F = [m x w + f x v; f x w] */
+	Twist AdTwistTranspose(const Twist& V, const Twist& F) {
+		return Stack(Cross(Top(F), Top(V)) + Cross(Bottom(F), Bottom(V)), Cross(Bottom(F), Top(V)));
+	}
+
+	struct Robot {
+		std::string name;
+		int dof;
+		std::vector<Eigen::Matrix<double, 6, 1> > S;
+		std::vector<Eigen::Matrix4d> M;
+		std::vector<Eigen::Matrix<double, 6, 6> > G;
+	};
+
+	/* Joint variables of one generated function, declared on first use so that
+	 * nothing unused reaches the output. */
+	class Joints {
+	public:
+		explicit Joints(const Robot& robot) : robot_(robot), sin_(robot.dof), cos_(robot.dof), omc_(robot.dof) {}
+
+		Expr Theta(int i) { return Input("q", i); }
+
+		Expr Sin(int i) { Trig(i); return sin_[i]; }
+		Expr Cos(int i) { Trig(i); return cos_[i]; }
+		Expr OneMinusCos(int i) {
+			if (omc_[i].constant) omc_[i] = Const(1) - Cos(i);
+			return omc_[i];
+		}
+
+	private:
+		Expr Input(const char* prefix, int i) {
+			std::ostringstream name;
+			name << prefix << i;
+			std::map<std::string, Expr>::const_iterator it = inputs_.find(name.str());
+			if (it != inputs_.end()) return it->second;
+			std::ostringstream rhs;
+			rhs << "thetalist(" << i << ")";
+			return inputs_[name.str()] = emitter->Declare(name.str(), rhs.str());
+		}
+
+		void Trig(int i) {
+			if (!sin_[i].constant) return;
+			double k = robot_.S[i].head<3>().norm();
+			std::string arg = Theta(i).name;
+			if (k != 1) arg = Literal(k) + " * " + arg;
+			std::ostringstream s, c;
+			s << "s" << i;
+			c << "c" << i;
+			sin_[i] = emitter->Declare(s.str(), "std::sin(" + arg + ")");
+			cos_[i] = emitter->Declare(c.str(), "std::cos(" + arg + ")");
+		}
+
+		const Robot& robot_;
+		std::vector<Expr> sin_, cos_, omc_;
+		std::map<std::string, Expr> inputs_;
+	};
+
+	/* e^[A]theta for joint i, or e^-[A]theta when inverse is set, where A is either
+	 * the space-frame axis Si or the same joint expressed in another frame */
+	Transform JointExp(const Eigen::Matrix<double, 6, 1>& A, int i, bool inverse, Joints& joints) {
+		Transform T;
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++) T.R.e[r][c] = Const(r == c ? 1 : 0);
+		double k = A.head<3>().norm();
+		if (k < 1e-9) {
+			// prismatic: [I, v theta]
+			Expr theta = inverse ? -joints.Theta(i) : joints.Theta(i);
+			for (int r = 0; r < 3; r++) T.p.e[r] = Const(A(r + 3)) * theta;
+			return T;
+		}
+		Eigen::Vector3d w = A.head<3>() / k;
+		Eigen::Vector3d v = A.tail<3>() / k;
+		Eigen::Matrix3d W;
+		W << 0, -w(2), w(1),
+			w(2), 0, -w(0),
+			-w(1), w(0), 0;
+		Eigen::Matrix3d W2 = W * W;
+		Expr s = inverse ? -joints.Sin(i) : joints.Sin(i);
+		Expr omc = joints.OneMinusCos(i);
+		// R = I + sin [w] + (1 - cos)[w]^2, whose diagonal is 1 - (1 - cos)(1 - wi^2)
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++) {
+				if (r != c)
+					T.R.e[r][c] = s * Const(W(r, c)) + omc * Const(W2(r, c));
+				else if (W2(r, r) == -1)
+					T.R.e[r][c] = joints.Cos(i);
+				else
+					T.R.e[r][c] = Const(1) + omc * Const(W2(r, r));
+			}
+		// p = sin v + (1 - cos) w x v + (angle - sin)(w.v) w
+		Eigen::Vector3d wxv = w.cross(v);
+		double h = w.dot(v);
+		Expr screw = Const(0);
+		if (std::abs(h) > 1e-12) {
+			Expr angle = Const(k) * joints.Theta(i);
+			screw = (inverse ? -angle - s : angle - s) * Const(h);
+		}
+		for (int r = 0; r < 3; r++)
+			T.p.e[r] = s * Const(v(r)) + omc * Const(wxv(r)) + screw * Const(w(r));
+		return T;
+	}
+
+	Eigen::Matrix4d TransInv(const Eigen::Matrix4d& T) {
+		Eigen::Matrix4d r = Eigen::Matrix4d::Identity();
+		r.topLeftCorner<3, 3>() = T.topLeftCorner<3, 3>().transpose();
+		r.topRightCorner<3, 1>() = -T.topLeftCorner<3, 3>().transpose() * T.topRightCorner<3, 1>();
+		return r;
+	}
+
+	Eigen::Matrix<double, 6, 6> Adjoint(const Eigen::Matrix4d& T) {
+		Eigen::Matrix3d R = T.topLeftCorner<3, 3>();
+		Eigen::Vector3d p = T.topRightCorner<3, 1>();
+		Eigen::Matrix3d P;
+		P << 0, -p(2), p(1),
+			p(2), 0, -p(0),
+			-p(1), p(0), 0;
+		Eigen::Matrix<double, 6, 6> X = Eigen::Matrix<double, 6, 6>::Zero();
+		X.topLeftCorner<3, 3>() = R;
+		X.bottomLeftCorner<3, 3>() = P * R;
+		X.bottomRightCorner<3, 3>() = R;
+		return X;
+	}
+
+	/* The constants shared by the dynamics recursions: the joint axes Ai in the link
+	 * frames and the inverse link offsets M_{i-1,i}^-1, tip included. */
+	struct LinkFrames {
+		explicit LinkFrames(const Robot& robot) {
+			Eigen::Matrix4d M0i = Eigen::Matrix4d::Identity();
+			for (int i = 0; i < robot.dof; i++) {
+				M0i = M0i * robot.M[i];
+				A.push_back(Adjoint(TransInv(M0i)) * robot.S[i]);
+				Minv.push_back(TransInv(robot.M[i]));
+			}
+			Minv.push_back(TransInv(robot.M[robot.dof]));
+		}
+		std::vector<Eigen::Matrix<double, 6, 1> > A;
+		std::vector<Eigen::Matrix4d> Minv;
+
+		/* T_{i,i-1} = e^-[Ai]theta_i M_{i-1,i}^-1, the tip offset for i = n */
+		Transform Tparent(int i, Joints& joints) const {
+			if (i == static_cast<int>(A.size())) return ConstTransform(Minv[i]);
+			return JointExp(A[i], i, true, joints) * ConstTransform(Minv[i]);
+		}
+	};
+
+	Twist InputTwist(Emitter& em, const char* prefix, const char* source, int offset) {
+		Twist r;
+		for (int i = 0; i < 6; i++) {
+			std::ostringstream name, rhs;
+			name << prefix << i;
+			rhs << source << "(" << i + offset << ")";
+			r.e[i] = em.Declare(name.str(), rhs.str());
+		}
+		return r;
+	}
+
+	std::vector<Expr> InputVector(Emitter& em, const char* prefix, const char* source, int n) {
+		std::vector<Expr> r;
+		for (int i = 0; i < n; i++) {
+			std::ostringstream name, rhs;
+			name << prefix << i;
+			rhs << source << "(" << i << ")";
+			r.push_back(em.Declare(name.str(), rhs.str()));
+		}
+		return r;
+	}
+
+	/* Gravity enters as the base acceleration [0; -g] */
+	Twist GravityTwist(Emitter& em) {
+		Twist Vd;
+		for (int i = 0; i < 3; i++) {
+			std::ostringstream name, rhs;
+			name << "g" << i;
+			rhs << "-g(" << i << ")";
+			Vd.e[i] = Const(0);
+			Vd.e[i + 3] = em.Declare(name.str(), rhs.str());
+		}
+		return Vd;
+	}
+
+	void Assign(Emitter& em, const std::string& lhs, const Expr& e) { em.Line(lhs + " = " + Ref(e) + ";"); }
+
+	std::string Index(const char* name, int i) {
+		std::ostringstream s;
+		s << name << "(" << i << ")";
+		return s.str();
+	}
+
+	std::string Index(const char* name, int i, int j) {
+		std::ostringstream s;
+		s << name << "(" << i << ", " << j << ")";
+		return s.str();
+	}
+
+	std::string GenerateFKinSpace(const Robot& robot) {
+		Emitter em;
+		emitter = &em;
+		Joints joints(robot);
+		Eigen::Matrix4d M = Eigen::Matrix4d::Identity();
+		for (int i = 0; i <= robot.dof; i++) M = M * robot.M[i];
+		Transform T = ConstTransform(Eigen::Matrix4d::Identity());
+		for (int i = 0; i < robot.dof; i++) T = T * JointExp(robot.S[i], i, false, joints);
+		T = T * ConstTransform(M);
+		em.Line("Eigen::Matrix4f T;");
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) Assign(em, Index("T", i, j), T.R.e[i][j]);
+			Assign(em, Index("T", i, 3), T.p.e[i]);
+		}
+		em.Line("T.row(3) << 0, 0, 0, 1;");
+		em.Line("return T;");
+		return em.Body();
+	}
+
+	std::string GenerateJacobianSpace(const Robot& robot) {
+		Emitter em;
+		emitter = &em;
+		Joints joints(robot);
+		em.Line("Eigen::Matrix<float, 6, DOF> Js;");
+		Transform T = ConstTransform(Eigen::Matrix4d::Identity());
+		for (int i = 0; i < robot.dof; i++) {
+			// Jsi = [Ad(e^[S1]theta1 ... e^[Si-1]thetai-1)]Si
+			Twist J = AdApply(T, ConstTwist(robot.S[i]));
+			for (int r = 0; r < 6; r++) Assign(em, Index("Js", r, i), J.e[r]);
+			if (i + 1 < robot.dof) T = T * JointExp(robot.S[i], i, false, joints);
+		}
+		em.Line("return Js;");
+		return em.Body();
+	}
+
+	std::string GenerateInverseDynamics(const Robot& robot) {
+		Emitter em;
+		emitter = &em;
+		Joints joints(robot);
+		LinkFrames links(robot);
+		int n = robot.dof;
+		std::vector<Expr> dq = InputVector(em, "dq", "dthetalist", n);
+		std::vector<Expr> ddq = InputVector(em, "ddq", "ddthetalist", n);
+		Twist Ftip = InputTwist(em, "F", "Ftip", 0);
+		Twist V = ConstTwist(Eigen::Matrix<double, 6, 1>::Zero());
+		Twist Vd = GravityTwist(em);
+		std::vector<Transform> T;
+		std::vector<Twist> Vi, Vdi;
+		for (int i = 0; i < n; i++) {
+			T.push_back(links.Tparent(i, joints));
+			Twist A = ConstTwist(links.A[i]);
+			V = AdApply(T[i], V) + A * dq[i];
+			Vd = AdApply(T[i], Vd) + A * ddq[i] + AdTwist(V, A * dq[i]);
+			Vi.push_back(V);
+			Vdi.push_back(Vd);
+		}
+		T.push_back(links.Tparent(n, joints));
+		em.Line("Eigen::Matrix<float, DOF, 1> taulist;");
+		Twist F = Ftip;
+		for (int i = n - 1; i >= 0; i--) {
+			Mat6 G = ConstMat6(robot.G[i]);
+			F = AdTransposeApply(T[i + 1], F) + G * Vdi[i] - AdTwistTranspose(Vi[i], G * Vi[i]);
+			Assign(em, Index("taulist", i), Dot(F, ConstTwist(links.A[i])));
+		}
+		em.Line("return taulist;");
+		return em.Body();
+	}
+
+	std::string GenerateMassMatrix(const Robot& robot) {
+		Emitter em;
+		emitter = &em;
+		Joints joints(robot);
+		LinkFrames links(robot);
+		int n = robot.dof;
+		std::vector<Transform> T(n);
+		for (int i = 1; i < n; i++) T[i] = links.Tparent(i, joints);
+		// Composite inertias, outermost link first
+		std::vector<Mat6> Ic(n);
+		Ic[n - 1] = ConstMat6(robot.G[n - 1]);
+		for (int i = n - 1; i > 0; i--) {
+			Mat6 XIX = Congruence(AdMatrix(T[i]), Ic[i]);
+			Mat6 G = ConstMat6(robot.G[i - 1]);
+			for (int r = 0; r < 6; r++)
+				for (int c = 0; c < 6; c++) Ic[i - 1].e[r][c] = G.e[r][c] + XIX.e[r][c];
+		}
+		em.Line("Eigen::Matrix<float, DOF, DOF> M;");
+		for (int i = 0; i < n; i++) {
+			Twist F = Ic[i] * ConstTwist(links.A[i]);
+			Assign(em, Index("M", i, i), Dot(ConstTwist(links.A[i]), F));
+			for (int j = i; j > 0; j--) {
+				F = AdTransposeApply(T[j], F);
+				Expr Mji = Dot(ConstTwist(links.A[j - 1]), F);
+				Assign(em, Index("M", j - 1, i), Mji);
+				Assign(em, Index("M", i, j - 1), Mji);
+			}
+		}
+		em.Line("return M;");
+		return em.Body();
+	}
+
+	std::string GenerateForwardDynamics(const Robot& robot) {
+		Emitter em;
+		emitter = &em;
+		Joints joints(robot);
+		LinkFrames links(robot);
+		int n = robot.dof;
+		std::vector<Expr> dq = InputVector(em, "dq", "dthetalist", n);
+		std::vector<Expr> tau = InputVector(em, "tau", "taulist", n);
+		Twist Ftip = InputTwist(em, "F", "Ftip", 0);
+		Twist Vd0 = GravityTwist(em);
+
+		// Outward pass: velocities, velocity-product accelerations and bias forces
+		std::vector<Transform> T;
+		std::vector<Twist> A, c, Pa;
+		std::vector<Mat6> IA;
+		Twist V = ConstTwist(Eigen::Matrix<double, 6, 1>::Zero());
+		for (int i = 0; i < n; i++) {
+			T.push_back(links.Tparent(i, joints));
+			A.push_back(ConstTwist(links.A[i]));
+			Twist Adq = A[i] * dq[i];
+			V = AdApply(T[i], V) + Adq;
+			c.push_back(AdTwist(V, Adq));
+			IA.push_back(ConstMat6(robot.G[i]));
+			Pa.push_back(Twist() - AdTwistTranspose(V, IA[i] * V));
+		}
+		Pa[n - 1] = Pa[n - 1] + AdTransposeApply(links.Tparent(n, joints), Ftip);
+
+		// Inward pass: articulated inertias
+		std::vector<Twist> U(n);
+		std::vector<Expr> Dinv(n), u(n);
+		for (int i = n - 1; i >= 0; i--) {
+			U[i] = IA[i] * A[i];
+			Dinv[i] = Const(1) / Dot(A[i], U[i]);
+			u[i] = tau[i] - Dot(A[i], Pa[i]);
+			if (i == 0) break;
+			Mat6 Ia;
+			for (int r = 0; r < 6; r++)
+				for (int s = r; s < 6; s++) {
+					Ia.e[r][s] = IA[i].e[r][s] - U[i].e[r] * U[i].e[s] * Dinv[i];
+					Ia.e[s][r] = Ia.e[r][s];
+				}
+			Twist pa = Pa[i] + Ia * c[i] + U[i] * (u[i] * Dinv[i]);
+			Mat6 XIX = Congruence(AdMatrix(T[i]), Ia);
+			for (int r = 0; r < 6; r++)
+				for (int s = 0; s < 6; s++) IA[i - 1].e[r][s] += XIX.e[r][s];
+			Pa[i - 1] = Pa[i - 1] + AdTransposeApply(T[i], pa);
+		}
+
+		// Outward pass: joint and link accelerations
+		em.Line("Eigen::Matrix<float, DOF, 1> ddthetalist;");
+		Twist a = Vd0;
+		for (int i = 0; i < n; i++) {
+			Twist ap = AdApply(T[i], a) + c[i];
+			Expr ddq = (u[i] - Dot(U[i], ap)) * Dinv[i];
+			Assign(em, Index("ddthetalist", i), ddq);
+			if (i + 1 < n) a = ap + A[i] * ddq;
+		}
+		em.Line("return ddthetalist;");
+		return em.Body();
+	}
+
+	bool ReadNumbers(std::istringstream& line, int count, std::vector<double>& out) {
+		out.resize(count);
+		for (int i = 0; i < count; i++)
+			if (!(line >> out[i])) return false;
+		std::string extra;
+		return !(line >> extra);
+	}
+
+	bool ReadRobot(const char* path, Robot& robot, std::string& error) {
+		std::ifstream file(path);
+		if (!file) {
+			error = "cannot open " + std::string(path);
+			return false;
+		}
+		robot.dof = 0;
+		std::string text;
+		int lineNumber = 0;
+		while (std::getline(file, text)) {
+			lineNumber++;
+			std::string::size_type hash = text.find('#');
+			if (hash != std::string::npos) text.erase(hash);
+			std::istringstream line(text);
+			std::string key;
+			if (!(line >> key)) continue;
+			std::vector<double> x;
+			bool ok = true;
+			if (key == "name") {
+				ok = static_cast<bool>(line >> robot.name);
+			}
+			else if (key == "dof") {
+				ok = static_cast<bool>(line >> robot.dof) && robot.dof > 0;
+			}
+			else if (key == "S") {
+				ok = ReadNumbers(line, 6, x);
+				if (ok) robot.S.push_back(Eigen::Map<Eigen::Matrix<double, 6, 1> >(x.data()));
+			}
+			else if (key == "M") {
+				ok = ReadNumbers(line, 12, x);
+				if (ok) {
+					Eigen::Matrix4d M = Eigen::Matrix4d::Identity();
+					M.topRows<3>() = Eigen::Map<Eigen::Matrix<double, 3, 4, Eigen::RowMajor> >(x.data());
+					robot.M.push_back(M);
+				}
+			}
+			else if (key == "Gdiag") {
+				ok = ReadNumbers(line, 6, x);
+				if (ok) robot.G.push_back(Eigen::Map<Eigen::Matrix<double, 6, 1> >(x.data()).asDiagonal());
+			}
+			else if (key == "G") {
+				ok = ReadNumbers(line, 36, x);
+				if (ok) robot.G.push_back(Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor> >(x.data()));
+			}
+			else {
+				ok = false;
+			}
+			if (!ok) {
+				std::ostringstream msg;
+				msg << path << ":" << lineNumber << ": cannot parse '" << key << "' line";
+				error = msg.str();
+				return false;
+			}
+		}
+		if (robot.name.empty() || robot.dof == 0) {
+			error = "missing name or dof";
+			return false;
+		}
+		if (static_cast<int>(robot.S.size()) != robot.dof || static_cast<int>(robot.M.size()) != robot.dof + 1
+			|| static_cast<int>(robot.G.size()) != robot.dof) {
+			error = "expected dof S lines, dof+1 M lines and dof G/Gdiag lines";
+			return false;
+		}
+		return true;
+	}
+
+	void WriteMatrixData(std::ostream& out, const double* data, int count) {
+		for (int i = 0; i < count; i++) out << (i ? ", " : "") << Literal(data[i]);
+	}
+
+	void WriteHeader(std::ostream& out, const Robot& robot, const char* source) {
+		int n = robot.dof;
+		out << "// Generated by mr_codegen from " << source << ". Do not edit.\n"
+			<< "#pragma once\n\n"
+			<< "#include <Eigen/Dense>\n"
+			<< "#include <cmath>\n"
+			<< "#include <vector>\n\n"
+			<< "namespace " << robot.name << " {\n\n"
+			<< "\tconst int DOF = " << n << ";\n"
+			<< "\ttypedef Eigen::Matrix<float, DOF, 1> JointVector;\n\n";
+
+		out << "\t/* The description this file was generated from, in the layout the mr:: functions take */\n"
+			<< "\tinline Eigen::MatrixXf Slist() {\n"
+			<< "\t\tEigen::MatrixXf S(6, DOF);\n";
+		for (int i = 0; i < n; i++) {
+			out << "\t\tS.col(" << i << ") << ";
+			WriteMatrixData(out, robot.S[i].data(), 6);
+			out << ";\n";
+		}
+		out << "\t\treturn S;\n\t}\n\n"
+			<< "\tinline std::vector<Eigen::MatrixXf> Mlist() {\n"
+			<< "\t\tstd::vector<Eigen::MatrixXf> list(DOF + 1, Eigen::MatrixXf(4, 4));\n";
+		for (int i = 0; i <= n; i++) {
+			Eigen::Matrix<double, 4, 4, Eigen::RowMajor> M = robot.M[i];
+			out << "\t\tlist[" << i << "] << ";
+			WriteMatrixData(out, M.data(), 16);
+			out << ";\n";
+		}
+		out << "\t\treturn list;\n\t}\n\n"
+			<< "\tinline std::vector<Eigen::MatrixXf> Glist() {\n"
+			<< "\t\tstd::vector<Eigen::MatrixXf> list(DOF, Eigen::MatrixXf(6, 6));\n";
+		for (int i = 0; i < n; i++) {
+			Eigen::Matrix<double, 6, 6, Eigen::RowMajor> G = robot.G[i];
+			out << "\t\tlist[" << i << "] << ";
+			WriteMatrixData(out, G.data(), 36);
+			out << ";\n";
+		}
+		out << "\t\treturn list;\n\t}\n\n";
+
+		out << "\t/* mr::FKinSpace(Mlist product, Slist, thetalist) */\n"
+			<< "\tinline Eigen::Matrix4f FKinSpace(const JointVector& thetalist) {\n"
+			<< GenerateFKinSpace(robot) << "\t}\n\n";
+		out << "\t/* mr::JacobianSpace(Slist, thetalist) */\n"
+			<< "\tinline Eigen::Matrix<float, 6, DOF> JacobianSpace(const JointVector& thetalist) {\n"
+			<< GenerateJacobianSpace(robot) << "\t}\n\n";
+		out << "\t/* mr::InverseDynamics by the Newton-Euler recursion */\n"
+			<< "\tinline JointVector InverseDynamics(const JointVector& thetalist, const JointVector& dthetalist,\n"
+			<< "\t\tconst JointVector& ddthetalist, const Eigen::Vector3f& g, const Eigen::Matrix<float, 6, 1>& Ftip) {\n"
+			<< GenerateInverseDynamics(robot) << "\t}\n\n";
+		out << "\t/* mr::MassMatrix by the composite rigid body algorithm */\n"
+			<< "\tinline Eigen::Matrix<float, DOF, DOF> MassMatrix(const JointVector& thetalist) {\n"
+			<< GenerateMassMatrix(robot) << "\t}\n\n";
+		out << "\t/* mr::ForwardDynamics by the articulated body algorithm */\n"
+			<< "\tinline JointVector ForwardDynamics(const JointVector& thetalist, const JointVector& dthetalist,\n"
+			<< "\t\tconst JointVector& taulist, const Eigen::Vector3f& g, const Eigen::Matrix<float, 6, 1>& Ftip) {\n"
+			<< GenerateForwardDynamics(robot) << "\t}\n\n";
+		out << "}\n";
+	}
+
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " <robot description> <output header>\n";
+		return 2;
+	}
+	Robot robot;
+	std::string error;
+	if (!ReadRobot(argv[1], robot, error)) {
+		std::cerr << "mr_codegen: " << error << "\n";
+		return 1;
+	}
+	std::string source(argv[1]);
+	std::string::size_type slash = source.find_last_of("/\\");
+	if (slash != std::string::npos) source.erase(0, slash + 1);
+	std::ostringstream header;
+	WriteHeader(header, robot, source.c_str());
+	std::ofstream out(argv[2]);
+	out << header.str();
+	if (!out) {
+		std::cerr << "mr_codegen: cannot write " << argv[2] << "\n";
+		return 1;
+	}
+	return 0;
+}